@@ -0,0 +1,385 @@
+/* Copyright (C) 2023 James W M Barford-Evans
+ * <jamesbarfordevans at gmail dot com>
+ * All Rights Reserved
+ *
+ * This code is released under the BSD 2 clause license.
+ * See the COPYING file for more information.
+ *
+ * Benchmarks for Easy JSON, run with `make bench`. Parses newline delimited
+ * json from a file, or generated records if no file is given, and the same
+ * records as one big array on 1 to N threads and prints the throughput of
+ * each. Also compares a fresh allocator per record against a reused arena,
+ * parsing small documents on up to 32 threads with and without the thread
+ * cache, and walking the same array as a tree and as a tape.
+ */
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "json-selector.h"
+#include "json.h"
+
+#define BENCH_RECORDS (400000)
+#define BENCH_REPS    (3)
+
+static void __panic(char *fmt, ...) {
+    va_list va;
+    char msg[1024];
+
+    va_start(va, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, va);
+    fprintf(stderr, "%s\n", msg);
+
+    va_end(va);
+    exit(EXIT_FAILURE);
+}
+
+static double benchNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *benchReadFile(char *path, size_t *_len) {
+    FILE *fp;
+    struct stat st;
+    char *buffer;
+
+    if (stat(path, &st) == -1) {
+        __panic("Failed to stat file: %s\n", strerror(errno));
+    }
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        __panic("Failed to open file: %s\n", strerror(errno));
+    }
+
+    buffer = malloc(sizeof(char) * (st.st_size + 1));
+    if (fread(buffer, 1, st.st_size, fp) != st.st_size) {
+        __panic("Failed to read file: %s\n", strerror(errno));
+    }
+    buffer[st.st_size] = '\0';
+    fclose(fp);
+    *_len = st.st_size;
+    return buffer;
+}
+
+/* Something that looks like a log line */
+static char *benchGenerateLines(size_t count, size_t *_len) {
+    char *buffer = malloc(count * 256);
+    size_t len = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        len += sprintf(buffer + len,
+                       "{\"id\": %zu, \"ts\": %zu.%03zu, \"level\": \"%s\", "
+                       "\"msg\": \"request \\\"GET /api/v1/items/%zu\\\" "
+                       "served\", \"latency\": %.3f, \"ok\": %s, "
+                       "\"tags\": [\"edge\", \"eu-west-%zu\", null]}\n",
+                       i, 1700000000 + i, i % 1000,
+                       i % 10 ? "info" : "warn", i * 7, (i % 997) / 3.0,
+                       i % 13 ? "true" : "false", i % 4);
+    }
+    buffer[len] = '\0';
+    *_len = len;
+    return buffer;
+}
+
+static int benchCountRecord(json *J, size_t lineno, void *privdata) {
+    (void)J;
+    (void)lineno;
+    (*(size_t *)privdata)++;
+    return 0;
+}
+
+static void benchParseLines(char *buffer, size_t len, int max_threads,
+                            JSON_LINES_ORDER order) {
+    double single = 0;
+
+    printf("%s\n", order == JSON_LINES_ORDERED ? "ordered" : "unordered");
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        double best = 0;
+        size_t records = 0;
+
+        for (int rep = 0; rep < BENCH_REPS; ++rep) {
+            double start = benchNow();
+            records = 0;
+            jsonParseLinesParallel(buffer, len, JSON_NO_FLAGS, threads, order,
+                                   benchCountRecord, &records);
+            double elapsed = benchNow() - start;
+            if (best == 0 || elapsed < best) {
+                best = elapsed;
+            }
+        }
+
+        if (threads == 1) {
+            single = best;
+        }
+        printf("  %3d threads: %9.2fMB/s %10zu records %6.2fx\n", threads,
+               len / best / (1024 * 1024), records, single / best);
+
+        if (threads < max_threads && threads * 2 > max_threads) {
+            threads = max_threads / 2;
+        }
+    }
+}
+
+/* The same lines as one top level array */
+static char *benchLinesToArray(char *lines, size_t len, size_t *_len) {
+    char *buffer = malloc(len + 3);
+    size_t array_len = 0;
+
+    buffer[array_len++] = '[';
+    for (size_t i = 0; i < len; ++i) {
+        if (lines[i] == '\n') {
+            if (i + 1 < len) {
+                buffer[array_len++] = ',';
+            }
+        } else {
+            buffer[array_len++] = lines[i];
+        }
+    }
+    buffer[array_len++] = ']';
+    buffer[array_len] = '\0';
+    *_len = array_len;
+    return buffer;
+}
+
+static void benchParseArray(char *buffer, size_t len, int max_threads) {
+    double single = 0;
+
+    printf("array\n");
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        double best = 0;
+
+        for (int rep = 0; rep < BENCH_REPS; ++rep) {
+            double start = benchNow();
+            json *J = jsonParseArrayParallel(buffer, len, JSON_NO_FLAGS,
+                                             threads);
+            double elapsed = benchNow() - start;
+            if (!jsonOk(J)) {
+                __panic("Failed to parse array: %s", jsonGetStrerror(J));
+            }
+            jsonRelease(J);
+            if (best == 0 || elapsed < best) {
+                best = elapsed;
+            }
+        }
+
+        if (threads == 1) {
+            single = best;
+        }
+        printf("  %3d threads: %9.2fMB/s %6.2fx\n", threads,
+               len / best / (1024 * 1024), single / best);
+
+        if (threads < max_threads && threads * 2 > max_threads) {
+            threads = max_threads / 2;
+        }
+    }
+}
+
+/* Each line as its own document, freed after parsing or reset in an arena */
+static void benchParseArena(char *buffer, size_t len) {
+    jsonArena *arena = jsonArenaNew();
+
+    printf("arena\n");
+    for (int use_arena = 0; use_arena <= 1; ++use_arena) {
+        double best = 0;
+
+        for (int rep = 0; rep < BENCH_REPS; ++rep) {
+            double start = benchNow();
+            char *line = buffer, *end = buffer + len;
+            while (line < end) {
+                char *newline = memchr(line, '\n', end - line);
+                size_t line_len = newline ? newline - line : end - line;
+                if (use_arena) {
+                    jsonArenaReset(arena);
+                    jsonParseIntoArena(arena, line, line_len, JSON_NO_FLAGS);
+                } else {
+                    jsonRelease(jsonParseWithLen(line, line_len));
+                }
+                line += line_len + 1;
+            }
+            double elapsed = benchNow() - start;
+            if (best == 0 || elapsed < best) {
+                best = elapsed;
+            }
+        }
+
+        printf("  %-11s %9.2fMB/s\n", use_arena ? "reset:" : "release:",
+               len / best / (1024 * 1024));
+    }
+    printf("  high-water: %zu bytes\n", jsonArenaHighWaterMark(arena));
+    jsonArenaRelease(arena);
+}
+
+static size_t benchWalkTree(json *J) {
+    size_t count = 1;
+    if (J->type == JSON_OBJECT || J->type == JSON_ARRAY) {
+        for (json *child = J->array; child; child = child->next) {
+            count += benchWalkTree(child);
+        }
+    }
+    return count;
+}
+
+static size_t benchWalkTape(jsonTape *doc, jsonTapeIdx idx) {
+    size_t count = 1;
+    for (jsonTapeIdx child = jsonTapeChild(doc, idx); child;
+         child = jsonTapeNext(doc, child)) {
+        count += benchWalkTape(doc, child);
+    }
+    return count;
+}
+
+/* Visiting every value, reading one field from each record and printing
+ * the whole thing, on the tree and on the tape */
+static void benchTraverse(char *buffer, size_t len) {
+    json *J = jsonParseWithLen(buffer, len);
+    jsonTape *doc = jsonTapeParse(buffer, len, JSON_NO_FLAGS);
+    double best[2][3] = {{0}};
+    size_t values[2] = {0};
+    double sums[2] = {0};
+
+    if (!jsonOk(J) || jsonTapeGetError(doc) != JSON_OK) {
+        __panic("Failed to parse array");
+    }
+
+    for (int rep = 0; rep < BENCH_REPS; ++rep) {
+        for (int use_tape = 0; use_tape <= 1; ++use_tape) {
+            double elapsed[3];
+            double start = benchNow();
+            values[use_tape] = use_tape ? benchWalkTape(doc, jsonTapeRoot(doc))
+                                        : benchWalkTree(J);
+            elapsed[0] = benchNow() - start;
+
+            start = benchNow();
+            sums[use_tape] = 0;
+            if (use_tape) {
+                jsonTapeIdx root = jsonTapeRoot(doc);
+                for (jsonTapeIdx record = jsonTapeChild(doc, root); record;
+                     record = jsonTapeNext(doc, record)) {
+                    sums[use_tape] += jsonTapeGetFloat(
+                            doc, jsonTapeObjectAt(doc, record, "latency"));
+                }
+            } else {
+                for (json *record = J->array; record; record = record->next) {
+                    json *latency = jsonObjectAtCaseSensitive(record,
+                                                              "latency");
+                    sums[use_tape] += latency ? latency->floating : 0;
+                }
+            }
+            elapsed[1] = benchNow() - start;
+
+            start = benchNow();
+            char *str = use_tape ? jsonTapeToString(doc, jsonTapeRoot(doc),
+                                                    NULL)
+                                 : jsonToString(J, NULL);
+            elapsed[2] = benchNow() - start;
+            jsonFree(str);
+
+            for (int i = 0; i < 3; ++i) {
+                if (best[use_tape][i] == 0 || elapsed[i] < best[use_tape][i]) {
+                    best[use_tape][i] = elapsed[i];
+                }
+            }
+        }
+    }
+
+    if (values[0] != values[1] || sums[0] != sums[1]) {
+        __panic("Tree and tape disagree");
+    }
+    printf("Traversal, %zu values\n", values[0]);
+    for (int use_tape = 0; use_tape <= 1; ++use_tape) {
+        printf("  %-6s walk: %7.2fms  field: %7.2fms  print: %7.2fms\n",
+               use_tape ? "tape:" : "tree:", best[use_tape][0] * 1000,
+               best[use_tape][1] * 1000, best[use_tape][2] * 1000);
+    }
+    jsonTapeRelease(doc);
+    jsonRelease(J);
+}
+
+#define BENCH_SMALL_DOCS    (200000)
+#define BENCH_SMALL_THREADS (32)
+
+static char bench_small_doc[] =
+        "{\"jsonrpc\": \"2.0\", \"id\": 42, \"method\": \"items.get\", "
+        "\"params\": {\"ids\": [1, 2, 3], \"fields\": [\"name\", \"price\"], "
+        "\"cache\": true}}";
+
+static void *benchSmallDocsThread(void *arg) {
+    size_t len = strlen(bench_small_doc);
+    (void)arg;
+
+    for (size_t i = 0; i < BENCH_SMALL_DOCS; ++i) {
+        json *J = jsonParseWithLen(bench_small_doc, len);
+        if (!jsonOk(J)) {
+            __panic("Failed to parse small document");
+        }
+        jsonRelease(J);
+    }
+    return NULL;
+}
+
+/* Lots of tiny documents on every thread at once, with and without the
+ * thread cache, which shows how much time goes on contending for malloc */
+static void benchSmallDocs(void) {
+    pthread_t threads[BENCH_SMALL_THREADS];
+
+    printf("Small documents, %zu bytes, %d per thread\n",
+           strlen(bench_small_doc), BENCH_SMALL_DOCS);
+    for (int cache = 0; cache <= 1; ++cache) {
+        jsonSetThreadCacheSize(cache ? 4 : 0);
+        printf("%s\n", cache ? "thread cache" : "no cache");
+
+        for (int count = 1; count <= BENCH_SMALL_THREADS; count *= 2) {
+            double start = benchNow();
+            for (int i = 0; i < count; ++i) {
+                pthread_create(&threads[i], NULL, benchSmallDocsThread, NULL);
+            }
+            for (int i = 0; i < count; ++i) {
+                pthread_join(threads[i], NULL);
+            }
+            double elapsed = benchNow() - start;
+            printf("  %3d threads: %9.2fM docs/s\n", count,
+                   (double)count * BENCH_SMALL_DOCS / elapsed / 1e6);
+        }
+    }
+    jsonSetThreadCacheSize(0);
+}
+
+int main(int argc, char **argv) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = cpus > 0 ? (int)cpus : 1;
+    size_t len;
+    char *buffer;
+
+    if (argc > 1) {
+        buffer = benchReadFile(argv[1], &len);
+    } else {
+        buffer = benchGenerateLines(BENCH_RECORDS, &len);
+    }
+    if (argc > 2) {
+        max_threads = atoi(argv[2]);
+    }
+
+    printf("JSON Lines, %zu bytes\n", len);
+    benchParseLines(buffer, len, max_threads, JSON_LINES_ORDERED);
+    benchParseLines(buffer, len, max_threads, JSON_LINES_UNORDERED);
+    benchParseArena(buffer, len);
+
+    size_t array_len;
+    char *array = benchLinesToArray(buffer, len, &array_len);
+    printf("Top level array, %zu bytes\n", array_len);
+    benchParseArray(array, array_len, max_threads);
+    benchTraverse(array, array_len);
+    benchSmallDocs();
+
+    free(array);
+    free(buffer);
+}
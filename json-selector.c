@@ -20,13 +20,22 @@
 #define JSON_SEL_MAX_BUF   (256)
 
 /**
- * Get item from an array of json or return null
+ * Get item from an array of json or return null. This only reads the array,
+ * unless it was parsed with JSON_LAZY_INDEX_FLAG in which case the first call
+ * builds a vector of its members so the rest are O(1). That first call must
+ * not race with other threads reading the array
  */
 json *jsonArrayAt(json *j, int idx) {
     if (!jsonIsArray(j) || idx < 0) {
         return NULL;
     }
 
+    size_t len;
+    json **items = jsonArrayItems(j, &len);
+    if (items) {
+        return (size_t)idx < len ? items[idx] : NULL;
+    }
+
     json *node = j->array;
     int i = 0;
 
@@ -43,24 +52,6 @@ json *jsonArrayAt(json *j, int idx) {
     return node;
 }
 
-static json *_jsonObjectAt(json *j, const char *name,
-                           int (*_strcmp)(const char *, const char *)) {
-    if (!jsonIsObject(j) || name == NULL) {
-        return NULL;
-    }
-
-    json *el = j->object;
-    while ((el != NULL) && (el->key != NULL) && (_strcmp(name, el->key) != 0)) {
-        el = el->next;
-    }
-
-    if ((el == NULL) || (el->key == NULL)) {
-        return NULL;
-    }
-
-    return el;
-}
-
 static int jsonTypeCheck(json *j, char tk) {
     switch (tk) {
     case 's':
@@ -104,17 +95,21 @@ static int jsonTypeCheck(json *j, char tk) {
 }
 
 /**
- * Get from an object if the key matches the name - case sensitive
+ * Get from an object if the key matches the name - case sensitive. This only
+ * reads the object, unless it was parsed with JSON_LAZY_INDEX_FLAG in which
+ * case large objects are hashed on the first lookup so the rest are O(1).
+ * That first lookup must not race with other threads reading the object
  */
 json *jsonObjectAtCaseSensitive(json *j, const char *name) {
-    return _jsonObjectAt(j, name, strcmp);
+    return jsonObjectFind(j, name, 0);
 }
 
 /**
- * Get from an object if the key matches the name - case insensitive
+ * Get from an object if the key matches the name - case insensitive. Shares
+ * the table, and the rule on threads, of `jsonObjectAtCaseSensitive`
  */
 json *jsonObjectAtCaseInSensitive(json *j, const char *name) {
-    return _jsonObjectAt(j, name, strcasecmp);
+    return jsonObjectFind(j, name, 1);
 }
 
 /**
@@ -144,6 +139,12 @@ json *jsonObjectAtCaseInSensitive(json *j, const char *name) {
  *      "o" -> object
  *      "b" -> boolean
  *      "!" -> null
+ *
+ * Lookups are done with `jsonArrayAt` and `jsonObjectAtCaseSensitive`, so a
+ * document parsed with JSON_LAZY_INDEX_FLAG is written to the first time
+ * each array or large object is selected from, and must not be selected
+ * from by several threads at once until then. Without the flag selecting
+ * only reads.
  */
 json *jsonSelect(json *j, const char *fmt, ...) {
     /**
@@ -5,16 +5,26 @@
  * This code is released under the BSD 2 clause license.
  * See the COPYING file for more information. */
 #include <limits.h>
+#include <locale.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "json.h"
 
 #define JSON_ALLOCATOR_INITIAL_SIZE (4096)
+/* Blocks double in size from the initial size up to this */
+#define JSON_ALLOCATOR_MAX_BLOCK_SIZE (64 * 1024 * 1024)
+/* Blocks at least this big are mapped and backed by huge pages */
+#define JSON_ALLOCATOR_MMAP_THRESHOLD (2 * 1024 * 1024)
+#define JSON_HUGE_PAGE_SIZE           (2 * 1024 * 1024)
 
 #define __bufput(b, i, c) ((b)[(*i)++] = (c))
 
@@ -27,7 +37,9 @@
 #define toInt(ch)           (ch - '0')
 #define toUpper(ch)         ((ch >= 'a' && ch <= 'z') ? (ch - 'a' + 'A') : ch)
 #define toHex(ch)           (toUpper(ch) - 'A' + 10)
-#define isNumTerminator(ch) (ch == ',' || ch == ']' || ch == '\0' || ch == '\n')
+#define isNumTerminator(ch)                                          \
+    (ch == ',' || ch == ']' || ch == '}' || ch == '\0' || ch == ' ' || \
+     ch == '\n' || ch == '\r' || ch == '\t')
 #define numStart(ch)        (isNum(ch) || ch == '-' || ch == '+' || ch == '.')
 
 #define json_debug(...)                                                    \
@@ -54,21 +66,110 @@ typedef enum JsonParserType {
     JSON_PARSER_NULL,
 } JsonParserType;
 
+/* Bits of json.aux for values that have not been materialised yet, the low
+ * bits hold the length of the value in the buffer */
+#define JSON_AUX_LAZY     (1u << 31)
+#define JSON_AUX_ESCAPED  (1u << 30)
+#define JSON_AUX_LEN_MASK (JSON_AUX_ESCAPED - 1)
+/* Bits of json.aux for objects and arrays. Parsed with JSON_LAZY_INDEX_FLAG
+ * they may have an index built over their members, once they have the low
+ * bits hold its slot in the allocator's `indexes` */
+#define JSON_AUX_INDEXED   (1u << 29)
+#define JSON_AUX_INDEXABLE (1u << 28)
+#define JSON_AUX_SLOT_MASK (JSON_AUX_INDEXABLE - 1)
+
 static unsigned char *escapeString(char *buf);
 typedef struct jsonAllocatorBlock jsonAllocatorBlock;
+typedef struct jsonIndex jsonIndex;
+typedef struct jsonSimdKernels jsonSimdKernels;
+
+static void *jsonLibcMalloc(void *ctx, size_t size) {
+    (void)ctx;
+    return malloc(size);
+}
+
+static void *jsonLibcRealloc(void *ctx, void *ptr, size_t size) {
+    (void)ctx;
+    return realloc(ptr, size);
+}
+
+static void jsonLibcFree(void *ctx, void *ptr) {
+    (void)ctx;
+    free(ptr);
+}
+
+static const jsonAllocatorHooks json_libc_hooks = {
+        .malloc = jsonLibcMalloc,
+        .realloc = jsonLibcRealloc,
+        .free = jsonLibcFree,
+        .ctx = NULL,
+};
+
+/* Where everything not belonging to a particular arena gets its memory */
+static jsonAllocatorHooks json_hooks = {
+        .malloc = jsonLibcMalloc,
+        .realloc = jsonLibcRealloc,
+        .free = jsonLibcFree,
+        .ctx = NULL,
+};
+
+/**
+ * Route every allocation made by the library through `hooks`, or back to
+ * malloc, realloc and free if it is NULL. Arenas keep the hooks they were
+ * created with, so this should be set before anything else is allocated and
+ * not changed while other threads are using the library.
+ */
+void jsonSetAllocatorHooks(const jsonAllocatorHooks *hooks) {
+    json_hooks = hooks ? *hooks : json_libc_hooks;
+}
+
+static void *jsonMalloc(size_t size) {
+    return json_hooks.malloc(json_hooks.ctx, size);
+}
+
+static void *jsonRealloc(void *ptr, size_t size) {
+    return json_hooks.realloc(json_hooks.ctx, ptr, size);
+}
+
+static void *jsonCalloc(size_t count, size_t size) {
+    void *ptr = jsonMalloc(count * size);
+    if (ptr) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+/* Free what `jsonToString` and `jsonGetStrerror` return, or anything else the
+ * library has handed back to be freed */
+void jsonFree(void *ptr) {
+    json_hooks.free(json_hooks.ctx, ptr);
+}
 
 typedef struct jsonAllocatorBlock {
     unsigned int capacity;
     unsigned int used;
+    /* Holds a single allocation too big for the usual blocks */
+    unsigned char oversized;
+    /* `mem` was mapped with mmap rather than coming from the hooks */
+    unsigned char mapped;
     void *mem;
     jsonAllocatorBlock *next; 
 } jsonAllocatorBlock; 
 
 typedef struct jsonAllocator {
+    /* Where the allocator and its blocks come from */
+    jsonAllocatorHooks hooks;
+    /* Size of the next block, doubles each time one fills up */
     unsigned int block_capacity;
-    unsigned int used;
+    size_t used;
     jsonAllocatorBlock *head; /* Active block */
     jsonAllocatorBlock *tail; /* Used blocks */
+    jsonAllocatorBlock *spare; /* Blocks kept by a reset to be used again */
+    /* Indexes built over the containers of the documents in the allocator,
+     * the indexes themselves are allocated from the blocks */
+    void **indexes;
+    unsigned int indexes_len;
+    unsigned int indexes_capacity;
 } jsonAllocator;
 
 static unsigned int jsonAllocatorAlignMemorySize(unsigned int size) {
@@ -76,23 +177,101 @@ static unsigned int jsonAllocatorAlignMemorySize(unsigned int size) {
     return (size + (alignment - 1)) & ~(alignment - 1);
 }
 
-static jsonAllocatorBlock *jsonAllocatorBlockNew(unsigned int capacity) {
-    jsonAllocatorBlock *block = (jsonAllocatorBlock *)malloc(sizeof(jsonAllocatorBlock));
-    block->capacity = capacity;
+/**
+ * Map `size` bytes, which must be a multiple of the huge page size, aligned
+ * to a huge page and ask the kernel to back them with huge pages. NULL if the
+ * mapping failed.
+ */
+static void *jsonAllocatorMap(size_t size) {
+    size_t len = size + JSON_HUGE_PAGE_SIZE;
+    char *ptr = (char *)mmap(NULL, len, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return NULL;
+    }
+
+    /* Trim the excess either side of the aligned region */
+    char *aligned = (char *)(((uintptr_t)ptr + JSON_HUGE_PAGE_SIZE - 1) &
+                             ~(uintptr_t)(JSON_HUGE_PAGE_SIZE - 1));
+    if (aligned != ptr) {
+        munmap(ptr, aligned - ptr);
+    }
+    if (aligned + size != ptr + len) {
+        munmap(aligned + size, (ptr + len) - (aligned + size));
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+    return aligned;
+}
+
+static jsonAllocatorBlock *jsonAllocatorBlockNew(jsonAllocator *allocator,
+                                                 unsigned int capacity) {
+    jsonAllocatorHooks *hooks = &allocator->hooks;
+    jsonAllocatorBlock *block = (jsonAllocatorBlock *)hooks->malloc(
+            hooks->ctx, sizeof(jsonAllocatorBlock));
     block->used = 0;
-    block->mem = (void *)malloc(capacity);
+    block->oversized = 0;
+    block->mapped = 0;
+    block->mem = NULL;
+
+    /* Big blocks are mapped, unless the hooks say memory should come from
+     * somewhere in particular */
+    if (capacity >= JSON_ALLOCATOR_MMAP_THRESHOLD &&
+        hooks->malloc == jsonLibcMalloc) {
+        capacity = (capacity + JSON_HUGE_PAGE_SIZE - 1) &
+                   ~(JSON_HUGE_PAGE_SIZE - 1);
+        block->mem = jsonAllocatorMap(capacity);
+        block->mapped = block->mem != NULL;
+    }
+    if (block->mem == NULL) {
+        block->mem = hooks->malloc(hooks->ctx, capacity);
+    }
+    block->capacity = capacity;
     return block;
 }
 
-static jsonAllocator *jsonAllocatorNew(unsigned int capacity) {
-    jsonAllocator *allocator = (jsonAllocator *)malloc(sizeof(jsonAllocator));
+/* Take the first spare block `size` fits in, if there is one */
+static jsonAllocatorBlock *jsonAllocatorTakeSpare(jsonAllocator *allocator,
+                                                  unsigned int size) {
+    jsonAllocatorBlock **prev = &allocator->spare;
+    jsonAllocatorBlock *block = allocator->spare;
+
+    while (block) {
+        if (size <= block->capacity) {
+            *prev = block->next;
+            return block;
+        }
+        prev = &block->next;
+        block = block->next;
+    }
+    return NULL;
+}
+
+/* An allocator getting its memory from `hooks`, or the global hooks if NULL */
+static jsonAllocator *jsonAllocatorNewWithHooks(
+        unsigned int capacity, const jsonAllocatorHooks *hooks) {
+    if (hooks == NULL) {
+        hooks = &json_hooks;
+    }
+    jsonAllocator *allocator = (jsonAllocator *)hooks->malloc(
+            hooks->ctx, sizeof(jsonAllocator));
+    allocator->hooks = *hooks;
     allocator->tail = NULL;
+    allocator->spare = NULL;
     allocator->block_capacity = jsonAllocatorAlignMemorySize(capacity);
     allocator->used = 0;
-    allocator->head = jsonAllocatorBlockNew(capacity);
+    allocator->indexes = NULL;
+    allocator->indexes_len = 0;
+    allocator->indexes_capacity = 0;
+    allocator->head = jsonAllocatorBlockNew(allocator, capacity);
     return allocator;
 }
 
+static jsonAllocator *jsonAllocatorNew(unsigned int capacity) {
+    return jsonAllocatorNewWithHooks(capacity, NULL);
+}
+
 static void *jsonAlloc(jsonAllocator *allocator, unsigned int size) {
     /* Allocate aligned memory only */
     unsigned int allocation_size = jsonAllocatorAlignMemorySize(size);
@@ -103,7 +282,9 @@ static void *jsonAlloc(jsonAllocator *allocator, unsigned int size) {
     if (allocation_size > allocator->block_capacity) {
         /* Do not set `block->used` so `arenaBlockRelease(...)` doesn't touch 
          * arbitrary memory */
-        jsonAllocatorBlock *block = jsonAllocatorBlockNew(allocation_size);
+        jsonAllocatorBlock *block = jsonAllocatorBlockNew(allocator,
+                                                          allocation_size);
+        block->oversized = 1;
         block->next = allocator->tail;
         /* Immediately add to the list of blocks that are used up */
         allocator->tail = block;
@@ -113,7 +294,18 @@ static void *jsonAlloc(jsonAllocator *allocator, unsigned int size) {
         /* We accept that `mem` may not be fully used up. In fact it probably 
          * never is. This keeps the implementation fast and simple. */
         if (block->used + allocation_size >= block->capacity) {
-            jsonAllocatorBlock *new_block = jsonAllocatorBlockNew(allocator->block_capacity);
+            jsonAllocatorBlock *new_block = jsonAllocatorTakeSpare(
+                    allocator, allocation_size);
+            if (new_block == NULL) {
+                /* Growing geometrically keeps the number of blocks, and so
+                 * the cost of releasing them, down to a handful even for
+                 * huge documents */
+                if (allocator->block_capacity < JSON_ALLOCATOR_MAX_BLOCK_SIZE) {
+                    allocator->block_capacity *= 2;
+                }
+                new_block = jsonAllocatorBlockNew(allocator,
+                                                  allocator->block_capacity);
+            }
             block->next = allocator->tail;
             allocator->tail = block;
             allocator->head = new_block;
@@ -128,26 +320,227 @@ static void *jsonAlloc(jsonAllocator *allocator, unsigned int size) {
     }
 }
 
-static void jsonAllocatorBlockRelease(jsonAllocatorBlock *block) {
+static void jsonAllocatorBlockRelease(jsonAllocator *allocator,
+                                      jsonAllocatorBlock *block) {
     if (block) {
+        jsonAllocatorHooks *hooks = &allocator->hooks;
         /* Need to go to the start address */
-        free(((char *)block->mem) - block->used);
-        free(block);
+        void *start = ((char *)block->mem) - block->used;
+        if (block->mapped) {
+            munmap(start, block->capacity);
+        } else {
+            hooks->free(hooks->ctx, start);
+        }
+        hooks->free(hooks->ctx, block);
+    }
+}
+
+static void jsonAllocatorBlockListRelease(jsonAllocator *allocator,
+                                          jsonAllocatorBlock *block) {
+    jsonAllocatorBlock *next = NULL;
+    while (block) {
+        next = block->next;
+        jsonAllocatorBlockRelease(allocator, block);
+        block = next;
     }
 }
 
 static void jsonAllocatorRelease(jsonAllocator *allocator) {
     if (allocator) {
-        jsonAllocatorBlockRelease(allocator->head);
-        jsonAllocatorBlock *block = allocator->tail;
-        jsonAllocatorBlock *next = NULL;
-        while (block) {
-            next = block->next;
-            jsonAllocatorBlockRelease(block);
-            block = next;
+        jsonAllocatorHooks hooks = allocator->hooks;
+        jsonAllocatorBlockRelease(allocator, allocator->head);
+        jsonAllocatorBlockListRelease(allocator, allocator->tail);
+        jsonAllocatorBlockListRelease(allocator, allocator->spare);
+        if (allocator->indexes) {
+            hooks.free(hooks.ctx, allocator->indexes);
+        }
+        hooks.free(hooks.ctx, allocator);
+    }
+}
+
+/**
+ * Forget everything that has been allocated but keep the memory. Blocks are
+ * rewound and kept for reuse, oversized ones are freed.
+ */
+static void jsonAllocatorReset(jsonAllocator *allocator) {
+    jsonAllocatorBlock *block = allocator->tail;
+    jsonAllocatorBlock *next = NULL;
+
+    allocator->head->mem = ((char *)allocator->head->mem) -
+            allocator->head->used;
+    allocator->head->used = 0;
+
+    while (block) {
+        next = block->next;
+        if (!block->oversized) {
+            block->mem = ((char *)block->mem) - block->used;
+            block->used = 0;
+            block->next = allocator->spare;
+            allocator->spare = block;
+        } else {
+            jsonAllocatorBlockRelease(allocator, block);
         }
-        free(allocator);
+        block = next;
     }
+
+    allocator->tail = NULL;
+    allocator->used = 0;
+    allocator->indexes_len = 0;
+}
+
+/**
+ * Take ownership of everything `src` has allocated, which stays where it is
+ * and is freed along with `dst`. `src` is freed, both must have been created
+ * with the same hooks.
+ */
+static void jsonAllocatorAdopt(jsonAllocator *dst, jsonAllocator *src) {
+    jsonAllocatorBlock *last = src->head;
+
+    /* The adopted blocks are all treated as used up */
+    src->head->next = src->tail;
+    while (last->next) {
+        last = last->next;
+    }
+    last->next = dst->tail;
+    dst->tail = src->head;
+    dst->used += src->used;
+
+    jsonAllocatorBlockListRelease(src, src->spare);
+    /* Nothing has had a chance to build an index while it was parsing */
+    if (src->indexes) {
+        src->hooks.free(src->hooks.ctx, src->indexes);
+    }
+    src->hooks.free(src->hooks.ctx, src);
+}
+
+/*=============================================================================
+ * Thread cache
+ *
+ * Opt in, each thread keeps a few retired allocators, rewound, rather than
+ * freeing them. Parsing lots of small documents then takes an allocator with
+ * its blocks from the cache and hands it back on release, never touching
+ * malloc or the locks inside it.
+ *============================================================================*/
+
+/* Allocators holding more than this are freed rather than cached */
+#define JSON_THREAD_CACHE_MAX_BYTES (256 * 1024)
+#define JSON_THREAD_CACHE_MAX_SIZE  (64)
+
+typedef struct jsonThreadCache {
+    size_t count;
+    jsonAllocator *allocators[JSON_THREAD_CACHE_MAX_SIZE];
+} jsonThreadCache;
+
+/* Allocators each thread keeps, 0 turns the cache off. Read on every parse
+ * and release from any thread, so it is only touched with relaxed atomics */
+static size_t json_thread_cache_size = 0;
+static __thread jsonThreadCache *json_thread_cache = NULL;
+static pthread_key_t json_thread_cache_key;
+static pthread_once_t json_thread_cache_once = PTHREAD_ONCE_INIT;
+
+/* Called as a thread exits */
+static void jsonThreadCacheRelease(void *ptr) {
+    jsonThreadCache *cache = (jsonThreadCache *)ptr;
+    for (size_t i = 0; i < cache->count; ++i) {
+        jsonAllocatorRelease(cache->allocators[i]);
+    }
+    jsonFree(cache);
+}
+
+static void jsonThreadCacheKeyCreate(void) {
+    pthread_key_create(&json_thread_cache_key, jsonThreadCacheRelease);
+}
+
+static size_t jsonThreadCacheSize(void) {
+    return __atomic_load_n(&json_thread_cache_size, __ATOMIC_RELAXED);
+}
+
+static jsonThreadCache *jsonThreadCacheGet(void) {
+    if (json_thread_cache == NULL) {
+        pthread_once(&json_thread_cache_once, jsonThreadCacheKeyCreate);
+        json_thread_cache = (jsonThreadCache *)jsonCalloc(
+                1, sizeof(jsonThreadCache));
+        pthread_setspecific(json_thread_cache_key, json_thread_cache);
+    }
+    return json_thread_cache;
+}
+
+/**
+ * How many retired allocators each thread keeps for the next parse, 0, the
+ * default, turns the cache off. At most 64, and only allocators that held
+ * less than 256KB are kept. Safe to call from any thread. Shrinking it frees
+ * what the calling thread has cached over the new size, and 0 frees the
+ * calling thread's cache entirely. Other threads free theirs as they exit,
+ * the main thread, which never exits through pthread, should set 0 before
+ * it returns.
+ */
+void jsonSetThreadCacheSize(size_t size) {
+    if (size > JSON_THREAD_CACHE_MAX_SIZE) {
+        size = JSON_THREAD_CACHE_MAX_SIZE;
+    }
+    __atomic_store_n(&json_thread_cache_size, size, __ATOMIC_RELAXED);
+    if (json_thread_cache == NULL) {
+        return;
+    }
+
+    while (json_thread_cache->count > size) {
+        jsonAllocatorRelease(
+                json_thread_cache->allocators[--json_thread_cache->count]);
+    }
+    if (size == 0) {
+        pthread_setspecific(json_thread_cache_key, NULL);
+        jsonFree(json_thread_cache);
+        json_thread_cache = NULL;
+    }
+}
+
+static int jsonHooksEqual(const jsonAllocatorHooks *a,
+                          const jsonAllocatorHooks *b) {
+    return a->malloc == b->malloc && a->realloc == b->realloc &&
+           a->free == b->free && a->ctx == b->ctx;
+}
+
+/* An allocator from the thread cache if there is one, otherwise a new one */
+static jsonAllocator *jsonAllocatorAcquire(const jsonAllocatorHooks *hooks) {
+    if (hooks == NULL && jsonThreadCacheSize()) {
+        jsonThreadCache *cache = jsonThreadCacheGet();
+        while (cache->count) {
+            jsonAllocator *allocator = cache->allocators[--cache->count];
+            /* The global hooks changed since it was cached */
+            if (!jsonHooksEqual(&allocator->hooks, &json_hooks)) {
+                jsonAllocatorRelease(allocator);
+                continue;
+            }
+            return allocator;
+        }
+    }
+    return jsonAllocatorNewWithHooks(JSON_ALLOCATOR_INITIAL_SIZE, hooks);
+}
+
+/* Put the allocator in the thread cache if it is worth keeping, otherwise
+ * free it */
+static void jsonAllocatorRetire(jsonAllocator *allocator) {
+    if (allocator == NULL) {
+        return;
+    }
+
+    size_t cache_size = jsonThreadCacheSize();
+    if (cache_size && jsonHooksEqual(&allocator->hooks, &json_hooks)) {
+        jsonThreadCache *cache = jsonThreadCacheGet();
+        if (cache->count < cache_size) {
+            size_t capacity = allocator->head->capacity;
+            jsonAllocatorReset(allocator);
+            for (jsonAllocatorBlock *block = allocator->spare; block;
+                 block = block->next) {
+                capacity += block->capacity;
+            }
+            if (capacity <= JSON_THREAD_CACHE_MAX_BYTES) {
+                cache->allocators[cache->count++] = allocator;
+                return;
+            }
+        }
+    }
+    jsonAllocatorRelease(allocator);
 }
 
 typedef struct jsonParser {
@@ -175,6 +568,11 @@ typedef struct jsonParser {
      * finished */
     jsonState *state;
     jsonAllocator *allocator;
+    /* SIMD kernels picked for this cpu */
+    const jsonSimdKernels *kernels;
+    /* Containers around the value being parsed that are not on the parse
+     * stack, an array element parsed on its own is inside the root */
+    size_t depth;
 } jsonParser;
 
 typedef struct jsonString {
@@ -188,17 +586,19 @@ typedef struct jsonString {
  *============================================================================*/
 
 jsonString *jsonStringNew(void) {
-    jsonString *jsb = malloc(sizeof(jsonString));
+    jsonString *jsb = jsonMalloc(sizeof(jsonString));
     jsb->len = 0;
     jsb->capacity = 128;
-    jsb->buffer = malloc(sizeof(char) * jsb->capacity);
+    jsb->buffer = jsonMalloc(sizeof(char) * jsb->capacity);
+    /* Nothing may ever be added to it */
+    jsb->buffer[0] = '\0';
     return jsb;
 }
 
 void jsonStringRelease(jsonString *js) {
     if (js) {
-        free(js->buffer);
-        free(js);
+        jsonFree(js->buffer);
+        jsonFree(js);
     }
 }
 
@@ -212,7 +612,7 @@ static int jsonStringExtendBufferIfNeeded(jsonString *js, size_t additional) {
         }
 
         char *_str = js->buffer;
-        char *tmp = (char *)realloc(_str, new_capacity);
+        char *tmp = (char *)jsonRealloc(_str, new_capacity);
 
         if (tmp == NULL) {
             return 0;
@@ -240,7 +640,7 @@ static void jsonStringCatf(jsonString *js, const char *fmt, ...) {
     size_t bufferlen = strlen(fmt) * 3;
     size_t len = 0;
     bufferlen = bufferlen > min_len ? bufferlen : min_len;
-    char *buf = (char *)malloc(sizeof(char) * bufferlen);
+    char *buf = (char *)jsonMalloc(sizeof(char) * bufferlen);
 
     while (1) {
         va_copy(copy, ap);
@@ -248,9 +648,9 @@ static void jsonStringCatf(jsonString *js, const char *fmt, ...) {
         va_end(copy);
 
         if (len >= bufferlen) {
-            free(buf);
+            jsonFree(buf);
             bufferlen = len + 1;
-            buf = malloc(bufferlen);
+            buf = jsonMalloc(bufferlen);
             if (buf == NULL) {
                 return;
             }
@@ -261,15 +661,23 @@ static void jsonStringCatf(jsonString *js, const char *fmt, ...) {
 
     buf[len] = '\0';
     jsonStringCatLen(js, buf, len);
-    free(buf);
+    jsonFree(buf);
     va_end(ap);
 }
 
+static void jsonMaterializeNumber(json *J);
+
+/* A lazy string that fails to unescape is printed as an empty string */
+static char *jsonGetStringOrEmpty(json *J) {
+    char *str = jsonGetString(J);
+    return str ? str : "";
+}
+
 static void jsonConcatKey(json *J, jsonString *js) {
     if (J->key) {
         unsigned char *escape_str = escapeString(J->key);
-        jsonStringCatf(js, "\"%s\":", J->key);
-        free(escape_str);
+        jsonStringCatf(js, "\"%s\":", escape_str);
+        jsonFree(escape_str);
     }
 }
 
@@ -280,6 +688,7 @@ static void _jsonToString(json *J, jsonString *js) {
     }
 
     while (J) {
+        jsonMaterializeNumber(J);
         switch (J->type) {
         case JSON_INT:
             jsonConcatKey(J, js);
@@ -298,9 +707,9 @@ static void _jsonToString(json *J, jsonString *js) {
 
         case JSON_STRING:
             jsonConcatKey(J, js);
-            unsigned char *escape_str = escapeString(J->str);
+            unsigned char *escape_str = escapeString(jsonGetStringOrEmpty(J));
             jsonStringCatf(js, "\"%s\"", (char *)escape_str);
-            free(escape_str);
+            jsonFree(escape_str);
             break;
 
         case JSON_ARRAY:
@@ -338,6 +747,7 @@ static void _jsonToString(json *J, jsonString *js) {
     }
 }
 
+/* Serialise `j`, the string must be freed with `jsonFree` */
 char *jsonToString(json *j, size_t *_len) {
     jsonString *js = jsonStringNew();
     char *buffer = NULL;
@@ -346,7 +756,7 @@ char *jsonToString(json *j, size_t *_len) {
         *_len = js->len;
     }
     buffer = js->buffer;
-    free(js);
+    jsonFree(js);
     return buffer;
 }
 
@@ -400,17 +810,6 @@ static const double powers_of_10[] = {
         1e+306, 1e+307, 1e+308,
 };
 
-/* Retun power of 10 from the cache */
-static double I64Pow10(int idx) {
-    if (idx > 308) {
-        return idx;
-    } else if (idx < -308) {
-        return 0.0;
-    }
-    return powers_of_10[idx];
-}
-
-
 #if defined(__GNUC__) || defined(__clang__)
 #define countTrailingZeros(x) ((x) == 0 ? 16 : __builtin_ctz(x))
 #else
@@ -424,18 +823,132 @@ static inline int countTrailingZeros(uint16_t n) {
 }
 #endif
 
-static size_t getNextNonWhitespaceIdxSimple(char *start, const char *ptr, char *endptr, int *_ok) {
-    while (isWhiteSpace(*ptr)) {
-        ++ptr;
+#if defined(__GNUC__) || defined(__clang__)
+#define countTrailingZeros64(x) (__builtin_ctzll(x))
+#else
+static inline int countTrailingZeros64(uint64_t n) {
+    int c = 0;
+    while (((n >> c) & 1) == 0) {
+        c++;
     }
-    if (ptr == endptr && isWhiteSpace(*(ptr-1))) {
-         *_ok = 0;
-         return ptr - start;
+    return c;
+}
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+        (defined(__GNUC__) || defined(__clang__))
+/* Wider kernels are compiled with target attributes and only run after
+ * checking the cpu supports them */
+#define JSON_X86_DISPATCH
+#endif
+
+#define JSON_BLOCK_SIZE (64)
+
+#define isJsonWhiteSpace(ch) \
+    (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r')
+#define isJsonStructural(ch) \
+    (ch == '{' || ch == '}' || ch == '[' || ch == ']' || ch == ':' || ch == ',')
+
+/* Bitmaps of the interesting characters in a 64 byte block */
+typedef struct jsonBlockMasks {
+    uint64_t whitespace;
+    uint64_t structural;
+    uint64_t quote;
+    uint64_t backslash;
+} jsonBlockMasks;
+
+/* Skip whitespace from `ptr` up to `endptr`, everything from `start` to
+ * `ptr` is already known to be whitespace. `_ok` is 0 if the whitespace ran
+ * in to `endptr`, every kernel has to give exactly this result and must not
+ * look past `endptr` */
+static size_t getNextNonWhitespaceIdxSimple(char *start, const char *ptr,
+                                            char *endptr, int *_ok) {
+    while (ptr < endptr && isWhiteSpace(*ptr)) {
+        ++ptr;
     }
-    *_ok = 1;
+    *_ok = !(ptr == endptr && ptr != start);
     return ptr - start;
 }
 
+/* Much simpler niave version */
+static size_t getNextNonWhitespaceIdxScalar(const char *ptr, char *endptr,
+                                            int *_ok) {
+    return getNextNonWhitespaceIdxSimple((char *)ptr, ptr, endptr, _ok);
+}
+
+static void jsonClassifyBlockScalar(const char *ptr, jsonBlockMasks *masks) {
+    masks->whitespace = 0;
+    masks->structural = 0;
+    masks->quote = 0;
+    masks->backslash = 0;
+
+    for (int i = 0; i < JSON_BLOCK_SIZE; ++i) {
+        char ch = ptr[i];
+        uint64_t bit = 1ULL << i;
+        if (isJsonWhiteSpace(ch)) {
+            masks->whitespace |= bit;
+        } else if (isJsonStructural(ch)) {
+            masks->structural |= bit;
+        } else if (ch == '"') {
+            masks->quote |= bit;
+        } else if (ch == '\\') {
+            masks->backslash |= bit;
+        }
+    }
+}
+
+/* Find the next character in a string that cannot just be copied; a quote,
+ * a backslash or a control character */
+static const char *jsonScanStringScalar(const char *ptr, const char *endptr) {
+    while (ptr < endptr && *ptr != '"' && *ptr != '\\' &&
+           (unsigned char)*ptr >= 0x20) {
+        ++ptr;
+    }
+    return ptr;
+}
+
+/* SWAR: all 8 bytes of a little endian load are '0'..'9' */
+static int jsonIsEightDigits(uint64_t v) {
+    return ((v & 0xF0F0F0F0F0F0F0F0ULL) |
+            (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+            0x3333333333333333ULL;
+}
+
+/* SWAR: convert 8 ascii digits, first digit in the low byte, to an integer
+ * with three multiplies rather than eight */
+static uint32_t jsonParseEightDigits(uint64_t v) {
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 100 + (1000000ULL << 32);
+    const uint64_t mul2 = 1 + (10000ULL << 32);
+
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+    return (uint32_t)v;
+}
+
+static uint64_t jsonLoad64(const char *ptr) {
+    uint64_t v;
+    memcpy(&v, ptr, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+/* Convert 16 digits to an integer, returns 0 if they are not all digits */
+static int jsonParseDigits16Scalar(const char *ptr, uint64_t *out) {
+    uint64_t hi = jsonLoad64(ptr);
+    uint64_t lo = jsonLoad64(ptr + 8);
+
+    if (!jsonIsEightDigits(hi) || !jsonIsEightDigits(lo)) {
+        return 0;
+    }
+    *out = (uint64_t)jsonParseEightDigits(hi) * 100000000ULL +
+            jsonParseEightDigits(lo);
+    return 1;
+}
+
 /**
  * Use SMID if avalible for machine, this is the one I have on my
  * computer hence the one I've implemented. Makes moving past
@@ -443,9 +956,10 @@ static size_t getNextNonWhitespaceIdxSimple(char *start, const char *ptr, char *
  */
 #if defined(__SSE2__)
 #include <emmintrin.h>
-static size_t getNextNonWhitespaceIdx(const char *ptr, char *endptr, int *_ok) { 
+static size_t getNextNonWhitespaceIdxSse2(const char *ptr, char *endptr,
+                                          int *_ok) {
     char *start = (char *)ptr;
-    if (isWhiteSpace(*ptr)) {
+    if (ptr < endptr && isWhiteSpace(*ptr)) {
         ++ptr;
     } else {
         *_ok = 1;
@@ -460,7 +974,7 @@ static size_t getNextNonWhitespaceIdx(const char *ptr, char *endptr, int *_ok) {
 
     /* loop through characters until the next boundary, checking for whitespaces
      */
-    while (ptr != next_boundary) {
+    while (ptr != next_boundary && ptr < endptr) {
         if (isWhiteSpace(*ptr)) {
             ++ptr;
         } else {
@@ -469,11 +983,6 @@ static size_t getNextNonWhitespaceIdx(const char *ptr, char *endptr, int *_ok) {
         }
     }
 
-    if (ptr == endptr) {
-        *_ok = 0;
-        return ptr-start;
-    }
-
     static const char whitespaces[4][16] = {
             {' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
              ' ', ' ', ' '},
@@ -490,8 +999,9 @@ static size_t getNextNonWhitespaceIdx(const char *ptr, char *endptr, int *_ok) {
     const __m128i w2 = _mm_loadu_si128((const __m128i *)(&whitespaces[2][0]));
     const __m128i w3 = _mm_loadu_si128((const __m128i *)(&whitespaces[3][0]));
 
-    /* Find next non-whitespace character 16 characters at a time */
-    while (1) {
+    /* Find next non-whitespace character 16 characters at a time, a partial
+     * block at the end is left to the scalar loop */
+    while (ptr + 16 <= endptr) {
         /* Load 16 bytes from the input string into an __m128i variable */
         const __m128i s = _mm_load_si128((const __m128i *)(ptr));
 
@@ -514,20 +1024,106 @@ static size_t getNextNonWhitespaceIdx(const char *ptr, char *endptr, int *_ok) {
             return (ptr + __builtin_ffs(r) - 1) - start;
         }
 
-        if (ptr + 16 >= endptr) {
-            *_ok = 0;
-            return ptr-start;
+        ptr += 16;
+    }
+    return getNextNonWhitespaceIdxSimple(start, ptr, endptr, _ok);
+}
+
+static uint64_t jsonBlockMask16(const char *ptr, const __m128i *needles,
+                                int count) {
+    uint64_t mask = 0;
+    for (int i = 0; i < 4; ++i) {
+        const __m128i s = _mm_loadu_si128((const __m128i *)(ptr + i * 16));
+        __m128i x = _mm_cmpeq_epi8(s, needles[0]);
+        for (int j = 1; j < count; ++j) {
+            x = _mm_or_si128(x, _mm_cmpeq_epi8(s, needles[j]));
         }
+        mask |= ((uint64_t)(unsigned short)_mm_movemask_epi8(x)) << (i * 16);
+    }
+    return mask;
+}
+
+static void jsonClassifyBlockSse2(const char *ptr, jsonBlockMasks *masks) {
+    const __m128i whitespace[4] = {
+            _mm_set1_epi8(' '),
+            _mm_set1_epi8('\t'),
+            _mm_set1_epi8('\n'),
+            _mm_set1_epi8('\r'),
+    };
+    const __m128i structural[6] = {
+            _mm_set1_epi8('{'), _mm_set1_epi8('}'), _mm_set1_epi8('['),
+            _mm_set1_epi8(']'), _mm_set1_epi8(':'), _mm_set1_epi8(','),
+    };
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
 
+    masks->whitespace = jsonBlockMask16(ptr, whitespace, 4);
+    masks->structural = jsonBlockMask16(ptr, structural, 6);
+    masks->quote = jsonBlockMask16(ptr, &quote, 1);
+    masks->backslash = jsonBlockMask16(ptr, &backslash, 1);
+}
+static const char *jsonScanStringSse2(const char *ptr, const char *endptr) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+
+    while (endptr - ptr >= 16) {
+        const __m128i s = _mm_loadu_si128((const __m128i *)ptr);
+        __m128i x = _mm_cmpeq_epi8(s, quote);
+        x = _mm_or_si128(x, _mm_cmpeq_epi8(s, backslash));
+        /* s <= 0x1F unsigned */
+        x = _mm_or_si128(x, _mm_cmpeq_epi8(_mm_max_epu8(s, control), control));
+
+        unsigned int r = (unsigned int)_mm_movemask_epi8(x);
+        if (r != 0) {
+            return ptr + __builtin_ctz(r);
+        }
         ptr += 16;
     }
+    return jsonScanStringScalar(ptr, endptr);
+}
+
+/* Pairs of digits are folded together with madd until two 8 digit halves are
+ * left, only SSE2 is needed for this */
+static int jsonParseDigits16Sse2(const char *ptr, uint64_t *out) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i s = _mm_loadu_si128((const __m128i *)ptr);
+    const __m128i digits = _mm_sub_epi8(s, _mm_set1_epi8('0'));
+    /* digit > 9 unsigned, anything below '0' wraps around */
+    const __m128i over = _mm_cmpeq_epi8(
+            _mm_max_epu8(digits, _mm_set1_epi8(9)), _mm_set1_epi8(9));
+
+    if (_mm_movemask_epi8(over) != 0xFFFF) {
+        return 0;
+    }
+
+    const __m128i x10 = _mm_set_epi16(1, 10, 1, 10, 1, 10, 1, 10);
+    const __m128i x100 = _mm_set_epi16(1, 100, 1, 100, 1, 100, 1, 100);
+    const __m128i x10000 = _mm_set_epi16(1, 10000, 1, 10000, 1, 10000, 1,
+                                         10000);
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(digits, zero), x10);
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(digits, zero), x10);
+    /* 8 x 2 digits */
+    __m128i v = _mm_packs_epi32(lo, hi);
+    /* 4 x 4 digits */
+    v = _mm_madd_epi16(v, x100);
+    v = _mm_packs_epi32(v, v);
+    /* 2 x 8 digits */
+    v = _mm_madd_epi16(v, x10000);
+
+    *out = (uint64_t)(uint32_t)_mm_cvtsi128_si32(v) * 100000000ULL +
+            (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(v, 4));
+    return 1;
 }
-#elif defined(__ARM_NEON)
+#endif
+
+#if defined(__ARM_NEON)
 #include <arm_neon.h>
-static size_t getNextNonWhitespaceIdx(const char *ptr, char *endptr, int *_ok) {
+static size_t getNextNonWhitespaceIdxNeon(const char *ptr, char *endptr,
+                                          int *_ok) {
     char *start = (char *)ptr;
 
-    if (isWhiteSpace(*ptr)) {
+    if (ptr < endptr && isWhiteSpace(*ptr)) {
         ++ptr;
     } else {
         *_ok = 1;
@@ -539,7 +1135,7 @@ static size_t getNextNonWhitespaceIdx(const char *ptr, char *endptr, int *_ok) {
 
     /* loop through characters until the next boundary
      * checking for whitespaces */
-    while (ptr < next_boundary) {
+    while (ptr < next_boundary && ptr < endptr) {
         if (isWhiteSpace(*ptr)) {
             ++ptr;
         } else {
@@ -600,80 +1196,614 @@ static size_t getNextNonWhitespaceIdx(const char *ptr, char *endptr, int *_ok) {
 
     return (size_t)(ptr - start);
 }
-#else
-/* Much simpler niave version */
-static size_t getNextNonWhitespaceIdx(const char *ptr, char *endptr, int *_ok) {
-    return getNextNonWhitespaceIdxSimple(ptr, ptr, endptr, _ok);
-}
-#endif
 
-/**
- * Create new json object
- */
-static json *jsonNew(jsonParser *p) {
-    json *J = (json *)jsonAlloc(p->allocator, sizeof(json));
-    J->type = JSON_NULL;
-    J->key = NULL;
-    J->next = NULL;
-    J->state = NULL;
-    return J;
+static uint64_t jsonNeonMovemask(uint8x16_t x) {
+    const uint8x16_t bit_mask_pattern = vcombine_u8(
+        (uint8x8_t){1, 2, 4, 8, 16, 32, 64, 128},
+        (uint8x8_t){1, 2, 4, 8, 16, 32, 64, 128}
+    );
+    uint8x16_t masked_bits = vandq_u8(x, bit_mask_pattern);
+    uint8_t low_byte_mask = vaddv_u8(vget_low_u8(masked_bits));
+    uint8_t high_byte_mask = vaddv_u8(vget_high_u8(masked_bits));
+    return (uint64_t)low_byte_mask | ((uint64_t)high_byte_mask << 8);
 }
 
-/**
- * Needs to be null checked before calling this function
- */
-static char jsonUnsafePeekAt(jsonParser *p, size_t idx) {
-    return p->buffer[idx];
-}
+static void jsonClassifyBlockNeon(const char *ptr, jsonBlockMasks *masks) {
+    masks->whitespace = 0;
+    masks->structural = 0;
+    masks->quote = 0;
+    masks->backslash = 0;
 
-/**
- * Look at the current character
- */
-static char jsonPeek(jsonParser *p) {
-    return p->buffer[p->offset];
+    for (int i = 0; i < 4; ++i) {
+        const uint8x16_t s = vld1q_u8((const uint8_t *)(ptr + i * 16));
+        uint8x16_t ws = vceqq_u8(s, vdupq_n_u8(' '));
+        ws = vorrq_u8(ws, vceqq_u8(s, vdupq_n_u8('\t')));
+        ws = vorrq_u8(ws, vceqq_u8(s, vdupq_n_u8('\n')));
+        ws = vorrq_u8(ws, vceqq_u8(s, vdupq_n_u8('\r')));
+
+        uint8x16_t op = vceqq_u8(s, vdupq_n_u8('{'));
+        op = vorrq_u8(op, vceqq_u8(s, vdupq_n_u8('}')));
+        op = vorrq_u8(op, vceqq_u8(s, vdupq_n_u8('[')));
+        op = vorrq_u8(op, vceqq_u8(s, vdupq_n_u8(']')));
+        op = vorrq_u8(op, vceqq_u8(s, vdupq_n_u8(':')));
+        op = vorrq_u8(op, vceqq_u8(s, vdupq_n_u8(',')));
+
+        masks->whitespace |= jsonNeonMovemask(ws) << (i * 16);
+        masks->structural |= jsonNeonMovemask(op) << (i * 16);
+        masks->quote |= jsonNeonMovemask(vceqq_u8(s, vdupq_n_u8('"')))
+                << (i * 16);
+        masks->backslash |= jsonNeonMovemask(vceqq_u8(s, vdupq_n_u8('\\')))
+                << (i * 16);
+    }
 }
-
-/**
- * Check if we can advance the buffer by 'jmp' characters
- */
-static int jsonCanAdvanceBy(jsonParser *p, size_t jmp) {
-    return p->offset + jmp < p->buflen;
+static const char *jsonScanStringNeon(const char *ptr, const char *endptr) {
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t control = vdupq_n_u8(0x20);
+
+    while (endptr - ptr >= 16) {
+        const uint8x16_t s = vld1q_u8((const uint8_t *)ptr);
+        uint8x16_t x = vceqq_u8(s, quote);
+        x = vorrq_u8(x, vceqq_u8(s, backslash));
+        x = vorrq_u8(x, vcltq_u8(s, control));
+
+        uint64_t r = jsonNeonMovemask(x);
+        if (r != 0) {
+            return ptr + countTrailingZeros64(r);
+        }
+        ptr += 16;
+    }
+    return jsonScanStringScalar(ptr, endptr);
 }
+#endif
 
-/**
- * Advance the offset into the buffer by 'jmp'
- */
-static void jsonUnsafeAdvanceBy(jsonParser *p, size_t jmp) {
-    p->offset += jmp;
-}
+#if defined(JSON_X86_DISPATCH)
+#include <immintrin.h>
 
-/**
- * Advance to error location and return 0
- */
-static int jsonAdvanceToError(jsonParser *p, size_t jmp, int error_code) {
-    p->errno = error_code;
-    jsonUnsafeAdvanceBy(p, jmp);
-    return 0;
-}
+__attribute__((target("avx2")))
+static size_t getNextNonWhitespaceIdxAvx2(const char *ptr, char *endptr,
+                                          int *_ok) {
+    char *start = (char *)ptr;
+    if (ptr < endptr && isWhiteSpace(*ptr)) {
+        ++ptr;
+    } else {
+        *_ok = 1;
+        return 0;
+    }
 
-/**
- * Advance buffers offset
- */
-static void jsonAdvance(jsonParser *p) {
-    if (jsonCanAdvanceBy(p, 1)) {
-        ++p->offset;
-        return;
+    /* Next 32-byte aligned block, aligned loads cannot cross a page */
+    const char *next_boundary = (const char *)((((size_t)ptr) + 31) &
+                                               ~((size_t)31));
+
+    while (ptr != next_boundary && ptr < endptr) {
+        if (isWhiteSpace(*ptr)) {
+            ++ptr;
+        } else {
+            *_ok = 1;
+            return ptr - start;
+        }
     }
-    p->errno = JSON_EOF;
+
+    const __m256i w0 = _mm256_set1_epi8(' ');
+    const __m256i w1 = _mm256_set1_epi8('\n');
+    const __m256i w2 = _mm256_set1_epi8('\r');
+    const __m256i w3 = _mm256_set1_epi8('\t');
+
+    /* Find next non-whitespace character 32 characters at a time, a partial
+     * block at the end is left to the scalar loop */
+    while (ptr + 32 <= endptr) {
+        const __m256i s = _mm256_load_si256((const __m256i *)(ptr));
+        __m256i x = _mm256_cmpeq_epi8(s, w0);
+        x = _mm256_or_si256(x, _mm256_cmpeq_epi8(s, w1));
+        x = _mm256_or_si256(x, _mm256_cmpeq_epi8(s, w2));
+        x = _mm256_or_si256(x, _mm256_cmpeq_epi8(s, w3));
+
+        unsigned int r = ~(unsigned int)_mm256_movemask_epi8(x);
+        if (r != 0) {
+            *_ok = 1;
+            return (ptr + __builtin_ctz(r)) - start;
+        }
+
+        ptr += 32;
+    }
+    return getNextNonWhitespaceIdxSimple(start, ptr, endptr, _ok);
+}
+
+__attribute__((target("avx2")))
+static void jsonClassifyBlockAvx2(const char *ptr, jsonBlockMasks *masks) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    /* '[' and ']' differ from '{' and '}' only by 0x20 */
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    const __m256i open = _mm256_set1_epi8('{');
+    const __m256i close = _mm256_set1_epi8('}');
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+
+    masks->whitespace = 0;
+    masks->structural = 0;
+    masks->quote = 0;
+    masks->backslash = 0;
+
+    for (int i = 0; i < 2; ++i) {
+        const __m256i s = _mm256_loadu_si256((const __m256i *)(ptr + i * 32));
+        const __m256i folded = _mm256_or_si256(s, case_bit);
+
+        __m256i ws = _mm256_cmpeq_epi8(s, space);
+        ws = _mm256_or_si256(ws, _mm256_cmpeq_epi8(s, tab));
+        ws = _mm256_or_si256(ws, _mm256_cmpeq_epi8(s, nl));
+        ws = _mm256_or_si256(ws, _mm256_cmpeq_epi8(s, cr));
+
+        __m256i op = _mm256_cmpeq_epi8(folded, open);
+        op = _mm256_or_si256(op, _mm256_cmpeq_epi8(folded, close));
+        op = _mm256_or_si256(op, _mm256_cmpeq_epi8(s, colon));
+        op = _mm256_or_si256(op, _mm256_cmpeq_epi8(s, comma));
+
+        masks->whitespace |= (uint64_t)(unsigned int)_mm256_movemask_epi8(ws)
+                << (i * 32);
+        masks->structural |= (uint64_t)(unsigned int)_mm256_movemask_epi8(op)
+                << (i * 32);
+        masks->quote |= (uint64_t)(unsigned int)_mm256_movemask_epi8(
+                                _mm256_cmpeq_epi8(s, quote))
+                << (i * 32);
+        masks->backslash |= (uint64_t)(unsigned int)_mm256_movemask_epi8(
+                                    _mm256_cmpeq_epi8(s, backslash))
+                << (i * 32);
+    }
+}
+
+__attribute__((target("avx2")))
+static const char *jsonScanStringAvx2(const char *ptr, const char *endptr) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1F);
+
+    while (endptr - ptr >= 32) {
+        const __m256i s = _mm256_loadu_si256((const __m256i *)ptr);
+        __m256i x = _mm256_cmpeq_epi8(s, quote);
+        x = _mm256_or_si256(x, _mm256_cmpeq_epi8(s, backslash));
+        x = _mm256_or_si256(x, _mm256_cmpeq_epi8(_mm256_max_epu8(s, control),
+                                                 control));
+
+        unsigned int r = (unsigned int)_mm256_movemask_epi8(x);
+        if (r != 0) {
+            return ptr + __builtin_ctz(r);
+        }
+        ptr += 32;
+    }
+#if defined(__SSE2__)
+    return jsonScanStringSse2(ptr, endptr);
+#else
+    return jsonScanStringScalar(ptr, endptr);
+#endif
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t getNextNonWhitespaceIdxAvx512(const char *ptr, char *endptr,
+                                            int *_ok) {
+    char *start = (char *)ptr;
+    if (ptr < endptr && isWhiteSpace(*ptr)) {
+        ++ptr;
+    } else {
+        *_ok = 1;
+        return 0;
+    }
+
+    const char *next_boundary = (const char *)((((size_t)ptr) + 63) &
+                                               ~((size_t)63));
+
+    while (ptr != next_boundary && ptr < endptr) {
+        if (isWhiteSpace(*ptr)) {
+            ++ptr;
+        } else {
+            *_ok = 1;
+            return ptr - start;
+        }
+    }
+
+    const __m512i w0 = _mm512_set1_epi8(' ');
+    const __m512i w1 = _mm512_set1_epi8('\n');
+    const __m512i w2 = _mm512_set1_epi8('\r');
+    const __m512i w3 = _mm512_set1_epi8('\t');
+
+    /* Find next non-whitespace character 64 characters at a time, a partial
+     * block at the end is left to the scalar loop */
+    while (ptr + 64 <= endptr) {
+        const __m512i s = _mm512_load_si512((const void *)(ptr));
+        uint64_t ws = _mm512_cmpeq_epi8_mask(s, w0) |
+                _mm512_cmpeq_epi8_mask(s, w1) | _mm512_cmpeq_epi8_mask(s, w2) |
+                _mm512_cmpeq_epi8_mask(s, w3);
+
+        if (~ws != 0) {
+            *_ok = 1;
+            return (ptr + countTrailingZeros64(~ws)) - start;
+        }
+
+        ptr += 64;
+    }
+    return getNextNonWhitespaceIdxSimple(start, ptr, endptr, _ok);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void jsonClassifyBlockAvx512(const char *ptr, jsonBlockMasks *masks) {
+    const __m512i s = _mm512_loadu_si512((const void *)ptr);
+    const __m512i folded = _mm512_or_si512(s, _mm512_set1_epi8(0x20));
+
+    masks->whitespace = _mm512_cmpeq_epi8_mask(s, _mm512_set1_epi8(' ')) |
+            _mm512_cmpeq_epi8_mask(s, _mm512_set1_epi8('\t')) |
+            _mm512_cmpeq_epi8_mask(s, _mm512_set1_epi8('\n')) |
+            _mm512_cmpeq_epi8_mask(s, _mm512_set1_epi8('\r'));
+    masks->structural =
+            _mm512_cmpeq_epi8_mask(folded, _mm512_set1_epi8('{')) |
+            _mm512_cmpeq_epi8_mask(folded, _mm512_set1_epi8('}')) |
+            _mm512_cmpeq_epi8_mask(s, _mm512_set1_epi8(':')) |
+            _mm512_cmpeq_epi8_mask(s, _mm512_set1_epi8(','));
+    masks->quote = _mm512_cmpeq_epi8_mask(s, _mm512_set1_epi8('"'));
+    masks->backslash = _mm512_cmpeq_epi8_mask(s, _mm512_set1_epi8('\\'));
+}
+__attribute__((target("avx512f,avx512bw")))
+static const char *jsonScanStringAvx512(const char *ptr, const char *endptr) {
+    const __m512i quote = _mm512_set1_epi8('"');
+    const __m512i backslash = _mm512_set1_epi8('\\');
+    const __m512i control = _mm512_set1_epi8(0x1F);
+
+    while (endptr - ptr >= 64) {
+        const __m512i s = _mm512_loadu_si512((const void *)ptr);
+        uint64_t r = _mm512_cmpeq_epi8_mask(s, quote) |
+                _mm512_cmpeq_epi8_mask(s, backslash) |
+                _mm512_cmple_epu8_mask(s, control);
+
+        if (r != 0) {
+            return ptr + countTrailingZeros64(r);
+        }
+        ptr += 64;
+    }
+
+    /* Masked out bytes are never read so the tail can be done in one go */
+    if (ptr < endptr) {
+        __mmask64 valid = ~0ULL >> (64 - (endptr - ptr));
+        const __m512i s = _mm512_maskz_loadu_epi8(valid, (const void *)ptr);
+        uint64_t r = (_mm512_cmpeq_epi8_mask(s, quote) |
+                      _mm512_cmpeq_epi8_mask(s, backslash) |
+                      _mm512_cmple_epu8_mask(s, control)) &
+                valid;
+        if (r != 0) {
+            return ptr + countTrailingZeros64(r);
+        }
+    }
+    return endptr;
+}
+#endif
+
+/*=============================================================================
+ * SIMD kernel dispatch
+ *
+ * Which kernels get used is decided once, the first time they are needed, by
+ * asking the cpu what it supports. The choice can be forced with the
+ * JSON_SIMD_KERNEL environment variable ("scalar", "sse2", "neon", "avx2" or
+ * "avx512") or by calling jsonSetSimdKernel, which is handy for benchmarking
+ * one against the other.
+ *============================================================================*/
+struct jsonSimdKernels {
+    JSON_SIMD_KERNEL kind;
+    const char *name;
+    size_t (*nextNonWhitespace)(const char *ptr, char *endptr, int *_ok);
+    void (*classifyBlock)(const char *ptr, jsonBlockMasks *masks);
+    const char *(*scanString)(const char *ptr, const char *endptr);
+    int (*parseDigits16)(const char *ptr, uint64_t *out);
+};
+
+/* 16 bytes is as wide as digits get, the wider kernels share SSE2's */
+#if defined(__SSE2__)
+#define jsonParseDigits16Wide jsonParseDigits16Sse2
+#else
+#define jsonParseDigits16Wide jsonParseDigits16Scalar
+#endif
+
+static const jsonSimdKernels json_simd_kernels[] = {
+        {JSON_SIMD_SCALAR, "scalar", getNextNonWhitespaceIdxScalar,
+         jsonClassifyBlockScalar, jsonScanStringScalar,
+         jsonParseDigits16Scalar},
+#if defined(__SSE2__)
+        {JSON_SIMD_SSE2, "sse2", getNextNonWhitespaceIdxSse2,
+         jsonClassifyBlockSse2, jsonScanStringSse2, jsonParseDigits16Sse2},
+#endif
+#if defined(__ARM_NEON)
+        {JSON_SIMD_NEON, "neon", getNextNonWhitespaceIdxNeon,
+         jsonClassifyBlockNeon, jsonScanStringNeon,
+         jsonParseDigits16Scalar},
+#endif
+#if defined(JSON_X86_DISPATCH)
+        {JSON_SIMD_AVX2, "avx2", getNextNonWhitespaceIdxAvx2,
+         jsonClassifyBlockAvx2, jsonScanStringAvx2, jsonParseDigits16Wide},
+        {JSON_SIMD_AVX512, "avx512", getNextNonWhitespaceIdxAvx512,
+         jsonClassifyBlockAvx512, jsonScanStringAvx512,
+         jsonParseDigits16Wide},
+#endif
+};
+
+#define JSON_SIMD_KERNEL_COUNT \
+    (sizeof(json_simd_kernels) / sizeof(json_simd_kernels[0]))
+
+static const jsonSimdKernels *json_kernels = NULL;
+
+static int jsonSimdKernelSupported(JSON_SIMD_KERNEL kind) {
+    switch (kind) {
+    case JSON_SIMD_SCALAR:
+        return 1;
+#if defined(__SSE2__)
+    case JSON_SIMD_SSE2:
+        return 1;
+#endif
+#if defined(__ARM_NEON)
+    case JSON_SIMD_NEON:
+        return 1;
+#endif
+#if defined(JSON_X86_DISPATCH)
+    case JSON_SIMD_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case JSON_SIMD_AVX512:
+        return __builtin_cpu_supports("avx512f") &&
+                __builtin_cpu_supports("avx512bw");
+#endif
+    default:
+        return 0;
+    }
+}
+
+static const jsonSimdKernels *jsonSimdKernelLookup(JSON_SIMD_KERNEL kind) {
+    for (size_t i = 0; i < JSON_SIMD_KERNEL_COUNT; ++i) {
+        if (json_simd_kernels[i].kind == kind &&
+            jsonSimdKernelSupported(kind)) {
+            return &json_simd_kernels[i];
+        }
+    }
+    return NULL;
+}
+
+/* The widest kernel the cpu can run, unless overridden by the environment */
+static const jsonSimdKernels *jsonSimdKernelsDetect(void) {
+    const jsonSimdKernels *kernels = NULL;
+    const char *forced = getenv("JSON_SIMD_KERNEL");
+
+    if (forced) {
+        for (size_t i = 0; i < JSON_SIMD_KERNEL_COUNT; ++i) {
+            if (!strcmp(forced, json_simd_kernels[i].name)) {
+                kernels = jsonSimdKernelLookup(json_simd_kernels[i].kind);
+                break;
+            }
+        }
+        if (kernels) {
+            return kernels;
+        }
+    }
+
+    for (size_t i = JSON_SIMD_KERNEL_COUNT; i > 0; --i) {
+        if (jsonSimdKernelSupported(json_simd_kernels[i - 1].kind)) {
+            return &json_simd_kernels[i - 1];
+        }
+    }
+    return &json_simd_kernels[0];
+}
+
+/* Every thread will detect the same kernels so racing here is harmless */
+static const jsonSimdKernels *jsonKernels(void) {
+    if (json_kernels == NULL) {
+        json_kernels = jsonSimdKernelsDetect();
+    }
+    return json_kernels;
+}
+
+/**
+ * Force the parser to use a specific set of SIMD kernels, JSON_SIMD_AUTO
+ * goes back to picking the best the cpu supports. Returns 1 on success and 0
+ * if the kernel is not compiled in or the cpu does not support it.
+ */
+int jsonSetSimdKernel(JSON_SIMD_KERNEL kind) {
+    const jsonSimdKernels *kernels;
+
+    if (kind == JSON_SIMD_AUTO) {
+        kernels = jsonSimdKernelsDetect();
+    } else if ((kernels = jsonSimdKernelLookup(kind)) == NULL) {
+        return 0;
+    }
+    json_kernels = kernels;
+    return 1;
+}
+
+/* The kernel currently in use */
+JSON_SIMD_KERNEL jsonGetSimdKernel(void) {
+    return jsonKernels()->kind;
+}
+
+/*=============================================================================
+ * Structural index
+ *
+ * The whole buffer is classified 64 bytes at a time into bitmaps of
+ * whitespace, structural characters, quotes and backslashes. From those the
+ * in-string regions are worked out and every structural character outside of
+ * a string, along with the first character of every string and scalar, is
+ * recorded in a flat list of offsets. jsonParseArrayParallel walks it to find
+ * where the elements of a large array start without parsing them.
+ *============================================================================*/
+#define JSON_INDEX_ODD_BITS (0xAAAAAAAAAAAAAAAAULL)
+
+struct jsonIndex {
+    /* Offsets into the buffer of every structural character and the start
+     * of every value */
+    uint32_t *indices;
+    size_t len;
+    size_t capacity;
+};
+
+/* Xor of every bit with all of the bits below it, turns a mask of quotes
+ * into a mask of everything between them */
+static uint64_t prefixXor(uint64_t bits) {
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+/* Characters preceded by an odd length run of backslashes. `carry` holds
+ * whether the first character of the block is escaped by the previous one */
+static uint64_t jsonEscapedMask(uint64_t backslash, uint64_t *carry) {
+    uint64_t escaped = *carry;
+    uint64_t potential_escape = backslash & ~escaped;
+    uint64_t maybe_escaped = potential_escape << 1;
+    uint64_t maybe_escaped_and_odd_bits = maybe_escaped | JSON_INDEX_ODD_BITS;
+    uint64_t even_series_codes_and_odd_bits = maybe_escaped_and_odd_bits -
+            potential_escape;
+    uint64_t escape_and_terminal_code = even_series_codes_and_odd_bits ^
+            JSON_INDEX_ODD_BITS;
+
+    escaped = escape_and_terminal_code ^ (backslash | escaped);
+    *carry = (escape_and_terminal_code & backslash) >> 63;
+    return escaped;
+}
+
+static void jsonIndexRelease(jsonIndex *index) {
+    if (index) {
+        jsonFree(index->indices);
+        jsonFree(index);
+    }
+}
+
+/**
+ * Build the structural index for `buf`, returns NULL if the buffer is too
+ * large to be addressed by 32 bit offsets
+ */
+static jsonIndex *jsonIndexNew(const jsonSimdKernels *kernels, const char *buf,
+                               size_t buflen) {
+    char tail[JSON_BLOCK_SIZE];
+    jsonBlockMasks masks;
+    uint64_t escape_carry = 0;
+    uint64_t in_string_carry = 0;
+    uint64_t scalar_carry = 0;
+
+    if (buflen >= UINT32_MAX) {
+        return NULL;
+    }
+
+    jsonIndex *index = (jsonIndex *)jsonMalloc(sizeof(jsonIndex));
+    index->len = 0;
+    index->capacity = (buflen / 4) + JSON_BLOCK_SIZE;
+    index->indices = (uint32_t *)jsonMalloc(sizeof(uint32_t) * index->capacity);
+
+    for (size_t offset = 0; offset < buflen;
+         offset += JSON_BLOCK_SIZE) {
+        const char *block = buf + offset;
+
+        /* Pad out the last block with whitespace */
+        if (buflen - offset < JSON_BLOCK_SIZE) {
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, block, buflen - offset);
+            block = tail;
+        }
+
+        kernels->classifyBlock(block, &masks);
+
+        uint64_t escaped = jsonEscapedMask(masks.backslash, &escape_carry);
+        uint64_t quote = masks.quote & ~escaped;
+        uint64_t in_string = prefixXor(quote) ^ in_string_carry;
+        in_string_carry = (uint64_t)((int64_t)in_string >> 63);
+
+        /* A scalar is anything that is not whitespace or structural, the
+         * start of one is a scalar that does not follow another. A
+         * quote is never considered to be continuing a scalar so the
+         * character after a closing quote is always indexed */
+        uint64_t scalar = ~(masks.whitespace | masks.structural);
+        uint64_t nonquote_scalar = scalar & ~quote;
+        uint64_t follows_scalar = (nonquote_scalar << 1) | scalar_carry;
+        scalar_carry = nonquote_scalar >> 63;
+
+        /* Everything inside a string bar the opening quote */
+        uint64_t string_tail = in_string ^ quote;
+        uint64_t bits = (masks.structural | (scalar & ~follows_scalar)) &
+                ~string_tail;
+
+        if (index->len + JSON_BLOCK_SIZE > index->capacity) {
+            index->capacity *= 2;
+            index->indices = (uint32_t *)jsonRealloc(index->indices,
+                    sizeof(uint32_t) * index->capacity);
+        }
+
+        while (bits) {
+            index->indices[index->len++] = (uint32_t)(offset +
+                    countTrailingZeros64(bits));
+            bits &= bits - 1;
+        }
+    }
+
+    return index;
+}
+
+/**
+ * Create new json object
+ */
+static json *jsonNew(jsonParser *p) {
+    json *J = (json *)jsonAlloc(p->allocator, sizeof(json));
+    J->type = JSON_NULL;
+    J->key = NULL;
+    J->next = NULL;
+    J->state = NULL;
+    J->aux = 0;
+    return J;
+}
+
+/**
+ * Needs to be null checked before calling this function
+ */
+static char jsonUnsafePeekAt(jsonParser *p, size_t idx) {
+    return p->buffer[idx];
+}
+
+/**
+ * Look at the current character
+ */
+static char jsonPeek(jsonParser *p) {
+    return p->buffer[p->offset];
+}
+
+/**
+ * Check if we can advance the buffer by 'jmp' characters
+ */
+static int jsonCanAdvanceBy(jsonParser *p, size_t jmp) {
+    return p->offset + jmp < p->buflen;
+}
+
+/**
+ * Advance the offset into the buffer by 'jmp'
+ */
+static void jsonUnsafeAdvanceBy(jsonParser *p, size_t jmp) {
+    p->offset += jmp;
 }
 
 /**
- * Advance to termintor
+ * Advance to error location and return 0
+ */
+static int jsonAdvanceToError(jsonParser *p, size_t jmp, int error_code) {
+    p->errno = error_code;
+    jsonUnsafeAdvanceBy(p, jmp);
+    return 0;
+}
+
+/**
+ * Advance buffers offset
  */
-static void jsonAdvanceToTerminator(jsonParser *p, char terminator) {
-    while (jsonCanAdvanceBy(p, 1) && jsonPeek(p) != terminator) {
+static void jsonAdvance(jsonParser *p) {
+    if (jsonCanAdvanceBy(p, 1)) {
         ++p->offset;
+        return;
     }
+    p->errno = JSON_EOF;
 }
 
 /**
@@ -681,7 +1811,8 @@ static void jsonAdvanceToTerminator(jsonParser *p, char terminator) {
  */
 static int jsonAdvanceWhitespace(jsonParser *p) {
     int ok = 0;
-    p->offset += getNextNonWhitespaceIdx(p->buffer + p->offset, p->endptr, &ok);
+    p->offset += p->kernels->nextNonWhitespace(p->buffer + p->offset,
+                                               p->endptr, &ok);
     if (!ok) {
         p->errno = JSON_UNTERMINATED;
     }
@@ -689,9 +1820,11 @@ static int jsonAdvanceWhitespace(jsonParser *p) {
 }
 
 /**
- * Json parser ready to rock and roll
+ * Json parser ready to rock and roll, allocating from `allocator` or a new
+ * one if that is NULL
  */
-static void jsonParserInit(jsonParser *p, char *buffer, size_t buflen) {
+static void jsonParserInit(jsonParser *p, char *buffer, size_t buflen,
+                           jsonAllocator *allocator) {
     p->offset = 0;
     p->buffer = buffer;
     p->buflen = buflen;
@@ -700,12 +1833,14 @@ static void jsonParserInit(jsonParser *p, char *buffer, size_t buflen) {
     p->ptr = NULL;
     p->errno = JSON_OK;
     p->endptr = p->buffer + p->buflen;
-    p->allocator = jsonAllocatorNew(JSON_ALLOCATOR_INITIAL_SIZE);
+    p->allocator = allocator ? allocator : jsonAllocatorAcquire(NULL);
+    p->state = jsonStateNew(p);
+    p->kernels = jsonKernels();
+    p->depth = 0;
 }
 
 /* All prototypes for parsing */
-static json *jsonParseObject(jsonParser *p);
-static json *jsonParseArray(jsonParser *p);
+static int jsonParseContainer(jsonParser *p);
 static int jsonParseBool(jsonParser *p);
 static int jsonParseValue(jsonParser *p);
 static int jsonParseNull(jsonParser *p);
@@ -714,85 +1849,151 @@ static void jsonParseNumber(jsonParser *p);
 
 /* Number parsing */
 
-/* Takes a string pointer and a pointer to an integer as input, and returns the
- * number of decimal numeric characters in the string, and the position of the
- * decimal point if present.
+/* Largest mantissa another digit can be added to without losing any */
+#define JSON_MANTISSA_DIGIT_LIMIT (1000000000000000000ULL)
+/* Largest mantissa 8 more digits can be added to */
+#define JSON_MANTISSA_SWAR_LIMIT (100000000000ULL)
+
+/**
+ * Everything about a number gathered in one pass over it. Up to 19
+ * significant digits are kept in `mantissa`, the value is
+ * mantissa * 10^exponent unless `truncated` says nonzero digits were dropped.
  */
-static int countMantissa(char *ptr, int *decidx) {
-    int mantissa = 0;
-    *decidx = -1;
+typedef struct jsonNumber {
+    const char *start;
+    size_t len;
+    uint64_t mantissa;
+    int64_t exponent;
+    int neg;
+    /* Had a '.' */
+    int is_float;
+    /* Had a 0x prefix, digits are left for stringToHex */
+    int is_hex;
+    int truncated;
+} jsonNumber;
 
-    for (;; ++mantissa) {
-        char ch = *ptr;
-        /* If the character is not a decimal numeric character, or if
-         * the decimal point has already been found exit the loop
-         */
-        if (!isNum(ch)) {
-            if ((ch != '.') || *decidx >= 0) {
-                break;
-            }
-            *decidx = mantissa;
+/**
+ * Gather a run of digits into the mantissa, 16 or 8 at a time while there are
+ * enough of them. `scale` is added to the exponent for each digit kept and
+ * `dropped` for each one that would not fit.
+ */
+static const char *jsonLexDigits(const jsonSimdKernels *kernels,
+                                 const char *ptr, const char *end,
+                                 jsonNumber *num, int scale, int dropped) {
+    uint64_t v;
+
+    /* Only validating, the value is built later */
+    if (kernels == NULL) {
+        while (ptr < end && isNum(*ptr)) {
+            ptr++;
         }
-        ptr++;
+        return ptr;
     }
-    return mantissa;
-}
 
-/* Get index where the number hits a terminal character &
- * a basic check for the validity of a number */
-static int countNumberLen(jsonParser *p, char *ptr) {
-    char *start = ptr;
-    int seen_e = 0;
-    int seen_dec = 0;
-    int seen_X = 0;
+    if (num->mantissa == 0 && end - ptr >= 16 &&
+        kernels->parseDigits16(ptr, &v)) {
+        num->mantissa = v;
+        num->exponent += 16 * scale;
+        ptr += 16;
+    }
 
-    while (!isNumTerminator(*ptr)) {
-        switch (*ptr) {
-        case 'e':
-        case 'E':
-            if (seen_e) {
-                return jsonAdvanceToError(p, ptr - start, JSON_INVALID_NUMBER);
-            }
-            seen_e = 1;
-            break;
-        case 'x':
-        case 'X':
-            if (seen_X) {
-                return jsonAdvanceToError(p, ptr - start, JSON_INVALID_NUMBER);
-            }
-            seen_X = 1;
-            break;
-        case '-':
-        case '+':
-            break;
+    while (num->mantissa < JSON_MANTISSA_SWAR_LIMIT && end - ptr >= 8 &&
+           jsonIsEightDigits(jsonLoad64(ptr))) {
+        num->mantissa = num->mantissa * 100000000ULL +
+                jsonParseEightDigits(jsonLoad64(ptr));
+        num->exponent += 8 * scale;
+        ptr += 8;
+    }
 
-        case '.':
-            if (seen_dec) {
-                return jsonAdvanceToError(p, ptr - start, JSON_INVALID_NUMBER);
-            }
-            seen_dec = 1;
-            break;
-        /* Anything else is invalid */
-        default:
-            if (!isHex(*ptr)) {
-                return jsonAdvanceToError(p, ptr - start, JSON_INVALID_NUMBER);
-            }
-            break;
+    for (; ptr < end && isNum(*ptr); ++ptr) {
+        if (num->mantissa < JSON_MANTISSA_DIGIT_LIMIT) {
+            num->mantissa = num->mantissa * 10 + toInt(*ptr);
+            num->exponent += scale;
+        } else {
+            num->truncated |= *ptr != '0';
+            num->exponent += dropped;
         }
+    }
+    return ptr;
+}
+
+/**
+ * Lex a number in a single pass, collecting its sign, digits and exponent.
+ * Allows a leading '+', and a '.' with digits on only one side of it.
+ * Returns JSON_OK, or JSON_INVALID_NUMBER with `num->len` at the offending
+ * character. Without `kernels` the number is only checked and measured.
+ */
+static JSON_ERRNO jsonLexNumber(const jsonSimdKernels *kernels,
+                                const char *ptr, const char *end,
+                                jsonNumber *num) {
+    const char *digits;
+    int exponent = 0, exponent_sign = 0, seen_digit = 0;
+
+    num->start = ptr;
+    num->mantissa = 0;
+    num->exponent = 0;
+    num->neg = 0;
+    num->is_float = 0;
+    num->is_hex = 0;
+    num->truncated = 0;
+
+    if (ptr < end && (*ptr == '-' || *ptr == '+')) {
+        num->neg = *ptr == '-';
         ptr++;
     }
 
-    /* Floating point hex does not exist */
-    if (seen_dec && seen_X) {
-        return jsonAdvanceToError(p, ptr - start, JSON_INVALID_NUMBER);
+    if (ptr < end && *ptr == '0') {
+        if (end - ptr > 1 && toUpper(ptr[1]) == 'X') {
+            num->is_hex = 1;
+            num->len = ptr + 2 - num->start;
+            return JSON_OK;
+        }
+        /* No leading zeros */
+        if (end - ptr > 1 && isNum(ptr[1])) {
+            num->len = ptr + 1 - num->start;
+            return JSON_INVALID_NUMBER;
+        }
+    }
+
+    digits = ptr;
+    ptr = jsonLexDigits(kernels, ptr, end, num, 0, 1);
+    seen_digit = ptr != digits;
+
+    if (ptr < end && *ptr == '.') {
+        num->is_float = 1;
+        digits = ++ptr;
+        ptr = jsonLexDigits(kernels, ptr, end, num, -1, 0);
+        seen_digit |= ptr != digits;
     }
 
-    /* Exponent hex does not exist */
-    if (seen_X && seen_e) {
-        return jsonAdvanceToError(p, ptr - start, JSON_INVALID_NUMBER);
+    if (!seen_digit) {
+        num->len = ptr - num->start;
+        return JSON_INVALID_NUMBER;
     }
 
-    return ptr - start;
+    if (ptr < end && toUpper(*ptr) == 'E') {
+        ptr++;
+        if (ptr < end && (*ptr == '-' || *ptr == '+')) {
+            exponent_sign = *ptr == '-';
+            ptr++;
+        }
+        if (ptr >= end || !isNum(*ptr)) {
+            num->len = ptr - num->start;
+            return JSON_INVALID_NUMBER;
+        }
+        for (; ptr < end && isNum(*ptr); ++ptr) {
+            if (exponent < INT_MAX / 100) {
+                exponent = exponent * 10 + toInt(*ptr);
+            }
+        }
+        num->exponent += exponent_sign ? -exponent : exponent;
+    }
+
+    num->len = ptr - num->start;
+    if (ptr < end && !isNumTerminator(*ptr)) {
+        return JSON_INVALID_NUMBER;
+    }
+    return JSON_OK;
 }
 
 static long stringToHex(jsonParser *p) {
@@ -814,210 +2015,986 @@ static long stringToHex(jsonParser *p) {
     return retval;
 }
 
-static ssize_t stringToI64(jsonParser *p, int neg) {
-    ssize_t retval = 0;
-    char cur;
-    int exponent = 0;
-    int exponent_sign = 0;
+/* Powers of 10 that fit in a uint64_t */
+static const uint64_t u64_powers_of_10[] = {
+        1ULL,
+        10ULL,
+        100ULL,
+        1000ULL,
+        10000ULL,
+        100000ULL,
+        1000000ULL,
+        10000000ULL,
+        100000000ULL,
+        1000000000ULL,
+        10000000000ULL,
+        100000000000ULL,
+        1000000000000ULL,
+        10000000000000ULL,
+        100000000000000ULL,
+        1000000000000000ULL,
+        10000000000000000ULL,
+        100000000000000000ULL,
+        1000000000000000000ULL,
+        10000000000000000000ULL,
+};
 
-    if (jsonPeek(p) == '0') {
-        jsonUnsafeAdvanceBy(p, 1);
-        if (toUpper(jsonPeek(p)) == 'X') {
-            jsonUnsafeAdvanceBy(p, 1);
-            return stringToHex(p);
-        } else {
-            return jsonAdvanceToError(p, 0, JSON_INVALID_NUMBER);
-        }
-    }
-
-    while (1) {
-        cur = jsonPeek(p);
-        switch (cur) {
-        case 'e':
-        case 'E':
-            goto parse_exponent;
+#define JSON_U64_MAX_POW10 (19)
 
-        case ',':
-        case '\n':
-        case ']':
-        case '\0':
-            goto out;
+/**
+ * Build an int64 from a lexed number without a '.', a positive exponent is
+ * applied with integer arithmetic. Returns 0 if it does not fit, or has a
+ * negative exponent, so it can be made a float instead of wrapping or
+ * truncating.
+ */
+static int jsonNumberToInt(const jsonNumber *num, ssize_t *out) {
+    uint64_t acc = num->mantissa;
+    uint64_t limit = num->neg ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
 
-        default:
-            retval = retval * 10 + toInt(cur);
-            break;
-        }
-        jsonUnsafeAdvanceBy(p, 1);
+    if (num->truncated) {
+        return 0;
     }
 
-parse_exponent:
-    if (toUpper(jsonPeek(p)) == 'E') {
-        jsonUnsafeAdvanceBy(p, 1);
-        if (jsonPeek(p) == '-') {
-            exponent_sign = 1;
-            jsonUnsafeAdvanceBy(p, 1);
-        } else if (jsonPeek(p) == '+') {
-            jsonUnsafeAdvanceBy(p, 1);
-        }
-        while (isNum(jsonPeek(p)) && exponent < INT_MAX / 100) {
-            exponent = exponent * 10 + toInt(jsonPeek(p));
-            jsonUnsafeAdvanceBy(p, 1);
-        }
-        while (isNum(jsonPeek(p))) {
-            jsonUnsafeAdvanceBy(p, 1);
+    /* 1e-1 is 0.1 not 0 */
+    if (num->exponent < 0) {
+        return 0;
+    } else if (num->exponent > 0 && acc != 0) {
+        if (num->exponent > JSON_U64_MAX_POW10 ||
+            acc > UINT64_MAX / u64_powers_of_10[num->exponent]) {
+            return 0;
         }
+        acc *= u64_powers_of_10[num->exponent];
     }
 
-    if (exponent && exponent_sign) {
-        retval /= I64Pow10(exponent);
-    } else if (exponent) {
-        retval *= I64Pow10(exponent);
+    if (acc > limit) {
+        return 0;
     }
 
-out:
-    if (neg) {
-        return -retval;
+    /* Written so that -2^63 does not overflow on the way */
+    *out = num->neg && acc ? -(ssize_t)(acc - 1) - 1 : (ssize_t)acc;
+    return 1;
+}
+
+/* The smallest and largest powers of 10 with a double that is not 0 or inf */
+#define JSON_POW5_MIN_EXPONENT (-342)
+#define JSON_POW5_MAX_EXPONENT (308)
+/* Widest integer a double holds exactly and the largest exact power of 10 */
+#define JSON_MAX_EXACT_DOUBLE_INT (1ULL << 53)
+#define JSON_MAX_EXACT_POW10      (22)
+
+/**
+ * 5^q for q in [-342, 308] as 128 bit mantissas, normalised so the top bit is
+ * set. Negative powers are rounded up, positive powers truncated.
+ */
+static const uint64_t powers_of_5_128[][2] = {
+        {0xEEF453D6923BD65AULL, 0x113FAA2906A13B3FULL},
+        {0x9558B4661B6565F8ULL, 0x4AC7CA59A424C507ULL},
+        {0xBAAEE17FA23EBF76ULL, 0x5D79BCF00D2DF649ULL},
+        {0xE95A99DF8ACE6F53ULL, 0xF4D82C2C107973DCULL},
+        {0x91D8A02BB6C10594ULL, 0x79071B9B8A4BE869ULL},
+        {0xB64EC836A47146F9ULL, 0x9748E2826CDEE284ULL},
+        {0xE3E27A444D8D98B7ULL, 0xFD1B1B2308169B25ULL},
+        {0x8E6D8C6AB0787F72ULL, 0xFE30F0F5E50E20F7ULL},
+        {0xB208EF855C969F4FULL, 0xBDBD2D335E51A935ULL},
+        {0xDE8B2B66B3BC4723ULL, 0xAD2C788035E61382ULL},
+        {0x8B16FB203055AC76ULL, 0x4C3BCB5021AFCC31ULL},
+        {0xADDCB9E83C6B1793ULL, 0xDF4ABE242A1BBF3DULL},
+        {0xD953E8624B85DD78ULL, 0xD71D6DAD34A2AF0DULL},
+        {0x87D4713D6F33AA6BULL, 0x8672648C40E5AD68ULL},
+        {0xA9C98D8CCB009506ULL, 0x680EFDAF511F18C2ULL},
+        {0xD43BF0EFFDC0BA48ULL, 0x0212BD1B2566DEF2ULL},
+        {0x84A57695FE98746DULL, 0x014BB630F7604B57ULL},
+        {0xA5CED43B7E3E9188ULL, 0x419EA3BD35385E2DULL},
+        {0xCF42894A5DCE35EAULL, 0x52064CAC828675B9ULL},
+        {0x818995CE7AA0E1B2ULL, 0x7343EFEBD1940993ULL},
+        {0xA1EBFB4219491A1FULL, 0x1014EBE6C5F90BF8ULL},
+        {0xCA66FA129F9B60A6ULL, 0xD41A26E077774EF6ULL},
+        {0xFD00B897478238D0ULL, 0x8920B098955522B4ULL},
+        {0x9E20735E8CB16382ULL, 0x55B46E5F5D5535B0ULL},
+        {0xC5A890362FDDBC62ULL, 0xEB2189F734AA831DULL},
+        {0xF712B443BBD52B7BULL, 0xA5E9EC7501D523E4ULL},
+        {0x9A6BB0AA55653B2DULL, 0x47B233C92125366EULL},
+        {0xC1069CD4EABE89F8ULL, 0x999EC0BB696E840AULL},
+        {0xF148440A256E2C76ULL, 0xC00670EA43CA250DULL},
+        {0x96CD2A865764DBCAULL, 0x380406926A5E5728ULL},
+        {0xBC807527ED3E12BCULL, 0xC605083704F5ECF2ULL},
+        {0xEBA09271E88D976BULL, 0xF7864A44C633682EULL},
+        {0x93445B8731587EA3ULL, 0x7AB3EE6AFBE0211DULL},
+        {0xB8157268FDAE9E4CULL, 0x5960EA05BAD82964ULL},
+        {0xE61ACF033D1A45DFULL, 0x6FB92487298E33BDULL},
+        {0x8FD0C16206306BABULL, 0xA5D3B6D479F8E056ULL},
+        {0xB3C4F1BA87BC8696ULL, 0x8F48A4899877186CULL},
+        {0xE0B62E2929ABA83CULL, 0x331ACDABFE94DE87ULL},
+        {0x8C71DCD9BA0B4925ULL, 0x9FF0C08B7F1D0B14ULL},
+        {0xAF8E5410288E1B6FULL, 0x07ECF0AE5EE44DD9ULL},
+        {0xDB71E91432B1A24AULL, 0xC9E82CD9F69D6150ULL},
+        {0x892731AC9FAF056EULL, 0xBE311C083A225CD2ULL},
+        {0xAB70FE17C79AC6CAULL, 0x6DBD630A48AAF406ULL},
+        {0xD64D3D9DB981787DULL, 0x092CBBCCDAD5B108ULL},
+        {0x85F0468293F0EB4EULL, 0x25BBF56008C58EA5ULL},
+        {0xA76C582338ED2621ULL, 0xAF2AF2B80AF6F24EULL},
+        {0xD1476E2C07286FAAULL, 0x1AF5AF660DB4AEE1ULL},
+        {0x82CCA4DB847945CAULL, 0x50D98D9FC890ED4DULL},
+        {0xA37FCE126597973CULL, 0xE50FF107BAB528A0ULL},
+        {0xCC5FC196FEFD7D0CULL, 0x1E53ED49A96272C8ULL},
+        {0xFF77B1FCBEBCDC4FULL, 0x25E8E89C13BB0F7AULL},
+        {0x9FAACF3DF73609B1ULL, 0x77B191618C54E9ACULL},
+        {0xC795830D75038C1DULL, 0xD59DF5B9EF6A2417ULL},
+        {0xF97AE3D0D2446F25ULL, 0x4B0573286B44AD1DULL},
+        {0x9BECCE62836AC577ULL, 0x4EE367F9430AEC32ULL},
+        {0xC2E801FB244576D5ULL, 0x229C41F793CDA73FULL},
+        {0xF3A20279ED56D48AULL, 0x6B43527578C1110FULL},
+        {0x9845418C345644D6ULL, 0x830A13896B78AAA9ULL},
+        {0xBE5691EF416BD60CULL, 0x23CC986BC656D553ULL},
+        {0xEDEC366B11C6CB8FULL, 0x2CBFBE86B7EC8AA8ULL},
+        {0x94B3A202EB1C3F39ULL, 0x7BF7D71432F3D6A9ULL},
+        {0xB9E08A83A5E34F07ULL, 0xDAF5CCD93FB0CC53ULL},
+        {0xE858AD248F5C22C9ULL, 0xD1B3400F8F9CFF68ULL},
+        {0x91376C36D99995BEULL, 0x23100809B9C21FA1ULL},
+        {0xB58547448FFFFB2DULL, 0xABD40A0C2832A78AULL},
+        {0xE2E69915B3FFF9F9ULL, 0x16C90C8F323F516CULL},
+        {0x8DD01FAD907FFC3BULL, 0xAE3DA7D97F6792E3ULL},
+        {0xB1442798F49FFB4AULL, 0x99CD11CFDF41779CULL},
+        {0xDD95317F31C7FA1DULL, 0x40405643D711D583ULL},
+        {0x8A7D3EEF7F1CFC52ULL, 0x482835EA666B2572ULL},
+        {0xAD1C8EAB5EE43B66ULL, 0xDA3243650005EECFULL},
+        {0xD863B256369D4A40ULL, 0x90BED43E40076A82ULL},
+        {0x873E4F75E2224E68ULL, 0x5A7744A6E804A291ULL},
+        {0xA90DE3535AAAE202ULL, 0x711515D0A205CB36ULL},
+        {0xD3515C2831559A83ULL, 0x0D5A5B44CA873E03ULL},
+        {0x8412D9991ED58091ULL, 0xE858790AFE9486C2ULL},
+        {0xA5178FFF668AE0B6ULL, 0x626E974DBE39A872ULL},
+        {0xCE5D73FF402D98E3ULL, 0xFB0A3D212DC8128FULL},
+        {0x80FA687F881C7F8EULL, 0x7CE66634BC9D0B99ULL},
+        {0xA139029F6A239F72ULL, 0x1C1FFFC1EBC44E80ULL},
+        {0xC987434744AC874EULL, 0xA327FFB266B56220ULL},
+        {0xFBE9141915D7A922ULL, 0x4BF1FF9F0062BAA8ULL},
+        {0x9D71AC8FADA6C9B5ULL, 0x6F773FC3603DB4A9ULL},
+        {0xC4CE17B399107C22ULL, 0xCB550FB4384D21D3ULL},
+        {0xF6019DA07F549B2BULL, 0x7E2A53A146606A48ULL},
+        {0x99C102844F94E0FBULL, 0x2EDA7444CBFC426DULL},
+        {0xC0314325637A1939ULL, 0xFA911155FEFB5308ULL},
+        {0xF03D93EEBC589F88ULL, 0x793555AB7EBA27CAULL},
+        {0x96267C7535B763B5ULL, 0x4BC1558B2F3458DEULL},
+        {0xBBB01B9283253CA2ULL, 0x9EB1AAEDFB016F16ULL},
+        {0xEA9C227723EE8BCBULL, 0x465E15A979C1CADCULL},
+        {0x92A1958A7675175FULL, 0x0BFACD89EC191EC9ULL},
+        {0xB749FAED14125D36ULL, 0xCEF980EC671F667BULL},
+        {0xE51C79A85916F484ULL, 0x82B7E12780E7401AULL},
+        {0x8F31CC0937AE58D2ULL, 0xD1B2ECB8B0908810ULL},
+        {0xB2FE3F0B8599EF07ULL, 0x861FA7E6DCB4AA15ULL},
+        {0xDFBDCECE67006AC9ULL, 0x67A791E093E1D49AULL},
+        {0x8BD6A141006042BDULL, 0xE0C8BB2C5C6D24E0ULL},
+        {0xAECC49914078536DULL, 0x58FAE9F773886E18ULL},
+        {0xDA7F5BF590966848ULL, 0xAF39A475506A899EULL},
+        {0x888F99797A5E012DULL, 0x6D8406C952429603ULL},
+        {0xAAB37FD7D8F58178ULL, 0xC8E5087BA6D33B83ULL},
+        {0xD5605FCDCF32E1D6ULL, 0xFB1E4A9A90880A64ULL},
+        {0x855C3BE0A17FCD26ULL, 0x5CF2EEA09A55067FULL},
+        {0xA6B34AD8C9DFC06FULL, 0xF42FAA48C0EA481EULL},
+        {0xD0601D8EFC57B08BULL, 0xF13B94DAF124DA26ULL},
+        {0x823C12795DB6CE57ULL, 0x76C53D08D6B70858ULL},
+        {0xA2CB1717B52481EDULL, 0x54768C4B0C64CA6EULL},
+        {0xCB7DDCDDA26DA268ULL, 0xA9942F5DCF7DFD09ULL},
+        {0xFE5D54150B090B02ULL, 0xD3F93B35435D7C4CULL},
+        {0x9EFA548D26E5A6E1ULL, 0xC47BC5014A1A6DAFULL},
+        {0xC6B8E9B0709F109AULL, 0x359AB6419CA1091BULL},
+        {0xF867241C8CC6D4C0ULL, 0xC30163D203C94B62ULL},
+        {0x9B407691D7FC44F8ULL, 0x79E0DE63425DCF1DULL},
+        {0xC21094364DFB5636ULL, 0x985915FC12F542E4ULL},
+        {0xF294B943E17A2BC4ULL, 0x3E6F5B7B17B2939DULL},
+        {0x979CF3CA6CEC5B5AULL, 0xA705992CEECF9C42ULL},
+        {0xBD8430BD08277231ULL, 0x50C6FF782A838353ULL},
+        {0xECE53CEC4A314EBDULL, 0xA4F8BF5635246428ULL},
+        {0x940F4613AE5ED136ULL, 0x871B7795E136BE99ULL},
+        {0xB913179899F68584ULL, 0x28E2557B59846E3FULL},
+        {0xE757DD7EC07426E5ULL, 0x331AEADA2FE589CFULL},
+        {0x9096EA6F3848984FULL, 0x3FF0D2C85DEF7621ULL},
+        {0xB4BCA50B065ABE63ULL, 0x0FED077A756B53A9ULL},
+        {0xE1EBCE4DC7F16DFBULL, 0xD3E8495912C62894ULL},
+        {0x8D3360F09CF6E4BDULL, 0x64712DD7ABBBD95CULL},
+        {0xB080392CC4349DECULL, 0xBD8D794D96AACFB3ULL},
+        {0xDCA04777F541C567ULL, 0xECF0D7A0FC5583A0ULL},
+        {0x89E42CAAF9491B60ULL, 0xF41686C49DB57244ULL},
+        {0xAC5D37D5B79B6239ULL, 0x311C2875C522CED5ULL},
+        {0xD77485CB25823AC7ULL, 0x7D633293366B828BULL},
+        {0x86A8D39EF77164BCULL, 0xAE5DFF9C02033197ULL},
+        {0xA8530886B54DBDEBULL, 0xD9F57F830283FDFCULL},
+        {0xD267CAA862A12D66ULL, 0xD072DF63C324FD7BULL},
+        {0x8380DEA93DA4BC60ULL, 0x4247CB9E59F71E6DULL},
+        {0xA46116538D0DEB78ULL, 0x52D9BE85F074E608ULL},
+        {0xCD795BE870516656ULL, 0x67902E276C921F8BULL},
+        {0x806BD9714632DFF6ULL, 0x00BA1CD8A3DB53B6ULL},
+        {0xA086CFCD97BF97F3ULL, 0x80E8A40ECCD228A4ULL},
+        {0xC8A883C0FDAF7DF0ULL, 0x6122CD128006B2CDULL},
+        {0xFAD2A4B13D1B5D6CULL, 0x796B805720085F81ULL},
+        {0x9CC3A6EEC6311A63ULL, 0xCBE3303674053BB0ULL},
+        {0xC3F490AA77BD60FCULL, 0xBEDBFC4411068A9CULL},
+        {0xF4F1B4D515ACB93BULL, 0xEE92FB5515482D44ULL},
+        {0x991711052D8BF3C5ULL, 0x751BDD152D4D1C4AULL},
+        {0xBF5CD54678EEF0B6ULL, 0xD262D45A78A0635DULL},
+        {0xEF340A98172AACE4ULL, 0x86FB897116C87C34ULL},
+        {0x9580869F0E7AAC0EULL, 0xD45D35E6AE3D4DA0ULL},
+        {0xBAE0A846D2195712ULL, 0x8974836059CCA109ULL},
+        {0xE998D258869FACD7ULL, 0x2BD1A438703FC94BULL},
+        {0x91FF83775423CC06ULL, 0x7B6306A34627DDCFULL},
+        {0xB67F6455292CBF08ULL, 0x1A3BC84C17B1D542ULL},
+        {0xE41F3D6A7377EECAULL, 0x20CABA5F1D9E4A93ULL},
+        {0x8E938662882AF53EULL, 0x547EB47B7282EE9CULL},
+        {0xB23867FB2A35B28DULL, 0xE99E619A4F23AA43ULL},
+        {0xDEC681F9F4C31F31ULL, 0x6405FA00E2EC94D4ULL},
+        {0x8B3C113C38F9F37EULL, 0xDE83BC408DD3DD04ULL},
+        {0xAE0B158B4738705EULL, 0x9624AB50B148D445ULL},
+        {0xD98DDAEE19068C76ULL, 0x3BADD624DD9B0957ULL},
+        {0x87F8A8D4CFA417C9ULL, 0xE54CA5D70A80E5D6ULL},
+        {0xA9F6D30A038D1DBCULL, 0x5E9FCF4CCD211F4CULL},
+        {0xD47487CC8470652BULL, 0x7647C3200069671FULL},
+        {0x84C8D4DFD2C63F3BULL, 0x29ECD9F40041E073ULL},
+        {0xA5FB0A17C777CF09ULL, 0xF468107100525890ULL},
+        {0xCF79CC9DB955C2CCULL, 0x7182148D4066EEB4ULL},
+        {0x81AC1FE293D599BFULL, 0xC6F14CD848405530ULL},
+        {0xA21727DB38CB002FULL, 0xB8ADA00E5A506A7CULL},
+        {0xCA9CF1D206FDC03BULL, 0xA6D90811F0E4851CULL},
+        {0xFD442E4688BD304AULL, 0x908F4A166D1DA663ULL},
+        {0x9E4A9CEC15763E2EULL, 0x9A598E4E043287FEULL},
+        {0xC5DD44271AD3CDBAULL, 0x40EFF1E1853F29FDULL},
+        {0xF7549530E188C128ULL, 0xD12BEE59E68EF47CULL},
+        {0x9A94DD3E8CF578B9ULL, 0x82BB74F8301958CEULL},
+        {0xC13A148E3032D6E7ULL, 0xE36A52363C1FAF01ULL},
+        {0xF18899B1BC3F8CA1ULL, 0xDC44E6C3CB279AC1ULL},
+        {0x96F5600F15A7B7E5ULL, 0x29AB103A5EF8C0B9ULL},
+        {0xBCB2B812DB11A5DEULL, 0x7415D448F6B6F0E7ULL},
+        {0xEBDF661791D60F56ULL, 0x111B495B3464AD21ULL},
+        {0x936B9FCEBB25C995ULL, 0xCAB10DD900BEEC34ULL},
+        {0xB84687C269EF3BFBULL, 0x3D5D514F40EEA742ULL},
+        {0xE65829B3046B0AFAULL, 0x0CB4A5A3112A5112ULL},
+        {0x8FF71A0FE2C2E6DCULL, 0x47F0E785EABA72ABULL},
+        {0xB3F4E093DB73A093ULL, 0x59ED216765690F56ULL},
+        {0xE0F218B8D25088B8ULL, 0x306869C13EC3532CULL},
+        {0x8C974F7383725573ULL, 0x1E414218C73A13FBULL},
+        {0xAFBD2350644EEACFULL, 0xE5D1929EF90898FAULL},
+        {0xDBAC6C247D62A583ULL, 0xDF45F746B74ABF39ULL},
+        {0x894BC396CE5DA772ULL, 0x6B8BBA8C328EB783ULL},
+        {0xAB9EB47C81F5114FULL, 0x066EA92F3F326564ULL},
+        {0xD686619BA27255A2ULL, 0xC80A537B0EFEFEBDULL},
+        {0x8613FD0145877585ULL, 0xBD06742CE95F5F36ULL},
+        {0xA798FC4196E952E7ULL, 0x2C48113823B73704ULL},
+        {0xD17F3B51FCA3A7A0ULL, 0xF75A15862CA504C5ULL},
+        {0x82EF85133DE648C4ULL, 0x9A984D73DBE722FBULL},
+        {0xA3AB66580D5FDAF5ULL, 0xC13E60D0D2E0EBBAULL},
+        {0xCC963FEE10B7D1B3ULL, 0x318DF905079926A8ULL},
+        {0xFFBBCFE994E5C61FULL, 0xFDF17746497F7052ULL},
+        {0x9FD561F1FD0F9BD3ULL, 0xFEB6EA8BEDEFA633ULL},
+        {0xC7CABA6E7C5382C8ULL, 0xFE64A52EE96B8FC0ULL},
+        {0xF9BD690A1B68637BULL, 0x3DFDCE7AA3C673B0ULL},
+        {0x9C1661A651213E2DULL, 0x06BEA10CA65C084EULL},
+        {0xC31BFA0FE5698DB8ULL, 0x486E494FCFF30A62ULL},
+        {0xF3E2F893DEC3F126ULL, 0x5A89DBA3C3EFCCFAULL},
+        {0x986DDB5C6B3A76B7ULL, 0xF89629465A75E01CULL},
+        {0xBE89523386091465ULL, 0xF6BBB397F1135823ULL},
+        {0xEE2BA6C0678B597FULL, 0x746AA07DED582E2CULL},
+        {0x94DB483840B717EFULL, 0xA8C2A44EB4571CDCULL},
+        {0xBA121A4650E4DDEBULL, 0x92F34D62616CE413ULL},
+        {0xE896A0D7E51E1566ULL, 0x77B020BAF9C81D17ULL},
+        {0x915E2486EF32CD60ULL, 0x0ACE1474DC1D122EULL},
+        {0xB5B5ADA8AAFF80B8ULL, 0x0D819992132456BAULL},
+        {0xE3231912D5BF60E6ULL, 0x10E1FFF697ED6C69ULL},
+        {0x8DF5EFABC5979C8FULL, 0xCA8D3FFA1EF463C1ULL},
+        {0xB1736B96B6FD83B3ULL, 0xBD308FF8A6B17CB2ULL},
+        {0xDDD0467C64BCE4A0ULL, 0xAC7CB3F6D05DDBDEULL},
+        {0x8AA22C0DBEF60EE4ULL, 0x6BCDF07A423AA96BULL},
+        {0xAD4AB7112EB3929DULL, 0x86C16C98D2C953C6ULL},
+        {0xD89D64D57A607744ULL, 0xE871C7BF077BA8B7ULL},
+        {0x87625F056C7C4A8BULL, 0x11471CD764AD4972ULL},
+        {0xA93AF6C6C79B5D2DULL, 0xD598E40D3DD89BCFULL},
+        {0xD389B47879823479ULL, 0x4AFF1D108D4EC2C3ULL},
+        {0x843610CB4BF160CBULL, 0xCEDF722A585139BAULL},
+        {0xA54394FE1EEDB8FEULL, 0xC2974EB4EE658828ULL},
+        {0xCE947A3DA6A9273EULL, 0x733D226229FEEA32ULL},
+        {0x811CCC668829B887ULL, 0x0806357D5A3F525FULL},
+        {0xA163FF802A3426A8ULL, 0xCA07C2DCB0CF26F7ULL},
+        {0xC9BCFF6034C13052ULL, 0xFC89B393DD02F0B5ULL},
+        {0xFC2C3F3841F17C67ULL, 0xBBAC2078D443ACE2ULL},
+        {0x9D9BA7832936EDC0ULL, 0xD54B944B84AA4C0DULL},
+        {0xC5029163F384A931ULL, 0x0A9E795E65D4DF11ULL},
+        {0xF64335BCF065D37DULL, 0x4D4617B5FF4A16D5ULL},
+        {0x99EA0196163FA42EULL, 0x504BCED1BF8E4E45ULL},
+        {0xC06481FB9BCF8D39ULL, 0xE45EC2862F71E1D6ULL},
+        {0xF07DA27A82C37088ULL, 0x5D767327BB4E5A4CULL},
+        {0x964E858C91BA2655ULL, 0x3A6A07F8D510F86FULL},
+        {0xBBE226EFB628AFEAULL, 0x890489F70A55368BULL},
+        {0xEADAB0ABA3B2DBE5ULL, 0x2B45AC74CCEA842EULL},
+        {0x92C8AE6B464FC96FULL, 0x3B0B8BC90012929DULL},
+        {0xB77ADA0617E3BBCBULL, 0x09CE6EBB40173744ULL},
+        {0xE55990879DDCAABDULL, 0xCC420A6A101D0515ULL},
+        {0x8F57FA54C2A9EAB6ULL, 0x9FA946824A12232DULL},
+        {0xB32DF8E9F3546564ULL, 0x47939822DC96ABF9ULL},
+        {0xDFF9772470297EBDULL, 0x59787E2B93BC56F7ULL},
+        {0x8BFBEA76C619EF36ULL, 0x57EB4EDB3C55B65AULL},
+        {0xAEFAE51477A06B03ULL, 0xEDE622920B6B23F1ULL},
+        {0xDAB99E59958885C4ULL, 0xE95FAB368E45ECEDULL},
+        {0x88B402F7FD75539BULL, 0x11DBCB0218EBB414ULL},
+        {0xAAE103B5FCD2A881ULL, 0xD652BDC29F26A119ULL},
+        {0xD59944A37C0752A2ULL, 0x4BE76D3346F0495FULL},
+        {0x857FCAE62D8493A5ULL, 0x6F70A4400C562DDBULL},
+        {0xA6DFBD9FB8E5B88EULL, 0xCB4CCD500F6BB952ULL},
+        {0xD097AD07A71F26B2ULL, 0x7E2000A41346A7A7ULL},
+        {0x825ECC24C873782FULL, 0x8ED400668C0C28C8ULL},
+        {0xA2F67F2DFA90563BULL, 0x728900802F0F32FAULL},
+        {0xCBB41EF979346BCAULL, 0x4F2B40A03AD2FFB9ULL},
+        {0xFEA126B7D78186BCULL, 0xE2F610C84987BFA8ULL},
+        {0x9F24B832E6B0F436ULL, 0x0DD9CA7D2DF4D7C9ULL},
+        {0xC6EDE63FA05D3143ULL, 0x91503D1C79720DBBULL},
+        {0xF8A95FCF88747D94ULL, 0x75A44C6397CE912AULL},
+        {0x9B69DBE1B548CE7CULL, 0xC986AFBE3EE11ABAULL},
+        {0xC24452DA229B021BULL, 0xFBE85BADCE996168ULL},
+        {0xF2D56790AB41C2A2ULL, 0xFAE27299423FB9C3ULL},
+        {0x97C560BA6B0919A5ULL, 0xDCCD879FC967D41AULL},
+        {0xBDB6B8E905CB600FULL, 0x5400E987BBC1C920ULL},
+        {0xED246723473E3813ULL, 0x290123E9AAB23B68ULL},
+        {0x9436C0760C86E30BULL, 0xF9A0B6720AAF6521ULL},
+        {0xB94470938FA89BCEULL, 0xF808E40E8D5B3E69ULL},
+        {0xE7958CB87392C2C2ULL, 0xB60B1D1230B20E04ULL},
+        {0x90BD77F3483BB9B9ULL, 0xB1C6F22B5E6F48C2ULL},
+        {0xB4ECD5F01A4AA828ULL, 0x1E38AEB6360B1AF3ULL},
+        {0xE2280B6C20DD5232ULL, 0x25C6DA63C38DE1B0ULL},
+        {0x8D590723948A535FULL, 0x579C487E5A38AD0EULL},
+        {0xB0AF48EC79ACE837ULL, 0x2D835A9DF0C6D851ULL},
+        {0xDCDB1B2798182244ULL, 0xF8E431456CF88E65ULL},
+        {0x8A08F0F8BF0F156BULL, 0x1B8E9ECB641B58FFULL},
+        {0xAC8B2D36EED2DAC5ULL, 0xE272467E3D222F3FULL},
+        {0xD7ADF884AA879177ULL, 0x5B0ED81DCC6ABB0FULL},
+        {0x86CCBB52EA94BAEAULL, 0x98E947129FC2B4E9ULL},
+        {0xA87FEA27A539E9A5ULL, 0x3F2398D747B36224ULL},
+        {0xD29FE4B18E88640EULL, 0x8EEC7F0D19A03AADULL},
+        {0x83A3EEEEF9153E89ULL, 0x1953CF68300424ACULL},
+        {0xA48CEAAAB75A8E2BULL, 0x5FA8C3423C052DD7ULL},
+        {0xCDB02555653131B6ULL, 0x3792F412CB06794DULL},
+        {0x808E17555F3EBF11ULL, 0xE2BBD88BBEE40BD0ULL},
+        {0xA0B19D2AB70E6ED6ULL, 0x5B6ACEAEAE9D0EC4ULL},
+        {0xC8DE047564D20A8BULL, 0xF245825A5A445275ULL},
+        {0xFB158592BE068D2EULL, 0xEED6E2F0F0D56712ULL},
+        {0x9CED737BB6C4183DULL, 0x55464DD69685606BULL},
+        {0xC428D05AA4751E4CULL, 0xAA97E14C3C26B886ULL},
+        {0xF53304714D9265DFULL, 0xD53DD99F4B3066A8ULL},
+        {0x993FE2C6D07B7FABULL, 0xE546A8038EFE4029ULL},
+        {0xBF8FDB78849A5F96ULL, 0xDE98520472BDD033ULL},
+        {0xEF73D256A5C0F77CULL, 0x963E66858F6D4440ULL},
+        {0x95A8637627989AADULL, 0xDDE7001379A44AA8ULL},
+        {0xBB127C53B17EC159ULL, 0x5560C018580D5D52ULL},
+        {0xE9D71B689DDE71AFULL, 0xAAB8F01E6E10B4A6ULL},
+        {0x9226712162AB070DULL, 0xCAB3961304CA70E8ULL},
+        {0xB6B00D69BB55C8D1ULL, 0x3D607B97C5FD0D22ULL},
+        {0xE45C10C42A2B3B05ULL, 0x8CB89A7DB77C506AULL},
+        {0x8EB98A7A9A5B04E3ULL, 0x77F3608E92ADB242ULL},
+        {0xB267ED1940F1C61CULL, 0x55F038B237591ED3ULL},
+        {0xDF01E85F912E37A3ULL, 0x6B6C46DEC52F6688ULL},
+        {0x8B61313BBABCE2C6ULL, 0x2323AC4B3B3DA015ULL},
+        {0xAE397D8AA96C1B77ULL, 0xABEC975E0A0D081AULL},
+        {0xD9C7DCED53C72255ULL, 0x96E7BD358C904A21ULL},
+        {0x881CEA14545C7575ULL, 0x7E50D64177DA2E54ULL},
+        {0xAA242499697392D2ULL, 0xDDE50BD1D5D0B9E9ULL},
+        {0xD4AD2DBFC3D07787ULL, 0x955E4EC64B44E864ULL},
+        {0x84EC3C97DA624AB4ULL, 0xBD5AF13BEF0B113EULL},
+        {0xA6274BBDD0FADD61ULL, 0xECB1AD8AEACDD58EULL},
+        {0xCFB11EAD453994BAULL, 0x67DE18EDA5814AF2ULL},
+        {0x81CEB32C4B43FCF4ULL, 0x80EACF948770CED7ULL},
+        {0xA2425FF75E14FC31ULL, 0xA1258379A94D028DULL},
+        {0xCAD2F7F5359A3B3EULL, 0x096EE45813A04330ULL},
+        {0xFD87B5F28300CA0DULL, 0x8BCA9D6E188853FCULL},
+        {0x9E74D1B791E07E48ULL, 0x775EA264CF55347EULL},
+        {0xC612062576589DDAULL, 0x95364AFE032A819EULL},
+        {0xF79687AED3EEC551ULL, 0x3A83DDBD83F52205ULL},
+        {0x9ABE14CD44753B52ULL, 0xC4926A9672793543ULL},
+        {0xC16D9A0095928A27ULL, 0x75B7053C0F178294ULL},
+        {0xF1C90080BAF72CB1ULL, 0x5324C68B12DD6339ULL},
+        {0x971DA05074DA7BEEULL, 0xD3F6FC16EBCA5E04ULL},
+        {0xBCE5086492111AEAULL, 0x88F4BB1CA6BCF585ULL},
+        {0xEC1E4A7DB69561A5ULL, 0x2B31E9E3D06C32E6ULL},
+        {0x9392EE8E921D5D07ULL, 0x3AFF322E62439FD0ULL},
+        {0xB877AA3236A4B449ULL, 0x09BEFEB9FAD487C3ULL},
+        {0xE69594BEC44DE15BULL, 0x4C2EBE687989A9B4ULL},
+        {0x901D7CF73AB0ACD9ULL, 0x0F9D37014BF60A11ULL},
+        {0xB424DC35095CD80FULL, 0x538484C19EF38C95ULL},
+        {0xE12E13424BB40E13ULL, 0x2865A5F206B06FBAULL},
+        {0x8CBCCC096F5088CBULL, 0xF93F87B7442E45D4ULL},
+        {0xAFEBFF0BCB24AAFEULL, 0xF78F69A51539D749ULL},
+        {0xDBE6FECEBDEDD5BEULL, 0xB573440E5A884D1CULL},
+        {0x89705F4136B4A597ULL, 0x31680A88F8953031ULL},
+        {0xABCC77118461CEFCULL, 0xFDC20D2B36BA7C3EULL},
+        {0xD6BF94D5E57A42BCULL, 0x3D32907604691B4DULL},
+        {0x8637BD05AF6C69B5ULL, 0xA63F9A49C2C1B110ULL},
+        {0xA7C5AC471B478423ULL, 0x0FCF80DC33721D54ULL},
+        {0xD1B71758E219652BULL, 0xD3C36113404EA4A9ULL},
+        {0x83126E978D4FDF3BULL, 0x645A1CAC083126EAULL},
+        {0xA3D70A3D70A3D70AULL, 0x3D70A3D70A3D70A4ULL},
+        {0xCCCCCCCCCCCCCCCCULL, 0xCCCCCCCCCCCCCCCDULL},
+        {0x8000000000000000ULL, 0x0000000000000000ULL},
+        {0xA000000000000000ULL, 0x0000000000000000ULL},
+        {0xC800000000000000ULL, 0x0000000000000000ULL},
+        {0xFA00000000000000ULL, 0x0000000000000000ULL},
+        {0x9C40000000000000ULL, 0x0000000000000000ULL},
+        {0xC350000000000000ULL, 0x0000000000000000ULL},
+        {0xF424000000000000ULL, 0x0000000000000000ULL},
+        {0x9896800000000000ULL, 0x0000000000000000ULL},
+        {0xBEBC200000000000ULL, 0x0000000000000000ULL},
+        {0xEE6B280000000000ULL, 0x0000000000000000ULL},
+        {0x9502F90000000000ULL, 0x0000000000000000ULL},
+        {0xBA43B74000000000ULL, 0x0000000000000000ULL},
+        {0xE8D4A51000000000ULL, 0x0000000000000000ULL},
+        {0x9184E72A00000000ULL, 0x0000000000000000ULL},
+        {0xB5E620F480000000ULL, 0x0000000000000000ULL},
+        {0xE35FA931A0000000ULL, 0x0000000000000000ULL},
+        {0x8E1BC9BF04000000ULL, 0x0000000000000000ULL},
+        {0xB1A2BC2EC5000000ULL, 0x0000000000000000ULL},
+        {0xDE0B6B3A76400000ULL, 0x0000000000000000ULL},
+        {0x8AC7230489E80000ULL, 0x0000000000000000ULL},
+        {0xAD78EBC5AC620000ULL, 0x0000000000000000ULL},
+        {0xD8D726B7177A8000ULL, 0x0000000000000000ULL},
+        {0x878678326EAC9000ULL, 0x0000000000000000ULL},
+        {0xA968163F0A57B400ULL, 0x0000000000000000ULL},
+        {0xD3C21BCECCEDA100ULL, 0x0000000000000000ULL},
+        {0x84595161401484A0ULL, 0x0000000000000000ULL},
+        {0xA56FA5B99019A5C8ULL, 0x0000000000000000ULL},
+        {0xCECB8F27F4200F3AULL, 0x0000000000000000ULL},
+        {0x813F3978F8940984ULL, 0x4000000000000000ULL},
+        {0xA18F07D736B90BE5ULL, 0x5000000000000000ULL},
+        {0xC9F2C9CD04674EDEULL, 0xA400000000000000ULL},
+        {0xFC6F7C4045812296ULL, 0x4D00000000000000ULL},
+        {0x9DC5ADA82B70B59DULL, 0xF020000000000000ULL},
+        {0xC5371912364CE305ULL, 0x6C28000000000000ULL},
+        {0xF684DF56C3E01BC6ULL, 0xC732000000000000ULL},
+        {0x9A130B963A6C115CULL, 0x3C7F400000000000ULL},
+        {0xC097CE7BC90715B3ULL, 0x4B9F100000000000ULL},
+        {0xF0BDC21ABB48DB20ULL, 0x1E86D40000000000ULL},
+        {0x96769950B50D88F4ULL, 0x1314448000000000ULL},
+        {0xBC143FA4E250EB31ULL, 0x17D955A000000000ULL},
+        {0xEB194F8E1AE525FDULL, 0x5DCFAB0800000000ULL},
+        {0x92EFD1B8D0CF37BEULL, 0x5AA1CAE500000000ULL},
+        {0xB7ABC627050305ADULL, 0xF14A3D9E40000000ULL},
+        {0xE596B7B0C643C719ULL, 0x6D9CCD05D0000000ULL},
+        {0x8F7E32CE7BEA5C6FULL, 0xE4820023A2000000ULL},
+        {0xB35DBF821AE4F38BULL, 0xDDA2802C8A800000ULL},
+        {0xE0352F62A19E306EULL, 0xD50B2037AD200000ULL},
+        {0x8C213D9DA502DE45ULL, 0x4526F422CC340000ULL},
+        {0xAF298D050E4395D6ULL, 0x9670B12B7F410000ULL},
+        {0xDAF3F04651D47B4CULL, 0x3C0CDD765F114000ULL},
+        {0x88D8762BF324CD0FULL, 0xA5880A69FB6AC800ULL},
+        {0xAB0E93B6EFEE0053ULL, 0x8EEA0D047A457A00ULL},
+        {0xD5D238A4ABE98068ULL, 0x72A4904598D6D880ULL},
+        {0x85A36366EB71F041ULL, 0x47A6DA2B7F864750ULL},
+        {0xA70C3C40A64E6C51ULL, 0x999090B65F67D924ULL},
+        {0xD0CF4B50CFE20765ULL, 0xFFF4B4E3F741CF6DULL},
+        {0x82818F1281ED449FULL, 0xBFF8F10E7A8921A4ULL},
+        {0xA321F2D7226895C7ULL, 0xAFF72D52192B6A0DULL},
+        {0xCBEA6F8CEB02BB39ULL, 0x9BF4F8A69F764490ULL},
+        {0xFEE50B7025C36A08ULL, 0x02F236D04753D5B4ULL},
+        {0x9F4F2726179A2245ULL, 0x01D762422C946590ULL},
+        {0xC722F0EF9D80AAD6ULL, 0x424D3AD2B7B97EF5ULL},
+        {0xF8EBAD2B84E0D58BULL, 0xD2E0898765A7DEB2ULL},
+        {0x9B934C3B330C8577ULL, 0x63CC55F49F88EB2FULL},
+        {0xC2781F49FFCFA6D5ULL, 0x3CBF6B71C76B25FBULL},
+        {0xF316271C7FC3908AULL, 0x8BEF464E3945EF7AULL},
+        {0x97EDD871CFDA3A56ULL, 0x97758BF0E3CBB5ACULL},
+        {0xBDE94E8E43D0C8ECULL, 0x3D52EEED1CBEA317ULL},
+        {0xED63A231D4C4FB27ULL, 0x4CA7AAA863EE4BDDULL},
+        {0x945E455F24FB1CF8ULL, 0x8FE8CAA93E74EF6AULL},
+        {0xB975D6B6EE39E436ULL, 0xB3E2FD538E122B44ULL},
+        {0xE7D34C64A9C85D44ULL, 0x60DBBCA87196B616ULL},
+        {0x90E40FBEEA1D3A4AULL, 0xBC8955E946FE31CDULL},
+        {0xB51D13AEA4A488DDULL, 0x6BABAB6398BDBE41ULL},
+        {0xE264589A4DCDAB14ULL, 0xC696963C7EED2DD1ULL},
+        {0x8D7EB76070A08AECULL, 0xFC1E1DE5CF543CA2ULL},
+        {0xB0DE65388CC8ADA8ULL, 0x3B25A55F43294BCBULL},
+        {0xDD15FE86AFFAD912ULL, 0x49EF0EB713F39EBEULL},
+        {0x8A2DBF142DFCC7ABULL, 0x6E3569326C784337ULL},
+        {0xACB92ED9397BF996ULL, 0x49C2C37F07965404ULL},
+        {0xD7E77A8F87DAF7FBULL, 0xDC33745EC97BE906ULL},
+        {0x86F0AC99B4E8DAFDULL, 0x69A028BB3DED71A3ULL},
+        {0xA8ACD7C0222311BCULL, 0xC40832EA0D68CE0CULL},
+        {0xD2D80DB02AABD62BULL, 0xF50A3FA490C30190ULL},
+        {0x83C7088E1AAB65DBULL, 0x792667C6DA79E0FAULL},
+        {0xA4B8CAB1A1563F52ULL, 0x577001B891185938ULL},
+        {0xCDE6FD5E09ABCF26ULL, 0xED4C0226B55E6F86ULL},
+        {0x80B05E5AC60B6178ULL, 0x544F8158315B05B4ULL},
+        {0xA0DC75F1778E39D6ULL, 0x696361AE3DB1C721ULL},
+        {0xC913936DD571C84CULL, 0x03BC3A19CD1E38E9ULL},
+        {0xFB5878494ACE3A5FULL, 0x04AB48A04065C723ULL},
+        {0x9D174B2DCEC0E47BULL, 0x62EB0D64283F9C76ULL},
+        {0xC45D1DF942711D9AULL, 0x3BA5D0BD324F8394ULL},
+        {0xF5746577930D6500ULL, 0xCA8F44EC7EE36479ULL},
+        {0x9968BF6ABBE85F20ULL, 0x7E998B13CF4E1ECBULL},
+        {0xBFC2EF456AE276E8ULL, 0x9E3FEDD8C321A67EULL},
+        {0xEFB3AB16C59B14A2ULL, 0xC5CFE94EF3EA101EULL},
+        {0x95D04AEE3B80ECE5ULL, 0xBBA1F1D158724A12ULL},
+        {0xBB445DA9CA61281FULL, 0x2A8A6E45AE8EDC97ULL},
+        {0xEA1575143CF97226ULL, 0xF52D09D71A3293BDULL},
+        {0x924D692CA61BE758ULL, 0x593C2626705F9C56ULL},
+        {0xB6E0C377CFA2E12EULL, 0x6F8B2FB00C77836CULL},
+        {0xE498F455C38B997AULL, 0x0B6DFB9C0F956447ULL},
+        {0x8EDF98B59A373FECULL, 0x4724BD4189BD5EACULL},
+        {0xB2977EE300C50FE7ULL, 0x58EDEC91EC2CB657ULL},
+        {0xDF3D5E9BC0F653E1ULL, 0x2F2967B66737E3EDULL},
+        {0x8B865B215899F46CULL, 0xBD79E0D20082EE74ULL},
+        {0xAE67F1E9AEC07187ULL, 0xECD8590680A3AA11ULL},
+        {0xDA01EE641A708DE9ULL, 0xE80E6F4820CC9495ULL},
+        {0x884134FE908658B2ULL, 0x3109058D147FDCDDULL},
+        {0xAA51823E34A7EEDEULL, 0xBD4B46F0599FD415ULL},
+        {0xD4E5E2CDC1D1EA96ULL, 0x6C9E18AC7007C91AULL},
+        {0x850FADC09923329EULL, 0x03E2CF6BC604DDB0ULL},
+        {0xA6539930BF6BFF45ULL, 0x84DB8346B786151CULL},
+        {0xCFE87F7CEF46FF16ULL, 0xE612641865679A63ULL},
+        {0x81F14FAE158C5F6EULL, 0x4FCB7E8F3F60C07EULL},
+        {0xA26DA3999AEF7749ULL, 0xE3BE5E330F38F09DULL},
+        {0xCB090C8001AB551CULL, 0x5CADF5BFD3072CC5ULL},
+        {0xFDCB4FA002162A63ULL, 0x73D9732FC7C8F7F6ULL},
+        {0x9E9F11C4014DDA7EULL, 0x2867E7FDDCDD9AFAULL},
+        {0xC646D63501A1511DULL, 0xB281E1FD541501B8ULL},
+        {0xF7D88BC24209A565ULL, 0x1F225A7CA91A4226ULL},
+        {0x9AE757596946075FULL, 0x3375788DE9B06958ULL},
+        {0xC1A12D2FC3978937ULL, 0x0052D6B1641C83AEULL},
+        {0xF209787BB47D6B84ULL, 0xC0678C5DBD23A49AULL},
+        {0x9745EB4D50CE6332ULL, 0xF840B7BA963646E0ULL},
+        {0xBD176620A501FBFFULL, 0xB650E5A93BC3D898ULL},
+        {0xEC5D3FA8CE427AFFULL, 0xA3E51F138AB4CEBEULL},
+        {0x93BA47C980E98CDFULL, 0xC66F336C36B10137ULL},
+        {0xB8A8D9BBE123F017ULL, 0xB80B0047445D4184ULL},
+        {0xE6D3102AD96CEC1DULL, 0xA60DC059157491E5ULL},
+        {0x9043EA1AC7E41392ULL, 0x87C89837AD68DB2FULL},
+        {0xB454E4A179DD1877ULL, 0x29BABE4598C311FBULL},
+        {0xE16A1DC9D8545E94ULL, 0xF4296DD6FEF3D67AULL},
+        {0x8CE2529E2734BB1DULL, 0x1899E4A65F58660CULL},
+        {0xB01AE745B101E9E4ULL, 0x5EC05DCFF72E7F8FULL},
+        {0xDC21A1171D42645DULL, 0x76707543F4FA1F73ULL},
+        {0x899504AE72497EBAULL, 0x6A06494A791C53A8ULL},
+        {0xABFA45DA0EDBDE69ULL, 0x0487DB9D17636892ULL},
+        {0xD6F8D7509292D603ULL, 0x45A9D2845D3C42B6ULL},
+        {0x865B86925B9BC5C2ULL, 0x0B8A2392BA45A9B2ULL},
+        {0xA7F26836F282B732ULL, 0x8E6CAC7768D7141EULL},
+        {0xD1EF0244AF2364FFULL, 0x3207D795430CD926ULL},
+        {0x8335616AED761F1FULL, 0x7F44E6BD49E807B8ULL},
+        {0xA402B9C5A8D3A6E7ULL, 0x5F16206C9C6209A6ULL},
+        {0xCD036837130890A1ULL, 0x36DBA887C37A8C0FULL},
+        {0x802221226BE55A64ULL, 0xC2494954DA2C9789ULL},
+        {0xA02AA96B06DEB0FDULL, 0xF2DB9BAA10B7BD6CULL},
+        {0xC83553C5C8965D3DULL, 0x6F92829494E5ACC7ULL},
+        {0xFA42A8B73ABBF48CULL, 0xCB772339BA1F17F9ULL},
+        {0x9C69A97284B578D7ULL, 0xFF2A760414536EFBULL},
+        {0xC38413CF25E2D70DULL, 0xFEF5138519684ABAULL},
+        {0xF46518C2EF5B8CD1ULL, 0x7EB258665FC25D69ULL},
+        {0x98BF2F79D5993802ULL, 0xEF2F773FFBD97A61ULL},
+        {0xBEEEFB584AFF8603ULL, 0xAAFB550FFACFD8FAULL},
+        {0xEEAABA2E5DBF6784ULL, 0x95BA2A53F983CF38ULL},
+        {0x952AB45CFA97A0B2ULL, 0xDD945A747BF26183ULL},
+        {0xBA756174393D88DFULL, 0x94F971119AEEF9E4ULL},
+        {0xE912B9D1478CEB17ULL, 0x7A37CD5601AAB85DULL},
+        {0x91ABB422CCB812EEULL, 0xAC62E055C10AB33AULL},
+        {0xB616A12B7FE617AAULL, 0x577B986B314D6009ULL},
+        {0xE39C49765FDF9D94ULL, 0xED5A7E85FDA0B80BULL},
+        {0x8E41ADE9FBEBC27DULL, 0x14588F13BE847307ULL},
+        {0xB1D219647AE6B31CULL, 0x596EB2D8AE258FC8ULL},
+        {0xDE469FBD99A05FE3ULL, 0x6FCA5F8ED9AEF3BBULL},
+        {0x8AEC23D680043BEEULL, 0x25DE7BB9480D5854ULL},
+        {0xADA72CCC20054AE9ULL, 0xAF561AA79A10AE6AULL},
+        {0xD910F7FF28069DA4ULL, 0x1B2BA1518094DA04ULL},
+        {0x87AA9AFF79042286ULL, 0x90FB44D2F05D0842ULL},
+        {0xA99541BF57452B28ULL, 0x353A1607AC744A53ULL},
+        {0xD3FA922F2D1675F2ULL, 0x42889B8997915CE8ULL},
+        {0x847C9B5D7C2E09B7ULL, 0x69956135FEBADA11ULL},
+        {0xA59BC234DB398C25ULL, 0x43FAB9837E699095ULL},
+        {0xCF02B2C21207EF2EULL, 0x94F967E45E03F4BBULL},
+        {0x8161AFB94B44F57DULL, 0x1D1BE0EEBAC278F5ULL},
+        {0xA1BA1BA79E1632DCULL, 0x6462D92A69731732ULL},
+        {0xCA28A291859BBF93ULL, 0x7D7B8F7503CFDCFEULL},
+        {0xFCB2CB35E702AF78ULL, 0x5CDA735244C3D43EULL},
+        {0x9DEFBF01B061ADABULL, 0x3A0888136AFA64A7ULL},
+        {0xC56BAEC21C7A1916ULL, 0x088AAA1845B8FDD0ULL},
+        {0xF6C69A72A3989F5BULL, 0x8AAD549E57273D45ULL},
+        {0x9A3C2087A63F6399ULL, 0x36AC54E2F678864BULL},
+        {0xC0CB28A98FCF3C7FULL, 0x84576A1BB416A7DDULL},
+        {0xF0FDF2D3F3C30B9FULL, 0x656D44A2A11C51D5ULL},
+        {0x969EB7C47859E743ULL, 0x9F644AE5A4B1B325ULL},
+        {0xBC4665B596706114ULL, 0x873D5D9F0DDE1FEEULL},
+        {0xEB57FF22FC0C7959ULL, 0xA90CB506D155A7EAULL},
+        {0x9316FF75DD87CBD8ULL, 0x09A7F12442D588F2ULL},
+        {0xB7DCBF5354E9BECEULL, 0x0C11ED6D538AEB2FULL},
+        {0xE5D3EF282A242E81ULL, 0x8F1668C8A86DA5FAULL},
+        {0x8FA475791A569D10ULL, 0xF96E017D694487BCULL},
+        {0xB38D92D760EC4455ULL, 0x37C981DCC395A9ACULL},
+        {0xE070F78D3927556AULL, 0x85BBE253F47B1417ULL},
+        {0x8C469AB843B89562ULL, 0x93956D7478CCEC8EULL},
+        {0xAF58416654A6BABBULL, 0x387AC8D1970027B2ULL},
+        {0xDB2E51BFE9D0696AULL, 0x06997B05FCC0319EULL},
+        {0x88FCF317F22241E2ULL, 0x441FECE3BDF81F03ULL},
+        {0xAB3C2FDDEEAAD25AULL, 0xD527E81CAD7626C3ULL},
+        {0xD60B3BD56A5586F1ULL, 0x8A71E223D8D3B074ULL},
+        {0x85C7056562757456ULL, 0xF6872D5667844E49ULL},
+        {0xA738C6BEBB12D16CULL, 0xB428F8AC016561DBULL},
+        {0xD106F86E69D785C7ULL, 0xE13336D701BEBA52ULL},
+        {0x82A45B450226B39CULL, 0xECC0024661173473ULL},
+        {0xA34D721642B06084ULL, 0x27F002D7F95D0190ULL},
+        {0xCC20CE9BD35C78A5ULL, 0x31EC038DF7B441F4ULL},
+        {0xFF290242C83396CEULL, 0x7E67047175A15271ULL},
+        {0x9F79A169BD203E41ULL, 0x0F0062C6E984D386ULL},
+        {0xC75809C42C684DD1ULL, 0x52C07B78A3E60868ULL},
+        {0xF92E0C3537826145ULL, 0xA7709A56CCDF8A82ULL},
+        {0x9BBCC7A142B17CCBULL, 0x88A66076400BB691ULL},
+        {0xC2ABF989935DDBFEULL, 0x6ACFF893D00EA435ULL},
+        {0xF356F7EBF83552FEULL, 0x0583F6B8C4124D43ULL},
+        {0x98165AF37B2153DEULL, 0xC3727A337A8B704AULL},
+        {0xBE1BF1B059E9A8D6ULL, 0x744F18C0592E4C5CULL},
+        {0xEDA2EE1C7064130CULL, 0x1162DEF06F79DF73ULL},
+        {0x9485D4D1C63E8BE7ULL, 0x8ADDCB5645AC2BA8ULL},
+        {0xB9A74A0637CE2EE1ULL, 0x6D953E2BD7173692ULL},
+        {0xE8111C87C5C1BA99ULL, 0xC8FA8DB6CCDD0437ULL},
+        {0x910AB1D4DB9914A0ULL, 0x1D9C9892400A22A2ULL},
+        {0xB54D5E4A127F59C8ULL, 0x2503BEB6D00CAB4BULL},
+        {0xE2A0B5DC971F303AULL, 0x2E44AE64840FD61DULL},
+        {0x8DA471A9DE737E24ULL, 0x5CEAECFED289E5D2ULL},
+        {0xB10D8E1456105DADULL, 0x7425A83E872C5F47ULL},
+        {0xDD50F1996B947518ULL, 0xD12F124E28F77719ULL},
+        {0x8A5296FFE33CC92FULL, 0x82BD6B70D99AAA6FULL},
+        {0xACE73CBFDC0BFB7BULL, 0x636CC64D1001550BULL},
+        {0xD8210BEFD30EFA5AULL, 0x3C47F7E05401AA4EULL},
+        {0x8714A775E3E95C78ULL, 0x65ACFAEC34810A71ULL},
+        {0xA8D9D1535CE3B396ULL, 0x7F1839A741A14D0DULL},
+        {0xD31045A8341CA07CULL, 0x1EDE48111209A050ULL},
+        {0x83EA2B892091E44DULL, 0x934AED0AAB460432ULL},
+        {0xA4E4B66B68B65D60ULL, 0xF81DA84D5617853FULL},
+        {0xCE1DE40642E3F4B9ULL, 0x36251260AB9D668EULL},
+        {0x80D2AE83E9CE78F3ULL, 0xC1D72B7C6B426019ULL},
+        {0xA1075A24E4421730ULL, 0xB24CF65B8612F81FULL},
+        {0xC94930AE1D529CFCULL, 0xDEE033F26797B627ULL},
+        {0xFB9B7CD9A4A7443CULL, 0x169840EF017DA3B1ULL},
+        {0x9D412E0806E88AA5ULL, 0x8E1F289560EE864EULL},
+        {0xC491798A08A2AD4EULL, 0xF1A6F2BAB92A27E2ULL},
+        {0xF5B5D7EC8ACB58A2ULL, 0xAE10AF696774B1DBULL},
+        {0x9991A6F3D6BF1765ULL, 0xACCA6DA1E0A8EF29ULL},
+        {0xBFF610B0CC6EDD3FULL, 0x17FD090A58D32AF3ULL},
+        {0xEFF394DCFF8A948EULL, 0xDDFC4B4CEF07F5B0ULL},
+        {0x95F83D0A1FB69CD9ULL, 0x4ABDAF101564F98EULL},
+        {0xBB764C4CA7A4440FULL, 0x9D6D1AD41ABE37F1ULL},
+        {0xEA53DF5FD18D5513ULL, 0x84C86189216DC5EDULL},
+        {0x92746B9BE2F8552CULL, 0x32FD3CF5B4E49BB4ULL},
+        {0xB7118682DBB66A77ULL, 0x3FBC8C33221DC2A1ULL},
+        {0xE4D5E82392A40515ULL, 0x0FABAF3FEAA5334AULL},
+        {0x8F05B1163BA6832DULL, 0x29CB4D87F2A7400EULL},
+        {0xB2C71D5BCA9023F8ULL, 0x743E20E9EF511012ULL},
+        {0xDF78E4B2BD342CF6ULL, 0x914DA9246B255416ULL},
+        {0x8BAB8EEFB6409C1AULL, 0x1AD089B6C2F7548EULL},
+        {0xAE9672ABA3D0C320ULL, 0xA184AC2473B529B1ULL},
+        {0xDA3C0F568CC4F3E8ULL, 0xC9E5D72D90A2741EULL},
+        {0x8865899617FB1871ULL, 0x7E2FA67C7A658892ULL},
+        {0xAA7EEBFB9DF9DE8DULL, 0xDDBB901B98FEEAB7ULL},
+        {0xD51EA6FA85785631ULL, 0x552A74227F3EA565ULL},
+        {0x8533285C936B35DEULL, 0xD53A88958F87275FULL},
+        {0xA67FF273B8460356ULL, 0x8A892ABAF368F137ULL},
+        {0xD01FEF10A657842CULL, 0x2D2B7569B0432D85ULL},
+        {0x8213F56A67F6B29BULL, 0x9C3B29620E29FC73ULL},
+        {0xA298F2C501F45F42ULL, 0x8349F3BA91B47B8FULL},
+        {0xCB3F2F7642717713ULL, 0x241C70A936219A73ULL},
+        {0xFE0EFB53D30DD4D7ULL, 0xED238CD383AA0110ULL},
+        {0x9EC95D1463E8A506ULL, 0xF4363804324A40AAULL},
+        {0xC67BB4597CE2CE48ULL, 0xB143C6053EDCD0D5ULL},
+        {0xF81AA16FDC1B81DAULL, 0xDD94B7868E94050AULL},
+        {0x9B10A4E5E9913128ULL, 0xCA7CF2B4191C8326ULL},
+        {0xC1D4CE1F63F57D72ULL, 0xFD1C2F611F63A3F0ULL},
+        {0xF24A01A73CF2DCCFULL, 0xBC633B39673C8CECULL},
+        {0x976E41088617CA01ULL, 0xD5BE0503E085D813ULL},
+        {0xBD49D14AA79DBC82ULL, 0x4B2D8644D8A74E18ULL},
+        {0xEC9C459D51852BA2ULL, 0xDDF8E7D60ED1219EULL},
+        {0x93E1AB8252F33B45ULL, 0xCABB90E5C942B503ULL},
+        {0xB8DA1662E7B00A17ULL, 0x3D6A751F3B936243ULL},
+        {0xE7109BFBA19C0C9DULL, 0x0CC512670A783AD4ULL},
+        {0x906A617D450187E2ULL, 0x27FB2B80668B24C5ULL},
+        {0xB484F9DC9641E9DAULL, 0xB1F9F660802DEDF6ULL},
+        {0xE1A63853BBD26451ULL, 0x5E7873F8A0396973ULL},
+        {0x8D07E33455637EB2ULL, 0xDB0B487B6423E1E8ULL},
+        {0xB049DC016ABC5E5FULL, 0x91CE1A9A3D2CDA62ULL},
+        {0xDC5C5301C56B75F7ULL, 0x7641A140CC7810FBULL},
+        {0x89B9B3E11B6329BAULL, 0xA9E904C87FCB0A9DULL},
+        {0xAC2820D9623BF429ULL, 0x546345FA9FBDCD44ULL},
+        {0xD732290FBACAF133ULL, 0xA97C177947AD4095ULL},
+        {0x867F59A9D4BED6C0ULL, 0x49ED8EABCCCC485DULL},
+        {0xA81F301449EE8C70ULL, 0x5C68F256BFFF5A74ULL},
+        {0xD226FC195C6A2F8CULL, 0x73832EEC6FFF3111ULL},
+        {0x83585D8FD9C25DB7ULL, 0xC831FD53C5FF7EABULL},
+        {0xA42E74F3D032F525ULL, 0xBA3E7CA8B77F5E55ULL},
+        {0xCD3A1230C43FB26FULL, 0x28CE1BD2E55F35EBULL},
+        {0x80444B5E7AA7CF85ULL, 0x7980D163CF5B81B3ULL},
+        {0xA0555E361951C366ULL, 0xD7E105BCC332621FULL},
+        {0xC86AB5C39FA63440ULL, 0x8DD9472BF3FEFAA7ULL},
+        {0xFA856334878FC150ULL, 0xB14F98F6F0FEB951ULL},
+        {0x9C935E00D4B9D8D2ULL, 0x6ED1BF9A569F33D3ULL},
+        {0xC3B8358109E84F07ULL, 0x0A862F80EC4700C8ULL},
+        {0xF4A642E14C6262C8ULL, 0xCD27BB612758C0FAULL},
+        {0x98E7E9CCCFBD7DBDULL, 0x8038D51CB897789CULL},
+        {0xBF21E44003ACDD2CULL, 0xE0470A63E6BD56C3ULL},
+        {0xEEEA5D5004981478ULL, 0x1858CCFCE06CAC74ULL},
+        {0x95527A5202DF0CCBULL, 0x0F37801E0C43EBC8ULL},
+        {0xBAA718E68396CFFDULL, 0xD30560258F54E6BAULL},
+        {0xE950DF20247C83FDULL, 0x47C6B82EF32A2069ULL},
+        {0x91D28B7416CDD27EULL, 0x4CDC331D57FA5441ULL},
+        {0xB6472E511C81471DULL, 0xE0133FE4ADF8E952ULL},
+        {0xE3D8F9E563A198E5ULL, 0x58180FDDD97723A6ULL},
+        {0x8E679C2F5E44FF8FULL, 0x570F09EAA7EA7648ULL},
+};
+
+/* Full 64x64->128 bit multiplication, returns the low half */
+static uint64_t jsonMul128(uint64_t a, uint64_t b, uint64_t *hi) {
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 r = (unsigned __int128)a * b;
+    *hi = (uint64_t)(r >> 64);
+    return (uint64_t)r;
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo;
+    uint64_t hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    *hi = a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+    return (cross << 32) | (uint32_t)lo_lo;
+#endif
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define countLeadingZeros64(x) (__builtin_clzll(x))
+#else
+static inline int countLeadingZeros64(uint64_t n) {
+    int c = 0;
+    while (!(n & (1ULL << 63))) {
+        n <<= 1;
+        c++;
     }
-    return retval;
+    return c;
 }
+#endif
 
-static double jsonParseFloat(jsonParser *p, char *ptr, int neg, int num_len,
-                             int dec_idx, int mantissa) {
-    int fraction_exponent = 0, exponent = 0, exponent_sign = 0;
+/**
+ * Eisel-Lemire: build the closest double to w * 10^q from a 128 bit
+ * approximation of 5^q. `w` must not be 0. Returns 0 when the approximation
+ * is too close to call, or the result is subnormal, and the caller should
+ * fall back to strtod.
+ */
+static int jsonEiselLemire(uint64_t w, int64_t q, double *out) {
+    uint64_t lo, hi, mantissa;
+    int64_t power2;
+    int lz, upperbit;
 
-    if (mantissa == 0) {
-        jsonUnsafeAdvanceBy(p, num_len);
-        return 0.0;
+    if (q < JSON_POW5_MIN_EXPONENT) {
+        *out = 0.0;
+        return 1;
+    } else if (q > JSON_POW5_MAX_EXPONENT) {
+        power2 = 0x7FF;
+        mantissa = 0;
+        goto done;
     }
 
-    if (dec_idx < 0) {
-        dec_idx = mantissa;
-    } else {
-        mantissa -= 1;
+    lz = countLeadingZeros64(w);
+    w <<= lz;
+
+    const uint64_t *pow5 = powers_of_5_128[q - JSON_POW5_MIN_EXPONENT];
+    lo = jsonMul128(w, pow5[0], &hi);
+
+    /* Only 55 bits are needed, if the ones below are all set the truncated
+     * low half of 5^q could carry into them */
+    if ((hi & 0x1FF) == 0x1FF) {
+        uint64_t hi2;
+        jsonMul128(w, pow5[1], &hi2);
+        lo += hi2;
+        if (hi2 > lo) {
+            hi++;
+        }
+        if (lo == UINT64_MAX && (q < -27 || q > 55)) {
+            return 0;
+        }
     }
 
-    if (mantissa > 18) {
-        fraction_exponent = dec_idx - 18;
-        mantissa = 18;
-    } else {
-        fraction_exponent = dec_idx - mantissa;
+    upperbit = hi >> 63;
+    mantissa = hi >> (upperbit + 9);
+    /* floor(log2(10^q)) + 63 is (152170 + 65536) * q >> 16 + 63 */
+    power2 = ((((152170 + 65536) * q) >> 16) + 63) + upperbit - lz + 1023;
+
+    if (power2 <= 0) {
+        return 0;
     }
 
-    int ii = 0;
-    int jj = 0;
-    double fraction = 0;
-    for (; mantissa > 9; --mantissa) {
-        char c = *ptr;
-        ptr++;
-        if (c == '.') {
-            c = *ptr;
-            ptr++;
-        }
-        ii = 10 * ii + toInt(c);
+    /* Exactly half way between two doubles, round to even */
+    if (lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 &&
+        (mantissa << (upperbit + 9)) == hi) {
+        mantissa &= ~1ULL;
     }
 
-    for (; mantissa > 0; --mantissa) {
-        char c = *ptr;
-        ptr++;
-        if (c == '.') {
-            c = *ptr;
-            ptr++;
-        }
-        jj = 10 * jj + toInt(c);
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= (2ULL << 52)) {
+        mantissa = 1ULL << 52;
+        power2++;
     }
-    fraction = (1.0e9 * ii) + jj;
+    mantissa &= ~(1ULL << 52);
 
-    if (toUpper(*ptr) == 'E') {
-        ptr++;
-        if (*ptr == '-') {
-            exponent_sign = -1;
-            ptr++;
-        } else if (*ptr == '+') {
-            ptr++;
-        }
-        while (isNum(*ptr) && exponent < INT_MAX / 100) {
-            exponent = exponent * 10 + (*ptr - '0');
-            ptr++;
-        }
-        while (isNum(*ptr)) {
-            ptr++;
-        }
+    if (power2 >= 0x7FF) {
+        power2 = 0x7FF;
+        mantissa = 0;
     }
 
-    if (exponent_sign) {
-        exponent = fraction_exponent - exponent;
-    } else {
-        exponent = fraction_exponent + exponent;
-    }
-
-    if (exponent < -JSON_MAX_EXPONENT) {
-        exponent = JSON_MAX_EXPONENT;
-        exponent_sign = 1;
-    } else if (exponent > JSON_MAX_EXPONENT) {
-        exponent = JSON_MAX_EXPONENT;
-        exponent_sign = 0;
-    } else if (exponent < 0) {
-        exponent_sign = 1;
-        exponent = -exponent;
-    } else {
-        exponent_sign = 0;
+done:;
+    uint64_t bits = mantissa | ((uint64_t)power2 << 52);
+    memcpy(out, &bits, sizeof(bits));
+    return 1;
+}
+
+/**
+ * strtod for the numbers the fast paths cannot do. It honours LC_NUMERIC, so
+ * the '.' is swapped for the decimal point of the current locale, and the
+ * copy also stops it reading past the end of a buffer that is not NUL
+ * terminated.
+ */
+static double jsonStrtod(const jsonNumber *num) {
+    char inline_buf[64];
+    char *buf = inline_buf;
+    const char *point = localeconv()->decimal_point;
+    size_t point_len = strlen(point);
+    size_t len = 0;
+    double retval;
+
+    if (num->len + point_len >= sizeof(inline_buf)) {
+        buf = (char *)jsonMalloc(num->len + point_len + 1);
     }
 
-    double double_exponent = I64Pow10(exponent);
-    double retval = fraction;
+    for (size_t i = 0; i < num->len; ++i) {
+        if (num->start[i] == '.') {
+            memcpy(buf + len, point, point_len);
+            len += point_len;
+        } else {
+            buf[len++] = num->start[i];
+        }
+    }
+    buf[len] = '\0';
 
-    if (exponent_sign) {
-        retval /= double_exponent;
-    } else {
-        retval *= double_exponent;
+    retval = strtod(buf, NULL);
+    if (buf != inline_buf) {
+        jsonFree(buf);
+    }
+    return retval;
+}
+
+/**
+ * Correctly rounded float from a lexed number. Most are exact with a power of
+ * 10 that is itself exact or go through Eisel-Lemire. Anything with more than
+ * 19 significant digits, subnormal or too close to call is handed to strtod.
+ */
+static double jsonNumberToDouble(const jsonNumber *num) {
+    uint64_t w = num->mantissa;
+    int64_t q = num->exponent;
+    double retval;
+
+    if (w == 0) {
+        retval = 0.0;
+    } else if (num->truncated) {
+        return jsonStrtod(num);
+    } else if (w <= JSON_MAX_EXACT_DOUBLE_INT && q >= -JSON_MAX_EXACT_POW10 &&
+               q <= JSON_MAX_EXACT_POW10) {
+        /* Clinger's fast path, both operands are exact so is the result */
+        retval = (double)w;
+        if (q < 0) {
+            retval /= powers_of_10[-q];
+        } else {
+            retval *= powers_of_10[q];
+        }
+    } else if (!jsonEiselLemire(w, q, &retval)) {
+        return jsonStrtod(num);
     }
 
-    jsonUnsafeAdvanceBy(p, num_len);
-    if (neg) {
+    if (num->neg) {
         return -retval;
     }
     return retval;
 }
 
+/**
+ * Numbers are lexed once, then built as an int if there was no '.' and it
+ * fits, otherwise as a float.
+ */
 static void jsonParseNumber(jsonParser *p) {
-    char *ptr = p->buffer + p->offset;
-    int num_len = countNumberLen(p, ptr);
     json *current = p->ptr;
-    int neg = 0;
-    int dec_idx = -1;
-    int mantissa = 0;
+    jsonNumber num;
+    ssize_t integer;
 
-    if (*ptr == '-') {
-        neg = 1;
-        ptr++;
-    } else if (*ptr == '+') {
-        neg = 0;
-        ptr++;
-    } else if ((!isNum(*ptr) && *ptr != '.') || (num_len == 0)) {
-        jsonAdvanceToError(p, 0, JSON_INVALID_NUMBER);
+    if (jsonLexNumber(p->kernels, p->buffer + p->offset, p->endptr, &num) !=
+        JSON_OK) {
+        jsonAdvanceToError(p, num.len, JSON_INVALID_NUMBER);
         return;
     }
 
-    if (num_len == 1) {
-        current->integer = toInt(jsonPeek(p));
+    if (num.is_hex) {
+        jsonUnsafeAdvanceBy(p, num.len);
+        integer = stringToHex(p);
+        current->integer = num.neg ? -integer : integer;
         current->type = JSON_INT;
-        jsonAdvance(p);
         return;
     }
 
-    mantissa = countMantissa(ptr, &dec_idx);
-
-    if (dec_idx == -1) {
-        if (neg) {
-            jsonAdvance(p);
-        }
-        current->integer = stringToI64(p, neg);
+    if (!num.is_float && jsonNumberToInt(&num, &integer)) {
+        current->integer = integer;
         current->type = JSON_INT;
+    } else {
+        current->floating = jsonNumberToDouble(&num);
+        current->type = JSON_FLOAT;
+    }
+    jsonUnsafeAdvanceBy(p, num.len);
+}
+
+/**
+ * With JSON_LAZY_NUMBER_FLAG numbers are only checked. `J->strnum` points at
+ * the number in the buffer, `J->aux` holds its length and `J->type` is a
+ * guess until jsonMaterializeNumber is called by one of the getters.
+ */
+static void jsonParseNumberView(jsonParser *p) {
+    json *current = p->ptr;
+    jsonNumber num;
+
+    if (jsonLexNumber(NULL, p->buffer + p->offset, p->endptr, &num) !=
+        JSON_OK) {
+        jsonAdvanceToError(p, num.len, JSON_INVALID_NUMBER);
+        return;
+    }
+
+    /* Hex is rare, and too long to be described by aux is rarer */
+    if (num.is_hex || num.len > JSON_AUX_LEN_MASK) {
+        jsonParseNumber(p);
         return;
     }
 
-    current->floating = jsonParseFloat(p, ptr, neg, num_len, dec_idx, mantissa);
-    current->type = JSON_FLOAT;
+    current->type = num.is_float || num.exponent < 0 ? JSON_FLOAT : JSON_INT;
+    current->strnum = (char *)num.start;
+    current->aux = JSON_AUX_LAZY | (unsigned int)num.len;
+    jsonUnsafeAdvanceBy(p, num.len);
+}
+
+/* Convert a number left in the buffer by JSON_LAZY_NUMBER_FLAG */
+static void jsonMaterializeNumber(json *J) {
+    const char *start = J->strnum;
+    jsonNumber num;
+    ssize_t integer;
+
+    if ((J->type != JSON_INT && J->type != JSON_FLOAT) ||
+        !(J->aux & JSON_AUX_LAZY)) {
+        return;
+    }
+
+    /* Already checked when parsed */
+    jsonLexNumber(jsonKernels(), start, start + (J->aux & JSON_AUX_LEN_MASK),
+                  &num);
+    if (!num.is_float && jsonNumberToInt(&num, &integer)) {
+        J->integer = integer;
+        J->type = JSON_INT;
+    } else {
+        J->floating = jsonNumberToDouble(&num);
+        J->type = JSON_FLOAT;
+    }
+    J->aux = 0;
 }
 
 /**
@@ -1031,10 +3008,10 @@ static unsigned int parseHex4(const unsigned char *buf) {
     for (int i = 0; i < 4; ++i) {
         ch = buf[i];
         if (isHex(ch)) {
-            if (isHex(ch)) {
-                hex += toHex(ch);
-            } else {
+            if (isNum(ch)) {
                 hex += toInt(ch);
+            } else {
+                hex += toHex(ch);
             }
         } else {
             return INT_MAX;
@@ -1066,16 +3043,22 @@ static void utf8Encode(char *buffer, unsigned int codepoint, size_t *offset) {
         __bufput(buffer, offset, 0x80 | (codepoint & 0x3F));
     } else {
         /* For codepoints above 65535, encode using four bytes */
-        __bufput(buffer, offset, 0xE0 | ((codepoint >> 18) & 0xFF));
+        __bufput(buffer, offset, 0xF0 | ((codepoint >> 18) & 0x07));
         __bufput(buffer, offset, 0x80 | ((codepoint >> 12) & 0x3F));
         __bufput(buffer, offset, 0x80 | ((codepoint >> 6) & 0x3F));
         __bufput(buffer, offset, 0x80 | (codepoint & 0x3F));
     }
 }
 
-static unsigned int jsonParseUTF16(jsonParser *p) {
-    if (!jsonCanAdvanceBy(p, 5)) {
-        return jsonAdvanceToError(p, 0, JSON_CANNOT_ADVANCE);
+/**
+ * Decode the \u escape the parser is on, and the low surrogate after it if
+ * it is a high one. `end` is the closing '"' of the string, nothing at or
+ * past it is read. The offset is left on the last hex digit.
+ */
+static unsigned int jsonParseUTF16(jsonParser *p, const char *end) {
+    /* 'u' and 4 hex digits, all before the closing '"' */
+    if (end - (p->buffer + p->offset) < 5) {
+        return jsonAdvanceToError(p, 0, JSON_INVALID_HEX);
     }
     unsigned int codepoint = parseHex4((const unsigned char *)p->buffer +
                                        p->offset + 1);
@@ -1090,12 +3073,13 @@ static unsigned int jsonParseUTF16(jsonParser *p) {
     /* UTF-16 pair */
     if (codepoint >= 0xD800 && codepoint <= 0xDFFF) {
         if (codepoint <= 0xDBFF) {
-            if (!jsonCanAdvanceBy(p, 6)) {
-                return jsonAdvanceToError(p, 0, JSON_CANNOT_ADVANCE);
+            /* The low surrogate has to follow inside the same string */
+            if (end - (p->buffer + p->offset) < 7) {
+                return jsonAdvanceToError(p, 0, JSON_INVALID_UTF16);
             }
 
-            jsonAdvance(p);
-            if (jsonPeek(p) != '\\' &&
+            jsonUnsafeAdvanceBy(p, 1);
+            if (jsonPeek(p) != '\\' ||
                 jsonUnsafePeekAt(p, p->offset + 1) != 'u') {
                 return jsonAdvanceToError(p, 0, JSON_INVALID_UTF16);
             }
@@ -1119,7 +3103,8 @@ static unsigned int jsonParseUTF16(jsonParser *p) {
             codepoint = (((codepoint - 0xD800) << 10) | (codepoint2 - 0xDC00)) +
                     0x10000;
             */
-            jsonCanAdvanceBy(p, 3);
+            /* Leave the offset on the last hex digit as for a single unit */
+            jsonUnsafeAdvanceBy(p, 3);
         } else {
             return jsonAdvanceToError(p, 0, JSON_INVALID_UTF16);
         }
@@ -1128,157 +3113,362 @@ static unsigned int jsonParseUTF16(jsonParser *p) {
     return codepoint;
 }
 
-static char *jsonParseString(jsonParser *p) {
-    int run = 1;
-    size_t start = p->offset;
-    size_t end = p->offset;
-
-    if (jsonPeek(p) == '"') {
-        jsonAdvance(p);
-        end++;
-    }
-
-    /* approximate string length */
-    while (jsonUnsafePeekAt(p, end) != '\0') {
-        char cur = jsonUnsafePeekAt(p, end);
-        if (cur == '"') {
-            if (jsonUnsafePeekAt(p, end - 1) != '\\') {
-                break;
-            }
-        } else if (cur == '\\') {
-            // escape sequence so add another byte
-            if (jsonUnsafePeekAt(p, end + 1) == '\0') {
-                break;
-            }
-            end++;
+/**
+ * Find the closing '"' of a string that contains escapes, `ptr` is the first
+ * character the string scanner stopped on. Returns NULL if the string is not
+ * terminated before the end of the buffer.
+ */
+static const char *jsonFindStringEnd(jsonParser *p, const char *ptr) {
+    while (ptr < p->endptr && *ptr != '"' && *ptr != '\0') {
+        ptr += *ptr == '\\' ? 2 : 1;
+        if (ptr < p->endptr) {
+            ptr = p->kernels->scanString(ptr, p->endptr);
         }
-        end++;
     }
 
-    if (jsonUnsafePeekAt(p, end) == '\0') {
-        p->errno = JSON_EOF;
+    if (ptr >= p->endptr || *ptr == '\0') {
         return NULL;
     }
+    return ptr;
+}
 
+/**
+ * Decode the string from the parsers offset up to `end` into `str`. Clean
+ * runs are copied wholesale, escapes are decoded a character at a time. The
+ * output is never longer than the input so `str` may alias the buffer.
+ * Returns 0 and sets `p->errno` on an invalid escape.
+ */
+static int jsonUnescape(jsonParser *p, char *str, const char *end,
+                        size_t *outlen) {
     size_t len = 0;
-    char *str = (char *)jsonAlloc(p->allocator, sizeof(char) * end - start);
+    const char *ptr;
+
+    while (1) {
+        const char *run = p->buffer + p->offset;
+        ptr = p->kernels->scanString(run, end);
+        memmove(str + len, run, ptr - run);
+        len += ptr - run;
+        jsonUnsafeAdvanceBy(p, ptr - run);
+
+        if (ptr == end) {
+            break;
+        }
+
+        /* Control characters are let through as they are */
+        if (*ptr != '\\') {
+            __bufput(str, &len, *ptr);
+            jsonUnsafeAdvanceBy(p, 1);
+            continue;
+        }
 
-    while (run && jsonPeek(p) != '\0') {
+        jsonUnsafeAdvanceBy(p, 1);
         switch (jsonPeek(p)) {
         case '\\':
-            jsonAdvance(p);
-            switch (jsonPeek(p)) {
-            case '\\':
-            case '"':
-            case '/':
-                __bufput(str, &len, jsonPeek(p));
-                break;
-            case 'b':
-                __bufput(str, &len, '\b');
-                break;
-            case 'f':
-                __bufput(str, &len, '\f');
-                break;
-            case 'n':
-                __bufput(str, &len, '\n');
-                break;
-            case 'r':
-                __bufput(str, &len, '\r');
-                break;
-            case 't':
-                __bufput(str, &len, '\t');
-                break;
-            case 'u': {
-                unsigned int codepoint = jsonParseUTF16(p);
-                if (p->errno != JSON_OK) {
-                    goto err;
-                }
-                utf8Encode(str, codepoint, &len);
-                break;
-            }
-            default:
-                p->errno = JSON_INVALID_ESCAPE_CHARACTER;
-                goto err;
-            }
-            break;
         case '"':
-            run = 0;
-            break;
-        default:
+        case '/':
             __bufput(str, &len, jsonPeek(p));
             break;
+        case 'b':
+            __bufput(str, &len, '\b');
+            break;
+        case 'f':
+            __bufput(str, &len, '\f');
+            break;
+        case 'n':
+            __bufput(str, &len, '\n');
+            break;
+        case 'r':
+            __bufput(str, &len, '\r');
+            break;
+        case 't':
+            __bufput(str, &len, '\t');
+            break;
+        case 'u': {
+            unsigned int codepoint = jsonParseUTF16(p, end);
+            if (p->errno != JSON_OK) {
+                return 0;
+            }
+            utf8Encode(str, codepoint, &len);
+            break;
         }
-        jsonAdvance(p);
-    }
-
-    if (jsonPeek(p) == '"') {
-        p->errno = JSON_INVALID_STRING_NOT_TERMINATED;
-        goto err;
+        default:
+            p->errno = JSON_INVALID_ESCAPE_CHARACTER;
+            return 0;
+        }
+        jsonUnsafeAdvanceBy(p, 1);
     }
 
-    str[len] = '\0';
-    return str;
-
-err:
-    /* @Leak */
-    return NULL;
+    *outlen = len;
+    return 1;
 }
 
 /**
- * Parse json boolean
- * 1: true
- * 0: false
- * -1: error
+ * Parse a string starting at the opening '"'. Runs of characters that do not
+ * need unescaping are found with the SIMD string scanner and copied into the
+ * arena wholesale, only escapes are decoded a character at a time.
+ *
+ * With JSON_INSITU_FLAG the string is decoded over the top of itself in the
+ * buffer and terminated where the closing '"' was, nothing is allocated.
  */
-static int jsonParseBool(jsonParser *p) {
-    char peek = jsonPeek(p);
-    int retval = -1;
+static char *jsonParseString(jsonParser *p) {
+    const char *end, *ptr;
+    char *start;
+    size_t len = 0;
+    char *str;
+    int insitu = p->flags & JSON_INSITU_FLAG;
 
-    /* Check if the next character in the buffer is 't' for true */
-    if (peek == 't') {
-        if (!jsonCanAdvanceBy(p, 4)) {
-            p->errno = JSON_CANNOT_ADVANCE;
-            return -1;
-        }
-        /* check next 3 characters for 'rue' */
-        retval = strncmp(p->buffer + p->offset + 1, "rue", 3) == 0 ? 1 : -1;
-        jsonUnsafeAdvanceBy(p, 4);
+    if (jsonPeek(p) == '"') {
+        jsonAdvance(p);
     }
-    /* Check if the next character in the buffer is 'f' for false */
-    else if (peek == 'f') {
-        if (!jsonCanAdvanceBy(p, 5)) {
-            p->errno = JSON_CANNOT_ADVANCE;
-            return -1;
+
+    start = p->buffer + p->offset;
+    ptr = p->kernels->scanString(start, p->endptr);
+
+    /* Happy path, nothing to unescape so copy it in one go */
+    if (ptr < p->endptr && *ptr == '"') {
+        len = ptr - start;
+        if (insitu) {
+            str = start;
+        } else {
+            str = (char *)jsonAlloc(p->allocator, len + 1);
+            memcpy(str, start, len);
         }
-        /* check next 4 characters for 'alse' */
-        retval = strncmp(p->buffer + p->offset + 1, "alse", 4) == 0 ? 0 : -1;
-        jsonUnsafeAdvanceBy(p, 5);
+        jsonUnsafeAdvanceBy(p, len);
+        goto terminate;
     }
 
-    /* Failed to parse boolean */
-    if (retval == -1) {
-        p->errno = JSON_CANNOT_ADVANCE;
+    /* Find the closing quote so we know how much space is needed, the
+     * decoded string can only ever be shorter than the raw one */
+    if ((end = jsonFindStringEnd(p, ptr)) == NULL) {
+        p->errno = JSON_EOF;
+        return NULL;
     }
-    return retval;
-}
 
-/**
- * Parse json null
- * 1: success
- * -1: error
- */
-static int jsonParseNull(jsonParser *p) {
-    if (!jsonCanAdvanceBy(p, 4)) {
-        p->errno = JSON_CANNOT_ADVANCE;
-        return -1;
+    /* Decoding never writes ahead of what has been read */
+    if (insitu) {
+        str = start;
+    } else {
+        str = (char *)jsonAlloc(p->allocator, (end - start) + 1);
     }
-    int retval = strncmp(p->buffer + p->offset, "null", 4) == 0 ? 1 : -1;
-    jsonUnsafeAdvanceBy(p, 4);
-    return retval;
+
+    if (!jsonUnescape(p, str, end, &len)) {
+        /* @Leak */
+        return NULL;
+    }
+
+terminate:
+    str[len] = '\0';
+    /* Move past the closing '"', it can not be the last byte */
+    jsonAdvance(p);
+    if (p->errno == JSON_OK && jsonPeek(p) == '"') {
+        p->errno = JSON_INVALID_STRING_NOT_TERMINATED;
+        return NULL;
+    }
+    return str;
 }
 
 /**
- * Given a small amount of starting characters that JSON can be;
+ * Check the escapes of a string that will be decoded later, `ptr` is the
+ * first one and `end` the closing '"'. \u escapes go through jsonParseUTF16
+ * so surrogate pairs are checked too, a bad escape fails with the error and
+ * offset `jsonUnescape` would give. The offset is left alone otherwise.
+ */
+static int jsonValidateEscapes(jsonParser *p, const char *ptr,
+                               const char *end) {
+    size_t offset = p->offset;
+
+    while ((ptr = memchr(ptr, '\\', end - ptr)) != NULL) {
+        switch (ptr[1]) {
+        case '\\':
+        case '"':
+        case '/':
+        case 'b':
+        case 'f':
+        case 'n':
+        case 'r':
+        case 't':
+            ptr += 2;
+            break;
+        case 'u':
+            p->offset = (ptr + 1) - p->buffer;
+            jsonParseUTF16(p, end);
+            if (p->errno != JSON_OK) {
+                return 0;
+            }
+            /* Left on the last hex digit */
+            ptr = p->buffer + p->offset + 1;
+            break;
+        default:
+            p->offset = (ptr + 1) - p->buffer;
+            p->errno = JSON_INVALID_ESCAPE_CHARACTER;
+            return 0;
+        }
+    }
+    p->offset = offset;
+    return 1;
+}
+
+/**
+ * With JSON_LAZY_STRING_FLAG string values are left in the buffer. `J->str`
+ * points to the first character after the opening '"' and `J->aux` holds the
+ * length along with whether the string needs unescaping, `jsonGetString`
+ * makes a '\0' terminated copy the first time it is called.
+ */
+static void jsonParseStringView(jsonParser *p, json *J) {
+    const char *end, *ptr;
+    char *start;
+    unsigned int aux = JSON_AUX_LAZY;
+
+    if (jsonPeek(p) == '"') {
+        jsonAdvance(p);
+    }
+
+    start = p->buffer + p->offset;
+    ptr = p->kernels->scanString(start, p->endptr);
+
+    if (ptr < p->endptr && *ptr == '"') {
+        end = ptr;
+    } else if ((end = jsonFindStringEnd(p, ptr)) == NULL) {
+        p->errno = JSON_EOF;
+        return;
+    } else if (!jsonValidateEscapes(p, ptr, end)) {
+        return;
+    } else {
+        aux |= JSON_AUX_ESCAPED;
+    }
+
+    /* Too long to be described by aux, decode it now */
+    if ((size_t)(end - start) > JSON_AUX_LEN_MASK) {
+        J->str = jsonParseString(p);
+        return;
+    }
+
+    J->str = start;
+    J->aux = aux | (unsigned int)(end - start);
+    J->state = p->state;
+    jsonUnsafeAdvanceBy(p, end - start);
+    /* Move past the closing '"', it can not be the last byte */
+    jsonAdvance(p);
+    if (p->errno == JSON_OK && jsonPeek(p) == '"') {
+        p->errno = JSON_INVALID_STRING_NOT_TERMINATED;
+    }
+}
+
+/**
+ * Turn a string left in the buffer by JSON_LAZY_STRING_FLAG into a '\0'
+ * terminated string in the arena. The escapes were checked when parsed, a
+ * failure to decode is still recorded on the documents state and NULL is
+ * returned.
+ */
+static char *jsonMaterializeString(json *J) {
+    size_t len = J->aux & JSON_AUX_LEN_MASK;
+    char *str = (char *)jsonAlloc((jsonAllocator *)J->state->mem, len + 1);
+
+    if (J->aux & JSON_AUX_ESCAPED) {
+        jsonParser p;
+        p.flags = JSON_NO_FLAGS;
+        p.buffer = J->str;
+        p.offset = 0;
+        /* Include the closing '"' so bounds match the original parse */
+        p.buflen = len + 1;
+        p.endptr = p.buffer + p.buflen;
+        p.errno = JSON_OK;
+        p.kernels = jsonKernels();
+        if (!jsonUnescape(&p, str, J->str + len, &len)) {
+            if (J->state->error == JSON_OK) {
+                J->state->error = p.errno;
+                J->state->ch = p.buffer[p.offset];
+                J->state->offset = p.offset;
+            }
+            return NULL;
+        }
+    } else {
+        memcpy(str, J->str, len);
+    }
+
+    str[len] = '\0';
+    J->str = str;
+    J->aux = 0;
+    return str;
+}
+
+/**
+ * With JSON_STRNUM_FLAG numbers are copied verbatim up to their terminator
+ */
+static char *jsonParseStrnum(jsonParser *p) {
+    const char *start = p->buffer + p->offset;
+    const char *ptr = start;
+
+    while (ptr < p->endptr && !isNumTerminator(*ptr)) {
+        ++ptr;
+    }
+
+    size_t len = ptr - start;
+    char *str = (char *)jsonAlloc(p->allocator, len + 1);
+    memcpy(str, start, len);
+    str[len] = '\0';
+    jsonUnsafeAdvanceBy(p, len);
+    return str;
+}
+
+/**
+ * Parse json boolean
+ * 1: true
+ * 0: false
+ * -1: error
+ */
+static int jsonParseBool(jsonParser *p) {
+    char peek = jsonPeek(p);
+    int retval = -1;
+
+    /* Check if the next character in the buffer is 't' for true */
+    if (peek == 't') {
+        if (!jsonCanAdvanceBy(p, 4)) {
+            p->errno = JSON_CANNOT_ADVANCE;
+            return -1;
+        }
+        /* check next 3 characters for 'rue' */
+        retval = strncmp(p->buffer + p->offset + 1, "rue", 3) == 0 ? 1 : -1;
+        jsonUnsafeAdvanceBy(p, 4);
+    }
+    /* Check if the next character in the buffer is 'f' for false */
+    else if (peek == 'f') {
+        if (!jsonCanAdvanceBy(p, 5)) {
+            p->errno = JSON_CANNOT_ADVANCE;
+            return -1;
+        }
+        /* check next 4 characters for 'alse' */
+        retval = strncmp(p->buffer + p->offset + 1, "alse", 4) == 0 ? 0 : -1;
+        jsonUnsafeAdvanceBy(p, 5);
+    }
+
+    /* Failed to parse boolean */
+    if (retval == -1) {
+        p->errno = JSON_CANNOT_ADVANCE;
+    }
+    return retval;
+}
+
+/**
+ * Parse json null
+ * 1: success
+ * -1: error
+ */
+static int jsonParseNull(jsonParser *p) {
+    if (!jsonCanAdvanceBy(p, 4)) {
+        p->errno = JSON_CANNOT_ADVANCE;
+        return -1;
+    }
+    int retval = strncmp(p->buffer + p->offset, "null", 4) == 0 ? 1 : -1;
+    jsonUnsafeAdvanceBy(p, 4);
+    if (retval == -1) {
+        p->errno = JSON_CANNOT_ADVANCE;
+    }
+    return retval;
+}
+
+/**
+ * Given a small amount of starting characters that JSON can be;
  * set what type is ready for the parser
  */
 static int jsonSetExpectedType(jsonParser *p) {
@@ -1320,139 +3510,197 @@ static int jsonSetExpectedType(jsonParser *p) {
     return 1;
 }
 
+/* Containers nested deeper than this spill the parse stack on to the heap */
+#define JSON_PARSE_INLINE_DEPTH (32)
+
+typedef struct jsonParseFrame {
+    /* Object or array being filled in */
+    json *container;
+    /* The member currently being parsed */
+    json *member;
+} jsonParseFrame;
+
+static size_t json_max_depth = JSON_MAX_DEPTH;
+
+/**
+ * Move past the closing bracket of a container with `parents` containers
+ * around it. Only the outermost one can end on the last byte of the buffer.
+ */
+static void jsonCloseContainer(jsonParser *p, size_t parents) {
+    if (jsonCanAdvanceBy(p, 1)) {
+        jsonUnsafeAdvanceBy(p, 1);
+    } else if (parents) {
+        p->errno = JSON_EOF;
+    }
+}
+
+/* How deeply objects and arrays can nest before parsing fails with
+ * JSON_MAX_DEPTH_EXCEEDED, applies to all parsers */
+void jsonSetMaxDepth(size_t depth) {
+    json_max_depth = depth;
+}
+
+size_t jsonGetMaxDepth(void) {
+    return json_max_depth;
+}
+
 /**
- * Parse a json object starting with '{'
- * of return NULL if the next character is '}'
+ * Parse the object or array starting at the current character in to
+ * `p->ptr`. Rather than recursing for every nested container they are pushed
+ * on to an explicit stack, so a deeply nested document cannot blow up the C
+ * stack. An empty container, or one which fails without any members, is
+ * left NULL.
  */
-static json *jsonParseObject(jsonParser *p) {
-    /* move past '{' */
+static int jsonParseContainer(jsonParser *p) {
+    jsonParseFrame inline_stack[JSON_PARSE_INLINE_DEPTH];
+    jsonParseFrame *stack = inline_stack;
+    jsonParseFrame *frame = NULL;
+    size_t capacity = JSON_PARSE_INLINE_DEPTH;
+    size_t depth = 0;
+    json *J = p->ptr;
+    char ch, close;
+
+open:
+    /* `J` is the node for the container starting at '{' or '[' */
+    close = jsonPeek(p) == '{' ? '}' : ']';
+    J->type = close == '}' ? JSON_OBJECT : JSON_ARRAY;
+    J->object = NULL;
+    /* So an index can be built in the arena later */
+    J->state = p->state;
+    J->aux = p->flags & JSON_LAZY_INDEX_FLAG ? JSON_AUX_INDEXABLE : 0;
+    if (p->depth + depth >= json_max_depth) {
+        p->errno = JSON_MAX_DEPTH_EXCEEDED;
+        goto closed;
+    }
+
+    /* move past '{' or '[', the buffer can end right after it */
     jsonAdvance(p);
-    if (!jsonAdvanceWhitespace(p)) {
-        return NULL;
+    if (p->errno != JSON_OK || !jsonAdvanceWhitespace(p)) {
+        goto closed;
     }
 
-    /* Object is empty we can skip */
-    if (jsonPeek(p) == '}') {
-        jsonAdvance(p);
-        return NULL;
+    /* Container is empty we can skip */
+    if (jsonPeek(p) == close) {
+        jsonCloseContainer(p, p->depth + depth);
+        goto closed;
     }
-    char ch = '\0';
-    int can_advance = 0;
-    json *J;
-    json *val = jsonNew(p);
-    p->ptr = val;
 
-    while (1) {
-        J = p->ptr;
-        if (!jsonAdvanceWhitespace(p)) {
-            return NULL;
+    if (depth == capacity) {
+        jsonParseFrame *grown = (jsonParseFrame *)jsonMalloc(
+                sizeof(jsonParseFrame) * capacity * 2);
+        memcpy(grown, stack, sizeof(jsonParseFrame) * depth);
+        if (stack != inline_stack) {
+            jsonFree(stack);
         }
+        stack = grown;
+        capacity *= 2;
+    }
+
+    frame = &stack[depth++];
+    frame->container = J;
+    frame->member = jsonNew(p);
+    J->object = frame->member;
+    p->ptr = frame->member;
 
+member:
+    J = frame->member;
+    if (!jsonAdvanceWhitespace(p)) {
+        goto discard;
+    }
 
+    if (frame->container->type == JSON_OBJECT) {
         if (jsonPeek(p) != '"') {
             p->errno = JSON_INVALID_KEY_TERMINATOR_CHARACTER;
-            return NULL;
+            goto discard;
         }
 
         J->key = jsonParseString(p);
-        jsonAdvanceToTerminator(p, ':');
+        if (p->errno != JSON_OK || !jsonAdvanceWhitespace(p)) {
+            goto discard;
+        }
         if (jsonPeek(p) != ':') {
             p->errno = JSON_INVALID_KEY_TERMINATOR_CHARACTER;
-            return NULL;
+            goto discard;
         }
 
         jsonAdvance(p);
-        if (!jsonAdvanceWhitespace(p)) {
-            return NULL;
+        if (p->errno != JSON_OK || !jsonAdvanceWhitespace(p)) {
+            goto discard;
         }
+    }
 
+    if (!jsonSetExpectedType(p)) {
+        goto finish;
+    }
+    if (p->type == JSON_PARSER_OBJECT || p->type == JSON_PARSER_ARRAY) {
+        goto open;
+    }
+    if (!jsonParseValue(p)) {
+        goto finish;
+    }
 
-        if (!jsonSetExpectedType(p) || !jsonParseValue(p)) {
-            break;
-        }
-
-        if (!jsonAdvanceWhitespace(p)) {
-            return NULL;
-        }
-        ch = jsonPeek(p);
-        if (ch != ',') {
-            can_advance = jsonCanAdvanceBy(p, 1);
-            if (ch == '}' && can_advance) {
-                jsonAdvance(p);
-                break;
-            } else if (ch == '}' && !can_advance) {
-                break;
-            } else {
-                p->errno = JSON_INVALID_JSON_TYPE_CHAR;
-                return NULL;
-            }
+next:
+    /* The value ran up to the end of the buffer */
+    if (p->offset == p->buflen) {
+        p->offset--;
+        p->errno = JSON_EOF;
+        goto discard;
+    }
+    if (!jsonAdvanceWhitespace(p)) {
+        goto discard;
+    }
+    close = frame->container->type == JSON_OBJECT ? '}' : ']';
+    ch = jsonPeek(p);
+    if (ch != ',') {
+        if (ch != close) {
+            p->errno = close == '}' ? JSON_INVALID_JSON_TYPE_CHAR
+                                    : JSON_INVALID_ARRAY_CHARACTER;
+            goto discard;
         }
-
-        jsonAdvance(p);
-        J->next = jsonNew(p);
-        p->ptr = J->next;
+        jsonCloseContainer(p, p->depth + depth - 1);
+        goto finish;
     }
 
-    return val;
-}
-
-/**
- * Very similar to parsing an object where starting char is '[',
- * if array is empty return NULL
- */
-static json *jsonParseArray(jsonParser *p) {
-    /* move past '[' */
     jsonAdvance(p);
-    if (!jsonAdvanceWhitespace(p)) {
-        return NULL;
+    if (p->errno != JSON_OK) {
+        goto discard;
     }
-
-    /* array empty we can skip */
-    if (jsonPeek(p) == ']') {
-        jsonAdvance(p);
-        return NULL;
+    J->next = jsonNew(p);
+    frame->member = J->next;
+    p->ptr = J->next;
+    goto member;
+
+discard:
+    /* Throw away the members of the innermost container */
+    frame->container->object = NULL;
+    J = frame->container;
+    depth--;
+    goto closed;
+
+finish:
+    /* Keep the members of the innermost container parsed so far */
+    J = frame->container;
+    depth--;
+    if (J->type == JSON_ARRAY) {
+        p->ptr = J->array;
     }
 
-    char ch = '\0';
-    int can_advance = 0;
-    json *J;
-    json *val = jsonNew(p);
-    p->ptr = val;
-
-    while (1) {
-        J = p->ptr;
-        if (!jsonAdvanceWhitespace(p)) {
-            return NULL;
-        }
-
-        if (!jsonSetExpectedType(p) || !jsonParseValue(p)) {
-            break;
-        }
-
-        if (!jsonAdvanceWhitespace(p)) {
-            return NULL;
+closed:
+    /* Carry on with the parent of the container that was just closed, unless
+     * it stopped with an error in which case the parent stops too */
+    if (depth) {
+        frame = &stack[depth - 1];
+        J = frame->member;
+        if (p->errno != JSON_OK) {
+            goto finish;
         }
-        ch = jsonPeek(p);
-        if (ch != ',') {
-            can_advance = jsonCanAdvanceBy(p, 1);
-            if (ch == ']' && can_advance) {
-                jsonAdvance(p);
-                break;
-            } else if (ch == ']' && !can_advance) {
-                break;
-            } else {
-                p->errno = JSON_INVALID_ARRAY_CHARACTER;
-                return NULL;
-            }
-        }
-
-        jsonAdvance(p);
-        J->next = jsonNew(p);
-        p->ptr = J->next;
+        goto next;
     }
 
-    p->ptr = val;
-    return val;
+    if (stack != inline_stack) {
+        jsonFree(stack);
+    }
+    return p->errno == JSON_OK;
 }
 
 /**
@@ -1466,7 +3714,9 @@ static int jsonParseValue(jsonParser *p) {
     case JSON_PARSER_NUMERIC: {
         if (p->flags & JSON_STRNUM_FLAG) {
             J->type = JSON_STRNUM;
-            J->strnum = jsonParseString(p);
+            J->strnum = jsonParseStrnum(p);
+        } else if (p->flags & JSON_LAZY_NUMBER_FLAG) {
+            jsonParseNumberView(p);
         } else {
             jsonParseNumber(p);
         }
@@ -1475,7 +3725,11 @@ static int jsonParseValue(jsonParser *p) {
 
     case JSON_PARSER_STRING:
         J->type = JSON_STRING;
-        J->str = jsonParseString(p);
+        if (p->flags & JSON_LAZY_STRING_FLAG) {
+            jsonParseStringView(p, J);
+        } else {
+            J->str = jsonParseString(p);
+        }
         break;
 
     case JSON_PARSER_NULL:
@@ -1485,8 +3739,8 @@ static int jsonParseValue(jsonParser *p) {
         break;
 
     case JSON_PARSER_OBJECT:
-        J->type = JSON_OBJECT;
-        J->object = jsonParseObject(p);
+    case JSON_PARSER_ARRAY:
+        jsonParseContainer(p);
         break;
 
     case JSON_PARSER_BOOL:
@@ -1494,10 +3748,6 @@ static int jsonParseValue(jsonParser *p) {
         J->boolean = jsonParseBool(p);
         break;
 
-    case JSON_PARSER_ARRAY:
-        J->type = JSON_ARRAY;
-        J->array = jsonParseArray(p);
-        break;
     }
 
     return p->errno == JSON_OK;
@@ -1532,8 +3782,9 @@ static unsigned char *escapeString(char *buf) {
             escape_chars++;
             break;
         default:
+            /* Becomes \u00XX */
             if (*ptr < 32) {
-                escape_chars += 6;
+                escape_chars += 5;
             }
             break;
         }
@@ -1541,7 +3792,7 @@ static unsigned char *escapeString(char *buf) {
     }
 
     len = (size_t)(ptr - (unsigned char *)buf) + escape_chars;
-    outbuf = malloc(sizeof(char) * len+2);
+    outbuf = jsonMalloc(sizeof(char) * len+2);
 
     if (escape_chars == 0) {
         memcpy(outbuf, buf, len);
@@ -1579,8 +3830,9 @@ static unsigned char *escapeString(char *buf) {
                 __bufput(outbuf, &offset, 'r');
                 break;
             default:
-                offset += snprintf((char *)outbuf + offset, len-offset, "u%04x",
-                                  (unsigned int)*ptr);
+                /* +1 leaves room for snprintf's '\0' */
+                offset += snprintf((char *)outbuf + offset, len + 1 - offset,
+                                   "u%04x", (unsigned int)*ptr);
                 break;
             }
         }
@@ -1594,7 +3846,7 @@ static void printJsonKey(json *J) {
     if (J->key) {
         unsigned char *escape_str = escapeString(J->key);
         printf("\"%s\": ", escape_str);
-        free(escape_str);
+        jsonFree(escape_str);
     }
 }
 
@@ -1606,6 +3858,7 @@ static void __json_print(json *J, int depth) {
 
     while (J) {
         printDepth(depth);
+        jsonMaterializeNumber(J);
         switch (J->type) {
         case JSON_INT:
             printJsonKey(J);
@@ -1624,9 +3877,9 @@ static void __json_print(json *J, int depth) {
 
         case JSON_STRING:
             printJsonKey(J);
-            unsigned char *escape_str = escapeString(J->str);
+            unsigned char *escape_str = escapeString(jsonGetStringOrEmpty(J));
             printf("\"%s\"", escape_str);
-            free(escape_str);
+            jsonFree(escape_str);
             break;
 
         case JSON_ARRAY: {
@@ -1675,7 +3928,7 @@ static void __json_print(json *J, int depth) {
 /* Release the allocator */
 void jsonRelease(json *J) {
     jsonAllocator *allocator = (jsonAllocator *)J->state->mem;
-    jsonAllocatorRelease(allocator);
+    jsonAllocatorRetire(allocator);
 }
 
 static jsonString *_jsonGetStrerror(JSON_ERRNO error, char ch, size_t offset) {
@@ -1795,123 +4048,3395 @@ static jsonString *_jsonGetStrerror(JSON_ERRNO error, char ch, size_t offset) {
         jsonStringCatf(js, "Unexpected end of json buffer at position: %zu, unterminated whitespace",
                        offset);
         break;
+    case JSON_STOPPED:
+        jsonStringCatf(js, "Parsing stopped by a callback at position: %zu",
+                       offset);
+        break;
+    case JSON_DOCUMENT_TOO_LARGE:
+        jsonStringCatf(js, "Document too large to represent at position: %zu",
+                       offset);
+        break;
+    case JSON_MAX_DEPTH_EXCEEDED:
+        jsonStringCatf(js, "Maximum nesting depth of %zu exceeded at position: %zu",
+                       json_max_depth, offset);
+        break;
+    }
+    return js;
+}
+
+/* If the json has state this will return the error as a human readible string
+ * must be freed by the caller with `jsonFree` (allows it to be thread safe),
+ * which is plain free unless allocator hooks have been set. It would be
+ * advisable to use this for debugging purposes only as it calls malloc */
+char *jsonGetStrerror(json *J) {
+    if (!jsonOk(J)) {
+        jsonString *js = _jsonGetStrerror(J->state->error, J->state->ch,
+                                          J->state->offset);
+        char *buffer = js->buffer;
+        jsonFree(js);
+        return buffer;
+    }
+    return NULL;
+}
+
+/* Print the error to stderr */
+void jsonPrintError(json *J) {
+    char *str_error = jsonGetStrerror(J);
+    if (str_error) {
+        fprintf(stderr, "%s\n", str_error);
+        jsonFree(str_error);
+    } else {
+        fprintf(stderr, "No errors\n");
+    }
+}
+
+/**
+ * Parse a document allocating from `allocator`, returns NULL if there is
+ * nothing but whitespace.
+ */
+static json *jsonParseWithAllocator(char *raw_json, size_t buflen, int flags,
+                                    jsonAllocator *allocator) {
+    jsonParser p;
+    p.flags = flags;
+    jsonParserInit(&p, raw_json, buflen, allocator);
+
+    if (!jsonAdvanceWhitespace(&p)) {
+        return NULL;
+    }
+    char peek = jsonPeek(&p);
+    json *J = jsonNew(&p);
+
+    p.J = J;
+
+    /**
+     * Kick off parsing by finding the first non whitespace character,
+     * json has to start with either '{' or '['
+     */
+    if (peek == '{' || peek == '[') {
+        p.ptr = J;
+        jsonParseContainer(&p);
+    } else {
+        p.errno = JSON_CANNOT_START_PARSE;
+    }
+
+    J->state = p.state;
+    J->state->error = p.errno;
+    J->state->ch = p.offset < p.buflen ? p.buffer[p.offset] : '\0';
+    J->state->offset = p.offset;
+    J->state->mem = (void *)p.allocator;
+
+#ifdef ERROR_REPORTING
+    if (p.errno != JSON_OK) {
+        char *error_buf = _jsonGetStrerror(p.errno, jsonPeek(&p), p.offset);
+        json_debug("%s\n", error_buf);
+        jsonFree(error_buf);
+    }
+#endif
+
+    return J;
+}
+
+/**
+ * Parse null terminated string buffer to a json struct. The length of the json
+ * string must be known ahead of time.
+ *
+ * Pass in flags to modify the behaviour of the parser:
+ * - JSON_STRNUM_FLAG: do not try to parse numbers: floats,hex, ints etc..
+ *   will be treated as strings.
+ * - JSON_INSITU_FLAG: decode keys and strings in place, `raw_json` is
+ *   modified and must outlive the json.
+ * - JSON_LAZY_STRING_FLAG: leave string values in `raw_json`, which must
+ *   outlive the json, and only copy them out when asked for. Escapes are
+ *   still checked while parsing.
+ * - JSON_LAZY_NUMBER_FLAG: only check numbers, converting them when one of
+ *   the number getters is first called. `raw_json` must outlive the json.
+ * - JSON_STATE_FLAG: Maintain state for the parse, capturing errors
+ *
+ * You must free the resulting pointer with `jsonRelease`
+ */
+json *jsonParseWithLenAndFlags(char *raw_json, size_t buflen, int flags) {
+    return jsonParseWithHooks(raw_json, buflen, flags, NULL);
+}
+
+/**
+ * As `jsonParseWithLenAndFlags` but the arena holding the json gets its
+ * memory from `hooks`, or the global hooks if NULL, until `jsonRelease`.
+ * Scratch memory only needed while parsing still comes from the global hooks.
+ */
+json *jsonParseWithHooks(char *raw_json, size_t buflen, int flags,
+                         const jsonAllocatorHooks *hooks) {
+    jsonAllocator *allocator = jsonAllocatorAcquire(hooks);
+    json *J = jsonParseWithAllocator(raw_json, buflen, flags, allocator);
+
+    if (J == NULL) {
+        jsonAllocatorRetire(allocator);
+    }
+    return J;
+}
+
+/**
+ * Parse null terminated string buffer to a json struct. The length of the json
+ * string must be known ahead of time.
+ *
+ * You must free the resulting pointer with `jsonRelease`
+ */
+json *jsonParseWithLen(char *raw_json, size_t buflen) {
+    return jsonParseWithLenAndFlags(raw_json, buflen, JSON_NO_FLAGS);
+}
+
+/**
+ * Parse null terminated string buffer to a json struct strlen will be called
+ * to obtain the raw json string's length. Pass in flags to modify the
+ * behaviour of the parser.
+ *
+ * Pass in flags to modify the behaviour of the parser:
+ * - JSON_STRNUM_FLAG: do not try to parse numbers: floats,hex, ints etc..
+ *   will be treated as strings.
+ *
+ * You must free the resulting pointer with `jsonRelease`
+ */
+json *jsonParseWithFlags(char *raw_json, int flags) {
+    return jsonParseWithLenAndFlags(raw_json, strlen(raw_json), flags);
+}
+
+/**
+ * Parse null terminated string buffer to a json struct, strlen will be called
+ * to obtain the raw json string's length.
+ *
+ * You must free the resulting pointer with `jsonRelease`
+ */
+json *jsonParse(char *raw_json) {
+    return jsonParseWithLen(raw_json, strlen(raw_json));
+}
+
+/*=============================================================================
+ * Arenas
+ *
+ * A caller owned allocator for parsing one document after another. Resetting
+ * it rewinds the blocks rather than freeing them, so once it has grown to
+ * fit the largest document parsing no longer goes back to malloc.
+ *============================================================================*/
+struct jsonArena {
+    jsonAllocator *allocator;
+    /* Most that has been allocated between resets */
+    size_t high_water;
+};
+
+jsonArena *jsonArenaNew(void) {
+    return jsonArenaNewWithHooks(NULL);
+}
+
+/* An arena getting its memory from `hooks`, or the global hooks if NULL */
+jsonArena *jsonArenaNewWithHooks(const jsonAllocatorHooks *hooks) {
+    jsonAllocator *allocator = jsonAllocatorNewWithHooks(
+            JSON_ALLOCATOR_INITIAL_SIZE, hooks);
+    jsonArena *arena = (jsonArena *)allocator->hooks.malloc(
+            allocator->hooks.ctx, sizeof(jsonArena));
+    arena->allocator = allocator;
+    arena->high_water = 0;
+    return arena;
+}
+
+/**
+ * Parse in to `arena`, taking the same flags as `jsonParseWithLenAndFlags`.
+ * The json is valid until the arena is reset or released and must NOT be
+ * passed to `jsonRelease`.
+ */
+json *jsonParseIntoArena(jsonArena *arena, char *raw_json, size_t buflen,
+                         int flags) {
+    return jsonParseWithAllocator(raw_json, buflen, flags, arena->allocator);
+}
+
+/* Most bytes the arena has held at once, with each allocation rounded up to
+ * 8 bytes, for working out how much memory a request loop needs */
+size_t jsonArenaHighWaterMark(jsonArena *arena) {
+    if (arena->allocator->used > arena->high_water) {
+        arena->high_water = arena->allocator->used;
+    }
+    return arena->high_water;
+}
+
+/* Forget everything parsed in to the arena, keeping its memory for the next
+ * document. Blocks bigger than usual, from very long strings, are freed */
+void jsonArenaReset(jsonArena *arena) {
+    jsonArenaHighWaterMark(arena);
+    jsonAllocatorReset(arena->allocator);
+}
+
+void jsonArenaRelease(jsonArena *arena) {
+    if (arena) {
+        jsonAllocatorHooks hooks = arena->allocator->hooks;
+        jsonAllocatorRelease(arena->allocator);
+        hooks.free(hooks.ctx, arena);
+    }
+}
+
+/*=============================================================================
+ * JSON Lines
+ *
+ * Newline delimited records are parsed one after another out of the same
+ * allocator, which is reset rather than freed between them so a batch of
+ * small records does not go back to malloc for each one.
+ *============================================================================*/
+struct jsonLines {
+    char *buffer;
+    size_t buflen;
+    size_t offset;
+    /* Line the last record returned was on, from 1 */
+    size_t lineno;
+    int flags;
+    jsonAllocator *allocator;
+};
+
+/**
+ * Iterate over the records of newline delimited json in `buffer`, which must
+ * outlive the iterator. The buffer is only written to with JSON_INSITU_FLAG.
+ */
+jsonLines *jsonLinesNew(char *buffer, size_t buflen, int flags) {
+    jsonLines *lines = (jsonLines *)jsonMalloc(sizeof(jsonLines));
+    lines->buffer = buffer;
+    lines->buflen = buflen;
+    lines->offset = 0;
+    lines->lineno = 0;
+    lines->flags = flags;
+    lines->allocator = jsonAllocatorNew(JSON_ALLOCATOR_INITIAL_SIZE);
+    return lines;
+}
+
+/**
+ * Parse the next non blank line into the allocator without resetting it, so
+ * earlier records stay valid
+ */
+static json *jsonLinesParseNext(jsonLines *lines) {
+    while (lines->offset < lines->buflen) {
+        char *start = lines->buffer + lines->offset;
+        char *end;
+        size_t len;
+        json *J;
+
+        end = memchr(start, '\n', lines->buflen - lines->offset);
+        if (end) {
+            lines->offset = (end - lines->buffer) + 1;
+        } else {
+            end = lines->buffer + lines->buflen;
+            lines->offset = lines->buflen;
+        }
+        lines->lineno++;
+
+        len = end - start;
+        if (len && start[len - 1] == '\r') {
+            len--;
+        }
+        while (len && isWhiteSpace(*start)) {
+            start++;
+            len--;
+        }
+        if (len == 0) {
+            continue;
+        }
+
+        /* Bounded by the record so the parse never runs on in to the next
+         * one, which leaves the buffer alone for other threads */
+        J = jsonParseWithAllocator(start, len, lines->flags,
+                                   lines->allocator);
+        if (J) {
+            return J;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Parse the next record, skipping blank lines. A record that fails to parse
+ * is still returned so its error can be looked at, `jsonLinesNumber` says
+ * which line it was on. Returns NULL when there are no more lines.
+ *
+ * The record is only valid until the next call and must NOT be passed to
+ * `jsonRelease`.
+ */
+json *jsonLinesNext(jsonLines *lines) {
+    jsonAllocatorReset(lines->allocator);
+    return jsonLinesParseNext(lines);
+}
+
+/* Line number of the record last returned by `jsonLinesNext` */
+size_t jsonLinesNumber(jsonLines *lines) {
+    return lines->lineno;
+}
+
+void jsonLinesRelease(jsonLines *lines) {
+    if (lines) {
+        jsonAllocatorRelease(lines->allocator);
+        jsonFree(lines);
+    }
+}
+
+/**
+ * Call `callback` with every record of newline delimited json in `buffer`
+ * and the line it is on. Records that fail to parse are passed along too,
+ * check them with `jsonOk`. Stops early if `callback` returns non zero.
+ * Each record is only valid for the duration of its callback.
+ *
+ * Returns how many records failed to parse.
+ */
+size_t jsonParseLines(char *buffer, size_t buflen, int flags,
+                      jsonLinesCallback *callback, void *privdata) {
+    jsonLines *lines = jsonLinesNew(buffer, buflen, flags);
+    size_t failed = 0;
+    json *J;
+
+    while ((J = jsonLinesNext(lines)) != NULL) {
+        if (!jsonOk(J)) {
+            failed++;
+        }
+        if (callback(J, lines->lineno, privdata) != 0) {
+            break;
+        }
+    }
+
+    jsonLinesRelease(lines);
+    return failed;
+}
+
+/*=============================================================================
+ * Parallel JSON Lines
+ *
+ * The buffer is cut into chunks that end on a newline. Workers first count
+ * the lines in each chunk so every record knows its line number up front,
+ * then parse whole chunks into their own allocator and hand the records to
+ * the callback, one chunk at a time.
+ *
+ * Records are parsed bounded by their own length and nothing is written to
+ * the buffer, apart from strings unescaped in place with JSON_INSITU_FLAG,
+ * which stay inside the record they belong to.
+ *============================================================================*/
+#define JSON_LINES_MIN_CHUNK (1 << 16)
+#define JSON_LINES_MAX_CHUNK (1 << 22)
+/* Chunks per thread, more smooths over records that take longer to parse */
+#define JSON_LINES_CHUNKS_PER_THREAD (4)
+
+typedef struct jsonLinesChunk {
+    char *buffer;
+    size_t buflen;
+    /* Lines before this chunk */
+    size_t lineno;
+    /* Newlines in this chunk */
+    size_t newlines;
+} jsonLinesChunk;
+
+typedef struct jsonLinesPool {
+    jsonLinesChunk *chunks;
+    size_t chunk_count;
+    /* Next chunk for a worker to pick up */
+    size_t next_chunk;
+    /* Next chunk whose records can be delivered when ordered */
+    size_t next_deliver;
+    int counting;
+    int flags;
+    JSON_LINES_ORDER order;
+    jsonLinesCallback *callback;
+    void *privdata;
+    /* Set with both locks held so either is enough to read it */
+    int stop;
+    size_t failed;
+    pthread_mutex_t lock;
+    pthread_cond_t delivered;
+    /* Held while records are handed to the callback, so it is only ever
+     * called from one thread at a time without holding up the workers that
+     * are still parsing */
+    pthread_mutex_t deliver;
+} jsonLinesPool;
+
+typedef struct jsonLinesWorker {
+    jsonLinesPool *pool;
+    jsonAllocator *allocator;
+    json **records;
+    size_t *lineno;
+    size_t count;
+    size_t capacity;
+    pthread_t thread;
+} jsonLinesWorker;
+
+/* Claim the next chunk, returns -1 when they have all gone */
+static ssize_t jsonLinesPoolTake(jsonLinesPool *pool) {
+    ssize_t idx = -1;
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->stop && pool->next_chunk < pool->chunk_count) {
+        idx = pool->next_chunk++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return idx;
+}
+
+static size_t jsonCountNewlines(char *buffer, size_t buflen) {
+    char *end = buffer + buflen;
+    size_t count = 0;
+
+    while ((buffer = memchr(buffer, '\n', end - buffer)) != NULL) {
+        count++;
+        buffer++;
+    }
+    return count;
+}
+
+static void jsonLinesWorkerParse(jsonLinesWorker *worker,
+                                 jsonLinesChunk *chunk) {
+    jsonLines lines = {
+            .buffer = chunk->buffer,
+            .buflen = chunk->buflen,
+            .offset = 0,
+            .lineno = chunk->lineno,
+            .flags = worker->pool->flags,
+            .allocator = worker->allocator,
+    };
+    json *J;
+
+    jsonAllocatorReset(worker->allocator);
+    worker->count = 0;
+
+    while ((J = jsonLinesParseNext(&lines)) != NULL) {
+        if (worker->count == worker->capacity) {
+            worker->capacity = worker->capacity ? worker->capacity * 2 : 256;
+            worker->records = (json **)jsonRealloc(
+                    worker->records, sizeof(json *) * worker->capacity);
+            worker->lineno = (size_t *)jsonRealloc(
+                    worker->lineno, sizeof(size_t) * worker->capacity);
+        }
+        worker->records[worker->count] = J;
+        worker->lineno[worker->count] = lines.lineno;
+        worker->count++;
+    }
+}
+
+static void jsonLinesWorkerDeliver(jsonLinesWorker *worker) {
+    jsonLinesPool *pool = worker->pool;
+
+    pthread_mutex_lock(&pool->deliver);
+    for (size_t i = 0; i < worker->count && !pool->stop; ++i) {
+        if (!jsonOk(worker->records[i])) {
+            pool->failed++;
+        }
+        if (pool->callback(worker->records[i], worker->lineno[i],
+                           pool->privdata) != 0) {
+            pthread_mutex_lock(&pool->lock);
+            pool->stop = 1;
+            pthread_cond_broadcast(&pool->delivered);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->deliver);
+}
+
+static void *jsonLinesWorkerMain(void *arg) {
+    jsonLinesWorker *worker = (jsonLinesWorker *)arg;
+    jsonLinesPool *pool = worker->pool;
+    ssize_t idx;
+
+    while ((idx = jsonLinesPoolTake(pool)) != -1) {
+        jsonLinesChunk *chunk = &pool->chunks[idx];
+
+        if (pool->counting) {
+            chunk->newlines = jsonCountNewlines(chunk->buffer, chunk->buflen);
+            continue;
+        }
+
+        jsonLinesWorkerParse(worker, chunk);
+
+        if (pool->order == JSON_LINES_ORDERED) {
+            pthread_mutex_lock(&pool->lock);
+            while (!pool->stop && pool->next_deliver != (size_t)idx) {
+                pthread_cond_wait(&pool->delivered, &pool->lock);
+            }
+            pthread_mutex_unlock(&pool->lock);
+
+            jsonLinesWorkerDeliver(worker);
+
+            pthread_mutex_lock(&pool->lock);
+            pool->next_deliver++;
+            pthread_cond_broadcast(&pool->delivered);
+            pthread_mutex_unlock(&pool->lock);
+        } else {
+            jsonLinesWorkerDeliver(worker);
+        }
+    }
+    return NULL;
+}
+
+/* The workers that did start share out all of the chunks between them, if
+ * none could the calling thread works through them on its own */
+static void jsonLinesPoolRun(jsonLinesPool *pool, jsonLinesWorker *workers,
+                             int threads) {
+    int started = 0;
+
+    pool->next_chunk = 0;
+    while (started < threads &&
+           pthread_create(&workers[started].thread, NULL, jsonLinesWorkerMain,
+                          &workers[started]) == 0) {
+        started++;
+    }
+    if (started == 0) {
+        jsonLinesWorkerMain(&workers[0]);
+    }
+    for (int i = 0; i < started; ++i) {
+        pthread_join(workers[i].thread, NULL);
+    }
+}
+
+/* Cut the buffer into chunks of roughly `chunk_size` that end on a newline */
+static jsonLinesChunk *jsonLinesSplit(char *buffer, size_t buflen,
+                                      size_t chunk_size, size_t *_count) {
+    size_t capacity = buflen / chunk_size + 1;
+    jsonLinesChunk *chunks =
+            (jsonLinesChunk *)jsonMalloc(sizeof(jsonLinesChunk) * capacity);
+    size_t count = 0;
+    size_t offset = 0;
+
+    while (offset < buflen) {
+        size_t end = offset + chunk_size;
+        char *newline;
+
+        if (end >= buflen) {
+            end = buflen;
+        } else if ((newline = memchr(buffer + end, '\n', buflen - end))) {
+            end = (newline - buffer) + 1;
+        } else {
+            end = buflen;
+        }
+
+        if (count == capacity) {
+            capacity *= 2;
+            chunks = (jsonLinesChunk *)jsonRealloc(
+                    chunks, sizeof(jsonLinesChunk) * capacity);
+        }
+        chunks[count].buffer = buffer + offset;
+        chunks[count].buflen = end - offset;
+        chunks[count].lineno = 0;
+        chunks[count].newlines = 0;
+        count++;
+        offset = end;
+    }
+
+    *_count = count;
+    return chunks;
+}
+
+/**
+ * Like `jsonParseLines` but spread over `threads` workers, 0 uses one per
+ * online cpu. With JSON_LINES_ORDERED records arrive in the order they
+ * appear in the buffer, JSON_LINES_UNORDERED hands them over as soon as a
+ * worker has parsed them. Either way `callback` is never called from two
+ * threads at once, though it may be called from any of them.
+ *
+ * Returns how many records failed to parse.
+ */
+size_t jsonParseLinesParallel(char *buffer, size_t buflen, int flags,
+                              int threads, JSON_LINES_ORDER order,
+                              jsonLinesCallback *callback, void *privdata) {
+    jsonLinesPool pool;
+    jsonLinesWorker *workers;
+    size_t chunk_size, lineno = 0;
+
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+
+    chunk_size = buflen / ((size_t)threads * JSON_LINES_CHUNKS_PER_THREAD);
+    if (chunk_size < JSON_LINES_MIN_CHUNK) {
+        chunk_size = JSON_LINES_MIN_CHUNK;
+    } else if (chunk_size > JSON_LINES_MAX_CHUNK) {
+        chunk_size = JSON_LINES_MAX_CHUNK;
+    }
+
+    pool.chunks = jsonLinesSplit(buffer, buflen, chunk_size,
+                                 &pool.chunk_count);
+    pool.next_deliver = 0;
+    pool.flags = flags;
+    pool.order = order;
+    pool.callback = callback;
+    pool.privdata = privdata;
+    pool.stop = 0;
+    pool.failed = 0;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.delivered, NULL);
+    pthread_mutex_init(&pool.deliver, NULL);
+
+    if ((size_t)threads > pool.chunk_count) {
+        threads = pool.chunk_count ? (int)pool.chunk_count : 1;
+    }
+
+    workers = (jsonLinesWorker *)jsonCalloc(threads, sizeof(jsonLinesWorker));
+    for (int i = 0; i < threads; ++i) {
+        workers[i].pool = &pool;
+        workers[i].allocator = jsonAllocatorNew(JSON_ALLOCATOR_INITIAL_SIZE);
+    }
+
+    pool.counting = 1;
+    jsonLinesPoolRun(&pool, workers, threads);
+    for (size_t i = 0; i < pool.chunk_count; ++i) {
+        pool.chunks[i].lineno = lineno;
+        lineno += pool.chunks[i].newlines;
+    }
+
+    pool.counting = 0;
+    jsonLinesPoolRun(&pool, workers, threads);
+
+    for (int i = 0; i < threads; ++i) {
+        jsonAllocatorRelease(workers[i].allocator);
+        jsonFree(workers[i].records);
+        jsonFree(workers[i].lineno);
+    }
+    jsonFree(workers);
+    jsonFree(pool.chunks);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.delivered);
+    pthread_mutex_destroy(&pool.deliver);
+    return pool.failed;
+}
+
+/*=============================================================================
+ * Parallel arrays
+ *
+ * A document that is one big top level array is cut into groups of
+ * consecutive elements. The boundaries come from the structural index, or a
+ * plain scan for buffers too big for it, which only has to track nesting and
+ * notice commas one level deep. Each group is then parsed on a worker with
+ * its own allocator and the groups' lists of elements are linked together.
+ * Every group must finish exactly where the next one starts, so the result
+ * is the same as parsing the array in one go.
+ *============================================================================*/
+#define JSON_ARRAY_MIN_GROUP (1 << 16)
+#define JSON_ARRAY_GROUPS_PER_THREAD (4)
+
+typedef struct jsonArrayGroup {
+    /* Offset of the first element */
+    size_t start;
+    /* Offset of the first element of the next group, or the buffer length */
+    size_t end;
+    json *head;
+    json *tail;
+    JSON_ERRNO error;
+    size_t error_offset;
+    /* The error was between elements rather than inside one, which throws
+     * away the members of the array as jsonParseContainer does */
+    int discard;
+} jsonArrayGroup;
+
+typedef struct jsonArraySplitter {
+    jsonArrayGroup *groups;
+    size_t count;
+    size_t capacity;
+    size_t group_size;
+    size_t depth;
+    /* Next thing at depth 1 is the start of an element */
+    int expect_element;
+    /* The root was not an array or has been closed */
+    int done;
+} jsonArraySplitter;
+
+typedef struct jsonArrayPool {
+    char *buffer;
+    size_t buflen;
+    int flags;
+    /* Of the root, lazy values point at it to find the allocator */
+    jsonState *state;
+    jsonArrayGroup *groups;
+    size_t count;
+    size_t next_group;
+    pthread_mutex_t lock;
+} jsonArrayPool;
+
+typedef struct jsonArrayWorker {
+    jsonArrayPool *pool;
+    jsonAllocator *allocator;
+    pthread_t thread;
+} jsonArrayWorker;
+
+/* Look at one structural character or start of a value at `offset` */
+static void jsonArraySplitterStep(jsonArraySplitter *splitter, char ch,
+                                  size_t offset) {
+    if (splitter->done) {
+        return;
+    } else if (splitter->depth == 0 && ch != '[') {
+        splitter->done = 1;
+        return;
+    }
+
+    if (splitter->depth == 1 && splitter->expect_element) {
+        splitter->expect_element = 0;
+        if (splitter->count == 0 ||
+            offset - splitter->groups[splitter->count - 1].start >=
+                    splitter->group_size) {
+            if (splitter->count == splitter->capacity) {
+                splitter->capacity = splitter->capacity * 2 + 16;
+                splitter->groups = (jsonArrayGroup *)jsonRealloc(
+                        splitter->groups,
+                        sizeof(jsonArrayGroup) * splitter->capacity);
+            }
+            if (splitter->count) {
+                splitter->groups[splitter->count - 1].end = offset;
+            }
+            splitter->groups[splitter->count].start = offset;
+            splitter->count++;
+        }
+    }
+
+    switch (ch) {
+    case '[':
+    case '{':
+        splitter->depth++;
+        if (splitter->depth == 1) {
+            splitter->expect_element = 1;
+        }
+        break;
+    case ']':
+    case '}':
+        if (--splitter->depth == 0) {
+            splitter->done = 1;
+        }
+        break;
+    case ',':
+        if (splitter->depth == 1) {
+            splitter->expect_element = 1;
+        }
+        break;
+    }
+}
+
+/* Without the index every non whitespace character outside of a string is
+ * stepped over, the splitter ignores ones that cannot start an element */
+static void jsonArraySplitScan(jsonArraySplitter *splitter, const char *buf,
+                               size_t buflen) {
+    int in_string = 0;
+
+    for (size_t i = 0; i < buflen; ++i) {
+        char ch = buf[i];
+
+        if (in_string) {
+            if (ch == '\\') {
+                i++;
+            } else if (ch == '"') {
+                in_string = 0;
+            }
+        } else if (!isJsonWhiteSpace(ch)) {
+            in_string = ch == '"';
+            jsonArraySplitterStep(splitter, ch, i);
+        }
+    }
+}
+
+/* Cut the array into groups of roughly `group_size`, returns the number of
+ * groups and 0 if the buffer is not an array */
+static size_t jsonArraySplit(jsonArraySplitter *splitter,
+                             const jsonSimdKernels *kernels, const char *buf,
+                             size_t buflen) {
+    jsonIndex *index = jsonIndexNew(kernels, buf, buflen);
+
+    if (index) {
+        for (size_t i = 0; i < index->len; ++i) {
+            size_t offset = index->indices[i];
+            jsonArraySplitterStep(splitter, buf[offset], offset);
+        }
+        jsonIndexRelease(index);
+    } else {
+        jsonArraySplitScan(splitter, buf, buflen);
+    }
+
+    if (splitter->count) {
+        splitter->groups[splitter->count - 1].end = buflen;
+    }
+    return splitter->count;
+}
+
+/**
+ * Parse the elements of one group, linking them together. Only the last
+ * group may end the array.
+ */
+static void jsonArrayGroupParse(jsonParser *p, jsonArrayGroup *group,
+                                int last) {
+    json *J;
+
+    p->offset = group->start;
+    p->errno = JSON_OK;
+    group->head = jsonNew(p);
+    group->discard = 1;
+    p->ptr = group->head;
+
+    while (1) {
+        J = p->ptr;
+        if (!jsonAdvanceWhitespace(p)) {
+            break;
+        }
+        if (!jsonSetExpectedType(p) || !jsonParseValue(p)) {
+            group->discard = 0;
+            break;
+        }
+        /* As in jsonParseContainer, the array can not end with the value */
+        if (p->offset == p->buflen) {
+            p->offset--;
+            p->errno = JSON_EOF;
+            break;
+        }
+        if (!jsonAdvanceWhitespace(p)) {
+            break;
+        }
+
+        char ch = jsonPeek(p);
+        if (ch == ']' && last) {
+            break;
+        } else if (ch != ',') {
+            p->errno = JSON_INVALID_ARRAY_CHARACTER;
+            break;
+        }
+
+        jsonAdvance(p);
+        if (p->errno != JSON_OK || !jsonAdvanceWhitespace(p)) {
+            break;
+        }
+        if (!last && p->offset >= group->end) {
+            /* The next element belongs to the next group, overshooting means
+             * the split was thrown by invalid json */
+            if (p->offset != group->end) {
+                p->errno = JSON_INVALID_ARRAY_CHARACTER;
+            }
+            break;
+        }
+
+        J->next = jsonNew(p);
+        p->ptr = J->next;
+    }
+
+    group->tail = J;
+    group->error = p->errno;
+    group->error_offset = p->offset;
+}
+
+static void *jsonArrayWorkerMain(void *arg) {
+    jsonArrayWorker *worker = (jsonArrayWorker *)arg;
+    jsonArrayPool *pool = worker->pool;
+    jsonParser p;
+
+    p.flags = pool->flags;
+    jsonParserInit(&p, pool->buffer, pool->buflen, worker->allocator);
+    p.state = pool->state;
+    /* Elements are inside the root array */
+    p.depth = 1;
+
+    while (1) {
+        size_t idx;
+
+        pthread_mutex_lock(&pool->lock);
+        idx = pool->next_group++;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (idx >= pool->count) {
+            break;
+        }
+        jsonArrayGroupParse(&p, &pool->groups[idx], idx == pool->count - 1);
+    }
+    return NULL;
+}
+
+/**
+ * Parse a document that is a single top level array of many elements on
+ * `threads` workers, 0 uses one per online cpu. Anything else, or an array
+ * too small to be worth splitting, is parsed as `jsonParseWithLenAndFlags`
+ * would. Takes the same flags and the result is freed with `jsonRelease`.
+ *
+ * With JSON_INSITU_FLAG the array is parsed on the calling thread, a group
+ * that runs past its end on invalid json would otherwise read strings
+ * another worker is unescaping in place and fail differently.
+ */
+json *jsonParseArrayParallel(char *raw_json, size_t buflen, int flags,
+                             int threads) {
+    jsonArraySplitter splitter = {0};
+    jsonArrayPool pool;
+    jsonArrayWorker *workers;
+    jsonParser p;
+    json *J, *prev = NULL;
+    int started = 0;
+
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+
+    splitter.group_size =
+            buflen / ((size_t)threads * JSON_ARRAY_GROUPS_PER_THREAD);
+    if (splitter.group_size < JSON_ARRAY_MIN_GROUP) {
+        splitter.group_size = JSON_ARRAY_MIN_GROUP;
+    }
+
+    if (threads == 1 || (flags & JSON_INSITU_FLAG) ||
+        jsonArraySplit(&splitter, jsonKernels(), raw_json, buflen) < 2) {
+        jsonFree(splitter.groups);
+        return jsonParseWithLenAndFlags(raw_json, buflen, flags);
+    }
+
+    p.flags = flags;
+    jsonParserInit(&p, raw_json, buflen, NULL);
+    J = jsonNew(&p);
+    J->type = JSON_ARRAY;
+    J->aux = flags & JSON_LAZY_INDEX_FLAG ? JSON_AUX_INDEXABLE : 0;
+
+    pool.buffer = raw_json;
+    pool.buflen = buflen;
+    pool.flags = flags;
+    pool.state = p.state;
+    pool.groups = splitter.groups;
+    pool.count = splitter.count;
+    pool.next_group = 0;
+    pthread_mutex_init(&pool.lock, NULL);
+
+    if ((size_t)threads > pool.count) {
+        threads = (int)pool.count;
+    }
+
+    workers = (jsonArrayWorker *)jsonCalloc(threads, sizeof(jsonArrayWorker));
+    for (int i = 0; i < threads; ++i) {
+        workers[i].pool = &pool;
+        workers[i].allocator = jsonAllocatorNewWithHooks(
+                JSON_ALLOCATOR_INITIAL_SIZE, &p.allocator->hooks);
+    }
+    while (started < threads &&
+           pthread_create(&workers[started].thread, NULL, jsonArrayWorkerMain,
+                          &workers[started]) == 0) {
+        started++;
+    }
+    /* Groups the missing workers would have taken are parsed here */
+    if (started < threads) {
+        jsonArrayWorkerMain(&workers[started]);
+    }
+
+    for (int i = 0; i < threads; ++i) {
+        if (i < started) {
+            pthread_join(workers[i].thread, NULL);
+        }
+        jsonAllocatorAdopt(p.allocator, workers[i].allocator);
+    }
+
+    /* Groups before the first error all parsed exactly as they would have in
+     * one go, so that error is the one a plain parse would have found */
+    for (size_t i = 0; i < pool.count; ++i) {
+        jsonArrayGroup *group = &pool.groups[i];
+
+        if (prev) {
+            prev->next = group->head;
+        } else {
+            J->array = group->head;
+        }
+        prev = group->tail;
+
+        p.offset = group->error_offset;
+        if (group->error != JSON_OK) {
+            p.errno = group->error;
+            prev->next = NULL;
+            if (group->discard) {
+                J->array = NULL;
+            }
+            break;
+        }
+    }
+    if (p.errno == JSON_OK) {
+        /* The last group stopped on the ']' */
+        jsonCloseContainer(&p, 0);
+    }
+
+    J->state = p.state;
+    J->state->error = p.errno;
+    J->state->ch = p.offset < buflen ? p.buffer[p.offset] : '\0';
+    J->state->offset = p.offset;
+    J->state->mem = (void *)p.allocator;
+
+    jsonFree(workers);
+    jsonFree(pool.groups);
+    pthread_mutex_destroy(&pool.lock);
+    return J;
+}
+
+/*=============================================================================
+ * On demand
+ *
+ * A jsonDoc is walked with cursors rather than parsed into a tree. Only the
+ * values that are asked for are parsed, with the same routines the tree
+ * parser uses, everything else is stepped over by matching brackets and
+ * nothing is allocated for it. Cursors only move forward through a document.
+ *============================================================================*/
+#define JSON_CURSOR_FRESH  (0)
+#define JSON_CURSOR_ACTIVE (1)
+#define JSON_CURSOR_END    (2)
+
+struct jsonDoc {
+    jsonParser p;
+    /* First error hit, after which every cursor stops */
+    JSON_ERRNO error;
+    size_t error_offset;
+};
+
+/**
+ * Walk `buffer` on demand, which must outlive the doc. Strings handed out by
+ * cursors are valid until `jsonDocRelease`.
+ */
+jsonDoc *jsonDocNew(char *buffer, size_t buflen) {
+    jsonDoc *doc = (jsonDoc *)jsonMalloc(sizeof(jsonDoc));
+    doc->p.flags = JSON_NO_FLAGS;
+    jsonParserInit(&doc->p, buffer, buflen, NULL);
+    doc->error = JSON_OK;
+    doc->error_offset = 0;
+    return doc;
+}
+
+void jsonDocRelease(jsonDoc *doc) {
+    if (doc) {
+        jsonAllocatorRetire(doc->p.allocator);
+        jsonFree(doc);
+    }
+}
+
+/* The first error any cursor on the doc came across */
+JSON_ERRNO jsonDocGetError(jsonDoc *doc) {
+    return doc->error;
+}
+
+/* Record the parser's error if it has one, returns 1 if all is well */
+static int jsonDocCheck(jsonDoc *doc) {
+    if (doc->error == JSON_OK && doc->p.errno != JSON_OK) {
+        doc->error = doc->p.errno;
+        doc->error_offset = doc->p.offset;
+    }
+    return doc->error == JSON_OK;
+}
+
+static int jsonDocFail(jsonDoc *doc, JSON_ERRNO error) {
+    doc->p.errno = error;
+    return jsonDocCheck(doc);
+}
+
+static void jsonCursorInit(jsonCursor *cur, jsonDoc *doc, size_t offset) {
+    cur->doc = doc;
+    cur->start = offset;
+    cur->offset = 0;
+    cur->state = JSON_CURSOR_FRESH;
+}
+
+/**
+ * Offset just past the value at `offset`, containers are skipped by matching
+ * brackets without looking at what is in them. Returns 0 if the value is
+ * not terminated.
+ */
+static size_t jsonDocSkip(jsonDoc *doc, size_t offset) {
+    jsonParser *p = &doc->p;
+    const char *ptr = p->buffer + offset;
+    size_t depth = 0;
+
+    do {
+        switch (*ptr) {
+        case '"':
+            if ((ptr = jsonFindStringEnd(p, ptr + 1)) == NULL) {
+                p->offset = p->buflen;
+                jsonDocFail(doc, JSON_INVALID_STRING_NOT_TERMINATED);
+                return 0;
+            }
+            break;
+        case '{':
+        case '[':
+            depth++;
+            break;
+        case '}':
+        case ']':
+            depth--;
+            break;
+        case '\0':
+            if (ptr >= p->endptr) {
+                p->offset = p->buflen;
+                jsonDocFail(doc, JSON_UNTERMINATED);
+                return 0;
+            }
+            break;
+        default:
+            /* A scalar on its own runs up to its terminator */
+            if (depth == 0) {
+                while (ptr + 1 < p->endptr && !isNumTerminator(ptr[1])) {
+                    ptr++;
+                }
+            }
+            break;
+        }
+        ptr++;
+    } while (depth);
+
+    return ptr - p->buffer;
+}
+
+/**
+ * Move an object or array cursor on to its next member, leaving `offset` on
+ * the member's value and the key in `key` and `keylen` for objects. Returns 0
+ * at the end or on an error.
+ */
+static int jsonCursorNextMember(jsonCursor *cur, const char **key,
+                                size_t *keylen) {
+    jsonDoc *doc = cur->doc;
+    jsonParser *p = &doc->p;
+    int is_object = p->buffer[cur->start] == '{';
+    char close = is_object ? '}' : ']';
+
+    if (cur->state == JSON_CURSOR_END || !jsonDocCheck(doc)) {
+        return 0;
+    }
+
+    if (cur->state == JSON_CURSOR_FRESH) {
+        p->offset = cur->start + 1;
+        if (!jsonAdvanceWhitespace(p) || !jsonDocCheck(doc)) {
+            return 0;
+        }
+        if (jsonPeek(p) == close) {
+            cur->state = JSON_CURSOR_END;
+            return 0;
+        }
+    } else {
+        size_t end = jsonDocSkip(doc, cur->offset);
+        if (end == 0) {
+            return 0;
+        }
+        p->offset = end;
+        if (!jsonAdvanceWhitespace(p) || !jsonDocCheck(doc)) {
+            return 0;
+        }
+        if (jsonPeek(p) == close) {
+            cur->state = JSON_CURSOR_END;
+            return 0;
+        } else if (jsonPeek(p) != ',') {
+            return jsonDocFail(doc, is_object
+                                            ? JSON_INVALID_JSON_TYPE_CHAR
+                                            : JSON_INVALID_ARRAY_CHARACTER);
+        }
+        jsonAdvance(p);
+        if (!jsonAdvanceWhitespace(p) || !jsonDocCheck(doc)) {
+            return 0;
+        }
+    }
+
+    if (is_object) {
+        const char *end;
+
+        if (jsonPeek(p) != '"') {
+            return jsonDocFail(doc, JSON_INVALID_KEY_TERMINATOR_CHARACTER);
+        }
+        *key = p->buffer + p->offset;
+        if ((end = jsonFindStringEnd(p, *key + 1)) == NULL) {
+            return jsonDocFail(doc, JSON_INVALID_STRING_NOT_TERMINATED);
+        }
+        *keylen = end - *key - 1;
+        p->offset = end - p->buffer + 1;
+
+        if (!jsonAdvanceWhitespace(p) || !jsonDocCheck(doc)) {
+            return 0;
+        }
+        if (jsonPeek(p) != ':') {
+            return jsonDocFail(doc, JSON_INVALID_KEY_TERMINATOR_CHARACTER);
+        }
+        jsonAdvance(p);
+        if (!jsonAdvanceWhitespace(p) || !jsonDocCheck(doc)) {
+            return 0;
+        }
+    }
+
+    cur->offset = p->offset;
+    cur->state = JSON_CURSOR_ACTIVE;
+    return 1;
+}
+
+/* Does the raw key, quotes and all, at `raw` say `name` */
+static int jsonCursorKeyIs(jsonDoc *doc, const char *raw, size_t rawlen,
+                           const char *name, size_t namelen) {
+    jsonParser *p = &doc->p;
+    char *key;
+
+    if (memchr(raw + 1, '\\', rawlen) == NULL) {
+        return rawlen == namelen && !memcmp(raw + 1, name, namelen);
+    }
+
+    /* Escaped keys are rare enough to decode into the arena */
+    p->offset = raw - p->buffer;
+    key = jsonParseString(p);
+    if (!jsonDocCheck(doc)) {
+        return 0;
+    }
+    return !strcmp(key, name);
+}
+
+/**
+ * Put a cursor on the root of the document, which has to be an object or
+ * an array
+ */
+int jsonDocRoot(jsonDoc *doc, jsonCursor *root) {
+    jsonParser *p = &doc->p;
+    char peek;
+
+    p->offset = 0;
+    if (!jsonAdvanceWhitespace(p) || !jsonDocCheck(doc)) {
+        return 0;
+    }
+    peek = jsonPeek(p);
+    if (peek != '{' && peek != '[') {
+        return jsonDocFail(doc, JSON_CANNOT_START_PARSE);
+    }
+    jsonCursorInit(root, doc, p->offset);
+    return 1;
+}
+
+/**
+ * Find `name` in the object under `object`, carrying on from the last field
+ * found and wrapping around to the start if need be, so looking fields up in
+ * the order they appear never goes back over the object. Returns 1 and sets
+ * `value` if found.
+ */
+int jsonCursorFindField(jsonCursor *object, const char *name,
+                        jsonCursor *value) {
+    jsonDoc *doc = object->doc;
+    jsonCursor saved = *object;
+    size_t namelen = strlen(name);
+    size_t first = 0;
+    int wrapped = saved.state == JSON_CURSOR_FRESH;
+    const char *key;
+    size_t keylen;
+
+    if (doc->p.buffer[object->start] != '{') {
+        return 0;
+    }
+
+    while (1) {
+        if (!jsonCursorNextMember(object, &key, &keylen)) {
+            if (wrapped || doc->error != JSON_OK) {
+                *object = saved;
+                return 0;
+            }
+            object->state = JSON_CURSOR_FRESH;
+            wrapped = 1;
+            continue;
+        }
+
+        size_t key_offset = key - doc->p.buffer;
+        if (first == 0) {
+            first = key_offset;
+        } else if (key_offset == first) {
+            /* Back to where we started */
+            *object = saved;
+            return 0;
+        }
+
+        if (jsonCursorKeyIs(doc, key, keylen, name, namelen)) {
+            jsonCursorInit(value, doc, object->offset);
+            return 1;
+        }
+    }
+}
+
+/* Set `element` to the next element of the array under `array` */
+int jsonCursorArrayNext(jsonCursor *array, jsonCursor *element) {
+    jsonDoc *doc = array->doc;
+
+    if (doc->p.buffer[array->start] != '[' ||
+        !jsonCursorNextMember(array, NULL, NULL)) {
+        return 0;
+    }
+    jsonCursorInit(element, doc, array->offset);
+    return 1;
+}
+
+/**
+ * Step over the value under the cursor without parsing it, returns how many
+ * bytes of the buffer it takes up or 0 if it is not terminated
+ */
+size_t jsonCursorSkip(jsonCursor *cur) {
+    size_t end;
+
+    if (!jsonDocCheck(cur->doc) ||
+        (end = jsonDocSkip(cur->doc, cur->start)) == 0) {
+        return 0;
+    }
+    cur->state = JSON_CURSOR_END;
+    return end - cur->start;
+}
+
+/* Parse the scalar under the cursor into `scratch` */
+static int jsonCursorScalar(jsonCursor *cur, json *scratch) {
+    jsonParser *p = &cur->doc->p;
+    char peek = p->buffer[cur->start];
+
+    scratch->type = JSON_NULL;
+    scratch->state = NULL;
+    scratch->aux = 0;
+    if (peek == '{' || peek == '[' || !jsonDocCheck(cur->doc)) {
+        return 0;
+    }
+
+    p->offset = cur->start;
+    p->ptr = scratch;
+    if (!jsonSetExpectedType(p) || !jsonParseValue(p)) {
+        return jsonDocCheck(cur->doc);
+    }
+    return 1;
+}
+
+JSON_DATA_TYPE jsonCursorType(jsonCursor *cur) {
+    json scratch;
+
+    switch (cur->doc->p.buffer[cur->start]) {
+    case '{':
+        return JSON_OBJECT;
+    case '[':
+        return JSON_ARRAY;
+    case '"':
+        return JSON_STRING;
+    default:
+        jsonCursorScalar(cur, &scratch);
+        return scratch.type;
+    }
+}
+
+ssize_t jsonCursorGetInt(jsonCursor *cur) {
+    json scratch;
+    if (cur->doc->p.buffer[cur->start] == '"' ||
+        !jsonCursorScalar(cur, &scratch)) {
+        return 0;
+    }
+    return jsonGetInt(&scratch);
+}
+
+double jsonCursorGetFloat(jsonCursor *cur) {
+    json scratch;
+    if (cur->doc->p.buffer[cur->start] == '"' ||
+        !jsonCursorScalar(cur, &scratch)) {
+        return 0.0;
+    }
+    return jsonGetFloat(&scratch);
+}
+
+int jsonCursorGetBool(jsonCursor *cur) {
+    json scratch;
+    if (cur->doc->p.buffer[cur->start] == '"' ||
+        !jsonCursorScalar(cur, &scratch)) {
+        return -1;
+    }
+    return jsonGetBool(&scratch);
+}
+
+/**
+ * The string under the cursor and its length. Strings without escapes point
+ * straight into the buffer and are NOT '\0' terminated, ones with escapes
+ * are decoded into the doc. NULL if it is not a string.
+ */
+const char *jsonCursorGetString(jsonCursor *cur, size_t *len) {
+    jsonDoc *doc = cur->doc;
+    jsonParser *p = &doc->p;
+    const char *start = p->buffer + cur->start + 1;
+    const char *end;
+    char *str;
+
+    if (start[-1] != '"' || !jsonDocCheck(doc)) {
+        return NULL;
+    }
+
+    if ((end = jsonFindStringEnd(p, start)) == NULL) {
+        p->offset = cur->start;
+        jsonDocFail(doc, JSON_INVALID_STRING_NOT_TERMINATED);
+        return NULL;
+    }
+
+    if (memchr(start, '\\', end - start) == NULL) {
+        *len = end - start;
+        return start;
+    }
+
+    p->offset = cur->start;
+    str = jsonParseString(p);
+    if (!jsonDocCheck(doc)) {
+        return NULL;
+    }
+    *len = strlen(str);
+    return str;
+}
+
+/*=============================================================================
+ * Tokenizer
+ *
+ * A pull parser handing back one token at a time. Nesting is tracked on an
+ * explicit stack, so deep documents do not recurse, and scalars are lexed by
+ * the same code as the tree parser into a node on the stack. Nothing is
+ * allocated per token, only when a string with escapes is longer than any
+ * seen before or the document nests deeper than the stack on hand.
+ *============================================================================*/
+#define JSON_TOKENIZER_STACK (64)
+
+typedef enum JSON_TOKENIZER_STATE {
+    JSON_TOKENIZER_START,
+    JSON_TOKENIZER_VALUE,
+    JSON_TOKENIZER_KEY,
+    /* After a value, expecting a ',' or the end of the container */
+    JSON_TOKENIZER_NEXT,
+    JSON_TOKENIZER_CLOSE,
+    JSON_TOKENIZER_DONE,
+    JSON_TOKENIZER_ERROR,
+} JSON_TOKENIZER_STATE;
+
+struct jsonTokenizer {
+    jsonParser p;
+    JSON_TOKENIZER_STATE state;
+    /* '{' or '[' for each open container */
+    char *stack;
+    size_t depth;
+    size_t capacity;
+    char inline_stack[JSON_TOKENIZER_STACK];
+    /* Escaped strings are decoded in to here, unless parsing in situ */
+    char *scratch;
+    size_t scratch_capacity;
+};
+
+static void jsonTokenizerInit(jsonTokenizer *t, char *buffer, size_t buflen,
+                              int flags) {
+    jsonParser *p = &t->p;
+
+    p->buffer = buffer;
+    p->buflen = buflen;
+    p->endptr = buffer + buflen;
+    p->offset = 0;
+    p->flags = flags & JSON_INSITU_FLAG;
+    p->errno = JSON_OK;
+    p->type = -1;
+    p->J = NULL;
+    p->ptr = NULL;
+    p->allocator = NULL;
+    p->state = NULL;
+    p->kernels = jsonKernels();
+
+    t->state = JSON_TOKENIZER_START;
+    t->stack = t->inline_stack;
+    t->depth = 0;
+    t->capacity = JSON_TOKENIZER_STACK;
+    t->scratch = NULL;
+    t->scratch_capacity = 0;
+}
+
+static void jsonTokenizerCleanup(jsonTokenizer *t) {
+    if (t->stack != t->inline_stack) {
+        jsonFree(t->stack);
+    }
+    jsonFree(t->scratch);
+}
+
+/**
+ * Tokenize `buffer`, which must outlive the tokenizer. JSON_INSITU_FLAG
+ * decodes escaped strings over the top of the buffer and '\0' terminates
+ * them, no other flags apply.
+ */
+jsonTokenizer *jsonTokenizerNew(char *buffer, size_t buflen, int flags) {
+    jsonTokenizer *t = (jsonTokenizer *)jsonMalloc(sizeof(jsonTokenizer));
+    jsonTokenizerInit(t, buffer, buflen, flags);
+    return t;
+}
+
+void jsonTokenizerRelease(jsonTokenizer *t) {
+    if (t) {
+        jsonTokenizerCleanup(t);
+        jsonFree(t);
+    }
+}
+
+/* JSON_OK, or why `jsonNextToken` handed back a JSON_TOKEN_ERROR */
+JSON_ERRNO jsonTokenizerGetError(jsonTokenizer *t) {
+    return t->p.errno;
+}
+
+static int jsonTokenizerPush(jsonTokenizer *t, char container) {
+    if (t->depth >= json_max_depth) {
+        t->p.errno = JSON_MAX_DEPTH_EXCEEDED;
+        return 0;
+    }
+    if (t->depth == t->capacity) {
+        char *stack = (char *)jsonMalloc(t->capacity * 2);
+        memcpy(stack, t->stack, t->capacity);
+        if (t->stack != t->inline_stack) {
+            jsonFree(t->stack);
+        }
+        t->stack = stack;
+        t->capacity *= 2;
+    }
+    t->stack[t->depth++] = container;
+    return 1;
+}
+
+/**
+ * Lex the string at the opening '"' without allocating for it if at all
+ * possible. The result is NOT '\0' terminated unless parsing in situ.
+ */
+static int jsonTokenizerString(jsonTokenizer *t, jsonToken *tok) {
+    jsonParser *p = &t->p;
+    const char *end, *ptr;
+    char *start, *str;
+    size_t len;
+
+    jsonAdvance(p);
+    if (p->errno != JSON_OK) {
+        return 0;
+    }
+    start = p->buffer + p->offset;
+    ptr = p->kernels->scanString(start, p->endptr);
+
+    if (ptr < p->endptr && *ptr == '"') {
+        len = ptr - start;
+        str = start;
+        jsonUnsafeAdvanceBy(p, len);
+    } else {
+        if ((end = jsonFindStringEnd(p, ptr)) == NULL) {
+            p->errno = JSON_EOF;
+            return 0;
+        }
+
+        if (p->flags & JSON_INSITU_FLAG) {
+            str = start;
+        } else {
+            if ((size_t)(end - start) >= t->scratch_capacity) {
+                t->scratch_capacity = (end - start) * 2 + 1;
+                t->scratch = (char *)jsonRealloc(t->scratch,
+                                             t->scratch_capacity);
+            }
+            str = t->scratch;
+        }
+
+        if (!jsonUnescape(p, str, end, &len)) {
+            return 0;
+        }
+    }
+
+    if (p->flags & JSON_INSITU_FLAG) {
+        str[len] = '\0';
+    }
+    /* Move past the closing '"', it can not be the last byte */
+    jsonAdvance(p);
+    if (p->errno != JSON_OK) {
+        return 0;
+    }
+    if (jsonPeek(p) == '"') {
+        p->errno = JSON_INVALID_STRING_NOT_TERMINATED;
+        return 0;
+    }
+    tok->str = str;
+    tok->str_len = len;
+    return 1;
+}
+
+/* Lex the scalar at the current offset */
+static int jsonTokenizerScalar(jsonTokenizer *t, jsonToken *tok) {
+    jsonParser *p = &t->p;
+    json scratch;
+
+    if (jsonPeek(p) == '"') {
+        tok->type = JSON_TOKEN_STRING;
+        return jsonTokenizerString(t, tok);
+    }
+
+    scratch.type = JSON_NULL;
+    p->ptr = &scratch;
+    if (!jsonSetExpectedType(p) || !jsonParseValue(p)) {
+        return 0;
+    }
+
+    switch (scratch.type) {
+    case JSON_INT:
+        tok->type = JSON_TOKEN_INT;
+        tok->integer = scratch.integer;
+        break;
+    case JSON_FLOAT:
+        tok->type = JSON_TOKEN_FLOAT;
+        tok->floating = scratch.floating;
+        break;
+    case JSON_BOOL:
+        tok->type = JSON_TOKEN_BOOL;
+        tok->boolean = scratch.boolean;
+        break;
+    default:
+        tok->type = JSON_TOKEN_NULL;
+        break;
+    }
+    return 1;
+}
+
+static int jsonTokenizerStep(jsonTokenizer *t, jsonToken *tok) {
+    jsonParser *p = &t->p;
+    char ch;
+
+    while (1) {
+        switch (t->state) {
+        case JSON_TOKENIZER_START:
+            if (!jsonAdvanceWhitespace(p)) {
+                return 0;
+            }
+            ch = jsonPeek(p);
+            if (ch != '{' && ch != '[') {
+                p->errno = JSON_CANNOT_START_PARSE;
+                return 0;
+            }
+            t->state = JSON_TOKENIZER_VALUE;
+            break;
+
+        case JSON_TOKENIZER_VALUE:
+            ch = jsonPeek(p);
+            tok->offset = p->offset;
+            tok->depth = t->depth;
+
+            if (ch == '{' || ch == '[') {
+                tok->type = ch == '{' ? JSON_TOKEN_START_OBJECT
+                                      : JSON_TOKEN_START_ARRAY;
+                tok->len = 1;
+                if (!jsonTokenizerPush(t, ch)) {
+                    return 0;
+                }
+                jsonAdvance(p);
+                if (p->errno != JSON_OK || !jsonAdvanceWhitespace(p)) {
+                    return 0;
+                }
+                if (jsonPeek(p) == (ch == '{' ? '}' : ']')) {
+                    t->state = JSON_TOKENIZER_CLOSE;
+                } else {
+                    t->state = ch == '{' ? JSON_TOKENIZER_KEY
+                                         : JSON_TOKENIZER_VALUE;
+                }
+                return 1;
+            }
+
+            if (!jsonTokenizerScalar(t, tok)) {
+                return 0;
+            }
+            tok->len = p->offset - tok->offset;
+            t->state = JSON_TOKENIZER_NEXT;
+            return 1;
+
+        case JSON_TOKENIZER_KEY:
+            if (jsonPeek(p) != '"') {
+                p->errno = JSON_INVALID_KEY_TERMINATOR_CHARACTER;
+                return 0;
+            }
+            tok->type = JSON_TOKEN_KEY;
+            tok->offset = p->offset;
+            tok->depth = t->depth;
+            if (!jsonTokenizerString(t, tok)) {
+                return 0;
+            }
+            tok->len = p->offset - tok->offset;
+
+            if (!jsonAdvanceWhitespace(p)) {
+                return 0;
+            }
+            if (jsonPeek(p) != ':') {
+                p->errno = JSON_INVALID_KEY_TERMINATOR_CHARACTER;
+                return 0;
+            }
+            jsonAdvance(p);
+            if (p->errno != JSON_OK || !jsonAdvanceWhitespace(p)) {
+                return 0;
+            }
+            t->state = JSON_TOKENIZER_VALUE;
+            return 1;
+
+        case JSON_TOKENIZER_NEXT:
+            /* A nested container closed on the last byte of the buffer */
+            if (p->offset == p->buflen) {
+                p->offset--;
+                p->errno = JSON_EOF;
+                return 0;
+            }
+            if (!jsonAdvanceWhitespace(p)) {
+                return 0;
+            }
+            ch = jsonPeek(p);
+            if (ch == ',') {
+                jsonAdvance(p);
+                if (p->errno != JSON_OK || !jsonAdvanceWhitespace(p)) {
+                    return 0;
+                }
+                t->state = t->stack[t->depth - 1] == '['
+                                   ? JSON_TOKENIZER_VALUE
+                                   : JSON_TOKENIZER_KEY;
+            } else if (ch == (t->stack[t->depth - 1] == '{' ? '}' : ']')) {
+                t->state = JSON_TOKENIZER_CLOSE;
+            } else {
+                p->errno = t->stack[t->depth - 1] == '{'
+                                   ? JSON_INVALID_JSON_TYPE_CHAR
+                                   : JSON_INVALID_ARRAY_CHARACTER;
+                return 0;
+            }
+            break;
+
+        case JSON_TOKENIZER_CLOSE:
+            tok->type = t->stack[--t->depth] == '{' ? JSON_TOKEN_END_OBJECT
+                                                    : JSON_TOKEN_END_ARRAY;
+            tok->offset = p->offset;
+            tok->len = 1;
+            tok->depth = t->depth;
+            /* Not jsonAdvance, the root may close on the last byte of the
+             * buffer */
+            jsonUnsafeAdvanceBy(p, 1);
+            t->state = t->depth ? JSON_TOKENIZER_NEXT : JSON_TOKENIZER_DONE;
+            return 1;
+
+        case JSON_TOKENIZER_DONE:
+            tok->type = JSON_TOKEN_END;
+            tok->offset = p->offset;
+            tok->len = 0;
+            tok->depth = 0;
+            return 0;
+
+        case JSON_TOKENIZER_ERROR:
+            return 0;
+        }
+    }
+}
+
+/**
+ * Fill in `tok` with the next token, returning 1 or 0 once the document has
+ * ended or hit an error, in which case the token is JSON_TOKEN_END or
+ * JSON_TOKEN_ERROR. Decoded strings are only valid until the next call.
+ */
+int jsonNextToken(jsonTokenizer *t, jsonToken *tok) {
+    if (jsonTokenizerStep(t, tok)) {
+        return 1;
+    }
+    if (t->state != JSON_TOKENIZER_DONE) {
+        t->state = JSON_TOKENIZER_ERROR;
+        tok->type = JSON_TOKEN_ERROR;
+        tok->offset = t->p.offset;
+        tok->len = 0;
+        tok->depth = t->depth;
+    }
+    return 0;
+}
+
+/*=============================================================================
+ * Events
+ *
+ * A push parser on top of the tokenizer, calling a handler for each token.
+ *============================================================================*/
+
+/* Call a handler if there is one, non zero from it stops the parse */
+#define jsonEmit(events, event, ...)                      \
+    ((events)->event == NULL ? 0 : (events)->event(__VA_ARGS__))
+
+static int jsonEventDispatch(const jsonEvents *events, void *privdata,
+                             jsonToken *tok) {
+    switch (tok->type) {
+    case JSON_TOKEN_START_OBJECT:
+        return jsonEmit(events, start_object, privdata);
+    case JSON_TOKEN_END_OBJECT:
+        return jsonEmit(events, end_object, privdata);
+    case JSON_TOKEN_START_ARRAY:
+        return jsonEmit(events, start_array, privdata);
+    case JSON_TOKEN_END_ARRAY:
+        return jsonEmit(events, end_array, privdata);
+    case JSON_TOKEN_KEY:
+        return jsonEmit(events, key, privdata, tok->str, tok->str_len);
+    case JSON_TOKEN_STRING:
+        return jsonEmit(events, string, privdata, tok->str, tok->str_len);
+    case JSON_TOKEN_INT:
+        return jsonEmit(events, integer, privdata, tok->integer);
+    case JSON_TOKEN_FLOAT:
+        return jsonEmit(events, floating, privdata, tok->floating);
+    case JSON_TOKEN_BOOL:
+        return jsonEmit(events, boolean, privdata, tok->boolean);
+    case JSON_TOKEN_NULL:
+        return jsonEmit(events, null, privdata);
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Parse `buffer` calling the handlers in `events` as each value is reached,
+ * handlers left as NULL are skipped and one that returns non zero stops the
+ * parse with JSON_STOPPED. Strings and keys are passed with their length and
+ * are only valid for the duration of the call. JSON_INSITU_FLAG decodes
+ * escaped strings over the top of the buffer and '\0' terminates them, no
+ * other flags apply.
+ *
+ * Returns JSON_OK or the error, which along with where it happened is also
+ * put in `state` if that is not NULL.
+ */
+JSON_ERRNO jsonParseEvents(char *buffer, size_t buflen, int flags,
+                           const jsonEvents *events, void *privdata,
+                           jsonState *state) {
+    jsonTokenizer t;
+    jsonToken tok;
+
+    jsonTokenizerInit(&t, buffer, buflen, flags);
+
+    while (jsonNextToken(&t, &tok)) {
+        if (jsonEventDispatch(events, privdata, &tok) != 0) {
+            t.p.errno = JSON_STOPPED;
+            break;
+        }
+    }
+
+    if (state) {
+        state->error = t.p.errno;
+        state->ch = t.p.offset < buflen ? buffer[t.p.offset] : '\0';
+        state->offset = t.p.offset;
+        state->mem = NULL;
+    }
+
+    jsonTokenizerCleanup(&t);
+    return t.p.errno;
+}
+
+/*=============================================================================
+ * Streaming parser
+ *
+ * Builds the same tree as jsonParse from a document that arrives in chunks.
+ * Chunks are appended to a buffer the tokenizer runs over, and between chunks
+ * only what is left from the start of the first token that could not be
+ * finished is kept. A token that runs in to the end of what has arrived so
+ * far is lexed again once there is more, so a document fails with the same
+ * error at the same offset as it would with jsonParse.
+ *
+ * Until then each chunk is only scanned for the end of that token, carrying
+ * on from where the last chunk left off, so a long string, number or run of
+ * whitespace costs the same however many chunks it is split over.
+ *============================================================================*/
+/* What the tokenizer was stopped on when it ran out of input */
+typedef enum JSON_STREAM_PENDING {
+    /* Nothing, the tokenizer can be run on the next chunk */
+    JSON_STREAM_NONE,
+    /* Between tokens */
+    JSON_STREAM_GAP,
+    JSON_STREAM_STRING,
+    /* A number, literal or anything else that runs up to a terminator */
+    JSON_STREAM_SCALAR,
+    /* A string with a '\0' in it, which can only fail at the end */
+    JSON_STREAM_STUCK,
+} JSON_STREAM_PENDING;
+
+typedef struct jsonStreamFrame {
+    json *container;
+    /* Last child so far, new ones are appended after it */
+    json *last;
+} jsonStreamFrame;
+
+struct jsonStreamParser {
+    /* Holds the allocator, state and error for the whole stream */
+    jsonParser p;
+    jsonTokenizer t;
+    json *root;
+    /* Object member whose value is being waited for */
+    json *member;
+    jsonStreamFrame *stack;
+    size_t depth;
+    size_t capacity;
+    /* Input that has not been turned in to nodes yet */
+    char *buffer;
+    size_t len;
+    size_t buffer_capacity;
+    /* Bytes of the document dropped from the front of `buffer` */
+    size_t consumed;
+    JSON_STREAM_PENDING pending;
+    /* Offset into `buffer` the tokenizer was last rolled back to, the scan
+     * carries on from where it got to while it is rolled back there again */
+    size_t restart;
+    /* How far the scan has got, and whether it stopped just after a '\\' */
+    size_t scan;
+    int escaped;
+};
+
+#define isStreamTerminator(ch) \
+    (isJsonStructural(ch) || isJsonWhiteSpace(ch) || ch == '"')
+
+static char *jsonStreamCopy(jsonStreamParser *sp, const char *str,
+                            size_t len) {
+    char *copy = (char *)jsonAlloc(sp->p.allocator, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/* Attach a new value to the innermost open container */
+static json *jsonStreamValueNode(jsonStreamParser *sp) {
+    jsonStreamFrame *frame;
+    json *J;
+
+    if (sp->depth == 0) {
+        return sp->root;
+    }
+
+    frame = &sp->stack[sp->depth - 1];
+    if (frame->container->type == JSON_OBJECT) {
+        return sp->member;
+    }
+
+    J = jsonNew(&sp->p);
+    if (frame->last) {
+        frame->last->next = J;
+    } else {
+        frame->container->array = J;
+    }
+    frame->last = J;
+    return J;
+}
+
+/* Add a token to the tree, strings are copied as the buffer is reused */
+static void jsonStreamToken(jsonStreamParser *sp, jsonToken *tok) {
+    jsonStreamFrame *frame;
+    json *J;
+
+    switch (tok->type) {
+    case JSON_TOKEN_START_OBJECT:
+    case JSON_TOKEN_START_ARRAY:
+        J = jsonStreamValueNode(sp);
+        if (sp->depth == sp->capacity) {
+            sp->capacity = sp->capacity ? sp->capacity * 2 : 16;
+            sp->stack = jsonRealloc(sp->stack,
+                                    sp->capacity * sizeof(jsonStreamFrame));
+        }
+        J->type = tok->type == JSON_TOKEN_START_OBJECT ? JSON_OBJECT
+                                                       : JSON_ARRAY;
+        J->object = NULL;
+        J->state = sp->p.state;
+        J->aux = sp->p.flags & JSON_LAZY_INDEX_FLAG ? JSON_AUX_INDEXABLE : 0;
+        sp->stack[sp->depth].container = J;
+        sp->stack[sp->depth].last = NULL;
+        sp->depth++;
+        return;
+
+    case JSON_TOKEN_END_OBJECT:
+    case JSON_TOKEN_END_ARRAY:
+        sp->depth--;
+        return;
+
+    case JSON_TOKEN_KEY:
+        frame = &sp->stack[sp->depth - 1];
+        J = jsonNew(&sp->p);
+        J->key = jsonStreamCopy(sp, tok->str, tok->str_len);
+        if (frame->last) {
+            frame->last->next = J;
+        } else {
+            frame->container->object = J;
+        }
+        frame->last = J;
+        sp->member = J;
+        return;
+
+    default:
+        break;
+    }
+
+    J = jsonStreamValueNode(sp);
+    switch (tok->type) {
+    case JSON_TOKEN_STRING:
+        J->type = JSON_STRING;
+        J->str = jsonStreamCopy(sp, tok->str, tok->str_len);
+        break;
+    case JSON_TOKEN_INT:
+    case JSON_TOKEN_FLOAT:
+        if (sp->p.flags & JSON_STRNUM_FLAG) {
+            J->type = JSON_STRNUM;
+            J->strnum = jsonStreamCopy(sp, sp->buffer + tok->offset,
+                                       tok->len);
+        } else if (tok->type == JSON_TOKEN_INT) {
+            J->type = JSON_INT;
+            J->integer = tok->integer;
+        } else {
+            J->type = JSON_FLOAT;
+            J->floating = tok->floating;
+        }
+        break;
+    case JSON_TOKEN_BOOL:
+        J->type = JSON_BOOL;
+        J->boolean = tok->boolean;
+        break;
+    default:
+        J->type = JSON_NULL;
+        break;
+    }
+}
+
+/**
+ * Whether the tokenizer failed at `offset` only because the input stops
+ * there, which is so if it ran out or the value it failed on carries on up
+ * to the end of what has arrived.
+ */
+static int jsonStreamIncomplete(jsonStreamParser *sp, size_t offset) {
+    if (sp->t.p.errno == JSON_EOF || sp->t.p.errno == JSON_UNTERMINATED) {
+        return 1;
+    }
+    /* Literals are compared whole, and need a byte past them to be */
+    if (offset < sp->len && (sp->buffer[offset] == 't' ||
+                             sp->buffer[offset] == 'f' ||
+                             sp->buffer[offset] == 'n')) {
+        return sp->len - offset <= (sp->buffer[offset] == 'f' ? 5 : 4);
+    }
+    for (; offset < sp->len; ++offset) {
+        if (isStreamTerminator(sp->buffer[offset])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Carry on scanning from where the tokenizer last ran out over what has
+ * arrived since. Returns 1 once there is something new it could finish, the
+ * end of a string or scalar or a bracket, and it is worth running again.
+ */
+static int jsonStreamScan(jsonStreamParser *sp) {
+    const char *buf = sp->buffer;
+    size_t i = sp->scan;
+    int found = 0;
+
+    while (i < sp->len && !found) {
+        char ch = buf[i];
+
+        switch (sp->pending) {
+        case JSON_STREAM_GAP:
+            if (ch == '"') {
+                sp->pending = JSON_STREAM_STRING;
+            } else if (isJsonStructural(ch)) {
+                found = ch != ',' && ch != ':';
+            } else if (!isJsonWhiteSpace(ch)) {
+                sp->pending = JSON_STREAM_SCALAR;
+                continue;
+            }
+            i++;
+            break;
+
+        case JSON_STREAM_STRING:
+            /* Same rules as jsonFindStringEnd */
+            if (sp->escaped) {
+                sp->escaped = 0;
+                i++;
+                break;
+            }
+            i = sp->p.kernels->scanString(buf + i, buf + sp->len) - buf;
+            if (i == sp->len) {
+                break;
+            } else if (buf[i] == '"') {
+                sp->pending = JSON_STREAM_GAP;
+                found = 1;
+            } else if (buf[i] == '\\') {
+                sp->escaped = 1;
+            } else if (buf[i] == '\0') {
+                sp->pending = JSON_STREAM_STUCK;
+            }
+            i++;
+            break;
+
+        case JSON_STREAM_SCALAR:
+            if (isStreamTerminator(ch)) {
+                /* The terminator is looked at again as part of the gap */
+                sp->pending = JSON_STREAM_GAP;
+                found = 1;
+            } else {
+                i++;
+            }
+            break;
+
+        default:
+            i = sp->len;
+            break;
+        }
+    }
+
+    sp->scan = i;
+    return found;
+}
+
+/**
+ * Turn as much of the buffer in to nodes as can be, with `final` set the
+ * document has ended and a token that is cut off is an error.
+ */
+static void jsonStreamRun(jsonStreamParser *sp, int final) {
+    jsonTokenizer *t = &sp->t;
+    jsonToken tok;
+    size_t drop;
+
+    if (!final && sp->pending != JSON_STREAM_NONE && !jsonStreamScan(sp)) {
+        return;
+    }
+
+    t->p.buffer = sp->buffer;
+    t->p.buflen = sp->len;
+    t->p.endptr = sp->buffer + sp->len;
+
+    while (1) {
+        JSON_TOKENIZER_STATE state = t->state;
+        size_t depth = t->depth;
+        size_t offset = t->p.offset;
+        int ok = jsonNextToken(t, &tok);
+
+        if (!ok && tok.type == JSON_TOKEN_END) {
+            break;
+        }
+
+        /* A number at the end may have more digits to come */
+        if (!final &&
+            (ok ? tok.type >= JSON_TOKEN_INT && tok.type <= JSON_TOKEN_NULL &&
+                          tok.offset + tok.len == sp->len
+                : jsonStreamIncomplete(sp, tok.offset))) {
+            t->state = state;
+            t->depth = depth;
+            t->p.offset = offset;
+            t->p.errno = JSON_OK;
+            if (sp->pending == JSON_STREAM_NONE || sp->restart != offset) {
+                sp->pending = JSON_STREAM_GAP;
+                sp->restart = offset;
+                sp->scan = offset;
+                sp->escaped = 0;
+            }
+            break;
+        }
+
+        if (!ok) {
+            sp->p.errno = t->p.errno;
+            sp->p.state->error = t->p.errno;
+            sp->p.state->ch = tok.offset < sp->len ? sp->buffer[tok.offset]
+                                                   : '\0';
+            sp->p.state->offset = sp->consumed + tok.offset;
+            return;
+        }
+        jsonStreamToken(sp, &tok);
+    }
+
+    /* Keep the byte before the tokenizer, a container closed on it is where
+     * a document that ends there fails */
+    drop = t->p.offset ? t->p.offset - 1 : 0;
+    memmove(sp->buffer, sp->buffer + drop, sp->len - drop);
+    sp->len -= drop;
+    sp->consumed += drop;
+    t->p.offset -= drop;
+    if (sp->pending != JSON_STREAM_NONE) {
+        sp->restart -= drop;
+        sp->scan -= drop;
+    }
+}
+
+/**
+ * Create a parser for a document that will be passed in chunks with
+ * `jsonParserFeed`. JSON_STRNUM_FLAG and JSON_LAZY_INDEX_FLAG are honoured.
+ * Chunks are not kept so there is nothing for JSON_INSITU_FLAG or the lazy
+ * string and number flags to point in to, they are ignored.
+ */
+jsonStreamParser *jsonParserNew(int flags) {
+    jsonStreamParser *sp = jsonCalloc(1, sizeof(jsonStreamParser));
+
+    sp->p.flags = flags & (JSON_STRNUM_FLAG | JSON_LAZY_INDEX_FLAG);
+    jsonParserInit(&sp->p, NULL, 0, NULL);
+    jsonTokenizerInit(&sp->t, NULL, 0, JSON_NO_FLAGS);
+    sp->root = jsonNew(&sp->p);
+    return sp;
+}
+
+/**
+ * Parse the next chunk of the document, the chunk does not need to be kept
+ * around after this returns. Returns JSON_OK or the error the document
+ * failed with, after which any more input is ignored.
+ */
+int jsonParserFeed(jsonStreamParser *sp, const char *chunk, size_t len) {
+    if (sp->p.errno != JSON_OK || sp->t.state == JSON_TOKENIZER_DONE ||
+        len == 0) {
+        return sp->p.errno;
+    }
+
+    if (sp->len + len > sp->buffer_capacity) {
+        size_t capacity = sp->buffer_capacity ? sp->buffer_capacity : 64;
+        while (sp->len + len > capacity) {
+            capacity *= 2;
+        }
+        sp->buffer = jsonRealloc(sp->buffer, capacity);
+        sp->buffer_capacity = capacity;
+    }
+    memcpy(sp->buffer + sp->len, chunk, len);
+    sp->len += len;
+
+    jsonStreamRun(sp, 0);
+    return sp->p.errno;
+}
+
+/**
+ * Finish the document and free the parser. The returned json has the same
+ * shape as one from `jsonParse` and must be freed with `jsonRelease`. A
+ * document that ended early fails as it would with `jsonParse`, one that
+ * never started fails with JSON_UNTERMINATED.
+ */
+json *jsonParserFinish(jsonStreamParser *sp) {
+    json *J = sp->root;
+
+    if (sp->p.errno == JSON_OK) {
+        if (sp->len == 0) {
+            sp->p.errno = JSON_UNTERMINATED;
+            sp->p.state->error = JSON_UNTERMINATED;
+            sp->p.state->offset = sp->consumed;
+        } else {
+            jsonStreamRun(sp, 1);
+        }
+    }
+
+    J->state = sp->p.state;
+    J->state->mem = (void *)sp->p.allocator;
+    jsonTokenizerCleanup(&sp->t);
+    jsonFree(sp->stack);
+    jsonFree(sp->buffer);
+    jsonFree(sp);
+    return J;
+}
+
+/*=============================================================================
+ * Compact documents
+ *
+ * A read only alternative to the tree. Every value is a 16 byte node in one
+ * array and refers to the others by their index in it rather than by
+ * pointer, the type is packed in to the low bits of the index of the next
+ * sibling and nothing but the document itself has state. Keys and strings
+ * are packed one after another in a string pool. It is built straight from
+ * the tokenizer so the tree is never materialised.
+ *============================================================================*/
+#define JSON_COMPACT_TYPE_BITS (4)
+#define JSON_COMPACT_TYPE_MASK ((1u << JSON_COMPACT_TYPE_BITS) - 1)
+/* Node indexes have to fit in what is left of `next_type` */
+#define JSON_COMPACT_MAX_NODES (1u << (32 - JSON_COMPACT_TYPE_BITS))
+
+typedef struct jsonCompactNode {
+    /* Index of the next sibling shifted up, the type in the bottom bits */
+    uint32_t next_type;
+    /* Offset of the key in the string pool, 0 if there is no key */
+    uint32_t key;
+    union {
+        int64_t integer;
+        double floating;
+        int boolean;
+        /* Strings and strnums */
+        struct {
+            uint32_t offset;
+            uint32_t len;
+        } str;
+        struct {
+            /* Index of the first member, 0 if empty */
+            uint32_t child;
+            uint32_t count;
+        } container;
+    };
+} jsonCompactNode;
+
+/* Open containers while building */
+typedef struct jsonCompactFrame {
+    jsonNode node;
+    jsonNode last;
+} jsonCompactFrame;
+
+struct jsonCompact {
+    /* Node 0 is never used so that 0 can mean no node, it is a bare null
+     * so looking anything up on it finds nothing */
+    jsonCompactNode *nodes;
+    uint32_t count;
+    uint32_t capacity;
+    /* Keys and strings, '\0' terminated, offset 0 is the empty string */
+    char *pool;
+    size_t pool_len;
+    size_t pool_capacity;
+    jsonState state;
+};
+
+static jsonNode jsonCompactNodeNew(jsonCompact *doc, JSON_DATA_TYPE type,
+                                   uint32_t key) {
+    if (doc->count == JSON_COMPACT_MAX_NODES) {
+        doc->state.error = JSON_DOCUMENT_TOO_LARGE;
+        return JSON_NODE_NONE;
+    }
+    if (doc->count == doc->capacity) {
+        doc->capacity *= 2;
+        doc->nodes = (jsonCompactNode *)jsonRealloc(
+                doc->nodes, sizeof(jsonCompactNode) * doc->capacity);
+    }
+
+    jsonNode node = doc->count++;
+    doc->nodes[node].next_type = type;
+    doc->nodes[node].key = key;
+    doc->nodes[node].integer = 0;
+    return node;
+}
+
+/* Copy `len` bytes in to the string pool '\0' terminated, returning their
+ * offset */
+static uint32_t jsonCompactIntern(jsonCompact *doc, const char *str,
+                                  size_t len) {
+    if (doc->pool_len + len + 1 > UINT32_MAX) {
+        doc->state.error = JSON_DOCUMENT_TOO_LARGE;
+        return 0;
+    }
+    if (doc->pool_len + len + 1 > doc->pool_capacity) {
+        while (doc->pool_len + len + 1 > doc->pool_capacity) {
+            doc->pool_capacity *= 2;
+        }
+        doc->pool = (char *)jsonRealloc(doc->pool, doc->pool_capacity);
+    }
+
+    uint32_t offset = (uint32_t)doc->pool_len;
+    memcpy(doc->pool + offset, str, len);
+    doc->pool[offset + len] = '\0';
+    doc->pool_len += len + 1;
+    return offset;
+}
+
+/**
+ * Parse `buffer` in to a compact document. JSON_STRNUM_FLAG keeps numbers as
+ * strings and JSON_INSITU_FLAG is as for the tokenizer, no other flags
+ * apply. Keys and strings are copied so the buffer can be freed straight
+ * away. Check for errors with `jsonCompactGetError`, the document must be
+ * freed with `jsonCompactRelease`.
+ */
+jsonCompact *jsonCompactParse(char *buffer, size_t buflen, int flags) {
+    jsonCompact *doc = (jsonCompact *)jsonMalloc(sizeof(jsonCompact));
+    jsonCompactFrame inline_stack[JSON_PARSE_INLINE_DEPTH];
+    jsonCompactFrame *stack = inline_stack;
+    size_t capacity = JSON_PARSE_INLINE_DEPTH;
+    size_t depth = 0;
+    uint32_t key = 0;
+    jsonTokenizer t;
+    jsonToken tok;
+
+    /* Both grow as needed and are trimmed to fit at the end */
+    doc->capacity = buflen / 32 > 64 ? (uint32_t)(buflen / 32) : 64;
+    if (doc->capacity > JSON_COMPACT_MAX_NODES) {
+        doc->capacity = JSON_COMPACT_MAX_NODES;
+    }
+    doc->nodes = (jsonCompactNode *)jsonMalloc(sizeof(jsonCompactNode) *
+                                               doc->capacity);
+    /* JSON_NODE_NONE reads as a null with no key, siblings or members */
+    memset(&doc->nodes[0], 0, sizeof(jsonCompactNode));
+    doc->nodes[0].next_type = JSON_NULL;
+    doc->count = 1;
+    doc->pool_capacity = buflen / 8 > 64 ? buflen / 8 : 64;
+    doc->pool = (char *)jsonMalloc(doc->pool_capacity);
+    doc->pool[0] = '\0';
+    doc->pool_len = 1;
+    doc->state.error = JSON_OK;
+    doc->state.mem = NULL;
+
+    jsonTokenizerInit(&t, buffer, buflen, flags);
+
+    while (doc->state.error == JSON_OK && jsonNextToken(&t, &tok)) {
+        jsonNode node;
+        jsonCompactNode *n;
+
+        switch (tok.type) {
+        case JSON_TOKEN_KEY:
+            key = jsonCompactIntern(doc, tok.str, tok.str_len);
+            continue;
+
+        case JSON_TOKEN_END_OBJECT:
+        case JSON_TOKEN_END_ARRAY:
+            depth--;
+            continue;
+
+        case JSON_TOKEN_START_OBJECT:
+            node = jsonCompactNodeNew(doc, JSON_OBJECT, key);
+            break;
+
+        case JSON_TOKEN_START_ARRAY:
+            node = jsonCompactNodeNew(doc, JSON_ARRAY, key);
+            break;
+
+        case JSON_TOKEN_STRING:
+            node = jsonCompactNodeNew(doc, JSON_STRING, key);
+            if (node) {
+                uint32_t offset = jsonCompactIntern(doc, tok.str,
+                                                    tok.str_len);
+                doc->nodes[node].str.offset = offset;
+                doc->nodes[node].str.len = (uint32_t)tok.str_len;
+            }
+            break;
+
+        case JSON_TOKEN_INT:
+        case JSON_TOKEN_FLOAT:
+            if (flags & JSON_STRNUM_FLAG) {
+                node = jsonCompactNodeNew(doc, JSON_STRNUM, key);
+                if (node) {
+                    uint32_t offset = jsonCompactIntern(
+                            doc, buffer + tok.offset, tok.len);
+                    doc->nodes[node].str.offset = offset;
+                    doc->nodes[node].str.len = (uint32_t)tok.len;
+                }
+            } else if (tok.type == JSON_TOKEN_INT) {
+                node = jsonCompactNodeNew(doc, JSON_INT, key);
+                if (node) {
+                    doc->nodes[node].integer = tok.integer;
+                }
+            } else {
+                node = jsonCompactNodeNew(doc, JSON_FLOAT, key);
+                if (node) {
+                    doc->nodes[node].floating = tok.floating;
+                }
+            }
+            break;
+
+        case JSON_TOKEN_BOOL:
+            node = jsonCompactNodeNew(doc, JSON_BOOL, key);
+            if (node) {
+                doc->nodes[node].boolean = tok.boolean;
+            }
+            break;
+
+        default:
+            node = jsonCompactNodeNew(doc, JSON_NULL, key);
+            break;
+        }
+
+        if (node == JSON_NODE_NONE) {
+            break;
+        }
+        key = 0;
+
+        /* Link it on to the end of its container */
+        if (depth) {
+            jsonCompactFrame *frame = &stack[depth - 1];
+            n = &doc->nodes[frame->node];
+            if (frame->last == JSON_NODE_NONE) {
+                n->container.child = node;
+            } else {
+                doc->nodes[frame->last].next_type |= node
+                                                     << JSON_COMPACT_TYPE_BITS;
+            }
+            n->container.count++;
+            frame->last = node;
+        }
+
+        if (tok.type == JSON_TOKEN_START_OBJECT ||
+            tok.type == JSON_TOKEN_START_ARRAY) {
+            if (depth == capacity) {
+                jsonCompactFrame *grown = (jsonCompactFrame *)jsonMalloc(
+                        sizeof(jsonCompactFrame) * capacity * 2);
+                memcpy(grown, stack, sizeof(jsonCompactFrame) * depth);
+                if (stack != inline_stack) {
+                    jsonFree(stack);
+                }
+                stack = grown;
+                capacity *= 2;
+            }
+            stack[depth].node = node;
+            stack[depth].last = JSON_NODE_NONE;
+            depth++;
+        }
+    }
+
+    if (doc->state.error == JSON_OK) {
+        doc->state.error = t.p.errno;
+    }
+    doc->state.ch = t.p.offset < buflen ? buffer[t.p.offset] : '\0';
+    doc->state.offset = t.p.offset;
+
+    doc->capacity = doc->count;
+    doc->nodes = (jsonCompactNode *)jsonRealloc(
+            doc->nodes, sizeof(jsonCompactNode) * doc->capacity);
+    doc->pool_capacity = doc->pool_len;
+    doc->pool = (char *)jsonRealloc(doc->pool, doc->pool_capacity);
+
+    if (stack != inline_stack) {
+        jsonFree(stack);
+    }
+    jsonTokenizerCleanup(&t);
+    return doc;
+}
+
+void jsonCompactRelease(jsonCompact *doc) {
+    if (doc) {
+        jsonFree(doc->nodes);
+        jsonFree(doc->pool);
+        jsonFree(doc);
+    }
+}
+
+JSON_ERRNO jsonCompactGetError(jsonCompact *doc) {
+    return doc->state.error;
+}
+
+/* The error as a human readable string, must be freed with `jsonFree` */
+char *jsonCompactGetStrerror(jsonCompact *doc) {
+    if (doc->state.error == JSON_OK) {
+        return NULL;
+    }
+    jsonString *js = _jsonGetStrerror(doc->state.error, doc->state.ch,
+                                      doc->state.offset);
+    char *buffer = js->buffer;
+    jsonFree(js);
+    return buffer;
+}
+
+/* Bytes held by the nodes and string pool actually in use */
+size_t jsonCompactMemoryUsage(jsonCompact *doc) {
+    return sizeof(jsonCompactNode) * doc->count + doc->pool_len;
+}
+
+/* The top level object or array, JSON_NODE_NONE if parsing failed before
+ * getting to it */
+jsonNode jsonCompactRoot(jsonCompact *doc) {
+    return doc->count > 1 ? 1 : JSON_NODE_NONE;
+}
+
+/* Type of the node, JSON_NULL for JSON_NODE_NONE */
+JSON_DATA_TYPE jsonCompactType(jsonCompact *doc, jsonNode node) {
+    return (JSON_DATA_TYPE)(doc->nodes[node].next_type &
+                            JSON_COMPACT_TYPE_MASK);
+}
+
+/* Next member of the same object or array, or JSON_NODE_NONE */
+jsonNode jsonCompactNext(jsonCompact *doc, jsonNode node) {
+    return doc->nodes[node].next_type >> JSON_COMPACT_TYPE_BITS;
+}
+
+/* Key of an object member, NULL for anything else */
+const char *jsonCompactKey(jsonCompact *doc, jsonNode node) {
+    jsonCompactNode *n = &doc->nodes[node];
+    return n->key ? doc->pool + n->key : NULL;
+}
+
+/* First member of an object or array, JSON_NODE_NONE if it is empty or not a
+ * container */
+jsonNode jsonCompactChild(jsonCompact *doc, jsonNode node) {
+    JSON_DATA_TYPE type = jsonCompactType(doc, node);
+    if (type == JSON_OBJECT || type == JSON_ARRAY) {
+        return doc->nodes[node].container.child;
+    }
+    return JSON_NODE_NONE;
+}
+
+/* How many members an object or array has, 0 for anything else */
+size_t jsonCompactLength(jsonCompact *doc, jsonNode node) {
+    JSON_DATA_TYPE type = jsonCompactType(doc, node);
+    if (type == JSON_OBJECT || type == JSON_ARRAY) {
+        return doc->nodes[node].container.count;
+    }
+    return 0;
+}
+
+/* Member of an object called `name` or JSON_NODE_NONE */
+jsonNode jsonCompactObjectAt(jsonCompact *doc, jsonNode node,
+                             const char *name) {
+    if (jsonCompactType(doc, node) != JSON_OBJECT) {
+        return JSON_NODE_NONE;
+    }
+    for (jsonNode child = jsonCompactChild(doc, node); child;
+         child = jsonCompactNext(doc, child)) {
+        if (!strcmp(doc->pool + doc->nodes[child].key, name)) {
+            return child;
+        }
+    }
+    return JSON_NODE_NONE;
+}
+
+/* Element `idx` of an array or JSON_NODE_NONE */
+jsonNode jsonCompactArrayAt(jsonCompact *doc, jsonNode node, size_t idx) {
+    if (jsonCompactType(doc, node) != JSON_ARRAY) {
+        return JSON_NODE_NONE;
+    }
+    jsonNode child = jsonCompactChild(doc, node);
+    while (child && idx--) {
+        child = jsonCompactNext(doc, child);
+    }
+    return child;
+}
+
+int jsonCompactIsObject(jsonCompact *doc, jsonNode node) {
+    return node && jsonCompactType(doc, node) == JSON_OBJECT;
+}
+
+int jsonCompactIsArray(jsonCompact *doc, jsonNode node) {
+    return node && jsonCompactType(doc, node) == JSON_ARRAY;
+}
+
+int jsonCompactIsNull(jsonCompact *doc, jsonNode node) {
+    return node && jsonCompactType(doc, node) == JSON_NULL;
+}
+
+int jsonCompactIsBool(jsonCompact *doc, jsonNode node) {
+    return node && jsonCompactType(doc, node) == JSON_BOOL;
+}
+
+int jsonCompactIsString(jsonCompact *doc, jsonNode node) {
+    return node && jsonCompactType(doc, node) == JSON_STRING;
+}
+
+int jsonCompactIsInt(jsonCompact *doc, jsonNode node) {
+    return node && jsonCompactType(doc, node) == JSON_INT;
+}
+
+int jsonCompactIsFloat(jsonCompact *doc, jsonNode node) {
+    return node && jsonCompactType(doc, node) == JSON_FLOAT;
+}
+
+/* String value, '\0' terminated, or NULL if it is not a string. Its length,
+ * which counts any '\0's it contains, is written to `len` if not NULL */
+const char *jsonCompactGetString(jsonCompact *doc, jsonNode node,
+                                 size_t *len) {
+    if (!jsonCompactIsString(doc, node)) {
+        return NULL;
+    }
+    if (len) {
+        *len = doc->nodes[node].str.len;
+    }
+    return doc->pool + doc->nodes[node].str.offset;
+}
+
+/* Number as it was written, only present if parsed with JSON_STRNUM_FLAG */
+const char *jsonCompactGetStrnum(jsonCompact *doc, jsonNode node) {
+    if (!node || jsonCompactType(doc, node) != JSON_STRNUM) {
+        return NULL;
+    }
+    return doc->pool + doc->nodes[node].str.offset;
+}
+
+ssize_t jsonCompactGetInt(jsonCompact *doc, jsonNode node) {
+    return jsonCompactIsInt(doc, node) ? doc->nodes[node].integer : 0;
+}
+
+double jsonCompactGetFloat(jsonCompact *doc, jsonNode node) {
+    return jsonCompactIsFloat(doc, node) ? doc->nodes[node].floating : 0.0;
+}
+
+/* 1 = true, 0 = false, -1 = not a boolean */
+int jsonCompactGetBool(jsonCompact *doc, jsonNode node) {
+    return jsonCompactIsBool(doc, node) ? doc->nodes[node].boolean : -1;
+}
+
+static void jsonCompactConcat(jsonCompact *doc, jsonNode node,
+                              jsonString *js) {
+    jsonCompactNode *n = &doc->nodes[node];
+
+    switch (jsonCompactType(doc, node)) {
+    case JSON_INT:
+        jsonStringCatf(js, "%ld", (long)n->integer);
+        break;
+
+    case JSON_FLOAT:
+        jsonStringCatf(js, "%1.17g", n->floating);
+        break;
+
+    case JSON_STRNUM:
+        jsonStringCatf(js, "%s", doc->pool + n->str.offset);
+        break;
+
+    case JSON_STRING: {
+        unsigned char *escape_str = escapeString(doc->pool + n->str.offset);
+        jsonStringCatf(js, "\"%s\"", (char *)escape_str);
+        jsonFree(escape_str);
+        break;
+    }
+
+    case JSON_ARRAY:
+    case JSON_OBJECT: {
+        int is_object = jsonCompactType(doc, node) == JSON_OBJECT;
+        jsonStringCatLen(js, is_object ? "{" : "[", 1);
+        for (jsonNode child = n->container.child; child;
+             child = jsonCompactNext(doc, child)) {
+            if (is_object) {
+                unsigned char *escape_str = escapeString(
+                        doc->pool + doc->nodes[child].key);
+                jsonStringCatf(js, "\"%s\":", escape_str);
+                jsonFree(escape_str);
+            }
+            jsonCompactConcat(doc, child, js);
+            if (jsonCompactNext(doc, child)) {
+                jsonStringCatLen(js, ",", 1);
+            }
+        }
+        jsonStringCatLen(js, is_object ? "}" : "]", 1);
+        break;
+    }
+
+    case JSON_BOOL:
+        if (n->boolean == 1) {
+            jsonStringCatLen(js, "true", 4);
+        } else {
+            jsonStringCatLen(js, "false", 5);
+        }
+        break;
+
+    case JSON_NULL:
+        jsonStringCatLen(js, "null", 4);
+        break;
+    }
+}
+
+/* Serialise `node` and everything under it, the string must be freed with
+ * `jsonFree` */
+char *jsonCompactToString(jsonCompact *doc, jsonNode node, size_t *_len) {
+    jsonString *js = jsonStringNew();
+    char *buffer = NULL;
+
+    if (node) {
+        jsonCompactConcat(doc, node, js);
+    }
+    if (_len) {
+        *_len = js->len;
+    }
+    buffer = js->buffer;
+    jsonFree(js);
+    return buffer;
+}
+
+/*=============================================================================
+ * Tapes
+ *
+ * Another read only alternative to the tree, laid out for scanning. The
+ * document is one array of 64 bit words in the order the values appear,
+ * the top 8 bits of each word say what it is and the rest is its payload.
+ * An open bracket holds the index of its matching close and how many
+ * members it has, so stepping over a value of any size is one jump. Keys
+ * and strings are in a string buffer and numbers in a number buffer beside
+ * the tape. The first and last words are root words, the first holds the
+ * index of the last.
+ *============================================================================*/
+#define JSON_TAPE_TAG_SHIFT    (56)
+#define JSON_TAPE_PAYLOAD_MASK ((UINT64_C(1) << JSON_TAPE_TAG_SHIFT) - 1)
+/* Open brackets hold the index of the close in the bottom 32 bits and the
+ * member count above it, a count of JSON_TAPE_MAX_COUNT means there are at
+ * least that many and they have to be counted */
+#define JSON_TAPE_COUNT_SHIFT  (32)
+#define JSON_TAPE_MAX_COUNT    ((UINT64_C(1) << 24) - 1)
+#define JSON_TAPE_MAX_WORDS    (UINT32_MAX)
+
+#define JSON_TAPE_ROOT         ('r')
+#define JSON_TAPE_START_OBJECT ('{')
+#define JSON_TAPE_END_OBJECT   ('}')
+#define JSON_TAPE_START_ARRAY  ('[')
+#define JSON_TAPE_END_ARRAY    (']')
+#define JSON_TAPE_KEY          ('k')
+#define JSON_TAPE_STRING       ('"')
+#define JSON_TAPE_STRNUM       ('s')
+#define JSON_TAPE_INT          ('l')
+#define JSON_TAPE_FLOAT        ('d')
+#define JSON_TAPE_TRUE         ('t')
+#define JSON_TAPE_FALSE        ('f')
+#define JSON_TAPE_NULL         ('n')
+
+/* Open containers while building */
+typedef struct jsonTapeFrame {
+    jsonTapeIdx open;
+    uint64_t count;
+} jsonTapeFrame;
+
+struct jsonTape {
+    uint64_t *tape;
+    size_t len;
+    size_t capacity;
+    /* Each string is its length as a uint32_t, then the bytes '\0'
+     * terminated. Tape words hold the offset of the length */
+    char *strings;
+    size_t strings_len;
+    size_t strings_capacity;
+    /* Integers and the bits of doubles, tape words hold the index */
+    uint64_t *numbers;
+    size_t numbers_len;
+    size_t numbers_capacity;
+    jsonState state;
+};
+
+static inline int jsonTapeTag(jsonTape *doc, jsonTapeIdx idx) {
+    return (int)(doc->tape[idx] >> JSON_TAPE_TAG_SHIFT);
+}
+
+static inline uint64_t jsonTapePayload(jsonTape *doc, jsonTapeIdx idx) {
+    return doc->tape[idx] & JSON_TAPE_PAYLOAD_MASK;
+}
+
+static jsonTapeIdx jsonTapeAppend(jsonTape *doc, int tag, uint64_t payload) {
+    if (doc->len == JSON_TAPE_MAX_WORDS) {
+        doc->state.error = JSON_DOCUMENT_TOO_LARGE;
+        return JSON_TAPE_NONE;
+    }
+    if (doc->len == doc->capacity) {
+        doc->capacity *= 2;
+        doc->tape = (uint64_t *)jsonRealloc(doc->tape,
+                                            sizeof(uint64_t) * doc->capacity);
+    }
+    doc->tape[doc->len] = ((uint64_t)tag << JSON_TAPE_TAG_SHIFT) | payload;
+    return (jsonTapeIdx)doc->len++;
+}
+
+/* Copy `len` bytes in to the string buffer returning where they start */
+static uint64_t jsonTapeAppendString(jsonTape *doc, const char *str,
+                                     size_t len) {
+    uint32_t len32 = (uint32_t)len;
+
+    if (len > UINT32_MAX) {
+        doc->state.error = JSON_DOCUMENT_TOO_LARGE;
+        return 0;
+    }
+    if (doc->strings_len + sizeof(len32) + len + 1 > doc->strings_capacity) {
+        while (doc->strings_len + sizeof(len32) + len + 1 >
+               doc->strings_capacity) {
+            doc->strings_capacity *= 2;
+        }
+        doc->strings = (char *)jsonRealloc(doc->strings,
+                                           doc->strings_capacity);
+    }
+
+    uint64_t offset = doc->strings_len;
+    memcpy(doc->strings + offset, &len32, sizeof(len32));
+    memcpy(doc->strings + offset + sizeof(len32), str, len);
+    doc->strings[offset + sizeof(len32) + len] = '\0';
+    doc->strings_len += sizeof(len32) + len + 1;
+    return offset;
+}
+
+static uint64_t jsonTapeAppendNumber(jsonTape *doc, uint64_t bits) {
+    if (doc->numbers_len == doc->numbers_capacity) {
+        doc->numbers_capacity *= 2;
+        doc->numbers = (uint64_t *)jsonRealloc(
+                doc->numbers, sizeof(uint64_t) * doc->numbers_capacity);
+    }
+    doc->numbers[doc->numbers_len] = bits;
+    return doc->numbers_len++;
+}
+
+static jsonTape *jsonTapeNew(size_t words, size_t strings, size_t numbers) {
+    jsonTape *doc = (jsonTape *)jsonMalloc(sizeof(jsonTape));
+
+    doc->capacity = words > 64 ? words : 64;
+    doc->tape = (uint64_t *)jsonMalloc(sizeof(uint64_t) * doc->capacity);
+    doc->len = 0;
+    doc->strings_capacity = strings > 64 ? strings : 64;
+    doc->strings = (char *)jsonMalloc(doc->strings_capacity);
+    doc->strings_len = 0;
+    doc->numbers_capacity = numbers > 16 ? numbers : 16;
+    doc->numbers = (uint64_t *)jsonMalloc(sizeof(uint64_t) *
+                                          doc->numbers_capacity);
+    doc->numbers_len = 0;
+    doc->state.error = JSON_OK;
+    doc->state.ch = '\0';
+    doc->state.offset = 0;
+    doc->state.mem = NULL;
+    return doc;
+}
+
+/**
+ * Parse `buffer` in to a tape. JSON_STRNUM_FLAG keeps numbers as strings and
+ * JSON_INSITU_FLAG is as for the tokenizer, no other flags apply. Keys and
+ * strings are copied so the buffer can be freed straight away. Check for
+ * errors with `jsonTapeGetError`, the tape must be freed with
+ * `jsonTapeRelease`.
+ */
+jsonTape *jsonTapeParse(char *buffer, size_t buflen, int flags) {
+    jsonTape *doc = jsonTapeNew(buflen / 8, buflen / 4, buflen / 32);
+    jsonTapeFrame inline_stack[JSON_PARSE_INLINE_DEPTH];
+    jsonTapeFrame *stack = inline_stack;
+    size_t capacity = JSON_PARSE_INLINE_DEPTH;
+    size_t depth = 0;
+    jsonTokenizer t;
+    jsonToken tok;
+
+    jsonTapeAppend(doc, JSON_TAPE_ROOT, 0);
+    jsonTokenizerInit(&t, buffer, buflen, flags);
+
+    while (doc->state.error == JSON_OK && jsonNextToken(&t, &tok)) {
+        jsonTapeIdx idx;
+        uint64_t payload;
+
+        switch (tok.type) {
+        case JSON_TOKEN_KEY:
+            payload = jsonTapeAppendString(doc, tok.str, tok.str_len);
+            jsonTapeAppend(doc, JSON_TAPE_KEY, payload);
+            continue;
+
+        case JSON_TOKEN_END_OBJECT:
+        case JSON_TOKEN_END_ARRAY: {
+            jsonTapeFrame *frame = &stack[--depth];
+            int tag = tok.type == JSON_TOKEN_END_OBJECT ? JSON_TAPE_END_OBJECT
+                                                        : JSON_TAPE_END_ARRAY;
+            idx = jsonTapeAppend(doc, tag, frame->open);
+            if (idx) {
+                uint64_t count = frame->count < JSON_TAPE_MAX_COUNT
+                                         ? frame->count
+                                         : JSON_TAPE_MAX_COUNT;
+                doc->tape[frame->open] |= (count << JSON_TAPE_COUNT_SHIFT) |
+                                          idx;
+            }
+            continue;
+        }
+
+        case JSON_TOKEN_START_OBJECT:
+            idx = jsonTapeAppend(doc, JSON_TAPE_START_OBJECT, 0);
+            break;
+
+        case JSON_TOKEN_START_ARRAY:
+            idx = jsonTapeAppend(doc, JSON_TAPE_START_ARRAY, 0);
+            break;
+
+        case JSON_TOKEN_STRING:
+            payload = jsonTapeAppendString(doc, tok.str, tok.str_len);
+            idx = jsonTapeAppend(doc, JSON_TAPE_STRING, payload);
+            break;
+
+        case JSON_TOKEN_INT:
+        case JSON_TOKEN_FLOAT:
+            if (flags & JSON_STRNUM_FLAG) {
+                payload = jsonTapeAppendString(doc, buffer + tok.offset,
+                                               tok.len);
+                idx = jsonTapeAppend(doc, JSON_TAPE_STRNUM, payload);
+            } else if (tok.type == JSON_TOKEN_INT) {
+                payload = jsonTapeAppendNumber(doc, (uint64_t)tok.integer);
+                idx = jsonTapeAppend(doc, JSON_TAPE_INT, payload);
+            } else {
+                uint64_t bits;
+                memcpy(&bits, &tok.floating, sizeof(bits));
+                payload = jsonTapeAppendNumber(doc, bits);
+                idx = jsonTapeAppend(doc, JSON_TAPE_FLOAT, payload);
+            }
+            break;
+
+        case JSON_TOKEN_BOOL:
+            idx = jsonTapeAppend(doc,
+                                 tok.boolean ? JSON_TAPE_TRUE : JSON_TAPE_FALSE,
+                                 0);
+            break;
+
+        default:
+            idx = jsonTapeAppend(doc, JSON_TAPE_NULL, 0);
+            break;
+        }
+
+        if (idx == JSON_TAPE_NONE) {
+            break;
+        }
+        if (depth) {
+            stack[depth - 1].count++;
+        }
+
+        if (tok.type == JSON_TOKEN_START_OBJECT ||
+            tok.type == JSON_TOKEN_START_ARRAY) {
+            if (depth == capacity) {
+                jsonTapeFrame *grown = (jsonTapeFrame *)jsonMalloc(
+                        sizeof(jsonTapeFrame) * capacity * 2);
+                memcpy(grown, stack, sizeof(jsonTapeFrame) * depth);
+                if (stack != inline_stack) {
+                    jsonFree(stack);
+                }
+                stack = grown;
+                capacity *= 2;
+            }
+            stack[depth].open = idx;
+            stack[depth].count = 0;
+            depth++;
+        }
+    }
+
+    if (doc->state.error == JSON_OK) {
+        doc->state.error = t.p.errno;
+    }
+    doc->state.ch = t.p.offset < buflen ? buffer[t.p.offset] : '\0';
+    doc->state.offset = t.p.offset;
+
+    if (doc->state.error == JSON_OK) {
+        jsonTapeIdx end = jsonTapeAppend(doc, JSON_TAPE_ROOT, 0);
+        doc->tape[0] |= end;
+    }
+    if (doc->state.error != JSON_OK) {
+        /* Brackets that were never closed cannot be skipped over, so none
+         * of it is kept */
+        doc->len = 0;
+        doc->strings_len = 0;
+        doc->numbers_len = 0;
+    }
+
+    doc->capacity = doc->len ? doc->len : 1;
+    doc->tape = (uint64_t *)jsonRealloc(doc->tape,
+                                        sizeof(uint64_t) * doc->capacity);
+    doc->strings_capacity = doc->strings_len ? doc->strings_len : 1;
+    doc->strings = (char *)jsonRealloc(doc->strings, doc->strings_capacity);
+    doc->numbers_capacity = doc->numbers_len ? doc->numbers_len : 1;
+    doc->numbers = (uint64_t *)jsonRealloc(
+            doc->numbers, sizeof(uint64_t) * doc->numbers_capacity);
+
+    if (stack != inline_stack) {
+        jsonFree(stack);
+    }
+    jsonTokenizerCleanup(&t);
+    return doc;
+}
+
+void jsonTapeRelease(jsonTape *doc) {
+    if (doc) {
+        jsonFree(doc->tape);
+        jsonFree(doc->strings);
+        jsonFree(doc->numbers);
+        jsonFree(doc);
+    }
+}
+
+JSON_ERRNO jsonTapeGetError(jsonTape *doc) {
+    return doc->state.error;
+}
+
+/* The error as a human readable string, must be freed with `jsonFree` */
+char *jsonTapeGetStrerror(jsonTape *doc) {
+    if (doc->state.error == JSON_OK) {
+        return NULL;
+    }
+    jsonString *js = _jsonGetStrerror(doc->state.error, doc->state.ch,
+                                      doc->state.offset);
+    char *buffer = js->buffer;
+    jsonFree(js);
+    return buffer;
+}
+
+/* Bytes held by the tape and the string and number buffers */
+size_t jsonTapeMemoryUsage(jsonTape *doc) {
+    return sizeof(uint64_t) * (doc->len + doc->numbers_len) +
+           doc->strings_len;
+}
+
+/* The top level value, JSON_TAPE_NONE if parsing failed */
+jsonTapeIdx jsonTapeRoot(jsonTape *doc) {
+    return doc->len > 2 ? 1 : JSON_TAPE_NONE;
+}
+
+/* Type of the value, JSON_NULL for JSON_TAPE_NONE */
+JSON_DATA_TYPE jsonTapeType(jsonTape *doc, jsonTapeIdx idx) {
+    if (!idx) {
+        return JSON_NULL;
+    }
+    switch (jsonTapeTag(doc, idx)) {
+    case JSON_TAPE_START_OBJECT:
+        return JSON_OBJECT;
+    case JSON_TAPE_START_ARRAY:
+        return JSON_ARRAY;
+    case JSON_TAPE_STRING:
+        return JSON_STRING;
+    case JSON_TAPE_STRNUM:
+        return JSON_STRNUM;
+    case JSON_TAPE_INT:
+        return JSON_INT;
+    case JSON_TAPE_FLOAT:
+        return JSON_FLOAT;
+    case JSON_TAPE_TRUE:
+    case JSON_TAPE_FALSE:
+        return JSON_BOOL;
+    default:
+        return JSON_NULL;
+    }
+}
+
+/* Index of the word after `idx` and everything under it, JSON_TAPE_NONE for
+ * JSON_TAPE_NONE as there is no word to step over */
+jsonTapeIdx jsonTapeSkip(jsonTape *doc, jsonTapeIdx idx) {
+    if (!idx) {
+        return JSON_TAPE_NONE;
+    }
+    int tag = jsonTapeTag(doc, idx);
+    if (tag == JSON_TAPE_START_OBJECT || tag == JSON_TAPE_START_ARRAY) {
+        return (jsonTapeIdx)(doc->tape[idx] & UINT32_MAX) + 1;
+    }
+    return idx + 1;
+}
+
+/* Step over a key to the value it belongs to, JSON_TAPE_NONE if `idx` is the
+ * end of a container */
+static jsonTapeIdx jsonTapeValueAt(jsonTape *doc, jsonTapeIdx idx) {
+    switch (jsonTapeTag(doc, idx)) {
+    case JSON_TAPE_KEY:
+        return idx + 1;
+    case JSON_TAPE_END_OBJECT:
+    case JSON_TAPE_END_ARRAY:
+    case JSON_TAPE_ROOT:
+        return JSON_TAPE_NONE;
+    default:
+        return idx;
+    }
+}
+
+/* Next member of the same object or array, or JSON_TAPE_NONE */
+jsonTapeIdx jsonTapeNext(jsonTape *doc, jsonTapeIdx idx) {
+    if (!idx) {
+        return JSON_TAPE_NONE;
+    }
+    return jsonTapeValueAt(doc, jsonTapeSkip(doc, idx));
+}
+
+/* First member of an object or array, JSON_TAPE_NONE if it is empty or not
+ * a container */
+jsonTapeIdx jsonTapeChild(jsonTape *doc, jsonTapeIdx idx) {
+    if (jsonTapeIsObject(doc, idx) || jsonTapeIsArray(doc, idx)) {
+        return jsonTapeValueAt(doc, idx + 1);
+    }
+    return JSON_TAPE_NONE;
+}
+
+static char *jsonTapeStringAt(jsonTape *doc, jsonTapeIdx idx, size_t *len) {
+    uint64_t offset = jsonTapePayload(doc, idx);
+    if (len) {
+        uint32_t len32;
+        memcpy(&len32, doc->strings + offset, sizeof(len32));
+        *len = len32;
+    }
+    return doc->strings + offset + sizeof(uint32_t);
+}
+
+/* Key of an object member, NULL for anything else */
+const char *jsonTapeKey(jsonTape *doc, jsonTapeIdx idx) {
+    if (idx > 1 && jsonTapeTag(doc, idx - 1) == JSON_TAPE_KEY) {
+        return jsonTapeStringAt(doc, idx - 1, NULL);
+    }
+    return NULL;
+}
+
+/* How many members an object or array has, 0 for anything else */
+size_t jsonTapeLength(jsonTape *doc, jsonTapeIdx idx) {
+    if (!jsonTapeIsObject(doc, idx) && !jsonTapeIsArray(doc, idx)) {
+        return 0;
     }
-    return js;
+
+    size_t count = (jsonTapePayload(doc, idx) >> JSON_TAPE_COUNT_SHIFT);
+    if (count == JSON_TAPE_MAX_COUNT) {
+        count = 0;
+        for (jsonTapeIdx child = jsonTapeChild(doc, idx); child;
+             child = jsonTapeNext(doc, child)) {
+            count++;
+        }
+    }
+    return count;
 }
 
-/* If the json has state this will return the error as a human readible string
- * must be freed by the caller (allows it to be thread safe). It would be
- * advisable to use this for debugging purposes only as it calls malloc */
-char *jsonGetStrerror(json *J) {
-    if (!jsonOk(J)) {
-        jsonString *js = _jsonGetStrerror(J->state->error, J->state->ch,
-                                          J->state->offset);
-        char *buffer = js->buffer;
-        free(js);
-        return buffer;
+/* Member of an object called `name` or JSON_TAPE_NONE */
+jsonTapeIdx jsonTapeObjectAt(jsonTape *doc, jsonTapeIdx idx,
+                             const char *name) {
+    if (!jsonTapeIsObject(doc, idx)) {
+        return JSON_TAPE_NONE;
     }
-    return NULL;
+    for (jsonTapeIdx child = jsonTapeChild(doc, idx); child;
+         child = jsonTapeNext(doc, child)) {
+        if (!strcmp(jsonTapeStringAt(doc, child - 1, NULL), name)) {
+            return child;
+        }
+    }
+    return JSON_TAPE_NONE;
 }
 
-/* Print the error to stderr */
-void jsonPrintError(json *J) {
-    char *str_error = jsonGetStrerror(J);
-    if (str_error) {
-        fprintf(stderr, "%s\n", str_error);
-        free(str_error);
-    } else {
-        fprintf(stderr, "No errors\n");
+/* Element `n` of an array or JSON_TAPE_NONE */
+jsonTapeIdx jsonTapeArrayAt(jsonTape *doc, jsonTapeIdx idx, size_t n) {
+    if (!jsonTapeIsArray(doc, idx)) {
+        return JSON_TAPE_NONE;
     }
+    jsonTapeIdx child = jsonTapeChild(doc, idx);
+    while (child && n--) {
+        child = jsonTapeNext(doc, child);
+    }
+    return child;
 }
 
-/**
- * Parse null terminated string buffer to a json struct. The length of the json
- * string must be known ahead of time.
- *
- * Pass in flags to modify the behaviour of the parser:
- * - JSON_STRNUM_FLAG: do not try to parse numbers: floats,hex, ints etc..
- *   will be treated as strings.
- * - JSON_STATE_FLAG: Maintain state for the parse, capturing errors
- *
- * You must free the resulting pointer with `jsonRelease`
- */
-json *jsonParseWithLenAndFlags(char *raw_json, size_t buflen, int flags) {
-    jsonParser p;
-    p.flags = flags;
-    jsonParserInit(&p, raw_json, buflen);
+int jsonTapeIsObject(jsonTape *doc, jsonTapeIdx idx) {
+    return idx && jsonTapeTag(doc, idx) == JSON_TAPE_START_OBJECT;
+}
 
-    if (!jsonAdvanceWhitespace(&p)) {
-        return NULL;
-    }
-    char peek = jsonPeek(&p);
-    json *J = jsonNew(&p);
+int jsonTapeIsArray(jsonTape *doc, jsonTapeIdx idx) {
+    return idx && jsonTapeTag(doc, idx) == JSON_TAPE_START_ARRAY;
+}
 
-    p.J = J;
+int jsonTapeIsNull(jsonTape *doc, jsonTapeIdx idx) {
+    return idx && jsonTapeTag(doc, idx) == JSON_TAPE_NULL;
+}
 
-    /**
-     * Kick off parsing by finding the first non whitespace character,
-     * json has to start with either '{' or '['
-     */
-    if (peek == '{') {
-        J->type = JSON_OBJECT;
-        J->object = jsonParseObject(&p);
-    } else if (peek == '[') {
-        J->type = JSON_ARRAY;
-        J->array = jsonParseArray(&p);
-    } else {
-        p.errno = JSON_CANNOT_START_PARSE;
+int jsonTapeIsBool(jsonTape *doc, jsonTapeIdx idx) {
+    return idx && (jsonTapeTag(doc, idx) == JSON_TAPE_TRUE ||
+                   jsonTapeTag(doc, idx) == JSON_TAPE_FALSE);
+}
+
+int jsonTapeIsString(jsonTape *doc, jsonTapeIdx idx) {
+    return idx && jsonTapeTag(doc, idx) == JSON_TAPE_STRING;
+}
+
+int jsonTapeIsInt(jsonTape *doc, jsonTapeIdx idx) {
+    return idx && jsonTapeTag(doc, idx) == JSON_TAPE_INT;
+}
+
+int jsonTapeIsFloat(jsonTape *doc, jsonTapeIdx idx) {
+    return idx && jsonTapeTag(doc, idx) == JSON_TAPE_FLOAT;
+}
+
+/* String value, '\0' terminated, or NULL if it is not a string. Its length,
+ * which counts any '\0's it contains, is written to `len` if not NULL */
+const char *jsonTapeGetString(jsonTape *doc, jsonTapeIdx idx, size_t *len) {
+    if (!jsonTapeIsString(doc, idx)) {
+        return NULL;
     }
+    return jsonTapeStringAt(doc, idx, len);
+}
 
-    J->state = jsonStateNew(&p);
-    J->state->error = p.errno;
-    J->state->ch = p.buffer[p.offset];
-    J->state->offset = p.offset;
-    J->state->mem = (void *)p.allocator;
+/* Number as it was written, only present if parsed with JSON_STRNUM_FLAG */
+const char *jsonTapeGetStrnum(jsonTape *doc, jsonTapeIdx idx) {
+    if (!idx || jsonTapeTag(doc, idx) != JSON_TAPE_STRNUM) {
+        return NULL;
+    }
+    return jsonTapeStringAt(doc, idx, NULL);
+}
 
-#ifdef ERROR_REPORTING
-    if (p.errno != JSON_OK) {
-        char *error_buf = _jsonGetStrerror(p.errno, jsonPeek(&p), p.offset);
-        json_debug("%s\n", error_buf);
-        free(error_buf);
+ssize_t jsonTapeGetInt(jsonTape *doc, jsonTapeIdx idx) {
+    if (!jsonTapeIsInt(doc, idx)) {
+        return 0;
     }
-#endif
+    return (ssize_t)doc->numbers[jsonTapePayload(doc, idx)];
+}
 
-    return J;
+double jsonTapeGetFloat(jsonTape *doc, jsonTapeIdx idx) {
+    double floating;
+    if (!jsonTapeIsFloat(doc, idx)) {
+        return 0.0;
+    }
+    memcpy(&floating, &doc->numbers[jsonTapePayload(doc, idx)],
+           sizeof(floating));
+    return floating;
 }
 
-/**
- * Parse null terminated string buffer to a json struct. The length of the json
- * string must be known ahead of time.
- *
- * You must free the resulting pointer with `jsonRelease`
- */
-json *jsonParseWithLen(char *raw_json, size_t buflen) {
-    return jsonParseWithLenAndFlags(raw_json, buflen, JSON_NO_FLAGS);
+/* 1 = true, 0 = false, -1 = not a boolean */
+int jsonTapeGetBool(jsonTape *doc, jsonTapeIdx idx) {
+    if (!jsonTapeIsBool(doc, idx)) {
+        return -1;
+    }
+    return jsonTapeTag(doc, idx) == JSON_TAPE_TRUE;
 }
 
 /**
- * Parse null terminated string buffer to a json struct strlen will be called
- * to obtain the raw json string's length. Pass in flags to modify the
- * behaviour of the parser.
- *
- * Pass in flags to modify the behaviour of the parser:
- * - JSON_STRNUM_FLAG: do not try to parse numbers: floats,hex, ints etc..
- *   will be treated as strings.
- *
- * You must free the resulting pointer with `jsonRelease`
+ * Copy the value at `idx` and everything under it in to a tape of its own,
+ * which must be freed with `jsonTapeRelease`, or NULL for JSON_TAPE_NONE.
+ * The words are copied in one go and only the payloads that point
+ * somewhere are rewritten.
  */
-json *jsonParseWithFlags(char *raw_json, int flags) {
-    return jsonParseWithLenAndFlags(raw_json, strlen(raw_json), flags);
+jsonTape *jsonTapeCopy(jsonTape *doc, jsonTapeIdx idx) {
+    if (!idx) {
+        return NULL;
+    }
+
+    jsonTapeIdx end = jsonTapeSkip(doc, idx);
+    size_t len = end - idx;
+    /* Everything in the copy moves up by this many words */
+    size_t shift = idx - 1;
+    jsonTape *copy = jsonTapeNew(len + 2, 64, 16);
+
+    copy->tape[0] = ((uint64_t)JSON_TAPE_ROOT << JSON_TAPE_TAG_SHIFT) |
+                    (len + 1);
+    memcpy(copy->tape + 1, doc->tape + idx, sizeof(uint64_t) * len);
+    copy->tape[len + 1] = (uint64_t)JSON_TAPE_ROOT << JSON_TAPE_TAG_SHIFT;
+    copy->len = len + 2;
+
+    for (size_t i = 1; i <= len; ++i) {
+        uint64_t word = copy->tape[i];
+        uint64_t tag_bits = word & ~JSON_TAPE_PAYLOAD_MASK;
+        size_t str_len;
+        const char *str;
+
+        switch ((int)(word >> JSON_TAPE_TAG_SHIFT)) {
+        /* Both hold an index in their bottom bits */
+        case JSON_TAPE_START_OBJECT:
+        case JSON_TAPE_START_ARRAY:
+        case JSON_TAPE_END_OBJECT:
+        case JSON_TAPE_END_ARRAY:
+            copy->tape[i] = word - shift;
+            break;
+
+        case JSON_TAPE_KEY:
+        case JSON_TAPE_STRING:
+        case JSON_TAPE_STRNUM:
+            str = jsonTapeStringAt(doc, idx + i - 1, &str_len);
+            copy->tape[i] = tag_bits |
+                            jsonTapeAppendString(copy, str, str_len);
+            break;
+
+        case JSON_TAPE_INT:
+        case JSON_TAPE_FLOAT:
+            copy->tape[i] = tag_bits |
+                            jsonTapeAppendNumber(
+                                    copy, doc->numbers[word &
+                                                       JSON_TAPE_PAYLOAD_MASK]);
+            break;
+        }
+    }
+    return copy;
 }
 
 /**
- * Parse null terminated string buffer to a json struct, strlen will be called
- * to obtain the raw json string's length.
- *
- * You must free the resulting pointer with `jsonRelease`
+ * Serialise `idx` and everything under it, the string must be freed with
+ * `jsonFree`. This is one pass along the tape, a comma is due before any
+ * value or key that does not directly follow an open bracket or a key.
  */
-json *jsonParse(char *raw_json) {
-    return jsonParseWithLen(raw_json, strlen(raw_json));
+char *jsonTapeToString(jsonTape *doc, jsonTapeIdx idx, size_t *_len) {
+    jsonString *js = jsonStringNew();
+    jsonTapeIdx end = jsonTapeSkip(doc, idx);
+    int comma = 0;
+    char *buffer;
+
+    for (jsonTapeIdx i = idx; i < end; ++i) {
+        int tag = jsonTapeTag(doc, i);
+        unsigned char *escape_str;
+        double floating;
+
+        if (comma && tag != JSON_TAPE_END_OBJECT &&
+            tag != JSON_TAPE_END_ARRAY) {
+            jsonStringCatLen(js, ",", 1);
+        }
+        comma = 1;
+
+        switch (tag) {
+        case JSON_TAPE_START_OBJECT:
+        case JSON_TAPE_START_ARRAY:
+        case JSON_TAPE_END_OBJECT:
+        case JSON_TAPE_END_ARRAY: {
+            char ch = (char)tag;
+            jsonStringCatLen(js, &ch, 1);
+            comma = tag == JSON_TAPE_END_OBJECT || tag == JSON_TAPE_END_ARRAY;
+            break;
+        }
+
+        case JSON_TAPE_KEY:
+            escape_str = escapeString(jsonTapeStringAt(doc, i, NULL));
+            jsonStringCatf(js, "\"%s\":", (char *)escape_str);
+            jsonFree(escape_str);
+            comma = 0;
+            break;
+
+        case JSON_TAPE_STRING:
+            escape_str = escapeString(jsonTapeStringAt(doc, i, NULL));
+            jsonStringCatf(js, "\"%s\"", (char *)escape_str);
+            jsonFree(escape_str);
+            break;
+
+        case JSON_TAPE_STRNUM:
+            jsonStringCatf(js, "%s", jsonTapeStringAt(doc, i, NULL));
+            break;
+
+        case JSON_TAPE_INT:
+            jsonStringCatf(js, "%ld",
+                           (long)doc->numbers[jsonTapePayload(doc, i)]);
+            break;
+
+        case JSON_TAPE_FLOAT:
+            memcpy(&floating, &doc->numbers[jsonTapePayload(doc, i)],
+                   sizeof(floating));
+            jsonStringCatf(js, "%1.17g", floating);
+            break;
+
+        case JSON_TAPE_TRUE:
+            jsonStringCatLen(js, "true", 4);
+            break;
+
+        case JSON_TAPE_FALSE:
+            jsonStringCatLen(js, "false", 5);
+            break;
+
+        case JSON_TAPE_NULL:
+            jsonStringCatLen(js, "null", 4);
+            break;
+        }
+    }
+
+    if (_len) {
+        *_len = js->len;
+    }
+    buffer = js->buffer;
+    jsonFree(js);
+    return buffer;
 }
 
 /**
@@ -1941,29 +7466,61 @@ int jsonIsString(json *j) {
     return j && j->type == JSON_STRING;
 }
 
+/* Numbers parsed with JSON_LAZY_NUMBER_FLAG are converted on the first call
+ * to any of the number getters, until then the type is only a guess */
 int jsonIsInt(json *j) {
+    if (j) {
+        jsonMaterializeNumber(j);
+    }
     return j && j->type == JSON_INT;
 }
 
 int jsonIsFloat(json *j) {
+    if (j) {
+        jsonMaterializeNumber(j);
+    }
     return j && j->type == JSON_FLOAT;
 }
 
 /**
- * Get json string value or NULL
+ * Get json string value or NULL. Strings parsed with JSON_LAZY_STRING_FLAG
+ * are copied, and unescaped if needs be, on the first call.
  */
 char *jsonGetString(json *J) {
-    return J && J->type == JSON_STRING ? J->str : NULL;
+    if (!J || J->type != JSON_STRING) {
+        return NULL;
+    }
+    if (J->aux & JSON_AUX_LAZY) {
+        return jsonMaterializeString(J);
+    }
+    return J->str;
+}
+
+/**
+ * Get json string value without copying it out of the buffer if it was parsed
+ * with JSON_LAZY_STRING_FLAG and has no escapes. The string is NOT '\0'
+ * terminated, its length is written to `len`.
+ */
+const char *jsonGetStringView(json *J, size_t *len) {
+    if (J && J->type == JSON_STRING && (J->aux & JSON_AUX_LAZY) &&
+        !(J->aux & JSON_AUX_ESCAPED)) {
+        *len = J->aux & JSON_AUX_LEN_MASK;
+        return J->str;
+    }
+
+    char *str = jsonGetString(J);
+    *len = str ? strlen(str) : 0;
+    return str;
 }
 
 /* Get float from json object */
 double jsonGetFloat(json *J) {
-    return J && J->type == JSON_FLOAT ? J->floating : 0.0;
+    return jsonIsFloat(J) ? J->floating : 0.0;
 }
 
 /* Get int from json object */
 ssize_t jsonGetInt(json *J) {
-    return J && J->type == JSON_INT ? J->integer : 0;
+    return jsonIsInt(J) ? J->integer : 0;
 }
 
 /* Get string number from json object, will only be present if the json was
@@ -1980,6 +7537,271 @@ json *jsonGetArray(json *J) {
     return J && J->type == JSON_ARRAY ? J->array : NULL;
 }
 
+/* Members of an array in one contiguous vector */
+typedef struct jsonArrayIndex {
+    size_t len;
+    json *items[];
+} jsonArrayIndex;
+
+/* Objects with fewer members than this are searched one key at a time */
+#define JSON_OBJECT_INDEX_MIN (16)
+
+typedef struct jsonObjectIndexEntry {
+    json *member;
+    /* Hash of the key and of the key with ASCII letters upper cased */
+    uint32_t hash;
+    uint32_t folded;
+} jsonObjectIndexEntry;
+
+/* Open addressing table of the members of an object, probed linearly from
+ * the folded hash so both kinds of lookup walk the same slots. Duplicate
+ * keys are found in the order they appear in the object */
+typedef struct jsonObjectIndex {
+    size_t mask;
+    jsonObjectIndexEntry entries[];
+} jsonObjectIndex;
+
+/* The arena of the document `J` is in, NULL if it was not made by the
+ * parser */
+static jsonAllocator *jsonContainerAllocator(json *J) {
+    if (J->state == NULL) {
+        return NULL;
+    }
+    return (jsonAllocator *)J->state->mem;
+}
+
+/* The index built over the members of `J`, or NULL if there is not one */
+static void *jsonContainerIndex(jsonAllocator *allocator, json *J) {
+    if (J->aux & JSON_AUX_INDEXED) {
+        return allocator->indexes[J->aux & JSON_AUX_SLOT_MASK];
+    }
+    return NULL;
+}
+
+/* Make room to record one more index, 0 if `size` bytes is too big to
+ * allocate or there are no slots left */
+static int jsonContainerIndexReserve(jsonAllocator *allocator, size_t size) {
+    if (allocator->indexes_len == JSON_AUX_SLOT_MASK || size > UINT_MAX) {
+        return 0;
+    }
+    if (allocator->indexes_len == allocator->indexes_capacity) {
+        jsonAllocatorHooks *hooks = &allocator->hooks;
+        allocator->indexes_capacity = allocator->indexes_capacity
+                                              ? allocator->indexes_capacity * 2
+                                              : 16;
+        allocator->indexes = (void **)hooks->realloc(
+                hooks->ctx, allocator->indexes,
+                sizeof(void *) * allocator->indexes_capacity);
+    }
+    return 1;
+}
+
+static void jsonContainerIndexSet(jsonAllocator *allocator, json *J,
+                                  void *index) {
+    allocator->indexes[allocator->indexes_len] = index;
+    J->aux |= JSON_AUX_INDEXED | allocator->indexes_len++;
+}
+
+/**
+ * The index over the members of the array `J`, built in the document's
+ * arena the first time it is asked for. Like lazy strings this writes to
+ * the document, so the first call must not race with other readers. NULL if
+ * it cannot be built or the document was parsed without
+ * JSON_LAZY_INDEX_FLAG, the caller then has to walk `J->array`.
+ */
+static jsonArrayIndex *jsonArrayIndexGet(json *J) {
+    jsonAllocator *allocator = jsonContainerAllocator(J);
+    jsonArrayIndex *index;
+    size_t len = 0, size;
+
+    if (allocator == NULL || !(J->aux & JSON_AUX_INDEXABLE)) {
+        return NULL;
+    }
+    if ((index = jsonContainerIndex(allocator, J)) != NULL) {
+        return index;
+    }
+
+    for (json *el = J->array; el; el = el->next) {
+        len++;
+    }
+    size = sizeof(jsonArrayIndex) + sizeof(json *) * len;
+    if (!jsonContainerIndexReserve(allocator, size)) {
+        return NULL;
+    }
+
+    index = (jsonArrayIndex *)jsonAlloc(allocator, (unsigned int)size);
+    index->len = len;
+    len = 0;
+    for (json *el = J->array; el; el = el->next) {
+        index->items[len++] = el;
+    }
+    jsonContainerIndexSet(allocator, J, index);
+    return index;
+}
+
+/* FNV-1a of `key` as it is and with ASCII letters upper cased, the same
+ * folding `strcasecmp` does */
+static void jsonHashKey(const char *key, uint32_t *hash, uint32_t *folded) {
+    uint32_t h = 2166136261u, f = 2166136261u;
+
+    for (const unsigned char *ptr = (const unsigned char *)key; *ptr; ++ptr) {
+        h = (h ^ *ptr) * 16777619u;
+        f = (f ^ (unsigned char)toUpper(*ptr)) * 16777619u;
+    }
+    *hash = h;
+    *folded = f;
+}
+
+/* As `jsonArrayIndexGet` but for objects, `len` is how many members it
+ * has */
+static jsonObjectIndex *jsonObjectIndexGet(json *J, size_t len) {
+    jsonAllocator *allocator = jsonContainerAllocator(J);
+    jsonObjectIndex *index;
+    size_t capacity = 16, size;
+
+    if (allocator == NULL || !(J->aux & JSON_AUX_INDEXABLE)) {
+        return NULL;
+    }
+    if ((index = jsonContainerIndex(allocator, J)) != NULL) {
+        return index;
+    }
+
+    /* At most half full so probes stay short */
+    while (capacity < len * 2) {
+        capacity *= 2;
+    }
+    size = sizeof(jsonObjectIndex) + sizeof(jsonObjectIndexEntry) * capacity;
+    if (!jsonContainerIndexReserve(allocator, size)) {
+        return NULL;
+    }
+
+    index = (jsonObjectIndex *)jsonAlloc(allocator, (unsigned int)size);
+    index->mask = capacity - 1;
+    memset(index->entries, 0, sizeof(jsonObjectIndexEntry) * capacity);
+    for (json *el = J->object; el && el->key; el = el->next) {
+        uint32_t hash, folded;
+        jsonHashKey(el->key, &hash, &folded);
+
+        size_t slot = folded & index->mask;
+        while (index->entries[slot].member) {
+            slot = (slot + 1) & index->mask;
+        }
+        index->entries[slot].member = el;
+        index->entries[slot].hash = hash;
+        index->entries[slot].folded = folded;
+    }
+    jsonContainerIndexSet(allocator, J, index);
+    return index;
+}
+
+static json *jsonObjectIndexFind(jsonObjectIndex *index, const char *name,
+                                 int case_insensitive) {
+    uint32_t hash, folded;
+    jsonHashKey(name, &hash, &folded);
+
+    for (size_t slot = folded & index->mask; index->entries[slot].member;
+         slot = (slot + 1) & index->mask) {
+        jsonObjectIndexEntry *entry = &index->entries[slot];
+        if (case_insensitive) {
+            if (entry->folded == folded &&
+                !strcasecmp(name, entry->member->key)) {
+                return entry->member;
+            }
+        } else if (entry->hash == hash && !strcmp(name, entry->member->key)) {
+            return entry->member;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Member of an object with the key `name`, NULL if there is not one. Objects
+ * are searched in order and only read, so any number of threads can look
+ * in to the same document. Parsed with JSON_LAZY_INDEX_FLAG, the first
+ * lookup on an object with at least JSON_OBJECT_INDEX_MIN members builds a
+ * hash table over its keys in the document's arena which serves both kinds
+ * of lookup from then on. That lookup writes to the document, so like
+ * `jsonArrayItems` it must not race with other readers.
+ */
+json *jsonObjectFind(json *J, const char *name, int case_insensitive) {
+    jsonObjectIndex *index;
+    size_t len = 0;
+    json *el;
+
+    if (!jsonIsObject(J) || name == NULL) {
+        return NULL;
+    }
+    if (J->aux & JSON_AUX_INDEXED) {
+        index = jsonContainerIndex(jsonContainerAllocator(J), J);
+        return jsonObjectIndexFind(index, name, case_insensitive);
+    }
+
+    for (el = J->object; el && el->key; el = el->next) {
+        if (!(case_insensitive ? strcasecmp(name, el->key)
+                               : strcmp(name, el->key))) {
+            return el;
+        }
+        if (++len == JSON_OBJECT_INDEX_MIN &&
+            (J->aux & JSON_AUX_INDEXABLE)) {
+            break;
+        }
+    }
+    if (len < JSON_OBJECT_INDEX_MIN || !(J->aux & JSON_AUX_INDEXABLE)) {
+        return NULL;
+    }
+
+    /* Count the rest for the size of the table */
+    for (el = el->next; el && el->key; el = el->next) {
+        len++;
+    }
+    if ((index = jsonObjectIndexGet(J, len)) != NULL) {
+        return jsonObjectIndexFind(index, name, case_insensitive);
+    }
+
+    for (el = J->object; el && el->key; el = el->next) {
+        if (!(case_insensitive ? strcasecmp(name, el->key)
+                               : strcmp(name, el->key))) {
+            return el;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * The members of an array as one contiguous vector of `len` pointers, built
+ * on the first call, after which `jsonArrayAt` and `jsonArrayLength` are
+ * O(1). Only documents parsed with JSON_LAZY_INDEX_FLAG are indexed, and
+ * the first call must not race with other readers of the document. NULL if
+ * `J` is not an array, is empty or was not indexed, in which case walk
+ * `J->array`.
+ */
+json **jsonArrayItems(json *J, size_t *len) {
+    jsonArrayIndex *index;
+
+    *len = 0;
+    if (!jsonIsArray(J) || J->array == NULL ||
+        (index = jsonArrayIndexGet(J)) == NULL) {
+        return NULL;
+    }
+    *len = index->len;
+    return index->items;
+}
+
+/**
+ * Number of members in an array, 0 if `J` is not an array
+ */
+size_t jsonArrayLength(json *J) {
+    size_t len = 0;
+
+    if (!jsonIsArray(J) || jsonArrayItems(J, &len) != NULL) {
+        return len;
+    }
+    for (json *el = J->array; el; el = el->next) {
+        len++;
+    }
+    return len;
+}
+
 /**
  * Get json object or NULL
  */
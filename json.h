@@ -11,14 +11,25 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
 #include <stdio.h>
 
 #define JSON_MAX_EXPONENT (511)
 #define JSON_SENTINAL     ((void *)(long)0x44)
 #define JSON_NO_FLAGS     (0)
+/* Default limit on how deeply objects and arrays can nest */
+#define JSON_MAX_DEPTH    (1024)
 
 /* Do not parse numbers, treat them as strings */
 #define JSON_STRNUM_FLAG (1)
+/* Decode strings in place, keys and strings point into the parsed buffer */
+#define JSON_INSITU_FLAG (4)
+/* Leave string values in the buffer until they are asked for */
+#define JSON_LAZY_STRING_FLAG (8)
+/* Leave numbers in the buffer until they are asked for */
+#define JSON_LAZY_NUMBER_FLAG (16)
+/* Index arrays and large objects the first time they are looked in to */
+#define JSON_LAZY_INDEX_FLAG (32)
 
 typedef enum JSON_DATA_TYPE {
     JSON_STRING,
@@ -31,6 +42,16 @@ typedef enum JSON_DATA_TYPE {
     JSON_NULL,
 } JSON_DATA_TYPE;
 
+/* SIMD kernels the parser can be forced to use */
+typedef enum JSON_SIMD_KERNEL {
+    JSON_SIMD_AUTO,
+    JSON_SIMD_SCALAR,
+    JSON_SIMD_SSE2,
+    JSON_SIMD_NEON,
+    JSON_SIMD_AVX2,
+    JSON_SIMD_AVX512,
+} JSON_SIMD_KERNEL;
+
 typedef struct jsonState {
     int error;
     char ch;
@@ -40,13 +61,105 @@ typedef struct jsonState {
 } jsonState;
 
 typedef struct json json;
+/* Where the library gets its memory from, `ctx` is passed back to each call */
+typedef struct jsonAllocatorHooks {
+    void *(*malloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *ptr, size_t size);
+    void (*free)(void *ctx, void *ptr);
+    void *ctx;
+} jsonAllocatorHooks;
+/* A caller owned allocator documents can be parsed in to and reused */
+typedef struct jsonArena jsonArena;
+/* Parses a document that arrives in chunks */
+typedef struct jsonStreamParser jsonStreamParser;
+/* Handlers for jsonParseEvents, any can be NULL. Returning non zero from
+ * one stops the parse */
+typedef struct jsonEvents {
+    int (*start_object)(void *privdata);
+    int (*end_object)(void *privdata);
+    int (*start_array)(void *privdata);
+    int (*end_array)(void *privdata);
+    int (*key)(void *privdata, const char *key, size_t len);
+    int (*string)(void *privdata, const char *str, size_t len);
+    int (*integer)(void *privdata, ssize_t value);
+    int (*floating)(void *privdata, double value);
+    int (*boolean)(void *privdata, int value);
+    int (*null)(void *privdata);
+} jsonEvents;
+/* Pulls a document apart one token at a time */
+typedef struct jsonTokenizer jsonTokenizer;
+typedef enum JSON_TOKEN_TYPE {
+    JSON_TOKEN_START_OBJECT,
+    JSON_TOKEN_END_OBJECT,
+    JSON_TOKEN_START_ARRAY,
+    JSON_TOKEN_END_ARRAY,
+    JSON_TOKEN_KEY,
+    JSON_TOKEN_STRING,
+    JSON_TOKEN_INT,
+    JSON_TOKEN_FLOAT,
+    JSON_TOKEN_BOOL,
+    JSON_TOKEN_NULL,
+    /* The document is finished */
+    JSON_TOKEN_END,
+    JSON_TOKEN_ERROR,
+} JSON_TOKEN_TYPE;
+typedef struct jsonToken {
+    JSON_TOKEN_TYPE type;
+    /* Where the raw token is in the buffer */
+    size_t offset;
+    size_t len;
+    /* How many containers the token is in, not counting its own */
+    size_t depth;
+    /* Decoded keys and strings, NOT '\0' terminated unless in situ */
+    const char *str;
+    size_t str_len;
+    union {
+        ssize_t integer;
+        double floating;
+        int boolean;
+    };
+} jsonToken;
+/* A document walked on demand with cursors */
+typedef struct jsonDoc jsonDoc;
+/* A value in a jsonDoc, cheap enough to live on the stack */
+typedef struct jsonCursor {
+    jsonDoc *doc;
+    /* Offset of the value in the buffer */
+    size_t start;
+    /* Offset of the member an object or array cursor has got to */
+    size_t offset;
+    int state;
+} jsonCursor;
+/* A read only document of 16 byte nodes that refer to each other by index */
+typedef struct jsonCompact jsonCompact;
+/* A value in a jsonCompact */
+typedef uint32_t jsonNode;
+#define JSON_NODE_NONE (0)
+/* A read only document laid out as one array of 64 bit words */
+typedef struct jsonTape jsonTape;
+/* Index of a value on a jsonTape */
+typedef uint32_t jsonTapeIdx;
+#define JSON_TAPE_NONE (0)
+/* Iterates over the records of newline delimited json */
+typedef struct jsonLines jsonLines;
+typedef int jsonLinesCallback(json *J, size_t lineno, void *privdata);
+/* Whether a parallel parse hands records over in the order they appear */
+typedef enum JSON_LINES_ORDER {
+    JSON_LINES_ORDERED,
+    JSON_LINES_UNORDERED,
+} JSON_LINES_ORDER;
 /* Everything on this struct is created by an arena, do NOT call free on any 
  * of the individual properties */
 typedef struct json {
+    /* Shared by the whole document and set on the root, every object and
+     * array, and strings left in the buffer by JSON_LAZY_STRING_FLAG. Other
+     * values leave it NULL, read errors from the root */
     jsonState *state;
     json *next;
     char *key;
     JSON_DATA_TYPE type;
+    /* Internal bookkeeping for values parsed lazily, do not touch */
+    unsigned int aux;
     union {
         json *array;
         json *object;
@@ -78,13 +191,20 @@ typedef enum JSON_ERRNO {
     JSON_INVALID_ESCAPE_CHARACTER,
     JSON_UNTERMINATED,
     JSON_EOF,
+    JSON_STOPPED,
+    JSON_MAX_DEPTH_EXCEEDED,
+    JSON_DOCUMENT_TOO_LARGE,
 } JSON_ERRNO;
 
 json *jsonGetObject(json *J);
 json *jsonGetArray(json *J);
+json **jsonArrayItems(json *J, size_t *len);
+size_t jsonArrayLength(json *J);
+json *jsonObjectFind(json *J, const char *name, int case_insensitive);
 void *jsonGetNull(json *J);
 int jsonGetBool(json *J);
 char *jsonGetString(json *J);
+const char *jsonGetStringView(json *J, size_t *len);
 ssize_t jsonGetInt(json *J);
 double jsonGetFloat(json *J);
 
@@ -100,7 +220,122 @@ json *jsonParse(char *raw_json);
 json *jsonParseWithFlags(char *raw_json, int flags);
 json *jsonParseWithLen(char *raw_json, size_t buflen);
 json *jsonParseWithLenAndFlags(char *raw_json, size_t buflen, int flags);
+json *jsonParseWithHooks(char *raw_json, size_t buflen, int flags,
+                         const jsonAllocatorHooks *hooks);
+json *jsonParseArrayParallel(char *raw_json, size_t buflen, int flags,
+                             int threads);
 void jsonRelease(json *J);
+void jsonSetMaxDepth(size_t depth);
+size_t jsonGetMaxDepth(void);
+void jsonSetAllocatorHooks(const jsonAllocatorHooks *hooks);
+void jsonSetThreadCacheSize(size_t size);
+void jsonFree(void *ptr);
+
+jsonArena *jsonArenaNew(void);
+jsonArena *jsonArenaNewWithHooks(const jsonAllocatorHooks *hooks);
+json *jsonParseIntoArena(jsonArena *arena, char *raw_json, size_t buflen,
+                         int flags);
+size_t jsonArenaHighWaterMark(jsonArena *arena);
+void jsonArenaReset(jsonArena *arena);
+void jsonArenaRelease(jsonArena *arena);
+
+jsonStreamParser *jsonParserNew(int flags);
+int jsonParserFeed(jsonStreamParser *sp, const char *chunk, size_t len);
+json *jsonParserFinish(jsonStreamParser *sp);
+
+jsonLines *jsonLinesNew(char *buffer, size_t buflen, int flags);
+json *jsonLinesNext(jsonLines *lines);
+size_t jsonLinesNumber(jsonLines *lines);
+void jsonLinesRelease(jsonLines *lines);
+size_t jsonParseLines(char *buffer, size_t buflen, int flags,
+                      jsonLinesCallback *callback, void *privdata);
+size_t jsonParseLinesParallel(char *buffer, size_t buflen, int flags,
+                              int threads, JSON_LINES_ORDER order,
+                              jsonLinesCallback *callback, void *privdata);
+
+jsonTokenizer *jsonTokenizerNew(char *buffer, size_t buflen, int flags);
+void jsonTokenizerRelease(jsonTokenizer *t);
+JSON_ERRNO jsonTokenizerGetError(jsonTokenizer *t);
+int jsonNextToken(jsonTokenizer *t, jsonToken *tok);
+JSON_ERRNO jsonParseEvents(char *buffer, size_t buflen, int flags,
+                           const jsonEvents *events, void *privdata,
+                           jsonState *state);
+
+jsonDoc *jsonDocNew(char *buffer, size_t buflen);
+void jsonDocRelease(jsonDoc *doc);
+JSON_ERRNO jsonDocGetError(jsonDoc *doc);
+int jsonDocRoot(jsonDoc *doc, jsonCursor *root);
+int jsonCursorFindField(jsonCursor *object, const char *name,
+                        jsonCursor *value);
+int jsonCursorArrayNext(jsonCursor *array, jsonCursor *element);
+size_t jsonCursorSkip(jsonCursor *cur);
+JSON_DATA_TYPE jsonCursorType(jsonCursor *cur);
+ssize_t jsonCursorGetInt(jsonCursor *cur);
+double jsonCursorGetFloat(jsonCursor *cur);
+int jsonCursorGetBool(jsonCursor *cur);
+const char *jsonCursorGetString(jsonCursor *cur, size_t *len);
+
+jsonCompact *jsonCompactParse(char *buffer, size_t buflen, int flags);
+void jsonCompactRelease(jsonCompact *doc);
+JSON_ERRNO jsonCompactGetError(jsonCompact *doc);
+char *jsonCompactGetStrerror(jsonCompact *doc);
+size_t jsonCompactMemoryUsage(jsonCompact *doc);
+jsonNode jsonCompactRoot(jsonCompact *doc);
+JSON_DATA_TYPE jsonCompactType(jsonCompact *doc, jsonNode node);
+jsonNode jsonCompactNext(jsonCompact *doc, jsonNode node);
+const char *jsonCompactKey(jsonCompact *doc, jsonNode node);
+jsonNode jsonCompactChild(jsonCompact *doc, jsonNode node);
+size_t jsonCompactLength(jsonCompact *doc, jsonNode node);
+jsonNode jsonCompactObjectAt(jsonCompact *doc, jsonNode node,
+                             const char *name);
+jsonNode jsonCompactArrayAt(jsonCompact *doc, jsonNode node, size_t idx);
+int jsonCompactIsObject(jsonCompact *doc, jsonNode node);
+int jsonCompactIsArray(jsonCompact *doc, jsonNode node);
+int jsonCompactIsNull(jsonCompact *doc, jsonNode node);
+int jsonCompactIsBool(jsonCompact *doc, jsonNode node);
+int jsonCompactIsString(jsonCompact *doc, jsonNode node);
+int jsonCompactIsInt(jsonCompact *doc, jsonNode node);
+int jsonCompactIsFloat(jsonCompact *doc, jsonNode node);
+const char *jsonCompactGetString(jsonCompact *doc, jsonNode node,
+                                 size_t *len);
+const char *jsonCompactGetStrnum(jsonCompact *doc, jsonNode node);
+ssize_t jsonCompactGetInt(jsonCompact *doc, jsonNode node);
+double jsonCompactGetFloat(jsonCompact *doc, jsonNode node);
+int jsonCompactGetBool(jsonCompact *doc, jsonNode node);
+char *jsonCompactToString(jsonCompact *doc, jsonNode node, size_t *len);
+
+jsonTape *jsonTapeParse(char *buffer, size_t buflen, int flags);
+void jsonTapeRelease(jsonTape *doc);
+JSON_ERRNO jsonTapeGetError(jsonTape *doc);
+char *jsonTapeGetStrerror(jsonTape *doc);
+size_t jsonTapeMemoryUsage(jsonTape *doc);
+jsonTapeIdx jsonTapeRoot(jsonTape *doc);
+JSON_DATA_TYPE jsonTapeType(jsonTape *doc, jsonTapeIdx idx);
+jsonTapeIdx jsonTapeSkip(jsonTape *doc, jsonTapeIdx idx);
+jsonTapeIdx jsonTapeNext(jsonTape *doc, jsonTapeIdx idx);
+jsonTapeIdx jsonTapeChild(jsonTape *doc, jsonTapeIdx idx);
+const char *jsonTapeKey(jsonTape *doc, jsonTapeIdx idx);
+size_t jsonTapeLength(jsonTape *doc, jsonTapeIdx idx);
+jsonTapeIdx jsonTapeObjectAt(jsonTape *doc, jsonTapeIdx idx,
+                             const char *name);
+jsonTapeIdx jsonTapeArrayAt(jsonTape *doc, jsonTapeIdx idx, size_t n);
+int jsonTapeIsObject(jsonTape *doc, jsonTapeIdx idx);
+int jsonTapeIsArray(jsonTape *doc, jsonTapeIdx idx);
+int jsonTapeIsNull(jsonTape *doc, jsonTapeIdx idx);
+int jsonTapeIsBool(jsonTape *doc, jsonTapeIdx idx);
+int jsonTapeIsString(jsonTape *doc, jsonTapeIdx idx);
+int jsonTapeIsInt(jsonTape *doc, jsonTapeIdx idx);
+int jsonTapeIsFloat(jsonTape *doc, jsonTapeIdx idx);
+const char *jsonTapeGetString(jsonTape *doc, jsonTapeIdx idx, size_t *len);
+const char *jsonTapeGetStrnum(jsonTape *doc, jsonTapeIdx idx);
+ssize_t jsonTapeGetInt(jsonTape *doc, jsonTapeIdx idx);
+double jsonTapeGetFloat(jsonTape *doc, jsonTapeIdx idx);
+int jsonTapeGetBool(jsonTape *doc, jsonTapeIdx idx);
+jsonTape *jsonTapeCopy(jsonTape *doc, jsonTapeIdx idx);
+char *jsonTapeToString(jsonTape *doc, jsonTapeIdx idx, size_t *len);
+
+int jsonSetSimdKernel(JSON_SIMD_KERNEL kernel);
+JSON_SIMD_KERNEL jsonGetSimdKernel(void);
 
 int jsonGetError(json *j);
 char *jsonGetStrerror(json *J);
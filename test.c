@@ -8,8 +8,10 @@
 #include <fcntl.h>
 #include <float.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,6 +20,8 @@
 #include "json-selector.h"
 #include "json.h"
 
+int safeStrcmp(char *s1, char *s2);
+
 json *jsonParseOrPanic(char *raw_json) {
     json *j = jsonParseWithLen(raw_json, strlen(raw_json));
     if (!j) {
@@ -26,7 +30,7 @@ json *jsonParseOrPanic(char *raw_json) {
     } else if (!jsonOk(j)) {
         char *error = jsonGetStrerror(j);
         fprintf(stderr, "Json Parser Error: %s\n",error);
-        free(error);
+        jsonFree(error);
         exit(1);
     }
     return j;
@@ -146,6 +150,48 @@ void testParsingFloats(void) {
     testCondition(floatEqual(parsed->array->floating, -1.50139930144708198E18));
     test("  Parsing %s\n", float_9);
     jsonRelease(parsed);
+
+    /* Must be bit for bit what strtod gives */
+    char *round_trip[] = {
+            "0.1",
+            "0.30000000000000004",
+            "1.0e23",
+            "9007199254740993.0",
+            "4.35679E-10",
+            "1.7976931348623157e308",
+            "2.2250738585072014e-308",
+            "2.2250738585072011e-308",
+            "4.9e-324",
+            "1.0e-400",
+            "1.0e400",
+            "-0.0",
+            "3.14159265358979323846264338327950288",
+            "123456789012345678901234567890.123",
+            "7.2057594037927933e16",
+            "-51.507351",
+            "0.000000000000000000000000000000000000001234",
+            "1.00000000000000000000000000000000000000000000000000000000000000"
+            "00000000001",
+            /* No '.' but a negative exponent is still a float */
+            "1e-1",
+            "8e-18",
+            "5e-324",
+            "1227857212e-4",
+            "-25e-1",
+    };
+
+    for (int i = 0; i < sizeof(round_trip) / sizeof(round_trip[0]); ++i) {
+        char buf[128];
+        double expected = strtod(round_trip[i], NULL);
+        snprintf(buf, sizeof(buf), "[%s]", round_trip[i]);
+        parsed = jsonParseOrPanic(buf);
+        testCondition(parsed->array->type == JSON_FLOAT &&
+                      !memcmp(&parsed->array->floating, &expected,
+                              sizeof(double)));
+        test("  Round trip %s = %1.17g\n", round_trip[i],
+             parsed->array->floating);
+        jsonRelease(parsed);
+    }
 }
 
 void testParsingInts(void) {
@@ -197,6 +243,122 @@ void testParsingInts(void) {
     testCondition(parsed->array->integer == 10101010100101010);
     test("  Parsing %s\n", int_8);
     jsonRelease(parsed);
+
+    struct {
+        char *raw_json;
+        ssize_t expected;
+    } ints[] = {
+            {"[12345678]", 12345678},
+            {"[1234567890123456]", 1234567890123456},
+            {"[12345678901234567]", 12345678901234567},
+            {"[9223372036854775807]", INT64_MAX},
+            {"[-9223372036854775808]", INT64_MIN},
+            {"[-0]", 0},
+            {"[+42]", 42},
+            {"[15e3]", 15000},
+            {"[0e5]", 0},
+    };
+
+    for (int i = 0; i < sizeof(ints) / sizeof(ints[0]); ++i) {
+        parsed = jsonParseOrPanic(ints[i].raw_json);
+        testCondition(parsed->array->type == JSON_INT &&
+                      parsed->array->integer == ints[i].expected);
+        test("  Parsing %s\n", ints[i].raw_json);
+        jsonRelease(parsed);
+    }
+
+    /* Promoted to a float rather than wrapping */
+    char *overflows[] = {
+            "9223372036854775808",
+            "-9223372036854775809",
+            "123456789012345678901234567890",
+            "1e19",
+    };
+
+    for (int i = 0; i < sizeof(overflows) / sizeof(overflows[0]); ++i) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "[%s]", overflows[i]);
+        parsed = jsonParseOrPanic(buf);
+        testCondition(parsed->array->type == JSON_FLOAT &&
+                      parsed->array->floating == strtod(overflows[i], NULL));
+        test("  Parsing %s overflows to a float\n", buf);
+        jsonRelease(parsed);
+    }
+}
+
+void testParsingStrings(void) {
+    struct {
+        char *raw_json;
+        char *expected;
+    } cases[] = {
+            {"[\"hello\"]", "hello"},
+            {"[\"\"]", ""},
+            {"[\"a\\\"b\\\\c\\/d\\n\"]", "a\"b\\c/d\n"},
+            {"[\"\\u0006\"]", "\x06"},
+            {"[\"caf\\u00e9 \\u20AC\"]", "caf\xc3\xa9 \xe2\x82\xac"},
+            {"[\"\\ud83d\\udc0c!\"]", "\xf0\x9f\x90\x8c!"},
+            {"[\"a long string that spans more than one sixty four byte block"
+             " with an escape right at the end\\t\"]",
+             "a long string that spans more than one sixty four byte block"
+             " with an escape right at the end\t"},
+    };
+
+    for (int i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        json *parsed = jsonParseOrPanic(cases[i].raw_json);
+        testCondition(safeStrcmp(jsonGetString(parsed->array),
+                                 cases[i].expected));
+        test("  Parsing %s\n", cases[i].raw_json);
+        jsonRelease(parsed);
+    }
+
+    char *unterminated = "[\"no closing quote]";
+    json *parsed = jsonParse(unterminated);
+    testCondition(jsonGetError(parsed) == JSON_EOF);
+    test("  Parsing %s\n", unterminated);
+    jsonRelease(parsed);
+
+    /* A high surrogate right before the closing quote, decoding the low one
+     * must not run past it. Keys may fail on the missing ':' first */
+    char *lone_surrogates[] = {
+            "[\"\\ud83d\"ude00 abcdefgh\", 1]",
+            "{\"a\\ud83d\"ude00bcdefgh\":1}",
+            "[\"\\ud83d\\u00\"]",
+    };
+    for (int i = 0; i < sizeof(lone_surrogates) / sizeof(lone_surrogates[0]);
+         ++i) {
+        size_t len = strlen(lone_surrogates[i]);
+        char *copy = strdup(lone_surrogates[i]);
+        jsonEvents events = {0};
+        jsonArena *arena = jsonArenaNew();
+        JSON_ERRNO errors[6];
+
+        parsed = jsonParse(lone_surrogates[i]);
+        errors[0] = jsonGetError(parsed);
+        jsonRelease(parsed);
+        parsed = jsonParseWithLenAndFlags(copy, len, JSON_INSITU_FLAG);
+        errors[1] = jsonGetError(parsed);
+        jsonRelease(parsed);
+        errors[2] = jsonGetError(jsonParseIntoArena(arena, lone_surrogates[i],
+                                                    len, JSON_NO_FLAGS));
+        errors[3] = jsonParseEvents(lone_surrogates[i], len, JSON_NO_FLAGS,
+                                    &events, NULL, NULL);
+        jsonCompact *compact = jsonCompactParse(lone_surrogates[i], len,
+                                                JSON_NO_FLAGS);
+        errors[4] = jsonCompactGetError(compact);
+        jsonCompactRelease(compact);
+        jsonTape *tape = jsonTapeParse(lone_surrogates[i], len, JSON_NO_FLAGS);
+        errors[5] = jsonTapeGetError(tape);
+        jsonTapeRelease(tape);
+
+        int all_invalid = 1;
+        for (int j = 0; j < 6; ++j) {
+            all_invalid &= errors[j] != JSON_OK;
+        }
+        testCondition(all_invalid);
+        test("  Lone high surrogate in %s\n", lone_surrogates[i]);
+        jsonArenaRelease(arena);
+        free(copy);
+    }
 }
 
 typedef struct invalidJson {
@@ -216,7 +378,8 @@ void testInvalidJson(void) {
             {JSON_INVALID_JSON_TYPE_CHAR, "./test-jsons/invalid3.json"},
             {JSON_INVALID_KEY_TERMINATOR_CHARACTER,
              "./test-jsons/invalid4.json"},
-            {JSON_INVALID_JSON_TYPE_CHAR, "./test-jsons/invalid5.json"},
+            /* Runs out before the object is closed */
+            {JSON_UNTERMINATED, "./test-jsons/invalid5.json"},
             {JSON_INVALID_ESCAPE_CHARACTER, "./test-jsons/invalid6.json"},
     };
 
@@ -229,6 +392,18 @@ void testInvalidJson(void) {
         parsed = NULL;
         free(raw_json);
     }
+
+    char *invalid_numbers[] = {
+            "[1e]", "[-]", "[.]", "[01]", "[1.2.3]", "[12a]", "[1-2]", "[1e+]",
+    };
+
+    for (int i = 0; i < sizeof(invalid_numbers) / sizeof(invalid_numbers[0]);
+         ++i) {
+        parsed = jsonParse(invalid_numbers[i]);
+        testCondition(jsonGetError(parsed) == JSON_INVALID_NUMBER);
+        test("  Parsing %s\n", invalid_numbers[i]);
+        jsonRelease(parsed);
+    }
 }
 
 void testParseThenToStringAndBack(void) {
@@ -256,7 +431,1825 @@ void testParseThenToStringAndBack(void) {
     test("  Parse json string\n");
 
     jsonRelease(parsed);
-    free(jsonstring);
+    jsonFree(jsonstring);
+    free(raw_json);
+}
+
+/* Documents every other way of parsing is checked against the tree with */
+static char *tree_documents[] = {
+        "./test-jsons/sample.json",
+        "./test-jsons/massive.json",
+        "./test-jsons/mildly-nested.json",
+        "./test-jsons/example2.json",
+};
+
+/* Invalid documents and what every parser has to fail them with */
+static struct {
+    char *raw_json;
+    JSON_ERRNO expected;
+} invalid_documents[] = {
+        {"{\"a\\u12\":1}", JSON_INVALID_HEX},
+        {"{\"a\\q\":1}", JSON_INVALID_ESCAPE_CHARACTER},
+        {"[\"\\ud800x\"]", JSON_INVALID_UTF16},
+        {"[1, 2", JSON_EOF},
+        {"{\"a\":[1]", JSON_EOF},
+        {"{\"a\" 1}", JSON_INVALID_KEY_TERMINATOR_CHARACTER},
+        {"{\"a\":1,}", JSON_INVALID_KEY_TERMINATOR_CHARACTER},
+        {"[1,]", JSON_INVALID_JSON_TYPE_CHAR},
+        {"[tru]", JSON_CANNOT_ADVANCE},
+        {"[1e]", JSON_INVALID_NUMBER},
+        {"[1, 2 3]", JSON_INVALID_ARRAY_CHARACTER},
+};
+
+/* Whether parsing `buffer` some other way agrees with `expected`, which
+ * jsonParse made from the same bytes */
+typedef int jsonTreeMatcher(json *expected, char *buffer, size_t buflen,
+                            void *privdata);
+
+/* Compare `J` with `expected` as strings, then release it */
+int jsonSameTree(json *expected, json *J) {
+    char *expected_str = jsonToString(expected, NULL);
+    char *str = jsonToString(J, NULL);
+    int same = jsonOk(J) && !strcmp(expected_str, str);
+
+    jsonFree(expected_str);
+    jsonFree(str);
+    jsonRelease(J);
+    return same;
+}
+
+/* Compare an error and its message with `expected`'s, then free `message` */
+int jsonSameError(json *expected, JSON_ERRNO error, char *message) {
+    char *expected_message = jsonGetStrerror(expected);
+    int same = error == jsonGetError(expected) &&
+               !strcmp(expected_message, message);
+
+    jsonFree(expected_message);
+    jsonFree(message);
+    return same;
+}
+
+/* Run `matches` over a copy of each of the tree_documents */
+void testMatchesTree(const char *label, jsonTreeMatcher *matches,
+                     void *privdata) {
+    for (int i = 0; i < sizeof(tree_documents) / sizeof(tree_documents[0]);
+         ++i) {
+        char *raw_json = readFile(tree_documents[i]);
+        char *copy = strdup(raw_json);
+        json *expected = jsonParse(raw_json);
+
+        testCondition(jsonOk(expected) &&
+                      matches(expected, copy, strlen(copy), privdata));
+        test("  %s %s\n", label, tree_documents[i]);
+
+        jsonRelease(expected);
+        free(copy);
+        free(raw_json);
+    }
+}
+
+/* Run `matches` over a copy of each of the invalid_documents */
+void testFailsAsTree(const char *label, jsonTreeMatcher *matches,
+                     void *privdata) {
+    for (int i = 0;
+         i < sizeof(invalid_documents) / sizeof(invalid_documents[0]); ++i) {
+        char *raw_json = invalid_documents[i].raw_json;
+        char *copy = strdup(raw_json);
+        json *expected = jsonParse(raw_json);
+
+        testCondition(jsonGetError(expected) == invalid_documents[i].expected &&
+                      matches(expected, copy, strlen(copy), privdata));
+        test("  %s %s fails as the tree does\n", label, raw_json);
+
+        jsonRelease(expected);
+        free(copy);
+    }
+}
+
+/* `privdata` points at the flags */
+int jsonFlagsMatchTree(json *expected, char *buffer, size_t buflen,
+                       void *privdata) {
+    return jsonSameTree(expected, jsonParseWithLenAndFlags(
+                                          buffer, buflen, *(int *)privdata));
+}
+
+void testInsitu(void) {
+    int flags = JSON_INSITU_FLAG;
+    testMatchesTree("In-situ parse of", jsonFlagsMatchTree, &flags);
+
+    char buf[] = "{\"k\\ney\": [\"plain\", \"a\\tb\\u00e9\\ud83d\\ude00\"]}";
+    json *J = jsonParseWithFlags(buf, JSON_INSITU_FLAG);
+    json *key = J->object;
+    char *plain = jsonGetString(key->array);
+    char *escaped = jsonGetString(key->array->next);
+
+    testCondition(jsonOk(J) && key->key >= buf && key->key < buf + sizeof(buf));
+    test("  In-situ key points into the buffer\n");
+    testCondition(plain >= buf && plain < buf + sizeof(buf) &&
+                  safeStrcmp(plain, "plain"));
+    test("  In-situ string points into the buffer\n");
+    testCondition(safeStrcmp(key->key, "k\ney") &&
+                  safeStrcmp(escaped, "a\tb\xc3\xa9\xf0\x9f\x98\x80"));
+    test("  In-situ strings are unescaped in place\n");
+    jsonRelease(J);
+}
+
+void testLazyStrings(void) {
+    int flags = JSON_LAZY_STRING_FLAG;
+    testMatchesTree("Lazy string parse of", jsonFlagsMatchTree, &flags);
+
+    char *raw_json = "[\"plain\", \"a\\tb\\u00e9\", \"\\ud83d\\ude00\"]";
+    json *J = jsonParseWithFlags(raw_json, JSON_LAZY_STRING_FLAG);
+    size_t len = 0;
+    const char *view = jsonGetStringView(J->array, &len);
+
+    testCondition(jsonOk(J) && view == raw_json + 2 && len == 5);
+    test("  Lazy string view points into the buffer\n");
+    testCondition(safeStrcmp(jsonGetString(J->array), "plain"));
+    test("  Lazy string is copied on access\n");
+    testCondition(safeStrcmp(jsonGetString(J->array->next), "a\tb\xc3\xa9"));
+    test("  Lazy string is unescaped on access\n");
+    testCondition(safeStrcmp(jsonGetString(J->array->next->next),
+                             "\xf0\x9f\x98\x80"));
+    test("  Lazy string surrogate pair is decoded on access\n");
+    jsonRelease(J);
+
+    /* Escapes are checked while parsing, not left to the first access */
+    char *invalid[] = {
+            "[\"bad \\q escape\"]", "[\"\\ud800x\"]",  "[\"\\ud800\\u0041\"]",
+            "[\"\\udc00\"]",        "[\"\\u12g4\"]",   "[\"ok\", \"\\ud83d\"]",
+    };
+    for (int i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+        json *expected = jsonParse(invalid[i]);
+        J = jsonParseWithFlags(invalid[i], JSON_LAZY_STRING_FLAG);
+        testCondition(!jsonOk(J) && jsonGetError(J) == jsonGetError(expected) &&
+                      J->state->offset == expected->state->offset);
+        test("  Lazy parse of %s fails as an eager one does\n", invalid[i]);
+        jsonRelease(J);
+        jsonRelease(expected);
+    }
+}
+
+void testLazyNumbers(void) {
+    int flags = JSON_LAZY_NUMBER_FLAG;
+    testMatchesTree("Lazy number parse of", jsonFlagsMatchTree, &flags);
+
+    char *raw_json = "[42, -2.5, 1e19, -9223372036854775808, 0xFF]";
+    json *J = jsonParseWithFlags(raw_json, JSON_LAZY_NUMBER_FLAG);
+    json *n = J->array;
+
+    testCondition(jsonOk(J) && jsonIsInt(n) && jsonGetInt(n) == 42);
+    test("  Lazy int is converted on access\n");
+    n = n->next;
+    testCondition(jsonIsFloat(n) && jsonGetFloat(n) == -2.5);
+    test("  Lazy float is converted on access\n");
+    n = n->next;
+    testCondition(!jsonIsInt(n) && jsonGetFloat(n) == 1e19);
+    test("  Lazy int that overflows is a float\n");
+    n = n->next;
+    testCondition(jsonGetInt(n) == INT64_MIN && jsonGetInt(n->next) == 0xFF);
+    test("  Lazy INT64_MIN and hex\n");
+    jsonRelease(J);
+
+    char *invalid = "[1, 01]";
+    J = jsonParseWithFlags(invalid, JSON_LAZY_NUMBER_FLAG);
+    testCondition(jsonGetError(J) == JSON_INVALID_NUMBER);
+    test("  Lazy parse of %s fails\n", invalid);
+    jsonRelease(J);
+}
+
+json *jsonStreamInChunks(char *raw_json, size_t chunk_size, int flags) {
+    jsonStreamParser *sp = jsonParserNew(flags);
+    size_t len = strlen(raw_json);
+
+    for (size_t i = 0; i < len; i += chunk_size) {
+        size_t n = len - i < chunk_size ? len - i : chunk_size;
+        /* Copy so nothing can be read past the end of the chunk */
+        char *chunk = malloc(n);
+        memcpy(chunk, raw_json + i, n);
+        jsonParserFeed(sp, chunk, n);
+        free(chunk);
+    }
+    return jsonParserFinish(sp);
+}
+
+/* `privdata` points at the chunk size */
+int jsonStreamMatchesTree(json *expected, char *buffer, size_t buflen,
+                          void *privdata) {
+    size_t chunk_size = *(size_t *)privdata;
+    return jsonSameTree(expected,
+                        jsonStreamInChunks(buffer, chunk_size, JSON_NO_FLAGS));
+}
+
+void testStreaming(void) {
+    size_t chunk_sizes[] = {1, 7, 64, 4096};
+
+    for (int i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); ++i) {
+        char label[64];
+        snprintf(label, sizeof(label), "Streaming %zu byte chunks of",
+                 chunk_sizes[i]);
+        testMatchesTree(label, jsonStreamMatchesTree, &chunk_sizes[i]);
+    }
+
+    char *escapes = "{\"k\\u00e9y\": [\"a\\\"b\", -12.5e1, true, null, 0xFF]}";
+    json *expected = jsonParse(escapes);
+    char *expected_str = jsonToString(expected, NULL);
+    json *streamed = jsonStreamInChunks(escapes, 1, JSON_NO_FLAGS);
+    char *streamed_str = jsonToString(streamed, NULL);
+    testCondition(jsonOk(streamed) && !strcmp(expected_str, streamed_str));
+    test("  Streaming %s a byte at a time\n", escapes);
+    jsonFree(streamed_str);
+    jsonFree(expected_str);
+    jsonRelease(streamed);
+    jsonRelease(expected);
+
+    /* Tokens split over a lot of chunks */
+    size_t long_len = 1 << 16;
+    char *long_json = malloc(long_len + 1);
+    char *fills[] = {"[\"%s\"]", "[1%s]", "[%s1]"};
+    char fill[] = {'a', '2', ' '};
+    for (int i = 0; i < sizeof(fills) / sizeof(fills[0]); ++i) {
+        char *body = malloc(long_len - 8 + 1);
+        memset(body, fill[i], long_len - 8);
+        body[long_len - 8] = '\0';
+        snprintf(long_json, long_len + 1, fills[i], body);
+        expected = jsonParse(long_json);
+        expected_str = jsonToString(expected, NULL);
+        streamed = jsonStreamInChunks(long_json, 16, JSON_NO_FLAGS);
+        streamed_str = jsonToString(streamed, NULL);
+        testCondition(jsonOk(streamed) &&
+                      !strcmp(expected_str, streamed_str));
+        test("  Streaming a %zu byte %s in 16 byte chunks\n",
+             strlen(long_json), i == 0 ? "string" : i == 1 ? "number" : "gap");
+        jsonFree(streamed_str);
+        jsonFree(expected_str);
+        jsonRelease(streamed);
+        jsonRelease(expected);
+        free(body);
+    }
+    free(long_json);
+
+    struct {
+        char *raw_json;
+        JSON_ERRNO expected_error;
+    } invalid[] = {
+            {"[1, 2", JSON_EOF},
+            {"{\"a\": \"b", JSON_EOF},
+            {"[1 2]", JSON_INVALID_ARRAY_CHARACTER},
+            {"[tru]", JSON_CANNOT_ADVANCE},
+            {"[01]", JSON_INVALID_NUMBER},
+            {"{1: 2}", JSON_INVALID_KEY_TERMINATOR_CHARACTER},
+            {"[\"\\q\"]", JSON_INVALID_ESCAPE_CHARACTER},
+            {"1", JSON_CANNOT_START_PARSE},
+    };
+
+    for (int i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+        for (size_t chunk_size = 1; chunk_size <= 64; chunk_size *= 64) {
+            streamed = jsonStreamInChunks(invalid[i].raw_json, chunk_size,
+                                          JSON_NO_FLAGS);
+            testCondition(jsonGetError(streamed) == invalid[i].expected_error);
+            test("  Streaming %s in %zu byte chunks fails\n",
+                 invalid[i].raw_json, chunk_size);
+            jsonRelease(streamed);
+        }
+    }
+
+    char *broken[] = {
+            "[1, 2",         "{\"a\": \"b",   "{\"a\": 1,}", "[\"\\ud800\"]",
+            "{\"a\" 1}",     "[1, -]",        "[1.5e]",     "[nul",
+            "{\"a\": [}",    "[\"a\" \"b\"]",   "[fals ]",    "[\"a\\x\"]",
+    };
+    for (int i = 0; i < sizeof(broken) / sizeof(broken[0]); ++i) {
+        json *parsed = jsonParse(broken[i]);
+        for (size_t chunk_size = 1; chunk_size <= 4; chunk_size += 3) {
+            streamed = jsonStreamInChunks(broken[i], chunk_size,
+                                          JSON_NO_FLAGS);
+            testCondition(parsed && jsonGetError(parsed) != JSON_OK &&
+                          jsonGetError(streamed) == jsonGetError(parsed) &&
+                          streamed->state->offset == parsed->state->offset);
+            test("  Streaming %s in %zu byte chunks fails as jsonParse "
+                 "does\n",
+                 broken[i], chunk_size);
+            jsonRelease(streamed);
+        }
+        jsonRelease(parsed);
+    }
+}
+
+typedef struct jsonLinesResult {
+    size_t count;
+    size_t lineno[8];
+    char *serialised[8];
+} jsonLinesResult;
+
+int jsonLinesCollect(json *J, size_t lineno, void *privdata) {
+    jsonLinesResult *result = (jsonLinesResult *)privdata;
+    result->lineno[result->count] = lineno;
+    result->serialised[result->count] =
+            jsonOk(J) ? jsonToString(J, NULL) : NULL;
+    result->count++;
+    return result->count == 8;
+}
+
+void testJsonLines(void) {
+    char *raw = "{\"id\": 1, \"tags\": [\"a\", \"b\"]}\n"
+                "\n"
+                "[1.5, true, null]\r\n"
+                "   \n"
+                "{\"id\": \n"
+                "{\"id\": 4, \"name\": \"caf\\u00e9\"}";
+    char *expected[] = {
+            "{\"id\":1,\"tags\":[\"a\",\"b\"]}",
+            "[1.5,true,null]",
+            NULL,
+            "{\"id\":4,\"name\":\"café\"}",
+    };
+    size_t expected_lineno[] = {1, 3, 5, 6};
+    size_t len = strlen(raw);
+    char *buffer = strdup(raw);
+    jsonLines *lines = jsonLinesNew(buffer, len, JSON_NO_FLAGS);
+    size_t count = 0;
+    int untouched = 1;
+    json *J;
+
+    while ((J = jsonLinesNext(lines)) != NULL && count < 4) {
+        /* Records are parsed bounded by their length, not by patching the
+         * newline after them */
+        if (strcmp(buffer, raw)) {
+            untouched = 0;
+        }
+        if (expected[count]) {
+            char *serialised = jsonToString(J, NULL);
+            testCondition(jsonOk(J) && !strcmp(serialised, expected[count]) &&
+                          jsonLinesNumber(lines) == expected_lineno[count]);
+            test("  Record on line %zu is %s\n", expected_lineno[count],
+                 expected[count]);
+            jsonFree(serialised);
+        } else {
+            char *line = "{\"id\": ";
+            json *alone = jsonParseWithLen(line, strlen(line));
+            testCondition(!jsonOk(J) &&
+                          jsonLinesNumber(lines) == expected_lineno[count] &&
+                          jsonGetError(J) == jsonGetError(alone) &&
+                          J->state->offset == alone->state->offset);
+            test("  Record on line %zu fails as it does on its own\n",
+                 expected_lineno[count]);
+            jsonRelease(alone);
+        }
+        count++;
+    }
+    testCondition(J == NULL && count == 4);
+    test("  Iterated over %zu records\n", count);
+    jsonLinesRelease(lines);
+
+    testCondition(untouched && !strcmp(buffer, raw));
+    test("  Buffer is not written to\n");
+
+    jsonLinesResult result = {0};
+    size_t failed = jsonParseLines(buffer, len, JSON_NO_FLAGS,
+                                   jsonLinesCollect, &result);
+    testCondition(failed == 1 && result.count == 4);
+    test("  jsonParseLines reports %zu failed record\n", failed);
+    for (size_t i = 0; i < result.count; ++i) {
+        testCondition(result.lineno[i] == expected_lineno[i] &&
+                      safeStrcmp(result.serialised[i], expected[i]));
+        test("  jsonParseLines line %zu\n", expected_lineno[i]);
+        jsonFree(result.serialised[i]);
+    }
+
+    /* Enough records that the allocator has to be reset and reused */
+    size_t record_count = 10000;
+    char *many = malloc(record_count * 32);
+    size_t many_len = 0;
+    for (size_t i = 0; i < record_count; ++i) {
+        many_len += sprintf(many + many_len, "{\"n\": %zu, \"s\": \"x\"}\n", i);
+    }
+    lines = jsonLinesNew(many, many_len, JSON_NO_FLAGS);
+    count = 0;
+    int in_order = 1;
+    while ((J = jsonLinesNext(lines)) != NULL) {
+        if (!jsonOk(J) || jsonGetInt(jsonSelect(J, ".n")) != (ssize_t)count) {
+            in_order = 0;
+        }
+        count++;
+    }
+    jsonLinesRelease(lines);
+    testCondition(in_order && count == record_count);
+    test("  Parsed %zu records in order\n", record_count);
+
+    free(many);
+    free(buffer);
+}
+
+typedef struct jsonParallelResult {
+    size_t count;
+    size_t stop_after;
+    size_t last_lineno;
+    int in_order;
+    int line_matches;
+    char *seen;
+} jsonParallelResult;
+
+int jsonParallelCollect(json *J, size_t lineno, void *privdata) {
+    jsonParallelResult *result = (jsonParallelResult *)privdata;
+
+    if (jsonOk(J)) {
+        ssize_t n = jsonGetInt(jsonSelect(J, ".n"));
+        /* Records are on every other line */
+        if ((size_t)n * 2 + 1 != lineno) {
+            result->line_matches = 0;
+        }
+        result->seen[n]++;
+    }
+    if (lineno <= result->last_lineno) {
+        result->in_order = 0;
+    }
+    result->last_lineno = lineno;
+    result->count++;
+    return result->count == result->stop_after;
+}
+
+void testParallelJsonLines(void) {
+    size_t record_count = 20000;
+    char *buffer = malloc(record_count * 64);
+    size_t len = 0;
+
+    for (size_t i = 0; i < record_count; ++i) {
+        len += sprintf(buffer + len,
+                       "{\"n\": %zu, \"s\": \"record\", \"a\": [1, 2.5]}\n\n",
+                       i);
+    }
+    /* One bad record on the very last line */
+    len += sprintf(buffer + len, "{\"n\": ");
+
+    JSON_LINES_ORDER orders[] = {JSON_LINES_ORDERED, JSON_LINES_UNORDERED};
+    char *order_names[] = {"ordered", "unordered"};
+    int thread_counts[] = {1, 4, 16};
+
+    for (int i = 0; i < sizeof(orders) / sizeof(orders[0]); ++i) {
+        for (int j = 0; j < sizeof(thread_counts) / sizeof(thread_counts[0]);
+             ++j) {
+            jsonParallelResult result = {0};
+            result.in_order = 1;
+            result.line_matches = 1;
+            result.seen = calloc(record_count, sizeof(char));
+
+            size_t failed = jsonParseLinesParallel(
+                    buffer, len, JSON_NO_FLAGS, thread_counts[j], orders[i],
+                    jsonParallelCollect, &result);
+
+            int all_seen = 1;
+            for (size_t k = 0; k < record_count; ++k) {
+                if (result.seen[k] != 1) {
+                    all_seen = 0;
+                }
+            }
+
+            testCondition(failed == 1 && result.count == record_count + 1 &&
+                          all_seen && result.line_matches &&
+                          (orders[i] == JSON_LINES_UNORDERED ||
+                           result.in_order));
+            test("  %s on %d threads\n", order_names[i], thread_counts[j]);
+            free(result.seen);
+        }
+    }
+
+    jsonParallelResult result = {0};
+    result.in_order = 1;
+    result.line_matches = 1;
+    result.stop_after = 100;
+    result.seen = calloc(record_count, sizeof(char));
+    jsonParseLinesParallel(buffer, len, JSON_NO_FLAGS, 4, JSON_LINES_ORDERED,
+                           jsonParallelCollect, &result);
+    testCondition(result.count == 100 && result.in_order &&
+                  result.seen[99] == 1 && result.seen[100] == 0);
+    test("  Stops when the callback asks it to\n");
+    free(result.seen);
+
+    free(buffer);
+}
+
+void testParallelArray(void) {
+    size_t element_count = 20000;
+    char *raw_json = malloc(element_count * 96 + 64);
+    size_t len = 0;
+
+    len += sprintf(raw_json + len, "[\n");
+    for (size_t i = 0; i < element_count; ++i) {
+        len += sprintf(raw_json + len,
+                       "  {\"n\": %zu, \"s\": \"a\\\"b\\\\\", \"f\": %zu.5, "
+                       "\"a\": [null, true, {}]}%s\n",
+                       i, i, i + 1 == element_count ? "" : ",");
+    }
+    len += sprintf(raw_json + len, "]");
+
+    int flags[] = {JSON_NO_FLAGS, JSON_INSITU_FLAG,
+                   JSON_LAZY_STRING_FLAG | JSON_LAZY_NUMBER_FLAG};
+    char *flag_names[] = {"no flags", "JSON_INSITU_FLAG", "lazy flags"};
+    json *expected = jsonParseWithLen(raw_json, len);
+    char *expected_str = jsonToString(expected, NULL);
+
+    for (int i = 0; i < sizeof(flags) / sizeof(flags[0]); ++i) {
+        char *copy = strdup(raw_json);
+        json *parsed = jsonParseArrayParallel(copy, len, flags[i], 4);
+        char *parsed_str = jsonToString(parsed, NULL);
+        testCondition(jsonOk(parsed) && !strcmp(expected_str, parsed_str));
+        test("  Array of %zu elements on 4 threads with %s\n", element_count,
+             flag_names[i]);
+        jsonFree(parsed_str);
+        jsonRelease(parsed);
+        free(copy);
+    }
+    jsonFree(expected_str);
+    jsonRelease(expected);
+
+    /* Each breaks the array somewhere, with the byte to change and the
+     * length to cut the buffer to */
+    struct {
+        char *name;
+        size_t at;
+        char ch;
+        size_t len;
+    } breaks[] = {
+            {"a bool in the middle", 0, 'x', len},
+            {"a string", 0, 0, len},
+            {"a bracket that takes the last ']'", len - 20, '[', len},
+            {"a trailing ','", len - 1, ',', len},
+            {"the end of a value", 0, 0, len / 2},
+    };
+    breaks[0].at = strstr(raw_json + len / 2, "true") - raw_json + 1;
+    breaks[1].len = strstr(raw_json + len / 3, "\"a\\") - raw_json + 2;
+    breaks[4].len = strstr(raw_json + len / 2, ".5") - raw_json + 2;
+
+    for (int i = 0; i < sizeof(breaks) / sizeof(breaks[0]); ++i) {
+        for (int j = 0; j < 2; ++j) {
+            int flag = j ? JSON_INSITU_FLAG : JSON_NO_FLAGS;
+            char *invalid = strdup(raw_json);
+            char *copy = strdup(raw_json);
+            if (breaks[i].ch) {
+                invalid[breaks[i].at] = copy[breaks[i].at] = breaks[i].ch;
+            }
+            expected = jsonParseWithLenAndFlags(invalid, breaks[i].len, flag);
+            json *parsed =
+                    jsonParseArrayParallel(copy, breaks[i].len, flag, 4);
+            /* What was kept of the array before the error matches too */
+            char *expected_str = jsonToString(expected, NULL);
+            char *parsed_str = jsonToString(parsed, NULL);
+            testCondition(!jsonOk(parsed) &&
+                          jsonGetError(parsed) == jsonGetError(expected) &&
+                          parsed->state->offset == expected->state->offset &&
+                          !strcmp(parsed_str, expected_str));
+            test("  Breaking %s fails as a sequential parse with %s\n",
+                 breaks[i].name, j ? "JSON_INSITU_FLAG" : "no flags");
+            jsonFree(parsed_str);
+            jsonFree(expected_str);
+            jsonRelease(parsed);
+            jsonRelease(expected);
+            free(invalid);
+            free(copy);
+        }
+    }
+
+    /* Elements are nested one deeper than they look on their own */
+    jsonSetMaxDepth(3);
+    expected = jsonParseWithLen(raw_json, len);
+    json *parsed = jsonParseArrayParallel(raw_json, len, JSON_NO_FLAGS, 4);
+    testCondition(jsonGetError(expected) == JSON_MAX_DEPTH_EXCEEDED &&
+                  jsonGetError(parsed) == JSON_MAX_DEPTH_EXCEEDED &&
+                  parsed->state->offset == expected->state->offset);
+    test("  Elements count the root towards JSON_MAX_DEPTH\n");
+    jsonSetMaxDepth(JSON_MAX_DEPTH);
+    jsonRelease(parsed);
+    jsonRelease(expected);
+
+    char *object = "{\"a\": [1, 2], \"b\": 3}";
+    parsed = jsonParseArrayParallel(object, strlen(object), JSON_NO_FLAGS, 4);
+    testCondition(jsonOk(parsed) && jsonIsObject(parsed) &&
+                  jsonGetInt(jsonSelect(parsed, ".b")) == 3);
+    test("  Falls back to a sequential parse for %s\n", object);
+    jsonRelease(parsed);
+
+    free(raw_json);
+}
+
+/* Walk the tree and a cursor over the same document side by side */
+int jsonCursorMatches(json *J, jsonCursor *cur) {
+    jsonCursor child;
+    size_t len;
+    const char *str;
+
+    if (jsonCursorType(cur) != J->type) {
+        return 0;
+    }
+
+    switch (J->type) {
+    case JSON_OBJECT:
+        for (json *it = J->object; it; it = it->next) {
+            if (!jsonCursorFindField(cur, it->key, &child) ||
+                !jsonCursorMatches(it, &child)) {
+                return 0;
+            }
+        }
+        return 1;
+    case JSON_ARRAY:
+        for (json *it = J->array; it; it = it->next) {
+            if (!jsonCursorArrayNext(cur, &child) ||
+                !jsonCursorMatches(it, &child)) {
+                return 0;
+            }
+        }
+        return !jsonCursorArrayNext(cur, &child);
+    case JSON_STRING:
+        str = jsonCursorGetString(cur, &len);
+        return str && len == strlen(J->str) && !memcmp(str, J->str, len);
+    case JSON_INT:
+        return jsonCursorGetInt(cur) == J->integer;
+    case JSON_FLOAT:
+        return jsonCursorGetFloat(cur) == J->floating;
+    case JSON_BOOL:
+        return jsonCursorGetBool(cur) == J->boolean;
+    default:
+        return 1;
+    }
+}
+
+int jsonCursorMatchesTree(json *expected, char *buffer, size_t buflen,
+                          void *privdata) {
+    jsonDoc *doc = jsonDocNew(buffer, buflen);
+    jsonCursor root;
+    int matches = jsonDocRoot(doc, &root) &&
+                  jsonCursorMatches(expected, &root) &&
+                  jsonDocGetError(doc) == JSON_OK;
+
+    jsonDocRelease(doc);
+    return matches;
+}
+
+void testCursor(void) {
+    testMatchesTree("Cursor over", jsonCursorMatchesTree, NULL);
+
+    char *raw_json = "{\"skip\": {\"a\": [1, {\"b\": \"}]\"}], \"c\": \"\\\"\"},"
+                     " \"n\": -42, \"f\": 2.5, \"k\\u00e9y\": \"caf\\u00e9\","
+                     " \"list\": [true, null, \"x\"]}";
+    jsonDoc *doc = jsonDocNew(raw_json, strlen(raw_json));
+    jsonCursor root, value, element;
+    size_t len;
+    const char *str;
+
+    jsonDocRoot(doc, &root);
+    testCondition(jsonCursorFindField(&root, "n", &value) &&
+                  jsonCursorGetInt(&value) == -42);
+    test("  Finds a field after skipping an object\n");
+
+    testCondition(jsonCursorFindField(&root, "list", &value) &&
+                  jsonCursorArrayNext(&value, &element) &&
+                  jsonCursorGetBool(&element) == 1 &&
+                  jsonCursorArrayNext(&value, &element) &&
+                  jsonCursorType(&element) == JSON_NULL &&
+                  jsonCursorArrayNext(&value, &element) &&
+                  (str = jsonCursorGetString(&element, &len)) != NULL &&
+                  len == 1 && *str == 'x' &&
+                  !jsonCursorArrayNext(&value, &element));
+    test("  Iterates over an array\n");
+
+    testCondition(jsonCursorFindField(&root, "f", &value) &&
+                  jsonCursorGetFloat(&value) == 2.5);
+    test("  Wraps around to find an earlier field\n");
+
+    testCondition(jsonCursorFindField(&root, "k\xc3\xa9y", &value) &&
+                  (str = jsonCursorGetString(&value, &len)) != NULL &&
+                  len == 5 && !memcmp(str, "caf\xc3\xa9", 5));
+    test("  Matches an escaped key and decodes an escaped string\n");
+
+    testCondition(!jsonCursorFindField(&root, "missing", &value) &&
+                  jsonCursorFindField(&root, "skip", &value) &&
+                  jsonCursorSkip(&value) == 34);
+    test("  Skips a whole object\n");
+
+    testCondition(jsonDocGetError(doc) == JSON_OK);
+    test("  No errors\n");
+    jsonDocRelease(doc);
+
+    raw_json = "{\"a\": [1, 2, {\"b\": 3}, \"c\": 4}";
+    doc = jsonDocNew(raw_json, strlen(raw_json));
+    jsonDocRoot(doc, &root);
+    testCondition(!jsonCursorFindField(&root, "c", &value) &&
+                  jsonDocGetError(doc) != JSON_OK);
+    test("  Unterminated documents are an error\n");
+    jsonDocRelease(doc);
+}
+
+/* Every event and the tree serialise to the same flat form for comparing */
+typedef struct jsonEventLog {
+    char *buf;
+    size_t len;
+    size_t capacity;
+    size_t stop_after;
+    size_t count;
+} jsonEventLog;
+
+void jsonEventLogCatf(jsonEventLog *log, const char *fmt, ...) {
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    if (log->len + len + 1 > log->capacity) {
+        log->capacity = (log->len + len + 1) * 2;
+        log->buf = realloc(log->buf, log->capacity);
+    }
+    va_start(ap, fmt);
+    vsnprintf(log->buf + log->len, len + 1, fmt, ap);
+    va_end(ap);
+    log->len += len;
+}
+
+int jsonEventLogCount(jsonEventLog *log) {
+    return ++log->count == log->stop_after;
+}
+
+int eventStartObject(void *privdata) {
+    jsonEventLogCatf(privdata, "{");
+    return jsonEventLogCount(privdata);
+}
+
+int eventEndObject(void *privdata) {
+    jsonEventLogCatf(privdata, "}");
+    return jsonEventLogCount(privdata);
+}
+
+int eventStartArray(void *privdata) {
+    jsonEventLogCatf(privdata, "[");
+    return jsonEventLogCount(privdata);
+}
+
+int eventEndArray(void *privdata) {
+    jsonEventLogCatf(privdata, "]");
+    return jsonEventLogCount(privdata);
+}
+
+/* The tree's strings are '\0' terminated so stop at any \u0000 to match */
+int eventKey(void *privdata, const char *key, size_t len) {
+    len = strnlen(key, len);
+    jsonEventLogCatf(privdata, "k%zu:%.*s,", len, (int)len, key);
+    return jsonEventLogCount(privdata);
+}
+
+int eventString(void *privdata, const char *str, size_t len) {
+    len = strnlen(str, len);
+    jsonEventLogCatf(privdata, "s%zu:%.*s,", len, (int)len, str);
+    return jsonEventLogCount(privdata);
+}
+
+int eventInteger(void *privdata, ssize_t value) {
+    jsonEventLogCatf(privdata, "i:%zd,", value);
+    return jsonEventLogCount(privdata);
+}
+
+int eventFloating(void *privdata, double value) {
+    jsonEventLogCatf(privdata, "f:%.17g,", value);
+    return jsonEventLogCount(privdata);
+}
+
+int eventBoolean(void *privdata, int value) {
+    jsonEventLogCatf(privdata, "b:%d,", value);
+    return jsonEventLogCount(privdata);
+}
+
+int eventNull(void *privdata) {
+    jsonEventLogCatf(privdata, "n,");
+    return jsonEventLogCount(privdata);
+}
+
+void jsonEventLogTree(jsonEventLog *log, json *J) {
+    for (; J; J = J->next) {
+        if (J->key) {
+            jsonEventLogCatf(log, "k%zu:%s,", strlen(J->key), J->key);
+        }
+        switch (J->type) {
+        case JSON_OBJECT:
+            jsonEventLogCatf(log, "{");
+            jsonEventLogTree(log, J->object);
+            jsonEventLogCatf(log, "}");
+            break;
+        case JSON_ARRAY:
+            jsonEventLogCatf(log, "[");
+            jsonEventLogTree(log, J->array);
+            jsonEventLogCatf(log, "]");
+            break;
+        case JSON_STRING:
+            jsonEventLogCatf(log, "s%zu:%s,", strlen(J->str), J->str);
+            break;
+        case JSON_INT:
+            jsonEventLogCatf(log, "i:%zd,", J->integer);
+            break;
+        case JSON_FLOAT:
+            jsonEventLogCatf(log, "f:%.17g,", J->floating);
+            break;
+        case JSON_BOOL:
+            jsonEventLogCatf(log, "b:%d,", J->boolean);
+            break;
+        default:
+            jsonEventLogCatf(log, "n,");
+            break;
+        }
+    }
+}
+
+/* Logs every event as jsonEventLogTree would */
+static jsonEvents event_logger = {
+        .start_object = eventStartObject,
+        .end_object = eventEndObject,
+        .start_array = eventStartArray,
+        .end_array = eventEndArray,
+        .key = eventKey,
+        .string = eventString,
+        .integer = eventInteger,
+        .floating = eventFloating,
+        .boolean = eventBoolean,
+        .null = eventNull,
+};
+
+/* `privdata` points at the flags */
+int jsonEventsMatchTree(json *expected, char *buffer, size_t buflen,
+                        void *privdata) {
+    jsonEventLog expected_log = {0}, log = {0};
+    JSON_ERRNO error;
+    int matches;
+
+    jsonEventLogTree(&expected_log, expected);
+    error = jsonParseEvents(buffer, buflen, *(int *)privdata, &event_logger,
+                            &log, NULL);
+    matches = error == JSON_OK && log.len == expected_log.len &&
+              !memcmp(log.buf, expected_log.buf, log.len);
+
+    free(log.buf);
+    free(expected_log.buf);
+    return matches;
+}
+
+void testParseEvents(void) {
+    jsonEvents events = event_logger;
+    int flags = JSON_NO_FLAGS;
+
+    testMatchesTree("Events for", jsonEventsMatchTree, &flags);
+    flags = JSON_INSITU_FLAG;
+    testMatchesTree("Events in situ for", jsonEventsMatchTree, &flags);
+
+    /* Deeper than the stack the parser starts with */
+    size_t depth = 1000;
+    char *deep = malloc(depth * 2 + 1);
+    memset(deep, '[', depth);
+    memset(deep + depth, ']', depth);
+    deep[depth * 2] = '\0';
+    jsonEventLog log = {0};
+    testCondition(jsonParseEvents(deep, depth * 2, JSON_NO_FLAGS, &events,
+                                  &log, NULL) == JSON_OK &&
+                  log.len == depth * 2 && !memcmp(log.buf, deep, depth * 2));
+    test("  Arrays nested %zu deep\n", depth);
+    free(log.buf);
+    free(deep);
+
+    char *raw_json = "{\"a\": [1, 2.5, \"x\\ny\"], \"b\": {\"c\": null}}";
+    jsonEventLog stopped = {.stop_after = 4};
+    jsonState state;
+    testCondition(jsonParseEvents(raw_json, strlen(raw_json), JSON_NO_FLAGS,
+                                  &events, &stopped, &state) == JSON_STOPPED &&
+                  state.error == JSON_STOPPED &&
+                  !strcmp(stopped.buf, "{k1:a,[i:1,"));
+    test("  Stops when a handler asks it to\n");
+    free(stopped.buf);
+
+    jsonEvents only_keys = {.key = eventKey};
+    log = (jsonEventLog){0};
+    testCondition(jsonParseEvents(raw_json, strlen(raw_json), JSON_NO_FLAGS,
+                                  &only_keys, &log, NULL) == JSON_OK &&
+                  !strcmp(log.buf, "k1:a,k1:b,k1:c,"));
+    test("  Handlers can be left out\n");
+    free(log.buf);
+
+    char *invalid[] = {"[1, 2", "{\"a\" 1}", "[1 2]", "{\"a\": tru}", "1"};
+    for (int i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+        json *expected = jsonParse(invalid[i]);
+        log = (jsonEventLog){0};
+        JSON_ERRNO error = jsonParseEvents(invalid[i], strlen(invalid[i]),
+                                           JSON_NO_FLAGS, &events, &log,
+                                           &state);
+        testCondition(error != JSON_OK && error == jsonGetError(expected) &&
+                      state.offset == expected->state->offset);
+        test("  %s fails as it does for the tree\n", invalid[i]);
+        free(log.buf);
+        jsonRelease(expected);
+    }
+}
+
+void testTokenizer(void) {
+    char *raw_json = "{\"id\": 7, \"tags\": [\"a\\tb\", 2.5, true, null], "
+                     "\"e\": {}}";
+    struct {
+        JSON_TOKEN_TYPE type;
+        size_t depth;
+        char *raw;
+    } expected[] = {
+            {JSON_TOKEN_START_OBJECT, 0, "{"},
+            {JSON_TOKEN_KEY, 1, "\"id\""},
+            {JSON_TOKEN_INT, 1, "7"},
+            {JSON_TOKEN_KEY, 1, "\"tags\""},
+            {JSON_TOKEN_START_ARRAY, 1, "["},
+            {JSON_TOKEN_STRING, 2, "\"a\\tb\""},
+            {JSON_TOKEN_FLOAT, 2, "2.5"},
+            {JSON_TOKEN_BOOL, 2, "true"},
+            {JSON_TOKEN_NULL, 2, "null"},
+            {JSON_TOKEN_END_ARRAY, 1, "]"},
+            {JSON_TOKEN_KEY, 1, "\"e\""},
+            {JSON_TOKEN_START_OBJECT, 1, "{"},
+            {JSON_TOKEN_END_OBJECT, 1, "}"},
+            {JSON_TOKEN_END_OBJECT, 0, "}"},
+    };
+    size_t count = sizeof(expected) / sizeof(expected[0]);
+    jsonTokenizer *t = jsonTokenizerNew(raw_json, strlen(raw_json),
+                                        JSON_NO_FLAGS);
+    jsonToken tok;
+    size_t i = 0;
+    int matches = 1;
+
+    while (jsonNextToken(t, &tok)) {
+        if (i >= count || tok.type != expected[i].type ||
+            tok.depth != expected[i].depth ||
+            tok.len != strlen(expected[i].raw) ||
+            memcmp(raw_json + tok.offset, expected[i].raw, tok.len)) {
+            matches = 0;
+        }
+        i++;
+    }
+    testCondition(matches && i == count && tok.type == JSON_TOKEN_END &&
+                  jsonTokenizerGetError(t) == JSON_OK);
+    test("  Token types, depths and spans\n");
+    jsonTokenizerRelease(t);
+
+    t = jsonTokenizerNew(raw_json, strlen(raw_json), JSON_NO_FLAGS);
+    for (i = 0; i < 6; ++i) {
+        jsonNextToken(t, &tok);
+    }
+    int decoded = tok.type == JSON_TOKEN_STRING && tok.str_len == 3 &&
+                  !memcmp(tok.str, "a\tb", 3);
+    jsonNextToken(t, &tok);
+    decoded &= tok.type == JSON_TOKEN_FLOAT && tok.floating == 2.5;
+    jsonNextToken(t, &tok);
+    decoded &= tok.type == JSON_TOKEN_BOOL && tok.boolean == 1;
+    testCondition(decoded);
+    test("  Decoded scalars\n");
+    /* Stopping early is just not asking for any more */
+    jsonTokenizerRelease(t);
+
+    raw_json = "[1, {\"a\": 2 \"b\": 3}]";
+    t = jsonTokenizerNew(raw_json, strlen(raw_json), JSON_NO_FLAGS);
+    while (jsonNextToken(t, &tok))
+        ;
+    testCondition(tok.type == JSON_TOKEN_ERROR &&
+                  jsonTokenizerGetError(t) == JSON_INVALID_JSON_TYPE_CHAR &&
+                  tok.offset == 12 && !jsonNextToken(t, &tok));
+    test("  Errors stop the tokenizer\n");
+    jsonTokenizerRelease(t);
+
+    /* The same error at the same offset as the tree */
+    char *invalid[] = {
+            "[1, 2",       "[\"a\"",        "{\"a\"",       "[[1]",
+            "{\"a\":",     "[1,",         "[\"\\x\"]",    "[\"\\u12\"]",
+            "[\"a\"\"]",    "{\"a\" 1}",     "[nul]",       "[1.2.3]",
+            "{1: 2}",      "[1 2]",       "[\"a\", ]",    "[{\"a\": 1]",
+    };
+    for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+        json *expected = jsonParse(invalid[i]);
+        t = jsonTokenizerNew(invalid[i], strlen(invalid[i]), JSON_NO_FLAGS);
+        while (jsonNextToken(t, &tok))
+            ;
+        testCondition(tok.type == JSON_TOKEN_ERROR &&
+                      jsonTokenizerGetError(t) == jsonGetError(expected) &&
+                      tok.offset == expected->state->offset);
+        test("  Tokenizing %s fails as the tree does\n", invalid[i]);
+        jsonTokenizerRelease(t);
+        jsonRelease(expected);
+    }
+}
+
+/* `depth` arrays nested inside each other around a 1 */
+static char *jsonNestedArrays(size_t depth) {
+    char *raw_json = malloc(depth * 2 + 2);
+    memset(raw_json, '[', depth);
+    raw_json[depth] = '1';
+    memset(raw_json + depth + 1, ']', depth);
+    raw_json[depth * 2 + 1] = '\0';
+    return raw_json;
+}
+
+void testMaxDepth(void) {
+    char *raw_json = jsonNestedArrays(JSON_MAX_DEPTH);
+    json *J = jsonParse(raw_json);
+    testCondition(jsonOk(J) && jsonGetMaxDepth() == JSON_MAX_DEPTH);
+    test("  Nesting up to the default limit\n");
+    jsonRelease(J);
+    free(raw_json);
+
+    raw_json = jsonNestedArrays(JSON_MAX_DEPTH + 1);
+    J = jsonParse(raw_json);
+    testCondition(jsonGetError(J) == JSON_MAX_DEPTH_EXCEEDED &&
+                  J->state->offset == JSON_MAX_DEPTH);
+    test("  Nesting past the default limit\n");
+    jsonRelease(J);
+
+    J = jsonStreamInChunks(raw_json, 100, JSON_NO_FLAGS);
+    testCondition(jsonGetError(J) == JSON_MAX_DEPTH_EXCEEDED &&
+                  J->state->offset == JSON_MAX_DEPTH);
+    test("  Streaming past the default limit\n");
+    jsonRelease(J);
+
+    jsonTokenizer *t = jsonTokenizerNew(raw_json, strlen(raw_json),
+                                        JSON_NO_FLAGS);
+    jsonToken tok;
+    while (jsonNextToken(t, &tok))
+        ;
+    testCondition(jsonTokenizerGetError(t) == JSON_MAX_DEPTH_EXCEEDED &&
+                  tok.offset == JSON_MAX_DEPTH);
+    test("  Tokenizing past the default limit\n");
+    jsonTokenizerRelease(t);
+    free(raw_json);
+
+    /* Would overflow the C stack if every level was a function call */
+    size_t depth = 100000;
+    jsonSetMaxDepth(depth);
+    raw_json = jsonNestedArrays(depth);
+    J = jsonParse(raw_json);
+    json *ptr = J;
+    size_t levels = 0;
+    while (ptr && jsonIsArray(ptr)) {
+        ptr = ptr->array;
+        levels++;
+    }
+    testCondition(jsonOk(J) && levels == depth && ptr &&
+                  jsonGetInt(ptr) == 1);
+    test("  Nesting %zu deep with a raised limit\n", depth);
+    jsonRelease(J);
+    free(raw_json);
+    jsonSetMaxDepth(JSON_MAX_DEPTH);
+
+    raw_json = "{\"a\": [{\"b\": [1, 2]}, {\"c\": true}, [[3]]], \"d\": 4}";
+    J = jsonParse(raw_json);
+    char *str = jsonToString(J, NULL);
+    testCondition(jsonOk(J) &&
+                  !strcmp(str, "{\"a\":[{\"b\":[1,2]},{\"c\":true},[[3]]],"
+                               "\"d\":4}"));
+    test("  Mixed nesting\n");
+    jsonFree(str);
+    jsonRelease(J);
+
+    /* Running out of buffer right after an opening bracket is the end of the
+     * input, not another level of nesting */
+    char *unterminated[] = {"[",        "[[",    "[1,[",      "{",
+                            "{\"a\":",    "{\"a\":{", "[[2]",       "[[]",
+                            "[\"a\"",     "[1,2",   "{\"a\":[1]"};
+    for (int i = 0; i < sizeof(unterminated) / sizeof(unterminated[0]); ++i) {
+        J = jsonParse(unterminated[i]);
+        testCondition(jsonGetError(J) == JSON_EOF);
+        test("  Unterminated %s\n", unterminated[i]);
+        jsonRelease(J);
+    }
+
+    char *closed_at_end[] = {"[]", "{}", "[[]]", "[[2]]", "{\"a\":{}}"};
+    for (int i = 0; i < sizeof(closed_at_end) / sizeof(closed_at_end[0]);
+         ++i) {
+        J = jsonParse(closed_at_end[i]);
+        testCondition(jsonOk(J));
+        test("  %s closing on the last byte\n", closed_at_end[i]);
+        jsonRelease(J);
+    }
+}
+
+void testArena(void) {
+    char *raw_json = "{\"id\": 1, \"name\": \"widget\", \"tags\": [\"a\", "
+                     "\"b\"], \"price\": 9.5}";
+    char *expected = "{\"id\":1,\"name\":\"widget\",\"tags\":[\"a\",\"b\"],"
+                     "\"price\":9.5}";
+    size_t len = strlen(raw_json);
+    jsonArena *arena = jsonArenaNew();
+
+    json *J = jsonParseIntoArena(arena, raw_json, len, JSON_NO_FLAGS);
+    char *str = jsonToString(J, NULL);
+    testCondition(jsonOk(J) && !strcmp(str, expected));
+    test("  Parse in to an arena\n");
+    jsonFree(str);
+
+    size_t high_water = jsonArenaHighWaterMark(arena);
+    json *first = J;
+    int reused = high_water > 0;
+    for (int i = 0; i < 100; ++i) {
+        jsonArenaReset(arena);
+        J = jsonParseIntoArena(arena, raw_json, len, JSON_NO_FLAGS);
+        reused &= J == first && jsonOk(J);
+    }
+    str = jsonToString(J, NULL);
+    testCondition(reused && !strcmp(str, expected) &&
+                  jsonArenaHighWaterMark(arena) == high_water);
+    test("  Reset reuses the same memory\n");
+    jsonFree(str);
+
+    /* Documents pile up until the arena is reset */
+    json *second = jsonParseIntoArena(arena, raw_json, len, JSON_NO_FLAGS);
+    testCondition(jsonOk(J) && jsonOk(second) && second != J &&
+                  jsonArenaHighWaterMark(arena) == high_water * 2);
+    test("  Several documents in one arena\n");
+
+    jsonArenaReset(arena);
+    J = jsonParseIntoArena(arena, raw_json, len, JSON_NO_FLAGS);
+    testCondition(jsonOk(J) &&
+                  jsonArenaHighWaterMark(arena) == high_water * 2);
+    test("  High-water mark survives a reset\n");
+    jsonArenaRelease(arena);
+}
+
+typedef struct jsonAllocCounts {
+    size_t calls;
+    /* Allocations not yet freed */
+    ssize_t live;
+} jsonAllocCounts;
+
+static void *jsonCountingMalloc(void *ctx, size_t size) {
+    jsonAllocCounts *counts = ctx;
+    counts->calls++;
+    counts->live++;
+    return malloc(size);
+}
+
+static void *jsonCountingRealloc(void *ctx, void *ptr, size_t size) {
+    jsonAllocCounts *counts = ctx;
+    counts->calls++;
+    if (ptr == NULL) {
+        counts->live++;
+    }
+    return realloc(ptr, size);
+}
+
+static void jsonCountingFree(void *ctx, void *ptr) {
+    jsonAllocCounts *counts = ctx;
+    if (ptr) {
+        counts->live--;
+    }
+    free(ptr);
+}
+
+void testAllocatorHooks(void) {
+    char *raw_json = "{\"id\": 1, \"name\": \"widget\", \"tags\": [\"a\\n\", "
+                     "\"b\"], \"price\": 9.5}";
+    jsonAllocCounts counts = {0};
+    jsonAllocatorHooks hooks = {
+            .malloc = jsonCountingMalloc,
+            .realloc = jsonCountingRealloc,
+            .free = jsonCountingFree,
+            .ctx = &counts,
+    };
+
+    json *J = jsonParseWithHooks(raw_json, strlen(raw_json), JSON_NO_FLAGS,
+                                 &hooks);
+    size_t calls = counts.calls;
+    char *str = jsonToString(J, NULL);
+    testCondition(jsonOk(J) && calls > 0 && counts.calls == calls);
+    test("  Per parse hooks hold the tree\n");
+    jsonFree(str);
+    jsonRelease(J);
+    testCondition(counts.live == 0);
+    test("  Released through the same hooks\n");
+
+    counts.calls = 0;
+    jsonArena *arena = jsonArenaNewWithHooks(&hooks);
+    for (int i = 0; i < 10; ++i) {
+        jsonArenaReset(arena);
+        J = jsonParseIntoArena(arena, raw_json, strlen(raw_json),
+                               JSON_NO_FLAGS);
+    }
+    int held = jsonOk(J) && counts.calls > 0 && counts.live > 0;
+    jsonArenaRelease(arena);
+    testCondition(held && counts.live == 0);
+    test("  Arena with hooks\n");
+
+    counts.calls = 0;
+    jsonSetAllocatorHooks(&hooks);
+    J = jsonParse(raw_json);
+    str = jsonToString(J, NULL);
+    json *invalid = jsonParse("[1, 2");
+    char *error = jsonGetStrerror(invalid);
+    held = jsonOk(J) && str && error && counts.live > 0;
+    jsonFree(str);
+    jsonFree(error);
+    jsonRelease(invalid);
+    jsonRelease(J);
+    jsonSetAllocatorHooks(NULL);
+    testCondition(held && counts.live == 0);
+    test("  Global hooks\n");
+}
+
+static void *jsonParseOnThread(void *arg) {
+    char *raw_json = arg;
+    for (int i = 0; i < 100; ++i) {
+        json *J = jsonParse(raw_json);
+        if (!jsonOk(J)) {
+            return NULL;
+        }
+        jsonRelease(J);
+    }
+    return arg;
+}
+
+void testThreadCache(void) {
+    char *raw_json = "{\"id\": 1, \"name\": \"widget\", \"tags\": [\"a\", "
+                     "\"b\"], \"price\": 9.5}";
+    jsonAllocCounts counts = {0};
+    jsonAllocatorHooks hooks = {
+            .malloc = jsonCountingMalloc,
+            .realloc = jsonCountingRealloc,
+            .free = jsonCountingFree,
+            .ctx = &counts,
+    };
+
+    jsonSetAllocatorHooks(&hooks);
+    jsonSetThreadCacheSize(2);
+    json *J = jsonParse(raw_json);
+    json *first = J;
+    jsonRelease(J);
+
+    counts.calls = 0;
+    int reused = 1;
+    for (int i = 0; i < 100; ++i) {
+        J = jsonParse(raw_json);
+        reused &= jsonOk(J) && J == first;
+        jsonRelease(J);
+    }
+    testCondition(reused && counts.calls == 0);
+    test("  Parse and release without allocating\n");
+
+    /* Two live at once come from the cache, a third is new */
+    json *a = jsonParse(raw_json);
+    json *b = jsonParse(raw_json);
+    json *c = jsonParse(raw_json);
+    int allocated = counts.calls > 0;
+    jsonRelease(a);
+    jsonRelease(b);
+    jsonRelease(c);
+    jsonSetThreadCacheSize(0);
+    testCondition(allocated && counts.live == 0);
+    test("  Bounded and freed when turned off\n");
+    jsonSetAllocatorHooks(NULL);
+
+    jsonSetThreadCacheSize(4);
+    pthread_t threads[4];
+    void *results[4];
+    for (int i = 0; i < 4; ++i) {
+        pthread_create(&threads[i], NULL, jsonParseOnThread, raw_json);
+    }
+    for (int i = 0; i < 4; ++i) {
+        pthread_join(threads[i], &results[i]);
+    }
+    testCondition(results[0] && results[1] && results[2] && results[3]);
+    test("  A cache per thread\n");
+
+    /* Turning it back on after a flush starts a fresh cache */
+    jsonSetAllocatorHooks(&hooks);
+    jsonSetThreadCacheSize(1);
+    jsonRelease(jsonParse(raw_json));
+    int cached = counts.live > 0;
+    jsonSetThreadCacheSize(0);
+    testCondition(cached && counts.live == 0);
+    test("  Flushed on the calling thread\n");
+    jsonSetAllocatorHooks(NULL);
+}
+
+void testLargeDocuments(void) {
+    /* Enough elements for the blocks to grow past the mmap threshold */
+    size_t count = 200000, len = 0;
+    char *raw_json = malloc(count * 48 + 16);
+
+    raw_json[len++] = '[';
+    for (size_t i = 0; i < count; ++i) {
+        len += sprintf(raw_json + len, "%s{\"id\": %zu, \"name\": \"item %zu\"}",
+                       i ? ", " : "", i, i);
+    }
+    raw_json[len++] = ']';
+    raw_json[len] = '\0';
+
+    jsonArena *arena = jsonArenaNew();
+    size_t high_water = 0;
+    int matches = 1;
+    for (int i = 0; i < 3; ++i) {
+        jsonArenaReset(arena);
+        json *J = jsonParseIntoArena(arena, raw_json, len, JSON_NO_FLAGS);
+        size_t seen = 0;
+        json *last = NULL;
+        for (json *el = J->array; el; el = el->next) {
+            last = el;
+            seen++;
+        }
+        matches &= jsonOk(J) && seen == count &&
+                   jsonGetInt(last->object) == (ssize_t)count - 1;
+        if (i == 0) {
+            high_water = jsonArenaHighWaterMark(arena);
+        }
+    }
+    testCondition(matches && jsonArenaHighWaterMark(arena) == high_water);
+    test("  %zu elements parsed into the same arena 3 times\n", count);
+    jsonArenaRelease(arena);
+    free(raw_json);
+
+    /* A string bigger than any block gets a block of its own */
+    size_t str_len = 3 * 1024 * 1024;
+    raw_json = malloc(str_len + 16);
+    len = sprintf(raw_json, "{\"big\": \"");
+    memset(raw_json + len, 'x', str_len);
+    len += str_len;
+    len += sprintf(raw_json + len, "\"}");
+    json *J = jsonParseWithLen(raw_json, len);
+    char *str = jsonGetString(J->object);
+    testCondition(jsonOk(J) && strlen(str) == str_len && str[0] == 'x' &&
+                  str[str_len - 1] == 'x');
+    test("  Oversized string\n");
+    jsonRelease(J);
+    free(raw_json);
+}
+
+int jsonCompactMatchesTree(json *expected, char *buffer, size_t buflen,
+                           void *privdata) {
+    jsonCompact *doc = jsonCompactParse(buffer, buflen, JSON_NO_FLAGS);
+    int matches;
+
+    if (jsonOk(expected)) {
+        /* Through the tree again so both are printed the same way */
+        char *str = jsonCompactToString(doc, jsonCompactRoot(doc), NULL);
+        matches = jsonCompactGetError(doc) == JSON_OK &&
+                  jsonSameTree(expected, jsonParse(str));
+        jsonFree(str);
+    } else {
+        matches = jsonSameError(expected, jsonCompactGetError(doc),
+                                jsonCompactGetStrerror(doc));
+    }
+    jsonCompactRelease(doc);
+    return matches;
+}
+
+void testCompact(void) {
+    testMatchesTree("Compact parse of", jsonCompactMatchesTree, NULL);
+    testFailsAsTree("Compacting", jsonCompactMatchesTree, NULL);
+
+    for (int i = 0; i < sizeof(tree_documents) / sizeof(tree_documents[0]);
+         ++i) {
+        char *raw_json = readFile(tree_documents[i]);
+        size_t len = strlen(raw_json);
+        jsonCompact *doc = jsonCompactParse(raw_json, len, JSON_NO_FLAGS);
+        jsonArena *arena = jsonArenaNew();
+
+        jsonParseIntoArena(arena, raw_json, len, JSON_NO_FLAGS);
+        testCondition(jsonCompactMemoryUsage(doc) <
+                      jsonArenaHighWaterMark(arena));
+        test("  Compact %s takes %zu bytes rather than %zu\n",
+             tree_documents[i], jsonCompactMemoryUsage(doc),
+             jsonArenaHighWaterMark(arena));
+
+        jsonArenaRelease(arena);
+        jsonCompactRelease(doc);
+        free(raw_json);
+    }
+
+    char *raw_json = "{\"id\": 7, \"name\": \"caf\\u00e9\", \"ok\": true, "
+                     "\"ratio\": 0.25, \"none\": null, \"tags\": [\"a\", "
+                     "\"b\", \"c\"], \"empty\": {}}";
+    jsonCompact *doc = jsonCompactParse(raw_json, strlen(raw_json),
+                                        JSON_NO_FLAGS);
+    jsonNode root = jsonCompactRoot(doc);
+    jsonNode tags = jsonCompactObjectAt(doc, root, "tags");
+    jsonNode empty = jsonCompactObjectAt(doc, root, "empty");
+    size_t len;
+    const char *name = jsonCompactGetString(
+            doc, jsonCompactObjectAt(doc, root, "name"), &len);
+
+    testCondition(
+            jsonCompactIsObject(doc, root) && jsonCompactLength(doc, root) == 7 &&
+            jsonCompactGetInt(doc, jsonCompactObjectAt(doc, root, "id")) == 7 &&
+            !strcmp(name, "café") && len == 5 &&
+            jsonCompactGetBool(doc, jsonCompactObjectAt(doc, root, "ok")) == 1 &&
+            jsonCompactGetFloat(doc, jsonCompactObjectAt(doc, root, "ratio")) ==
+                    0.25 &&
+            jsonCompactIsNull(doc, jsonCompactObjectAt(doc, root, "none")) &&
+            jsonCompactObjectAt(doc, root, "missing") == JSON_NODE_NONE);
+    test("  Getters\n");
+
+    testCondition(
+            jsonCompactIsArray(doc, tags) && jsonCompactLength(doc, tags) == 3 &&
+            !strcmp(jsonCompactGetString(
+                            doc, jsonCompactArrayAt(doc, tags, 2), NULL),
+                    "c") &&
+            !strcmp(jsonCompactKey(doc, tags), "tags") &&
+            jsonCompactKey(doc, jsonCompactChild(doc, tags)) == NULL &&
+            jsonCompactArrayAt(doc, tags, 3) == JSON_NODE_NONE &&
+            jsonCompactIsObject(doc, empty) &&
+            jsonCompactChild(doc, empty) == JSON_NODE_NONE);
+    test("  Walking arrays and empty containers\n");
+
+    jsonNode missing = jsonCompactObjectAt(doc, root, "missing");
+    testCondition(jsonCompactType(doc, missing) == JSON_NULL &&
+                  jsonCompactObjectAt(doc, missing, "id") == JSON_NODE_NONE &&
+                  jsonCompactArrayAt(doc, missing, 0) == JSON_NODE_NONE &&
+                  jsonCompactChild(doc, missing) == JSON_NODE_NONE &&
+                  jsonCompactNext(doc, missing) == JSON_NODE_NONE &&
+                  jsonCompactKey(doc, missing) == NULL &&
+                  jsonCompactLength(doc, missing) == 0);
+    test("  Lookups chained on a missing key find nothing\n");
+    jsonCompactRelease(doc);
+
+    raw_json = "[1, 1.5, 12345678901234567890]";
+    doc = jsonCompactParse(raw_json, strlen(raw_json), JSON_STRNUM_FLAG);
+    char *str = jsonCompactToString(doc, jsonCompactRoot(doc), NULL);
+    testCondition(!strcmp(str, "[1,1.5,12345678901234567890]") &&
+                  !strcmp(jsonCompactGetStrnum(
+                                  doc, jsonCompactArrayAt(
+                                               doc, jsonCompactRoot(doc), 1)),
+                          "1.5"));
+    test("  Numbers kept as strings\n");
+    jsonFree(str);
+    jsonCompactRelease(doc);
+
+    raw_json = "{\"a\": [1, 2 3]}";
+    doc = jsonCompactParse(raw_json, strlen(raw_json), JSON_NO_FLAGS);
+    json *expected = jsonParse(raw_json);
+    testCondition(jsonCompactGetError(doc) == jsonGetError(expected) &&
+                  jsonCompactGetError(doc) == JSON_INVALID_ARRAY_CHARACTER);
+    test("  Errors match the tree\n");
+    jsonRelease(expected);
+    jsonCompactRelease(doc);
+}
+
+int jsonTapeMatchesTree(json *expected, char *buffer, size_t buflen,
+                        void *privdata) {
+    jsonTape *doc = jsonTapeParse(buffer, buflen, JSON_NO_FLAGS);
+    int matches;
+
+    if (jsonOk(expected)) {
+        /* Through the tree again so both are printed the same way */
+        char *str = jsonTapeToString(doc, jsonTapeRoot(doc), NULL);
+        matches = jsonTapeGetError(doc) == JSON_OK &&
+                  jsonSameTree(expected, jsonParse(str));
+        jsonFree(str);
+    } else {
+        matches = jsonSameError(expected, jsonTapeGetError(doc),
+                                jsonTapeGetStrerror(doc));
+    }
+    jsonTapeRelease(doc);
+    return matches;
+}
+
+void testTape(void) {
+    testMatchesTree("Tape of", jsonTapeMatchesTree, NULL);
+    testFailsAsTree("Taping", jsonTapeMatchesTree, NULL);
+
+    char *raw_json = "{\"id\": 7, \"name\": \"caf\\u00e9\", \"ok\": false, "
+                     "\"ratio\": 0.25, \"none\": null, \"deep\": [[1, [2]], "
+                     "{\"x\": {}}], \"tags\": [\"a\", \"b\", \"c\"]}";
+    jsonTape *doc = jsonTapeParse(raw_json, strlen(raw_json), JSON_NO_FLAGS);
+    jsonTapeIdx root = jsonTapeRoot(doc);
+    jsonTapeIdx deep = jsonTapeObjectAt(doc, root, "deep");
+    jsonTapeIdx tags = jsonTapeObjectAt(doc, root, "tags");
+    size_t len;
+    const char *name = jsonTapeGetString(
+            doc, jsonTapeObjectAt(doc, root, "name"), &len);
+
+    testCondition(
+            jsonTapeIsObject(doc, root) && jsonTapeLength(doc, root) == 7 &&
+            jsonTapeGetInt(doc, jsonTapeObjectAt(doc, root, "id")) == 7 &&
+            !strcmp(name, "café") && len == 5 &&
+            jsonTapeGetBool(doc, jsonTapeObjectAt(doc, root, "ok")) == 0 &&
+            jsonTapeGetFloat(doc, jsonTapeObjectAt(doc, root, "ratio")) ==
+                    0.25 &&
+            jsonTapeIsNull(doc, jsonTapeObjectAt(doc, root, "none")) &&
+            jsonTapeObjectAt(doc, root, "missing") == JSON_TAPE_NONE);
+    test("  Getters\n");
+
+    /* Skipping "deep" has to land on the key of the member after it */
+    testCondition(jsonTapeNext(doc, deep) == tags &&
+                  jsonTapeSkip(doc, deep) == tags - 1 &&
+                  !strcmp(jsonTapeKey(doc, tags), "tags") &&
+                  jsonTapeKey(doc, jsonTapeChild(doc, tags)) == NULL &&
+                  jsonTapeLength(doc, tags) == 3 &&
+                  !strcmp(jsonTapeGetString(
+                                  doc, jsonTapeArrayAt(doc, tags, 2), NULL),
+                          "c") &&
+                  jsonTapeArrayAt(doc, tags, 3) == JSON_TAPE_NONE &&
+                  jsonTapeNext(doc, tags) == JSON_TAPE_NONE &&
+                  jsonTapeNext(doc, root) == JSON_TAPE_NONE);
+    test("  Skipping over containers\n");
+
+    jsonTape *copy = jsonTapeCopy(doc, deep);
+    char *copy_str = jsonTapeToString(copy, jsonTapeRoot(copy), NULL);
+    char *deep_str = jsonTapeToString(doc, deep, NULL);
+    jsonTapeRelease(doc);
+    jsonTapeIdx x = jsonTapeObjectAt(
+            copy, jsonTapeArrayAt(copy, jsonTapeRoot(copy), 1), "x");
+    testCondition(!strcmp(copy_str, "[[1,[2]],{\"x\":{}}]") &&
+                  !strcmp(copy_str, deep_str) &&
+                  jsonTapeIsObject(copy, x) &&
+                  jsonTapeChild(copy, x) == JSON_TAPE_NONE &&
+                  jsonTapeGetInt(copy, jsonTapeArrayAt(
+                                               copy,
+                                               jsonTapeArrayAt(
+                                                       copy,
+                                                       jsonTapeRoot(copy), 0),
+                                               0)) == 1);
+    test("  Copying a subtree\n");
+    jsonFree(copy_str);
+    jsonFree(deep_str);
+    jsonTapeRelease(copy);
+
+    raw_json = "[1, 1.5, 12345678901234567890]";
+    doc = jsonTapeParse(raw_json, strlen(raw_json), JSON_STRNUM_FLAG);
+    char *str = jsonTapeToString(doc, jsonTapeRoot(doc), NULL);
+    testCondition(
+            !strcmp(str, "[1,1.5,12345678901234567890]") &&
+            !strcmp(jsonTapeGetStrnum(
+                            doc, jsonTapeArrayAt(doc, jsonTapeRoot(doc), 1)),
+                    "1.5"));
+    test("  Numbers kept as strings\n");
+    jsonFree(str);
+    jsonTapeRelease(doc);
+
+    raw_json = "{\"a\": [1, 2 3]}";
+    doc = jsonTapeParse(raw_json, strlen(raw_json), JSON_NO_FLAGS);
+    json *expected = jsonParse(raw_json);
+    testCondition(jsonTapeGetError(doc) == jsonGetError(expected) &&
+                  jsonTapeGetError(doc) == JSON_INVALID_ARRAY_CHARACTER &&
+                  jsonTapeRoot(doc) == JSON_TAPE_NONE);
+    test("  Errors match the tree\n");
+    jsonRelease(expected);
+    jsonTapeRelease(doc);
+
+    raw_json = "{\"a\":";
+    doc = jsonTapeParse(raw_json, strlen(raw_json), JSON_NO_FLAGS);
+    jsonTapeIdx none = jsonTapeRoot(doc);
+    str = jsonTapeToString(doc, none, NULL);
+    testCondition(none == JSON_TAPE_NONE &&
+                  jsonTapeType(doc, none) == JSON_NULL &&
+                  jsonTapeSkip(doc, none) == JSON_TAPE_NONE &&
+                  jsonTapeNext(doc, none) == JSON_TAPE_NONE &&
+                  jsonTapeChild(doc, none) == JSON_TAPE_NONE &&
+                  jsonTapeKey(doc, none) == NULL &&
+                  jsonTapeLength(doc, none) == 0 &&
+                  jsonTapeObjectAt(doc, none, "a") == JSON_TAPE_NONE &&
+                  jsonTapeArrayAt(doc, none, 0) == JSON_TAPE_NONE &&
+                  jsonTapeGetString(doc, none, NULL) == NULL &&
+                  jsonTapeGetInt(doc, none) == 0 &&
+                  jsonTapeGetBool(doc, none) == -1 &&
+                  jsonTapeCopy(doc, none) == NULL && !strcmp(str, ""));
+    test("  JSON_TAPE_NONE from %s is nothing to every accessor\n", raw_json);
+    jsonFree(str);
+    jsonTapeRelease(doc);
+}
+
+/* {"items": [0, 1, 2, ...]} */
+static char *jsonItems(size_t count) {
+    char *raw_json = malloc(count * 12 + 32);
+    size_t len = sprintf(raw_json, "{\"items\": [");
+
+    for (size_t i = 0; i < count; ++i) {
+        len += sprintf(raw_json + len, "%s%zu", i ? ", " : "", i);
+    }
+    sprintf(raw_json + len, "]}");
+    return raw_json;
+}
+
+/* Index the shared array from another thread, which only reads it */
+static void *jsonArrayAtOnThread(void *arg) {
+    json *items = arg;
+    for (int i = 0; i < 1000; ++i) {
+        if (jsonGetInt(jsonArrayAt(items, i * 7)) != i * 7) {
+            return NULL;
+        }
+    }
+    return arg;
+}
+
+void testArrayIndex(void) {
+    size_t count = 100000;
+    char *raw_json = jsonItems(count);
+    json *J = jsonParseWithFlags(raw_json, JSON_LAZY_INDEX_FLAG);
+    json *items = jsonSelect(J, ".items");
+    size_t len;
+    size_t matched = 0;
+
+    /* Quadratic if each lookup walked the list */
+    for (size_t i = 0; i < count; ++i) {
+        if (jsonGetInt(jsonArrayAt(items, (int)i)) == (ssize_t)i) {
+            matched++;
+        }
+    }
+    testCondition(matched == count);
+    test("  Every index of a %zu element array\n", count);
+
+    json **vector = jsonArrayItems(items, &len);
+    testCondition(vector && len == count && vector[0] == items->array &&
+                  jsonArrayLength(items) == count &&
+                  jsonGetInt(jsonSelect(J, ".items[50000]")) == 50000 &&
+                  jsonArrayAt(items, (int)count) == NULL &&
+                  jsonArrayAt(items, -1) == NULL);
+    test("  Vector, length and out of range indexes\n");
+    jsonRelease(J);
+
+    J = jsonParseWithFlags("[[], [1, [2, 3]], {\"a\": 1}]",
+                           JSON_LAZY_INDEX_FLAG);
+    json *empty = jsonArrayAt(J, 0);
+    json *nested = jsonArrayAt(jsonArrayAt(J, 1), 1);
+    testCondition(jsonArrayLength(J) == 3 && jsonArrayLength(empty) == 0 &&
+                  jsonArrayItems(empty, &len) == NULL && len == 0 &&
+                  jsonGetInt(jsonArrayAt(nested, 1)) == 3 &&
+                  jsonArrayLength(jsonArrayAt(J, 2)) == 0 &&
+                  jsonArrayItems(jsonArrayAt(J, 2), &len) == NULL);
+    test("  Nested, empty and non arrays\n");
+    jsonRelease(J);
+
+    J = jsonStreamInChunks(raw_json, 4096, JSON_LAZY_INDEX_FLAG);
+    items = jsonSelect(J, ".items");
+    testCondition(jsonOk(J) && jsonArrayItems(items, &len) != NULL &&
+                  len == count &&
+                  jsonGetInt(jsonArrayAt(items, 99999)) == 99999);
+    test("  Streamed documents are indexed too\n");
+    jsonRelease(J);
+
+    /* Indexes live in the arena and go when it is reset */
+    jsonArena *arena = jsonArenaNew();
+    for (int i = 0; i < 3; ++i) {
+        jsonArenaReset(arena);
+        J = jsonParseIntoArena(arena, raw_json, strlen(raw_json),
+                               JSON_LAZY_INDEX_FLAG);
+        items = jsonSelect(J, ".items");
+        matched += jsonGetInt(jsonArrayAt(items, 1234)) == 1234;
+    }
+    testCondition(matched == count + 3);
+    test("  Indexing documents in a reused arena\n");
+    jsonArenaRelease(arena);
+
+    /* Without the flag the array is never written to */
+    J = jsonParse(raw_json);
+    items = jsonSelect(J, ".items");
+    pthread_t threads[4];
+    void *results[4];
+    for (int i = 0; i < 4; ++i) {
+        pthread_create(&threads[i], NULL, jsonArrayAtOnThread, items);
+    }
+    for (int i = 0; i < 4; ++i) {
+        pthread_join(threads[i], &results[i]);
+    }
+    testCondition(results[0] && results[1] && results[2] && results[3] &&
+                  jsonArrayItems(items, &len) == NULL && len == 0 &&
+                  jsonArrayLength(items) == count);
+    test("  Unindexed arrays are only read, from any thread\n");
+    jsonRelease(J);
+    free(raw_json);
+}
+
+void testObjectIndex(void) {
+    size_t count = 5000;
+    char *raw_json = malloc(count * 24 + 64);
+    size_t len = sprintf(raw_json, "{\"Case\": 1, \"case\": 2, ");
+    size_t matched = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        len += sprintf(raw_json + len, "\"key%zu\": %zu, ", i, i);
+    }
+    sprintf(raw_json + len, "\"case\": 3}");
+
+    json *J = jsonParseWithFlags(raw_json, JSON_LAZY_INDEX_FLAG);
+    for (size_t i = 0; i < count; ++i) {
+        char key[32];
+        sprintf(key, "key%zu", i);
+        if (jsonGetInt(jsonObjectAtCaseSensitive(J, key)) == (ssize_t)i) {
+            matched++;
+        }
+        sprintf(key, "KEY%zu", i);
+        if (jsonGetInt(jsonObjectAtCaseInSensitive(J, key)) == (ssize_t)i) {
+            matched++;
+        }
+    }
+    testCondition(matched == count * 2);
+    test("  Every key of a %zu member object\n", count);
+
+    /* The first of any duplicates wins, as it does for small objects */
+    testCondition(jsonGetInt(jsonObjectAtCaseSensitive(J, "case")) == 2 &&
+                  jsonGetInt(jsonObjectAtCaseInSensitive(J, "CASE")) == 1 &&
+                  jsonObjectAtCaseSensitive(J, "CASE") == NULL &&
+                  jsonObjectAtCaseSensitive(J, "key") == NULL &&
+                  jsonObjectAtCaseInSensitive(J, "key5000") == NULL &&
+                  jsonGetInt(jsonSelect(J, ".key4321")) == 4321);
+    test("  Duplicate, missing and mixed case keys\n");
+    jsonRelease(J);
+
+    J = jsonParse("{\"Case\": 1, \"case\": 2, \"a\": {\"b\": 3}}");
+    testCondition(jsonGetInt(jsonObjectAtCaseSensitive(J, "case")) == 2 &&
+                  jsonGetInt(jsonObjectAtCaseInSensitive(J, "CASE")) == 1 &&
+                  jsonObjectAtCaseSensitive(J, "CASE") == NULL &&
+                  jsonGetInt(jsonSelect(J, ".a.b")) == 3 &&
+                  jsonObjectFind(jsonSelect(J, ".a.b"), "b", 0) == NULL);
+    test("  Small objects\n");
+    jsonRelease(J);
+
+    /* Tables live in the arena and go when it is reset */
+    jsonArena *arena = jsonArenaNew();
+    matched = 0;
+    for (int i = 0; i < 3; ++i) {
+        jsonArenaReset(arena);
+        J = jsonParseIntoArena(arena, raw_json, strlen(raw_json),
+                               JSON_LAZY_INDEX_FLAG);
+        matched += jsonGetInt(jsonObjectAtCaseSensitive(J, "key1234")) ==
+                   1234;
+    }
+    testCondition(matched == 3);
+    test("  Looking up keys in a reused arena\n");
+    jsonArenaRelease(arena);
+
+    /* Without the flag lookups are the same, found in order */
+    J = jsonParse(raw_json);
+    testCondition(jsonGetInt(jsonObjectAtCaseSensitive(J, "key4999")) ==
+                          4999 &&
+                  jsonGetInt(jsonObjectAtCaseInSensitive(J, "CASE")) == 1 &&
+                  jsonObjectAtCaseSensitive(J, "missing") == NULL &&
+                  J->aux == 0);
+    test("  Unindexed objects are only read\n");
+    jsonRelease(J);
+    free(raw_json);
+}
+
+void testSimdKernels(void) {
+    JSON_SIMD_KERNEL kernels[] = {
+            JSON_SIMD_SCALAR, JSON_SIMD_SSE2,   JSON_SIMD_NEON,
+            JSON_SIMD_AVX2,   JSON_SIMD_AVX512,
+    };
+    char *names[] = {"scalar", "sse2", "neon", "avx2", "avx512"};
+    char *raw_json = readFile("./test-jsons/sample.json");
+    json *expected = jsonParse(raw_json);
+    char *expected_str = jsonToString(expected, NULL);
+
+    for (int i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+        if (!jsonSetSimdKernel(kernels[i])) {
+            continue;
+        }
+
+        json *parsed = jsonParse(raw_json);
+        char *parsed_str = jsonToString(parsed, NULL);
+        testCondition(jsonGetSimdKernel() == kernels[i] && jsonOk(parsed) &&
+                      !strcmp(expected_str, parsed_str));
+        test("  %s kernel\n", names[i]);
+        jsonFree(parsed_str);
+        jsonRelease(parsed);
+    }
+
+    char *ids = "[1234567890123456789, -9223372036854775808, 12345678, 1]";
+    for (int i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+        if (!jsonSetSimdKernel(kernels[i])) {
+            continue;
+        }
+
+        json *parsed = jsonParse(ids);
+        json *n = parsed->array;
+        testCondition(jsonOk(parsed) && n->integer == 1234567890123456789 &&
+                      n->next->integer == INT64_MIN &&
+                      n->next->next->integer == 12345678 &&
+                      n->next->next->next->integer == 1);
+        test("  %s kernel integers\n", names[i]);
+        jsonRelease(parsed);
+    }
+
+    /* Whitespace running up to the end of the buffer, with something that
+     * is not whitespace just past it which no kernel should see */
+    char *padded = malloc(256);
+    memset(padded, ' ', 256);
+    padded[0] = '[';
+    padded[255] = '1';
+    for (int i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+        if (!jsonSetSimdKernel(kernels[i])) {
+            continue;
+        }
+
+        int all_unterminated = 1;
+        for (size_t len = 2; len < 255; ++len) {
+            json *parsed = jsonParseWithLen(padded, len);
+            all_unterminated &= jsonGetError(parsed) == JSON_UNTERMINATED &&
+                                parsed->state->offset <= len;
+            jsonRelease(parsed);
+        }
+        testCondition(all_unterminated);
+        test("  %s kernel stops at the end of the buffer\n", names[i]);
+    }
+    free(padded);
+
+    testCondition(jsonSetSimdKernel(JSON_SIMD_AUTO));
+    test("  Reset to detected kernel\n");
+
+    jsonFree(expected_str);
+    jsonRelease(expected);
     free(raw_json);
 }
 
@@ -325,15 +2318,86 @@ void testJsonSelector(void) {
     jsonRelease(j);
 }
 
+/* JSON_SIMD_KERNEL names a kernel this machine can not run, so running the
+ * tests would only repeat them with the best one it can */
+int forcedKernelUnsupported(void) {
+    JSON_SIMD_KERNEL kernels[] = {
+            JSON_SIMD_SCALAR, JSON_SIMD_SSE2,   JSON_SIMD_NEON,
+            JSON_SIMD_AVX2,   JSON_SIMD_AVX512,
+    };
+    char *names[] = {"scalar", "sse2", "neon", "avx2", "avx512"};
+    char *forced = getenv("JSON_SIMD_KERNEL");
+
+    if (forced == NULL) {
+        return 0;
+    }
+    for (int i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+        if (!strcmp(forced, names[i])) {
+            return !jsonSetSimdKernel(kernels[i]);
+        }
+    }
+    return 1;
+}
+
 int main(void) {
+    if (forcedKernelUnsupported()) {
+        printf("JSON_SIMD_KERNEL=%s is not supported, skipping\n",
+               getenv("JSON_SIMD_KERNEL"));
+        /* Skipped, as automake has it */
+        return 77;
+    }
+
     printf("Parsing floats\n");
     testParsingFloats();
     printf("Parsing ints\n");
     testParsingInts();
+    printf("Parsing strings\n");
+    testParsingStrings();
     printf("Invalid JSON\n");
     testInvalidJson();
     printf("Parse JSON, then to string, then parse the string\n");
     testParseThenToStringAndBack();
+    printf("In-situ parsing\n");
+    testInsitu();
+    printf("Lazy strings\n");
+    testLazyStrings();
+    printf("Lazy numbers\n");
+    testLazyNumbers();
+    printf("Streaming\n");
+    testStreaming();
+    printf("JSON Lines\n");
+    testJsonLines();
+    printf("Parallel JSON Lines\n");
+    testParallelJsonLines();
+    printf("Parallel arrays\n");
+    testParallelArray();
+    printf("On demand cursors\n");
+    testCursor();
+    printf("Events\n");
+    testParseEvents();
+    printf("Tokenizer\n");
+    testTokenizer();
+    printf("Max depth\n");
+    testMaxDepth();
+    printf("Arenas\n");
+    testArena();
+    printf("Allocator hooks\n");
+    testAllocatorHooks();
+    printf("Thread cache\n");
+    testThreadCache();
+    printf("Large documents\n");
+    testLargeDocuments();
+    printf("Compact documents\n");
+    testCompact();
+    printf("Tapes\n");
+    testTape();
+    printf("Array indexes\n");
+    testArrayIndex();
+    printf("Object indexes\n");
+    testObjectIndex();
+    printf("SIMD kernels\n");
+    testSimdKernels();
     printf("jsonSelect\n");
     testJsonSelector();
+    return fails != 0;
 }